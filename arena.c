@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+#define ROUND_UP(n) (((n) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+
+typedef struct chunk
+{
+    struct chunk *next;
+    size_t size;
+    size_t used;
+    char *data;
+} chunk;
+
+struct arena
+{
+    size_t chunk_size;
+    size_t total;
+    chunk *first;
+    chunk *current;
+    chunk *last;
+};
+
+/**
+ * Adds a chunk with room for at least size bytes after the current
+ * one.  Returns NULL if there was an allocation error.
+ */
+static chunk *arena_add_chunk(arena *a, size_t size)
+{
+    size_t data_size = (size > a->chunk_size ? ROUND_UP(size) : a->chunk_size);
+
+    // the data starts on the first aligned address after the header
+    chunk *c = malloc(sizeof(chunk) + data_size + ARENA_ALIGNMENT);
+    if (c == NULL)
+    {
+        return NULL;
+    }
+    c->next = NULL;
+    c->size = data_size;
+    c->used = 0;
+    c->data = (char *) ROUND_UP((uintptr_t) (c + 1));
+
+    // oversized chunks go after the current one so that it keeps filling
+    if (a->current == NULL)
+    {
+        a->first = a->last = c;
+    }
+    else
+    {
+        c->next = a->current->next;
+        a->current->next = c;
+        if (a->last == a->current)
+        {
+            a->last = c;
+        }
+    }
+    a->total += data_size;
+    return c;
+}
+
+arena *arena_create(size_t chunk_size)
+{
+    arena *a = malloc(sizeof(arena));
+    if (a == NULL)
+    {
+        return NULL;
+    }
+
+    a->chunk_size = ROUND_UP(chunk_size > 0 ? chunk_size : 1);
+    a->total = 0;
+    a->first = a->current = a->last = NULL;
+    if (arena_add_chunk(a, a->chunk_size) == NULL)
+    {
+        free(a);
+        return NULL;
+    }
+    a->current = a->first;
+    return a;
+}
+
+void arena_destroy(arena *a)
+{
+    chunk *c = a->first;
+    while (c != NULL)
+    {
+        chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    free(a);
+}
+
+void *arena_alloc(arena *a, size_t size)
+{
+    size = ROUND_UP(size);
+
+    // use the current chunk or any later one left over from a reset
+    while (a->current->used + size > a->current->size && a->current->next != NULL
+           && a->current->next->used == 0 && a->current->next->size >= a->chunk_size)
+    {
+        a->current = a->current->next;
+    }
+    if (a->current->used + size > a->current->size)
+    {
+        chunk *c = arena_add_chunk(a, size);
+        if (c == NULL)
+        {
+            return NULL;
+        }
+        if (size < a->chunk_size || a->current->used == a->current->size)
+        {
+            a->current = c;
+        }
+        c->used = size;
+        return c->data;
+    }
+
+    void *ptr = a->current->data + a->current->used;
+    a->current->used += size;
+    return ptr;
+}
+
+void *arena_grow(arena *a, void *ptr, size_t old_size, size_t new_size)
+{
+    if (ptr == NULL)
+    {
+        return arena_alloc(a, new_size);
+    }
+
+    // grow in place when ptr is the top of the current chunk
+    chunk *c = a->current;
+    size_t old_rounded = ROUND_UP(old_size);
+    size_t new_rounded = ROUND_UP(new_size);
+    if ((char *) ptr + old_rounded == c->data + c->used
+        && c->used - old_rounded + new_rounded <= c->size)
+    {
+        c->used = c->used - old_rounded + new_rounded;
+        return ptr;
+    }
+    else if (new_size <= old_size)
+    {
+        // shrinking elsewhere just leaves the tail unused
+        return ptr;
+    }
+
+    void *bigger = arena_alloc(a, new_size);
+    if (bigger != NULL)
+    {
+        memcpy(bigger, ptr, old_size < new_size ? old_size : new_size);
+    }
+    return bigger;
+}
+
+void arena_reset(arena *a)
+{
+    for (chunk *c = a->first; c != NULL; c = c->next)
+    {
+        c->used = 0;
+    }
+    a->current = a->first;
+}
+
+size_t arena_size(const arena *a)
+{
+    return a->total;
+}
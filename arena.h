@@ -0,0 +1,72 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+typedef struct arena arena;
+
+/**
+ * Creates an arena that hands out memory carved from chunks of at
+ * least the given size.  Memory from an arena is never freed on its
+ * own; it is all released at once by arena_reset or arena_destroy.
+ *
+ * @param chunk_size a positive integer
+ * @return a pointer to the new arena, or NULL if there was an allocation error
+ */
+arena *arena_create(size_t chunk_size);
+
+/**
+ * Destroys the given arena, releasing all its chunks and so all the
+ * memory allocated from it.
+ *
+ * @param a a pointer to a valid arena
+ */
+void arena_destroy(arena *a);
+
+/**
+ * Returns a pointer to size bytes from the given arena, aligned to
+ * ARENA_ALIGNMENT bytes, or NULL if there was an allocation error.
+ * Requests larger than the chunk size get a chunk of their own.
+ *
+ * @param a a pointer to a valid arena
+ * @param size a nonnegative integer
+ */
+void *arena_alloc(arena *a, size_t size);
+
+/**
+ * Resizes an allocation from the given arena, keeping its contents up
+ * to the smaller of the two sizes.  The allocation grows in place if
+ * it was the last one made from its chunk and there is room; otherwise
+ * the contents are copied to a new allocation and the old space is
+ * not reused until the arena is reset.  Returns NULL if there was an
+ * allocation error, in which case the original allocation is unchanged.
+ *
+ * @param a a pointer to a valid arena
+ * @param ptr a pointer returned by arena_alloc or arena_grow on a, or NULL
+ * @param old_size the size ptr was allocated with
+ * @param new_size a nonnegative integer
+ */
+void *arena_grow(arena *a, void *ptr, size_t old_size, size_t new_size);
+
+/**
+ * Makes all the memory in the given arena available again without
+ * returning any chunks to the system.  Pointers previously returned
+ * from the arena become invalid.
+ *
+ * @param a a pointer to a valid arena
+ */
+void arena_reset(arena *a);
+
+/**
+ * Returns the total size of the chunks held by the given arena.
+ *
+ * @param a a pointer to a valid arena
+ */
+size_t arena_size(const arena *a);
+
+/**
+ * The alignment of every allocation from an arena: one cache line.
+ */
+#define ARENA_ALIGNMENT 64
+
+#endif
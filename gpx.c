@@ -0,0 +1,479 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gpx.h"
+
+// the longest number parsed without strtod, and the longest strtod gets
+#define FAST_DIGITS 15
+#define MAX_NUMBER 64
+
+typedef struct gpx_reader
+{
+    track *trk;
+    location locs[GPX_BATCH_POINTS];
+    long times[GPX_BATCH_POINTS];
+    int pending;
+    long added;
+} gpx_reader;
+
+static const double powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                       1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+                                       1e20, 1e21, 1e22};
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/**
+ * Adds the points gathered so far to the track.
+ */
+static void gpx_flush(gpx_reader *r)
+{
+    r->added += track_add_points(r->trk, r->locs, r->times, r->pending);
+    r->pending = 0;
+}
+
+/**
+ * Returns a pointer to the first occurrence of the given string in the
+ * range from p to end, or NULL if there is none.
+ */
+static const char *gpx_find(const char *p, const char *end, const char *s)
+{
+    size_t len = strlen(s);
+    while (end - p >= (ptrdiff_t) len && (p = memchr(p, s[0], end - p - len + 1)) != NULL)
+    {
+        if (memcmp(p, s, len) == 0)
+        {
+            return p;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+/**
+ * Returns whether the name of the given length is the given tag name.
+ */
+static inline bool gpx_tag_is(const char *name, size_t len, const char *tag)
+{
+    return len == strlen(tag) && memcmp(name, tag, len) == 0;
+}
+
+/**
+ * Parses the decimal number from s up to end, with optional
+ * surrounding whitespace.  Short numbers without exponents, which is
+ * all a GPX file normally holds, are read as an integer divided by a
+ * power of ten, which is exact to the last bit; anything else goes to
+ * strtod.  Returns false if the text is not a number.
+ */
+static bool gpx_parse_number(const char *s, const char *end, double *value)
+{
+    while (s < end && is_space(*s))
+    {
+        s++;
+    }
+    while (end > s && is_space(end[-1]))
+    {
+        end--;
+    }
+
+    const char *start = s;
+    bool negative = (s < end && *s == '-');
+    s += (s < end && (*s == '-' || *s == '+'));
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int decimals = 0;
+    bool point = false;
+    for (; s < end; s++)
+    {
+        if (is_digit(*s))
+        {
+            mantissa = mantissa * 10 + (*s - '0');
+            digits++;
+            decimals += point;
+        }
+        else if (*s == '.' && !point)
+        {
+            point = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (s == end && digits > 0 && digits <= FAST_DIGITS)
+    {
+        double v = (double) mantissa / powers_of_ten[decimals];
+        *value = (negative ? -v : v);
+        return true;
+    }
+
+    // exponents and long numbers
+    char copy[MAX_NUMBER];
+    if (end - start == 0 || end - start >= MAX_NUMBER)
+    {
+        return false;
+    }
+    memcpy(copy, start, end - start);
+    copy[end - start] = '\0';
+    char *stop;
+    *value = strtod(copy, &stop);
+    return *stop == '\0';
+}
+
+/**
+ * Reads the lat and lon attributes among the attributes from p up to
+ * end, in one pass over them.  Returns false if either is missing or
+ * is not a number.
+ */
+static bool gpx_point_location(const char *p, const char *end, location *loc)
+{
+    bool has_lat = false;
+    bool has_lon = false;
+    while (p < end)
+    {
+        // a name, an equals sign and a quoted value
+        while (p < end && is_space(*p))
+        {
+            p++;
+        }
+        const char *name = p;
+        while (p < end && *p != '=' && !is_space(*p))
+        {
+            p++;
+        }
+        size_t name_len = p - name;
+        while (p < end && is_space(*p))
+        {
+            p++;
+        }
+        if (p == end || *p != '=')
+        {
+            break;
+        }
+        p++;
+        while (p < end && is_space(*p))
+        {
+            p++;
+        }
+        if (p == end || (*p != '"' && *p != '\''))
+        {
+            break;
+        }
+        const char *close = memchr(p + 1, *p, end - p - 1);
+        if (close == NULL)
+        {
+            break;
+        }
+
+        if (gpx_tag_is(name, name_len, "lat"))
+        {
+            has_lat = gpx_parse_number(p + 1, close, &loc->lat);
+        }
+        else if (gpx_tag_is(name, name_len, "lon"))
+        {
+            has_lon = gpx_parse_number(p + 1, close, &loc->lon);
+        }
+        p = close + 1;
+    }
+    return has_lat && has_lon;
+}
+
+/**
+ * Returns a pointer past the end of the comment, CDATA section,
+ * declaration or processing instruction whose text starts at p, just
+ * after its opening '<', or NULL if it does not end before end.
+ */
+static const char *gpx_skip_special(const char *p, const char *end)
+{
+    const char *close;
+    size_t close_len;
+    if (end - p >= 3 && memcmp(p, "!--", 3) == 0)
+    {
+        close = gpx_find(p + 3, end, "-->");
+        close_len = 3;
+    }
+    else if (end - p >= 8 && memcmp(p, "![CDATA[", 8) == 0)
+    {
+        close = gpx_find(p + 8, end, "]]>");
+        close_len = 3;
+    }
+    else if (*p == '?')
+    {
+        close = gpx_find(p + 1, end, "?>");
+        close_len = 2;
+    }
+    else
+    {
+        close = memchr(p, '>', end - p);
+        close_len = 1;
+    }
+    return (close != NULL ? close + close_len : NULL);
+}
+
+long gpx_read_buffer(const char *data, size_t size, track *trk)
+{
+    gpx_reader *r = malloc(sizeof(gpx_reader));
+    if (r == NULL)
+    {
+        return -1;
+    }
+    r->trk = trk;
+    r->pending = 0;
+    r->added = 0;
+
+    const char *p = data;
+    const char *end = data + size;
+    bool in_point = false;
+    bool has_loc = false;
+    bool has_time = false;
+    location loc = {0, 0};
+    long time = 0;
+    while (p < end && (p = memchr(p, '<', end - p)) != NULL && ++p < end)
+    {
+        if (*p == '!' || *p == '?')
+        {
+            p = gpx_skip_special(p, end);
+            if (p == NULL)
+            {
+                break;
+            }
+            continue;
+        }
+
+        // the tag's name without any namespace prefix, and its end
+        bool closing = (*p == '/');
+        p += closing;
+        const char *name = p;
+        while (p < end && !is_space(*p) && *p != '>' && *p != '/')
+        {
+            name = (*p == ':' ? p + 1 : name);
+            p++;
+        }
+        size_t name_len = p - name;
+        const char *close = memchr(p, '>', end - p);
+        if (close == NULL)
+        {
+            break;
+        }
+        bool empty = (close[-1] == '/');
+
+        if (closing)
+        {
+            if (in_point && gpx_tag_is(name, name_len, "trkpt"))
+            {
+                if (has_loc && has_time)
+                {
+                    r->locs[r->pending] = loc;
+                    r->times[r->pending] = time;
+                    if (++r->pending == GPX_BATCH_POINTS)
+                    {
+                        gpx_flush(r);
+                    }
+                }
+                in_point = false;
+            }
+        }
+        else if (gpx_tag_is(name, name_len, "trkseg"))
+        {
+            gpx_flush(r);
+            track_start_segment(trk);
+            in_point = false;
+        }
+        else if (gpx_tag_is(name, name_len, "trkpt"))
+        {
+            in_point = !empty;
+            has_loc = gpx_point_location(p, close - empty, &loc);
+            has_time = false;
+        }
+        else if (in_point && !empty && gpx_tag_is(name, name_len, "time"))
+        {
+            // the text up to the next tag
+            const char *text = close + 1;
+            const char *next = memchr(text, '<', end - text);
+            if (next == NULL)
+            {
+                break;
+            }
+            has_time = gpx_parse_time(text, next - text, &time);
+            p = next;
+            continue;
+        }
+        p = close + 1;
+    }
+    gpx_flush(r);
+
+    long added = r->added;
+    free(r);
+    return added;
+}
+
+long gpx_read_file(const char *path, track *trk)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = (size_t) st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+    long added = gpx_read_buffer(data, size, trk);
+    munmap(data, size);
+    return added;
+}
+
+/**
+ * Parses n digits at s as a decimal number.  Returns false if any of
+ * them is not a digit.
+ */
+static bool gpx_digits(const char *s, int n, int *value)
+{
+    *value = 0;
+    for (int k=0; k<n; k++)
+    {
+        if (!is_digit(s[k]))
+        {
+            return false;
+        }
+        *value = *value * 10 + (s[k] - '0');
+    }
+    return true;
+}
+
+/**
+ * Returns the number of days from 1970-01-01 to the given date in the
+ * proleptic Gregorian calendar, counting in 400-year eras of 146097
+ * days from a year starting in March, so that leap days fall at the
+ * end of the year.
+ */
+static long days_from_civil(long year, int month, int day)
+{
+    year -= (month <= 2);
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long year_of_era = year - era * 400;
+    long day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+bool gpx_parse_time(const char *s, size_t len, long *time)
+{
+    const char *end = s + len;
+    while (s < end && is_space(*s))
+    {
+        s++;
+    }
+    while (end > s && is_space(end[-1]))
+    {
+        end--;
+    }
+
+    int year, month, day, hour, minute, second;
+    if (end - s < 19 || !gpx_digits(s, 4, &year) || s[4] != '-' || !gpx_digits(s + 5, 2, &month)
+        || s[7] != '-' || !gpx_digits(s + 8, 2, &day) || (s[10] != 'T' && s[10] != 't' && s[10] != ' ')
+        || !gpx_digits(s + 11, 2, &hour) || s[13] != ':' || !gpx_digits(s + 14, 2, &minute)
+        || s[16] != ':' || !gpx_digits(s + 17, 2, &second))
+    {
+        return false;
+    }
+    s += 19;
+
+    // fractions of a second are dropped
+    if (s < end && (*s == '.' || *s == ','))
+    {
+        const char *digits = ++s;
+        while (s < end && is_digit(*s))
+        {
+            s++;
+        }
+        if (s == digits)
+        {
+            return false;
+        }
+    }
+
+    long offset = 0;
+    if (s < end && (*s == 'Z' || *s == 'z'))
+    {
+        s++;
+    }
+    else if (s < end && (*s == '+' || *s == '-'))
+    {
+        int sign = (*s == '-' ? -1 : 1);
+        int offset_hours, offset_minutes;
+        s++;
+        if (end - s >= 5 && s[2] == ':' && gpx_digits(s, 2, &offset_hours) && gpx_digits(s + 3, 2, &offset_minutes))
+        {
+            s += 5;
+        }
+        else if (end - s >= 4 && gpx_digits(s, 2, &offset_hours) && gpx_digits(s + 2, 2, &offset_minutes))
+        {
+            s += 4;
+        }
+        else
+        {
+            return false;
+        }
+        if (offset_hours > 23 || offset_minutes > 59)
+        {
+            return false;
+        }
+        offset = sign * (offset_hours * 3600L + offset_minutes * 60L);
+    }
+    if (s != end)
+    {
+        return false;
+    }
+
+    if (!gpx_make_time(year, month, day, hour, minute, second, time))
+    {
+        return false;
+    }
+    *time -= offset;
+    return true;
+}
+
+bool gpx_make_time(int year, int month, int day, int hour, int minute, int second, long *time)
+{
+    static const int month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0));
+    if (month < 1 || month > 12 || day < 1 || day > month_days[month-1] + (month == 2 && leap)
+        || hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60)
+    {
+        return false;
+    }
+    *time = days_from_civil(year, month, day) * 86400L + hour * 3600L + minute * 60L + second;
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef __GPX_H__
+#define __GPX_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "track.h"
+
+// points gathered before each bulk append to the track
+#define GPX_BATCH_POINTS 4096
+
+/**
+ * Reads the track points of the GPX file at the given path into the
+ * given track, as gpx_read_buffer does, with the file mapped into
+ * memory rather than read.  Returns the number of points added, or -1
+ * if the file could not be opened or mapped or there is a memory
+ * allocation error.
+ *
+ * @param path the name of a file
+ * @param trk a pointer to a valid track
+ * @return the number of points added, or -1
+ */
+long gpx_read_file(const char *path, track *trk);
+
+/**
+ * Reads the track points of the GPX document in the given buffer into
+ * the given track and returns the number of points added.  Each
+ * trkseg element starts a new segment with track_start_segment, and
+ * each trkpt in it with lat and lon attributes and a time element is
+ * added with track_add_points in batches of GPX_BATCH_POINTS.  Points
+ * with no time or a time gpx_parse_time rejects are skipped, as are
+ * route and waypoint elements.  The document is scanned once, front to
+ * back, looking only at tag names, the two attributes and the text of
+ * time elements; comments, CDATA sections, processing instructions and
+ * declarations are skipped whole, and namespace prefixes are ignored.
+ * The XML is not validated: reading stops at the first tag that is not
+ * closed before the end of the buffer, keeping the points before it.
+ * Returns -1, leaving the track unchanged, if there is a memory
+ * allocation error.
+ *
+ * @param data a pointer to size bytes, which need not end in a null
+ * @param size the size of the buffer
+ * @param trk a pointer to a valid track
+ * @return the number of points added, or -1
+ */
+long gpx_read_buffer(const char *data, size_t size, track *trk);
+
+/**
+ * Parses an ISO 8601 timestamp of the form YYYY-MM-DDThh:mm:ss, with
+ * optional fractional seconds and an optional Z or +hh:mm, -hh:mm,
+ * +hhmm or -hhmm offset, into seconds since 1970-01-01T00:00:00Z.  A
+ * timestamp with no offset is taken to be in UTC, fractions of a
+ * second are dropped, and a space is allowed in place of the T.
+ * Leading and trailing whitespace is ignored.
+ *
+ * @param s a pointer to len characters, which need not end in a null
+ * @param len the number of characters
+ * @param time a pointer to where to store the time
+ * @return true if and only if the whole string is a valid timestamp
+ */
+bool gpx_parse_time(const char *s, size_t len, long *time);
+
+/**
+ * Converts a date and time in UTC to seconds since 1970-01-01T00:00:00Z
+ * in the proleptic Gregorian calendar.  A second of 60, a leap second,
+ * runs into the next minute as it does in POSIX time.  Returns false,
+ * leaving *time unchanged, if any field is out of range.
+ *
+ * @param year a year, such as 2024
+ * @param month a month from 1 to 12
+ * @param day a day of the month from 1
+ * @param hour an hour from 0 to 23
+ * @param minute a minute from 0 to 59
+ * @param second a second from 0 to 60
+ * @param time a pointer to where to store the time
+ * @return true if and only if the date and time are valid
+ */
+bool gpx_make_time(int year, int month, int day, int hour, int minute, int second, long *time);
+
+#endif
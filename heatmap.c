@@ -1,98 +1,1130 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <ctype.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "track.h"
 #include "trackpoint.h"
 #include "location.h"
+#include "image.h"
+#include "gpx.h"
+#include "nmea.h"
+#include "service.h"
 
 #define INITIAL_CAPACITY 30
 
+// the longest line of a track read, newline and null included
+#define LINE_SIZE 1024
 
-int main(int argc, char **argv)
+// bytes read at a time from a followed input
+#define FOLLOW_BUFFER_SIZE 65536
+
+// milliseconds between looks at a followed file for more
+#define FOLLOW_POLL_MS 250
+
+// seconds between the maps of a followed track unless given
+#define FOLLOW_INTERVAL 5
+
+/**
+ * Prints the character for the given heatmap value.  Values at or
+ * above the last range get the last character.
+ *
+ * @param value a nonnegative number
+ * @param heatmap_characters a nonempty string
+ * @param range the positive width of the range of values for each character
+ */
+void print_cell(double value, const char *heatmap_characters, double range)
 {
-    /* argc should be = 5 for correct execution */
-    if ( argc != 5 ) 
+    int max_index = strlen(heatmap_characters)-1;
+
+    // find the index of the value in the array of heatmap characters
+    double index = floor(value / range);
+
+    if (index > max_index)
     {
-        return 1;
+        putchar(heatmap_characters[max_index]);
     }
+    else
+    {
+        putchar(heatmap_characters[(int) index]);
+    }
+}
 
-    // set values
-    double cell_width = atof(argv[1]);
-    double cell_height = atof(argv[2]);
+/**
+ * Where and how to write a heatmap as an image instead of printing it
+ * as characters; a NULL path prints characters and "-" writes the
+ * image to standard output.
+ */
+typedef struct image_options
+{
+    const char *path;
+    image_format format;
+    image_scale scale;
+} image_options;
+
+/**
+ * Outputs the given heatmap, of ints or of doubles, and frees it a row
+ * at a time.  As characters, each cell is printed with print_cell.  As
+ * an image, the brightest level is the largest value in the map and
+ * each row is encoded and written as it is freed, so no more than a
+ * row of the image is held at once.  Returns the exit status for the
+ * program.
+ *
+ * @param map a 2-D array of ints or doubles
+ * @param doubles whether the map holds doubles
+ * @param rows the number of rows in the map
+ * @param cols the number of columns in the map
+ * @param heatmap_characters a nonempty string
+ * @param range the width of the range of values for each character
+ * @param img a pointer to the image options
+ */
+int output_map(void **map, bool doubles, int rows, int cols,
+               const char *heatmap_characters, double range, const image_options *img)
+{
+    image_writer *w = NULL;
+    FILE *out = NULL;
+    int status = 0;
 
-    char *heatmap_characters = argv[3];
+    if (img->path != NULL)
+    {
+        double max = 0;
+        for (int i=0; i<rows; i++)
+        {
+            for (int j=0; j<cols; j++)
+            {
+                double value = (doubles ? ((double **) map)[i][j] : ((int **) map)[i][j]);
+                max = fmax(max, value);
+            }
+        }
+        out = (strcmp(img->path, "-") == 0 ? stdout : fopen(img->path, "wb"));
+        w = (out != NULL ? image_writer_create(out, img->format, img->scale, rows, cols, max) : NULL);
+        if (w == NULL)
+        {
+            fprintf(stderr, "Heatmap: could not write %s\n", img->path);
+            status = 1;
+        }
+    }
 
+    for (int i=0; i<rows; i++)
+    {
+        if (w != NULL)
+        {
+            if (doubles)
+            {
+                image_write_row_double(w, map[i]);
+            }
+            else
+            {
+                image_write_row(w, map[i]);
+            }
+        }
+        else if (img->path == NULL)
+        {
+            for (int j=0; j<cols; j++)
+            {
+                print_cell(doubles ? ((double **) map)[i][j] : ((int **) map)[i][j], heatmap_characters, range);
+            }
+            printf("\n");
+        }
+        free(map[i]);
+    }
+    free(map);
+
+    if (w != NULL && !image_writer_finish(w))
+    {
+        fprintf(stderr, "Heatmap: could not write %s\n", img->path);
+        status = 1;
+    }
+    if (out != NULL && out != stdout && fclose(out) != 0)
+    {
+        status = 1;
+    }
+    return status;
+}
+
+/**
+ * Reads one line of a track into the given track: a point if it holds
+ * the latitude, longitude and timestamp of one, a new segment if it is
+ * blank, and nothing otherwise.
+ *
+ * @param line a string
+ * @param trk a pointer to a valid track
+ */
+void read_line(const char *line, track *trk)
+{
     double lat, lon;
     long time;
 
-    int range = atoi(argv[4]);
+    if (sscanf(line, "%lf %lf %ld", &lat, &lon, &time) == 3)
+    {
+        //create trkpt
+        trackpoint *my_trkpt = trackpoint_create(lat, lon, time);
+        if (my_trkpt != NULL)
+        {
+            track_add_point(trk, my_trkpt);
+            trackpoint_destroy(my_trkpt);
+        }
+    }
+    else
+    {
+        // a blank line ends the segment
+        const char *c = line;
+        while (isspace((unsigned char) *c))
+        {
+            c++;
+        }
+        if (*c == '\0')
+        {
+            track_start_segment(trk);
+        }
+    }
+}
 
-    // make track
-    track *my_trk = track_create();
+/**
+ * Reads points from the given stream into the given track.  Each line
+ * holds the latitude, longitude and timestamp of one point, and a
+ * blank line starts a new segment.  Lines that are not points are
+ * ignored.
+ *
+ * @param in a stream open for reading
+ * @param trk a pointer to a valid track
+ */
+void read_track(FILE *in, track *trk)
+{
+    char line[LINE_SIZE];
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        read_line(line, trk);
+    }
+}
 
-    // to use for getchar
-    int ch;                                                                                               
+/**
+ * Reads the track in the named file into the given track: as GPX if
+ * the name ends in .gpx, otherwise as read_track reads it.  Returns
+ * false if the file could not be read.
+ *
+ * @param path the name of a file
+ * @param trk a pointer to a valid track
+ */
+bool read_file(const char *path, track *trk)
+{
+    size_t len = strlen(path);
+    if (len >= 4 && strcmp(path + len - 4, ".gpx") == 0)
+    {
+        return gpx_read_file(path, trk) >= 0;
+    }
+
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+    {
+        return false;
+    }
+    read_track(in, trk);
+    fclose(in);
+    return true;
+}
 
-    while((ch = getchar()) != EOF)
+/**
+ * Reads NMEA sentences from the named file, or standard input if the
+ * name is "-", into the given track until the end of the input, as
+ * they arrive from a pipe or serial port.  A lost fix starts a new
+ * segment.  The sentences read and rejected and the fixes lost are
+ * reported on standard error.  Returns false if the input could not be
+ * read.
+ *
+ * @param path the name of a file, or "-"
+ * @param trk a pointer to a valid track
+ */
+bool read_nmea(const char *path, track *trk)
+{
+    bool from_stdin = (strcmp(path, "-") == 0);
+    int fd = (from_stdin ? STDIN_FILENO : open(path, O_RDONLY | O_NONBLOCK));
+    int flags = (fd >= 0 ? fcntl(fd, F_GETFL) : -1);
+    nmea_reader *r = nmea_reader_create(trk, 0);
+    if (flags < 0 || r == NULL || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
     {
-        if (ch == '\n')
+        nmea_reader_destroy(r);
+        if (fd >= 0 && !from_stdin)
         {
-            track_start_segment(my_trk);
+            close(fd);
+        }
+        return false;
+    }
+
+    // wait for more whenever the input runs dry
+    nmea_status status;
+    while ((status = nmea_read_fd(r, fd)) == NMEA_MORE)
+    {
+        struct pollfd ready = {fd, POLLIN, 0};
+        poll(&ready, 1, -1);
+    }
+
+    nmea_stats stats;
+    nmea_reader_stats(r, &stats);
+    fprintf(stderr, "%s: %ld NMEA sentences, %ld rejected, %ld points, %ld fixes lost\n",
+            path, stats.lines, stats.rejected, stats.points, stats.losses);
+    nmea_reader_destroy(r);
+
+    // standard input is shared with whoever started us, so put it back
+    if (from_stdin)
+    {
+        fcntl(fd, F_SETFL, flags);
+    }
+    else
+    {
+        close(fd);
+    }
+    return status == NMEA_END;
+}
+
+/**
+ * Simplifies the given track to the given tolerance and reports the
+ * reduction in points and the change in length on standard error.
+ *
+ * @param trk a pointer to a valid track
+ * @param name the name of the track to report
+ * @param tolerance a nonnegative distance in meters
+ */
+void simplify_track(track *trk, const char *name, double tolerance)
+{
+    track_simplify_stats stats;
+    track_simplify(trk, tolerance, &stats);
+
+    double kept = (stats.points_before > 0 ? 100.0 * stats.points_after / stats.points_before : 100.0);
+    double error = (stats.length_before > 0 ? 100.0 * (stats.length_before - stats.length_after) / stats.length_before : 0.0);
+    fprintf(stderr, "%s: kept %ld of %ld points (%.1f%%), length %.3f km to %.3f km (%.2f%% shorter)\n",
+            name, stats.points_after, stats.points_before, kept, stats.length_before, stats.length_after, error);
+}
+
+/**
+ * Reports the number of points collapsed into dwell times as the given
+ * track was read on standard error.
+ *
+ * @param trk a pointer to a valid track
+ * @param name the name of the track to report
+ */
+void report_collapsed(const track *trk, const char *name)
+{
+    fprintf(stderr, "%s: collapsed %ld stationary points\n", name, track_count_collapsed(trk));
+}
+
+/**
+ * The input followed by --follow and what has been read of it: the
+ * name to report, the descriptor, the NMEA reader for NMEA input or
+ * else the unfinished last line of a text track, and the track the
+ * points go into.
+ */
+typedef struct follow_input
+{
+    const char *name;
+    int fd;
+    nmea_reader *nmea;
+    char line[LINE_SIZE];
+    size_t len;
+    track *trk;
+} follow_input;
+
+// set when a signal asks us to stop following
+static volatile sig_atomic_t follow_stopped = 0;
+
+/**
+ * Asks the loop in follow to output the heatmap one last time and stop.
+ *
+ * @param sig the signal caught
+ */
+void follow_stop(int sig)
+{
+    (void) sig;
+    follow_stopped = 1;
+}
+
+/**
+ * Returns the time in seconds on a clock that only runs forward.
+ */
+double follow_clock(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Adds the given bytes of the followed input to its track.  A text
+ * line is read once its newline arrives, or once it fills the line
+ * buffer, which splits it as read_track would; until then the part
+ * that has arrived is held.
+ *
+ * @param in a pointer to the followed input
+ * @param data a pointer to n bytes
+ * @param n the number of bytes
+ */
+void follow_feed(follow_input *in, const char *data, size_t n)
+{
+    if (in->nmea != NULL)
+    {
+        nmea_feed(in->nmea, data, n);
+        return;
+    }
+
+    while (n > 0)
+    {
+        const char *end = memchr(data, '\n', n);
+        size_t take = (end != NULL ? (size_t) (end - data) + 1 : n);
+        if (take > LINE_SIZE - 1 - in->len)
+        {
+            take = LINE_SIZE - 1 - in->len;
+        }
+        memcpy(in->line + in->len, data, take);
+        in->len += take;
+        data += take;
+        n -= take;
+
+        if (in->line[in->len - 1] == '\n' || in->len == LINE_SIZE - 1)
+        {
+            in->line[in->len] = '\0';
+            read_line(in->line, in->trk);
+            in->len = 0;
+        }
+    }
+}
+
+/**
+ * Counts the points added to the followed track since the last time
+ * into the live heatmap and outputs the heatmap, reporting the points
+ * on standard error.  Characters on a terminal replace the last map on
+ * the screen, and otherwise a blank line separates one map from the
+ * next.  An image file is written beside the old one and renamed over
+ * it, so that a viewer never sees half of one.  Returns the exit status
+ * for the program.
+ *
+ * @param live a pointer to the live heatmap
+ * @param in a pointer to the followed input
+ * @param points a pointer to the number of points counted before, which
+ * is updated
+ * @param frames the number of maps output before
+ * @param heatmap_characters a nonempty string
+ * @param range the width of the range of values for each character
+ * @param img a pointer to the image options
+ */
+int follow_render(track_live_heatmap *live, const follow_input *in, long *points, long frames,
+                  const char *heatmap_characters, double range, const image_options *img)
+{
+    int **map = NULL;
+    int rows, cols;
+    long added = track_live_heatmap_update(live, in->trk);
+    if (added >= 0)
+    {
+        track_live_heatmap_map(live, &map, &rows, &cols);
+    }
+    if (map == NULL)
+    {
+        return 1;
+    }
+    *points += added;
+    fprintf(stderr, "%s: %ld points, %ld new\n", in->name, *points, added);
+
+    if (img->path == NULL || strcmp(img->path, "-") == 0)
+    {
+        if (img->path == NULL && isatty(STDOUT_FILENO))
+        {
+            printf("\033[H\033[2J");
+        }
+        else if (img->path == NULL && frames > 0)
+        {
+            printf("\n");
+        }
+        int status = output_map((void **) map, false, rows, cols, heatmap_characters, range, img);
+        fflush(stdout);
+        return status;
+    }
+
+    char *temp = malloc(strlen(img->path) + 5);
+    if (temp == NULL)
+    {
+        for (int i=0; i<rows; i++)
+        {
+            free(map[i]);
+        }
+        free(map);
+        return 1;
+    }
+    sprintf(temp, "%s.tmp", img->path);
+    image_options beside = *img;
+    beside.path = temp;
+
+    int status = output_map((void **) map, false, rows, cols, heatmap_characters, range, &beside);
+    if (status == 0 && rename(temp, img->path) != 0)
+    {
+        fprintf(stderr, "Heatmap: could not write %s\n", img->path);
+        status = 1;
+    }
+    if (status != 0)
+    {
+        remove(temp);
+    }
+    free(temp);
+    return status;
+}
+
+/**
+ * Follows a track as it is written, such as a log growing during an
+ * operation, keeping it in memory and outputting its heatmap every
+ * interval seconds while it changes.  Only the bytes appended since the
+ * last look are read: a file is looked at again every FOLLOW_POLL_MS
+ * milliseconds, reading on from where the last read stopped, and a
+ * pipe is waited on until it has more.  The new points are counted into
+ * a track_live_heatmap, so each map costs the new input plus the size
+ * of the map rather than the whole history.  A file that shrinks has
+ * been truncated or replaced, so the track and heatmap start over from
+ * its beginning.  Following ends when a pipe is closed, outputting the
+ * last map, or on SIGINT or SIGTERM, after outputting the map one last
+ * time if it changed.  Returns the exit status for the program.
+ *
+ * @param path the name of a file, or "-" for standard input
+ * @param nmea whether the input is NMEA sentences rather than a text
+ * track
+ * @param interval the positive number of seconds between maps
+ * @param cell_width the width of each cell in degrees
+ * @param cell_height the height of each cell in degrees
+ * @param heatmap_characters a nonempty string
+ * @param range the width of the range of values for each character
+ * @param img a pointer to the image options
+ * @param opts a pointer to the options to create the track with
+ */
+int follow(const char *path, bool nmea, double interval, double cell_width, double cell_height,
+           const char *heatmap_characters, double range, const image_options *img,
+           const track_options *opts)
+{
+    bool from_stdin = (strcmp(path, "-") == 0);
+    follow_input in;
+    in.name = (from_stdin ? "stdin" : path);
+    in.fd = (from_stdin ? STDIN_FILENO : open(path, O_RDONLY));
+    in.len = 0;
+    in.trk = track_create_with(opts);
+    in.nmea = (nmea && in.trk != NULL ? nmea_reader_create(in.trk, 0) : NULL);
+    track_live_heatmap *live = track_live_heatmap_create(cell_width, cell_height);
+
+    struct stat st;
+    int flags = (in.fd >= 0 ? fcntl(in.fd, F_GETFL) : -1);
+    bool ready = (flags >= 0 && fstat(in.fd, &st) == 0 && in.trk != NULL
+                  && (in.nmea != NULL || !nmea) && live != NULL);
+    bool regular = (ready && S_ISREG(st.st_mode));
+
+    // a pipe is waited on with poll, so reading it must not block
+    if (ready && !regular && fcntl(in.fd, F_SETFL, flags | O_NONBLOCK) != 0)
+    {
+        ready = false;
+    }
+    if (!ready)
+    {
+        fprintf(stderr, "Heatmap: could not read %s\n", in.name);
+    }
+
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = follow_stop;
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    char buffer[FOLLOW_BUFFER_SIZE];
+    off_t offset = (regular ? lseek(in.fd, 0, SEEK_CUR) : 0);
+    long points = 0;
+    long frames = 0;
+    bool changed = false;
+    double next = 0;
+    int status = (ready ? 0 : 1);
+
+    while (status == 0)
+    {
+        // everything appended since the last look
+        ssize_t got;
+        while ((got = read(in.fd, buffer, sizeof(buffer))) > 0)
+        {
+            follow_feed(&in, buffer, got);
+            offset += got;
+            changed = true;
+        }
+        if (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            fprintf(stderr, "Heatmap: could not read %s\n", in.name);
+            status = 1;
+            break;
+        }
+
+        if (regular && fstat(in.fd, &st) == 0 && st.st_size < offset)
+        {
+            fprintf(stderr, "%s: truncated, starting over\n", in.name);
+            offset = lseek(in.fd, 0, SEEK_SET);
+            bool reset = track_reset(in.trk);
+            in.len = 0;
+            if (in.nmea != NULL)
+            {
+                nmea_reader_destroy(in.nmea);
+                in.nmea = nmea_reader_create(in.trk, 0);
+            }
+            track_live_heatmap_destroy(live);
+            live = track_live_heatmap_create(cell_width, cell_height);
+            points = 0;
+            changed = true;
+            status = (offset == 0 && reset && live != NULL && (in.nmea != NULL || !nmea) ? 0 : 1);
+            continue;
+        }
+
+        // a closed pipe has no more to come, so finish its last line
+        bool ended = (got == 0 && !regular);
+        if (ended)
+        {
+            follow_feed(&in, "\n", in.nmea != NULL || in.len > 0 ? 1 : 0);
+        }
+        ended = ended || follow_stopped;
+
+        double now = follow_clock();
+        if (ended || now >= next)
+        {
+            if (changed || (ended && frames == 0))
+            {
+                status = follow_render(live, &in, &points, frames++, heatmap_characters, range, img);
+                changed = false;
+            }
+            next = now + interval;
+        }
+        if (ended)
+        {
+            break;
+        }
+
+        int wait = (int) ceil((next - now) * 1000);
+        if (regular && wait > FOLLOW_POLL_MS)
+        {
+            wait = FOLLOW_POLL_MS;
+        }
+        struct pollfd more = {in.fd, POLLIN, 0};
+        poll(&more, regular ? 0 : 1, wait > 0 ? wait : 0);
+    }
+
+    stop.sa_handler = SIG_DFL;
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    if (in.nmea != NULL)
+    {
+        nmea_stats stats;
+        nmea_reader_stats(in.nmea, &stats);
+        fprintf(stderr, "%s: %ld NMEA sentences, %ld rejected, %ld points, %ld fixes lost\n",
+                in.name, stats.lines, stats.rejected, stats.points, stats.losses);
+        nmea_reader_destroy(in.nmea);
+    }
+    if (opts->jitter_radius > 0 && in.trk != NULL)
+    {
+        report_collapsed(in.trk, in.name);
+    }
+
+    // standard input is shared with whoever started us, so put it back
+    if (from_stdin && flags >= 0)
+    {
+        fcntl(in.fd, F_SETFL, flags);
+    }
+    else if (!from_stdin && in.fd >= 0)
+    {
+        close(in.fd);
+    }
+    track_live_heatmap_destroy(live);
+    if (in.trk != NULL)
+    {
+        track_destroy(in.trk);
+    }
+    return status;
+}
+
+// the service to stop on SIGINT or SIGTERM
+static service *serving = NULL;
+
+/**
+ * Asks the running service to stop.
+ *
+ * @param sig the signal caught
+ */
+void serve_stop(int sig)
+{
+    (void) sig;
+    service_stop(serving);
+}
+
+/**
+ * Keeps tracks in memory for clients of a Unix domain socket at the
+ * given path, who add points to them and ask for their heatmaps and
+ * lengths, until SIGINT or SIGTERM.  Returns the exit status for the
+ * program.
+ *
+ * @param path the name for the socket
+ * @param opts a pointer to the options to create each track with
+ */
+int serve(const char *path, const track_options *opts)
+{
+    serving = service_create(path, opts);
+    if (serving == NULL)
+    {
+        fprintf(stderr, "Heatmap: could not serve on %s\n", path);
+        return 1;
+    }
+
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = serve_stop;
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    bool ok = service_run(serving);
+
+    stop.sa_handler = SIG_DFL;
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    service_destroy(serving);
+    serving = NULL;
+    return ok ? 0 : 1;
+}
+
+/**
+ * Prints a hexagonal heatmap with the given layout and frees it.  Each
+ * row of pointy hexagons is one line, with the odd rows indented half a
+ * cell.  Each row of a map of flat hexagons is two lines, the even
+ * columns on the first and the odd columns, which are half a cell
+ * further south, on the second.  Exporting instead prints the latitude,
+ * longitude and count of each cell holding any points, one per line.
+ *
+ * @param map a 2-D array of ints
+ * @param layout a pointer to the layout of the map
+ * @param heatmap_characters a nonempty string
+ * @param range the width of the range of values for each character
+ * @param export whether to print the cells as a list
+ */
+void print_hex(int **map, const track_hex_layout *layout, const char *heatmap_characters,
+               double range, bool export)
+{
+    bool pointy = (layout->orientation == TRACK_HEX_POINTY);
+    for (int i=0; i<layout->rows; i++)
+    {
+        if (export)
+        {
+            for (int j=0; j<layout->cols; j++)
+            {
+                if (map[i][j] > 0)
+                {
+                    location center = track_hex_center(layout, i, j);
+                    printf("%.6f %.6f %d\n", center.lat, center.lon, map[i][j]);
+                }
+            }
+        }
+        else if (pointy)
+        {
+            if (i % 2 == 1)
+            {
+                putchar(' ');
+            }
+            for (int j=0; j<layout->cols; j++)
+            {
+                print_cell(map[i][j], heatmap_characters, range);
+                putchar(j < layout->cols - 1 ? ' ' : '\n');
+            }
         }
         else
         {
-            ungetc(ch, stdin);
-            scanf("%lf %lf %ld", &lat, &lon, &time);
+            for (int half=0; half<2; half++)
+            {
+                for (int j=0; j<layout->cols; j++)
+                {
+                    if (j % 2 == half)
+                    {
+                        print_cell(map[i][j], heatmap_characters, range);
+                    }
+                    else
+                    {
+                        putchar(' ');
+                    }
+                }
+                printf("\n");
+            }
         }
-        //create trkpt
-        trackpoint *my_trkpt = trackpoint_create(lat, lon, time); 
+        free(map[i]);
+    }
+    free(map);
+}
 
-        track_add_point(my_trk, my_trkpt);
-        
-        trackpoint_destroy(my_trkpt);   
+/**
+ * Prints the combined heatmap of the tracks in the given files and,
+ * if requested, a line for each file breaking down the points it
+ * contributed.  Returns the exit status for the program.
+ *
+ * @param files an array of n file names
+ * @param n a positive integer
+ * @param cell_width the width of each cell in degrees
+ * @param cell_height the height of each cell in degrees
+ * @param heatmap_characters a nonempty string
+ * @param range the width of the range of values for each character
+ * @param teams whether to print the per-file breakdown
+ * @param img a pointer to the image options
+ * @param opts a pointer to the options to create each track with
+ * @param tolerance the tolerance in meters to simplify each track to, or
+ * a negative number to leave them as they are
+ */
+int print_multi(char **files, int n, double cell_width, double cell_height,
+                const char *heatmap_characters, double range, bool teams,
+                const image_options *img, const track_options *opts, double tolerance)
+{
+    track **trks = calloc(n, sizeof(track*));
+    if (trks == NULL)
+    {
+        return 1;
     }
 
-    // create heatmap
-    int **map;
+    int status = 0;
+    for (int t=0; t<n && status == 0; t++)
+    {
+        trks[t] = track_create_with(opts);
+        if (trks[t] == NULL || !read_file(files[t], trks[t]))
+        {
+            fprintf(stderr, "Heatmap: could not read %s\n", files[t]);
+            status = 1;
+        }
+        else
+        {
+            if (opts->jitter_radius > 0)
+            {
+                report_collapsed(trks[t], files[t]);
+            }
+            if (tolerance >= 0)
+            {
+                simplify_track(trks[t], files[t], tolerance);
+            }
+        }
+    }
 
+    int **map = NULL;
     int rows, cols;
+    track_heatmap_layer *layers = NULL;
 
-    track_heatmap(my_trk, cell_width, cell_height, &map, &rows, &cols);
+    if (status == 0)
+    {
+        track_heatmap_multi(trks, n, cell_width, cell_height, &map, &rows, &cols, teams ? &layers : NULL);
+        if (map == NULL)
+        {
+            status = 1;
+        }
+    }
 
-    int index;
-    int max_index = strlen(heatmap_characters)-1;
+    if (status == 0)
+    {
+        status = output_map((void **) map, false, rows, cols, heatmap_characters, range, img);
 
-    // for each row
-    for (int i=0; i<rows; i++)
+        // for each team, its points and its busiest cell
+        for (int t=0; t<n && layers != NULL; t++)
+        {
+            int points = 0;
+            int busiest = 0;
+            for (int k=0; k<layers[t].count; k++)
+            {
+                points += layers[t].values[k];
+                if (layers[t].values[k] > layers[t].values[busiest])
+                {
+                    busiest = k;
+                }
+            }
+            printf("%s: %d points in %d cells", files[t], points, layers[t].count);
+            if (layers[t].count > 0)
+            {
+                printf(", busiest row %d col %d with %d", layers[t].rows[busiest],
+                       layers[t].cols[busiest], layers[t].values[busiest]);
+            }
+            printf("\n");
+        }
+        track_heatmap_layers_destroy(layers, n);
+    }
+
+    for (int t=0; t<n; t++)
     {
-        // for each col
-        for (int j=0; j<cols; j++)
+        if (trks[t] != NULL)
         {
-            // find the index of the num of trkpts in each cell in the array of heatmap characters
-            index = (int) floor(map[i][j]/range);
+            track_destroy(trks[t]);
+        }
+    }
+    free(trks);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    // which heatmap to make
+    enum { POINTS, METERS, DWELL, COVERAGE, CORRIDOR } mode = POINTS;
+    double sweep_width = 0;
+    bool multi = false;
+    bool teams = false;
+    double tolerance = -1;
+    bool hex = false;
+    track_hex_orientation orientation = TRACK_HEX_POINTY;
+    bool export = false;
+    image_options img = {NULL, IMAGE_GRAY, IMAGE_SCALE_LINEAR};
+    const char *gpx = NULL;
+    const char *nmea = NULL;
+    double interval = 0;
+    const char *socket_path = NULL;
+    track_options opts = {0};
 
-            // match the cell values to the characters
-            map[i][j] = heatmap_characters[index];
-            if (index > max_index)
+    // options come before the positional arguments
+    int arg = 1;
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0)
+    {
+        if (strcmp(argv[arg], "--dwell") == 0)
+        {
+            mode = DWELL;
+        }
+        else if (strcmp(argv[arg], "--meters") == 0)
+        {
+            mode = METERS;
+        }
+        else if (strcmp(argv[arg], "--hex") == 0 || strcmp(argv[arg], "--hex=pointy") == 0)
+        {
+            hex = true;
+            orientation = TRACK_HEX_POINTY;
+        }
+        else if (strcmp(argv[arg], "--hex=flat") == 0)
+        {
+            hex = true;
+            orientation = TRACK_HEX_FLAT;
+        }
+        else if (strncmp(argv[arg], "--pgm=", 6) == 0)
+        {
+            img.path = argv[arg] + 6;
+            img.format = IMAGE_GRAY;
+        }
+        else if (strncmp(argv[arg], "--ppm=", 6) == 0)
+        {
+            img.path = argv[arg] + 6;
+            img.format = IMAGE_COLOR;
+        }
+        else if (strncmp(argv[arg], "--gpx=", 6) == 0)
+        {
+            gpx = argv[arg] + 6;
+        }
+        else if (strncmp(argv[arg], "--nmea=", 7) == 0)
+        {
+            nmea = argv[arg] + 7;
+        }
+        else if (strcmp(argv[arg], "--follow") == 0)
+        {
+            interval = FOLLOW_INTERVAL;
+        }
+        else if (strncmp(argv[arg], "--follow=", 9) == 0)
+        {
+            interval = atof(argv[arg] + 9);
+            if (!(interval > 0))
             {
-              putchar(heatmap_characters[max_index]);
+                return 1;
             }
-            else
+        }
+        else if (strncmp(argv[arg], "--serve=", 8) == 0)
+        {
+            socket_path = argv[arg] + 8;
+        }
+        else if (strcmp(argv[arg], "--log") == 0)
+        {
+            img.scale = IMAGE_SCALE_LOG;
+        }
+        else if (strcmp(argv[arg], "--export") == 0)
+        {
+            export = true;
+        }
+        else if (strcmp(argv[arg], "--coverage") == 0)
+        {
+            mode = COVERAGE;
+        }
+        else if (strncmp(argv[arg], "--corridor=", 11) == 0)
+        {
+            mode = CORRIDOR;
+            sweep_width = atof(argv[arg] + 11);
+        }
+        else if (strncmp(argv[arg], "--simplify=", 11) == 0)
+        {
+            tolerance = atof(argv[arg] + 11);
+            if (!(tolerance >= 0))
             {
-              printf("%c", map[i][j]);
+                return 1;
             }
         }
-        printf("\n");
+        else if (strncmp(argv[arg], "--collapse=", 11) == 0)
+        {
+            opts.jitter_radius = atof(argv[arg] + 11);
+            if (!(opts.jitter_radius > 0))
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "--multi") == 0)
+        {
+            multi = true;
+        }
+        else if (strcmp(argv[arg], "--teams") == 0)
+        {
+            multi = true;
+            teams = true;
+        }
+        else
+        {
+            return 1;
+        }
+        arg++;
     }
 
-    track_destroy(my_trk);
+    // a service takes its points and queries from its clients
+    if (socket_path != NULL)
+    {
+        return (argc == arg && !multi && !hex && mode == POINTS && gpx == NULL && nmea == NULL
+                && interval == 0 && tolerance < 0 && img.path == NULL ? serve(socket_path, &opts) : 1);
+    }
 
-    for (int i = 0; i < rows; i++) 
+    /* there should be 4 positional arguments for correct execution,
+       followed by the track files when combining several */
+    if ( (!multi && argc - arg != 4) || (multi && (argc - arg < 5 || mode != POINTS)) ) 
     {
-      free(map[i]);
+        return 1;
     }
-    free(map);
+
+    // hexagons are counted in degrees or meters, one track at a time
+    if ((hex && (multi || (mode != POINTS && mode != METERS) || img.path != NULL)) || (export && !hex))
+    {
+        return 1;
+    }
+
+    // several tracks are named after range, and GPX ones end in .gpx;
+    // a single track comes from one place
+    if ((multi && (gpx != NULL || nmea != NULL)) || (gpx != NULL && nmea != NULL))
+    {
+        return 1;
+    }
+
+    // a followed track is counted as it grows, so only plain points
+    // on the grid fixed by the first one, with nothing rewriting them
+    if (interval > 0 && (multi || hex || mode != POINTS || gpx != NULL || tolerance >= 0))
+    {
+        return 1;
+    }
+
+    // set values
+    double cell_width = atof(argv[arg]);
+    double cell_height = atof(argv[arg+1]);
+
+    char *heatmap_characters = argv[arg+2];
+
+    double range = atof(argv[arg+3]);
+
+    if (multi)
+    {
+        return print_multi(argv + arg + 4, argc - arg - 4, cell_width, cell_height,
+                           heatmap_characters, range, teams, &img, &opts, tolerance);
+    }
+
+    if (interval > 0)
+    {
+        return follow(nmea != NULL ? nmea : "-", nmea != NULL, interval, cell_width, cell_height,
+                      heatmap_characters, range, &img, &opts);
+    }
+
+    // make track
+    track *my_trk = track_create_with(&opts);
+
+    const char *name = (gpx != NULL ? gpx : (nmea != NULL ? nmea : "stdin"));
+    if (gpx == NULL && nmea == NULL)
+    {
+        read_track(stdin, my_trk);
+    }
+    else if (gpx != NULL ? gpx_read_file(gpx, my_trk) < 0 : !read_nmea(nmea, my_trk))
+    {
+        fprintf(stderr, "Heatmap: could not read %s\n", name);
+        track_destroy(my_trk);
+        return 1;
+    }
+    if (opts.jitter_radius > 0)
+    {
+        report_collapsed(my_trk, name);
+    }
+    if (tolerance >= 0)
+    {
+        simplify_track(my_trk, name, tolerance);
+    }
+
+    int rows, cols;
+    int status = 0;
+
+    if (hex)
+    {
+        // the cell width is the size of each hexagon
+        int **map;
+        track_hex_layout layout;
+
+        track_heatmap_hex(my_trk, cell_width, orientation, mode == METERS, &map, &layout);
+        if (map == NULL)
+        {
+            track_destroy(my_trk);
+            return 1;
+        }
+        print_hex(map, &layout, heatmap_characters, range, export);
+    }
+    else if (mode == DWELL)
+    {
+        // create heatmap of seconds spent in each cell
+        double **map;
+
+        track_heatmap_dwell(my_trk, cell_width, cell_height, &map, &rows, &cols);
+        if (map == NULL)
+        {
+            track_destroy(my_trk);
+            return 1;
+        }
+        status = output_map((void **) map, true, rows, cols, heatmap_characters, range, &img);
+    }
+    else
+    {
+        // create heatmap
+        int **map;
+
+        if (mode == COVERAGE)
+        {
+            track_heatmap_coverage(my_trk, cell_width, cell_height, &map, &rows, &cols);
+        }
+        else if (mode == CORRIDOR)
+        {
+            track_heatmap_corridor(my_trk, cell_width, cell_height, sweep_width, &map, &rows, &cols);
+        }
+        else if (mode == METERS)
+        {
+            track_heatmap_meters(my_trk, cell_width, cell_height, &map, &rows, &cols);
+        }
+        else
+        {
+            track_heatmap(my_trk, cell_width, cell_height, &map, &rows, &cols);
+        }
+        if (map == NULL)
+        {
+            track_destroy(my_trk);
+            return 1;
+        }
+
+        status = output_map((void **) map, false, rows, cols, heatmap_characters, range, &img);
+    }
+
+    track_destroy(my_trk);
+    return status;
 }
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "image.h"
+
+// small counts are looked up instead of scaled one at a time
+#define LEVEL_TABLE_SIZE 4096
+
+struct image_writer
+{
+    FILE *out;
+    int channels;
+    image_scale scale;
+    int rows;
+    int cols;
+    int rows_written;
+    bool failed;
+    double factor;
+    unsigned char levels[LEVEL_TABLE_SIZE];
+    unsigned char palette[256][3];
+    unsigned char *buffer;
+    size_t capacity;
+    size_t used;
+};
+
+/**
+ * Returns the level of the given value.
+ */
+static unsigned char image_level(const image_writer *w, double value)
+{
+    double v = (w->scale == IMAGE_SCALE_LOG ? log1p(fmax(value, 0.0)) : value) * w->factor;
+    return (unsigned char) (v >= 255.0 ? 255 : (v > 0 ? (int) v : 0));
+}
+
+/**
+ * Fills the palette with a ramp from black through red and yellow to
+ * white, the brightness rising steadily along it.
+ */
+static void image_palette(image_writer *w)
+{
+    static const unsigned char stops[4][3] = {{0, 0, 0}, {200, 0, 0}, {255, 200, 0}, {255, 255, 255}};
+    for (int k=0; k<256; k++)
+    {
+        double t = k * 3 / 255.0;
+        int s = (t >= 3 ? 2 : (int) t);
+        double f = t - s;
+        for (int c=0; c<3; c++)
+        {
+            w->palette[k][c] = (unsigned char) (stops[s][c] + (stops[s+1][c] - stops[s][c]) * f + 0.5);
+        }
+    }
+}
+
+/**
+ * Writes out the contents of the buffer.
+ */
+static void image_flush(image_writer *w)
+{
+    if (w->used > 0 && !w->failed && fwrite(w->buffer, 1, w->used, w->out) != w->used)
+    {
+        w->failed = true;
+    }
+    w->used = 0;
+}
+
+/**
+ * Returns room in the buffer for the next row, writing out the buffer
+ * first if the row would not fit, or NULL if no more rows can be added.
+ */
+static unsigned char *image_next_row(image_writer *w)
+{
+    if (w->failed || w->rows_written >= w->rows)
+    {
+        return NULL;
+    }
+    size_t row_size = (size_t) w->cols * w->channels;
+    if (w->used + row_size > w->capacity)
+    {
+        image_flush(w);
+    }
+    unsigned char *row = w->buffer + w->used;
+    w->used += row_size;
+    w->rows_written++;
+    return row;
+}
+
+/**
+ * Turns the levels of a row into colors in place, from the end so that
+ * no level is overwritten before it is read.
+ */
+static void image_colorize(const image_writer *w, unsigned char *row)
+{
+    for (int j=w->cols-1; j>=0; j--)
+    {
+        const unsigned char *color = w->palette[row[j]];
+        row[3*j] = color[0];
+        row[3*j+1] = color[1];
+        row[3*j+2] = color[2];
+    }
+}
+
+image_writer *image_writer_create(FILE *out, image_format format, image_scale scale,
+                                  int rows, int cols, double max)
+{
+    if (out == NULL || rows <= 0 || cols <= 0 || !(max >= 0 && max < INFINITY))
+    {
+        return NULL;
+    }
+
+    image_writer *w = malloc(sizeof(image_writer));
+    if (w == NULL)
+    {
+        return NULL;
+    }
+    w->out = out;
+    w->channels = (format == IMAGE_COLOR ? 3 : 1);
+    w->scale = scale;
+    w->rows = rows;
+    w->cols = cols;
+    w->rows_written = 0;
+    w->failed = false;
+    w->used = 0;
+
+    // at least one whole row fits in the buffer
+    size_t row_size = (size_t) cols * w->channels;
+    w->capacity = (row_size > IMAGE_BUFFER_SIZE ? row_size : IMAGE_BUFFER_SIZE);
+    w->buffer = malloc(w->capacity);
+    if (w->buffer == NULL)
+    {
+        free(w);
+        return NULL;
+    }
+
+    // the factor takes max, or its logarithm, to just under 256
+    double top = (scale == IMAGE_SCALE_LOG ? log1p(max) : max);
+    w->factor = (top > 0 ? 255.999 / top : 0.0);
+    for (int v=0; v<LEVEL_TABLE_SIZE; v++)
+    {
+        w->levels[v] = image_level(w, v);
+    }
+    if (format == IMAGE_COLOR)
+    {
+        image_palette(w);
+    }
+
+    if (fprintf(out, "%s\n%d %d\n255\n", format == IMAGE_COLOR ? "P6" : "P5", cols, rows) < 0)
+    {
+        free(w->buffer);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+bool image_write_row(image_writer *w, const int *values)
+{
+    unsigned char *row = image_next_row(w);
+    if (row == NULL)
+    {
+        return false;
+    }
+
+    for (int j=0; j<w->cols; j++)
+    {
+        int v = values[j];
+        row[j] = (v >= 0 && v < LEVEL_TABLE_SIZE ? w->levels[v] : image_level(w, v));
+    }
+    if (w->channels == 3)
+    {
+        image_colorize(w, row);
+    }
+    return true;
+}
+
+bool image_write_row_double(image_writer *w, const double *values)
+{
+    unsigned char *row = image_next_row(w);
+    if (row == NULL)
+    {
+        return false;
+    }
+
+    for (int j=0; j<w->cols; j++)
+    {
+        row[j] = image_level(w, values[j]);
+    }
+    if (w->channels == 3)
+    {
+        image_colorize(w, row);
+    }
+    return true;
+}
+
+bool image_writer_finish(image_writer *w)
+{
+    image_flush(w);
+    bool ok = !w->failed && w->rows_written == w->rows;
+    free(w->buffer);
+    free(w);
+    return ok;
+}
@@ -0,0 +1,82 @@
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// bytes of encoded pixels gathered before each write
+#define IMAGE_BUFFER_SIZE (1 << 20)
+
+typedef struct image_writer image_writer;
+
+/**
+ * The kind of image to write: a binary PGM with one gray level per
+ * cell, or a binary PPM with each cell colored from a black-red-yellow-
+ * white ramp.
+ */
+typedef enum
+{
+    IMAGE_GRAY,
+    IMAGE_COLOR
+} image_format;
+
+/**
+ * How values are mapped to the 256 levels of the image: in proportion
+ * to the value, or to its logarithm (of one more than it, so that 0
+ * stays 0), which keeps sparse cells visible next to busy ones.
+ */
+typedef enum
+{
+    IMAGE_SCALE_LINEAR,
+    IMAGE_SCALE_LOG
+} image_scale;
+
+/**
+ * Creates a writer of an image of the given size to the given stream
+ * and writes the image's header.  The rows are then passed in order
+ * from the top, one at a time, and encoded into a buffer that is
+ * written out IMAGE_BUFFER_SIZE bytes at a time, so a writer never
+ * holds more than that and one row whatever the size of the image.
+ * Values from 0 to max are spread over the levels of the image with
+ * the given scale, and values outside that range get the nearer end.
+ *
+ * @param out a stream open for writing in binary mode
+ * @param format the kind of image to write
+ * @param scale how values map to levels
+ * @param rows a positive integer
+ * @param cols a positive integer
+ * @param max the value of the brightest level, or 0 for an all-black image
+ * @return a pointer to the new writer, or NULL if the size is invalid or
+ * there was an allocation or write error
+ */
+image_writer *image_writer_create(FILE *out, image_format format, image_scale scale,
+                                  int rows, int cols, double max);
+
+/**
+ * Adds the next row of the image from the given values.  Returns false
+ * if a write failed or all the rows have already been added.
+ *
+ * @param w a pointer to a valid writer
+ * @param values an array of as many values as the image has columns
+ */
+bool image_write_row(image_writer *w, const int *values);
+
+/**
+ * Adds the next row of the image, as image_write_row does, from
+ * values of type double.
+ *
+ * @param w a pointer to a valid writer
+ * @param values an array of as many values as the image has columns
+ */
+bool image_write_row_double(image_writer *w, const double *values);
+
+/**
+ * Writes out what is left in the given writer's buffer and destroys
+ * it.  Returns true if and only if every row was added and every write
+ * succeeded; the stream itself is not flushed or closed.
+ *
+ * @param w a pointer to a valid writer
+ */
+bool image_writer_finish(image_writer *w);
+
+#endif
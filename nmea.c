@@ -0,0 +1,494 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "nmea.h"
+#include "gpx.h"
+
+#define RING_MASK (NMEA_BUFFER_SIZE - 1)
+
+// more fields than any sentence read here has
+#define MAX_FIELDS 24
+
+// the most digits in a coordinate read exactly
+#define MAX_DIGITS 15
+
+struct nmea_reader
+{
+    track *trk;
+    long max_gap;
+    char ring[NMEA_BUFFER_SIZE];
+    size_t head;
+    size_t tail;
+    size_t scanned;
+    bool discarding;
+    bool has_date;
+    long midnight;
+    bool has_fix;
+    long last_time;
+    bool lost;
+    nmea_stats stats;
+};
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/**
+ * Parses n digits at s as a decimal number.  Returns false if any of
+ * them is not a digit.
+ */
+static bool nmea_digits(const char *s, int n, int *value)
+{
+    *value = 0;
+    for (int k=0; k<n; k++)
+    {
+        if (!is_digit(s[k]))
+        {
+            return false;
+        }
+        *value = *value * 10 + (s[k] - '0');
+    }
+    return true;
+}
+
+/**
+ * Returns the value of the given hexadecimal digit, or -1 if it is not
+ * one.
+ */
+static int nmea_hex(char c)
+{
+    if (is_digit(c))
+    {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/**
+ * Parses a time of day of the form hhmmss with optional fractions of a
+ * second, which are dropped, into seconds after midnight.
+ */
+static bool nmea_time_of_day(const char *s, size_t len, long *seconds)
+{
+    int hour, minute, second;
+    if (len < 6 || !nmea_digits(s, 2, &hour) || !nmea_digits(s + 2, 2, &minute) || !nmea_digits(s + 4, 2, &second)
+        || hour > 23 || minute > 59 || second > 60)
+    {
+        return false;
+    }
+    if (len > 6)
+    {
+        if (s[6] != '.')
+        {
+            return false;
+        }
+        for (size_t k=7; k<len; k++)
+        {
+            if (!is_digit(s[k]))
+            {
+                return false;
+            }
+        }
+    }
+    *seconds = hour * 3600L + minute * 60L + second;
+    return true;
+}
+
+/**
+ * Parses a coordinate in degrees and decimal minutes (dddmm.mmmm) and
+ * its hemisphere, positive or negative, into decimal degrees.  The
+ * whole minutes and their fraction are split off the digits as
+ * integers, so the only rounding is in the final division.
+ */
+static bool nmea_coordinate(const char *s, size_t len, const char *hemisphere, size_t hemisphere_len,
+                            char positive, char negative, double *degrees)
+{
+    static const uint64_t powers_of_ten[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+                                             100000000, 1000000000, 10000000000, 100000000000,
+                                             1000000000000, 10000000000000};
+    if (hemisphere_len != 1 || (hemisphere[0] != positive && hemisphere[0] != negative))
+    {
+        return false;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int decimals = 0;
+    bool point = false;
+    for (size_t k=0; k<len; k++)
+    {
+        if (is_digit(s[k]))
+        {
+            mantissa = mantissa * 10 + (s[k] - '0');
+            digits++;
+            decimals += point;
+        }
+        else if (s[k] == '.' && !point)
+        {
+            point = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    if (digits - decimals < 3 || digits > MAX_DIGITS)
+    {
+        return false;
+    }
+
+    uint64_t scale = powers_of_ten[decimals];
+    uint64_t whole = mantissa / (100 * scale);
+    uint64_t minutes = mantissa - whole * 100 * scale;
+    if (minutes >= 60 * scale)
+    {
+        return false;
+    }
+    *degrees = (double) whole + (double) minutes / (double) (60 * scale);
+    *degrees = (hemisphere[0] == negative ? -*degrees : *degrees);
+    return true;
+}
+
+/**
+ * Notes that the receiver lost its fix, so that the next fix starts a
+ * new segment.
+ */
+static void nmea_lost(nmea_reader *r)
+{
+    r->stats.losses++;
+    r->lost = true;
+}
+
+/**
+ * Adds a fix at the given time and location to the track, first
+ * starting a new segment after a lost fix or too long a gap.
+ */
+static void nmea_fix(nmea_reader *r, long time, location loc)
+{
+    r->stats.fixes++;
+    if (r->has_fix && (r->lost || (r->max_gap > 0 && time - r->last_time > r->max_gap)))
+    {
+        track_start_segment(r->trk);
+    }
+    r->lost = false;
+    r->stats.points += track_add_points(r->trk, &loc, &time, 1);
+    if (!r->has_fix || time > r->last_time)
+    {
+        r->last_time = time;
+    }
+    r->has_fix = true;
+}
+
+/**
+ * Handles the fields of an RMC sentence: time, status, latitude and
+ * hemisphere, longitude and hemisphere, speed, course and date (ddmmyy,
+ * with years from 80 in the 1900s).  Returns false if a field the fix
+ * needs is unreadable.
+ */
+static bool nmea_rmc(nmea_reader *r, const char **fields, const size_t *lens, int n)
+{
+    if (n < 10 || lens[2] != 1)
+    {
+        return false;
+    }
+    if (fields[2][0] == 'V')
+    {
+        nmea_lost(r);
+        return true;
+    }
+
+    int day, month, year;
+    long seconds, midnight;
+    location loc;
+    if (fields[2][0] != 'A' || lens[9] != 6 || !nmea_digits(fields[9], 2, &day)
+        || !nmea_digits(fields[9] + 2, 2, &month) || !nmea_digits(fields[9] + 4, 2, &year)
+        || !gpx_make_time(year < 80 ? 2000 + year : 1900 + year, month, day, 0, 0, 0, &midnight)
+        || !nmea_time_of_day(fields[1], lens[1], &seconds)
+        || !nmea_coordinate(fields[3], lens[3], fields[4], lens[4], 'N', 'S', &loc.lat)
+        || !nmea_coordinate(fields[5], lens[5], fields[6], lens[6], 'E', 'W', &loc.lon))
+    {
+        return false;
+    }
+    r->has_date = true;
+    r->midnight = midnight;
+    nmea_fix(r, midnight + seconds, loc);
+    return true;
+}
+
+/**
+ * Handles the fields of a GGA sentence: time, latitude and hemisphere,
+ * longitude and hemisphere, and fix quality.  Its date is that of the
+ * last RMC, moved to the next day if the time would otherwise go back
+ * more than twelve hours, as it does when midnight passes between RMC
+ * sentences.  Returns false if a field the fix needs is unreadable.
+ */
+static bool nmea_gga(nmea_reader *r, const char **fields, const size_t *lens, int n)
+{
+    if (n < 7 || lens[6] != 1 || !is_digit(fields[6][0]))
+    {
+        return false;
+    }
+    if (fields[6][0] == '0')
+    {
+        nmea_lost(r);
+        return true;
+    }
+
+    long seconds;
+    location loc;
+    if (!nmea_time_of_day(fields[1], lens[1], &seconds)
+        || !nmea_coordinate(fields[2], lens[2], fields[3], lens[3], 'N', 'S', &loc.lat)
+        || !nmea_coordinate(fields[4], lens[4], fields[5], lens[5], 'E', 'W', &loc.lon))
+    {
+        return false;
+    }
+    if (!r->has_date)
+    {
+        return true;
+    }
+    if (r->has_fix && r->midnight + seconds < r->last_time - 43200)
+    {
+        r->midnight += 86400;
+    }
+    nmea_fix(r, r->midnight + seconds, loc);
+    return true;
+}
+
+/**
+ * Handles one sentence of the given length, without its line ending:
+ * checks the checksum of the characters between the $ and the *,
+ * splits the fields at the commas without copying them, and passes
+ * RMC and GGA sentences on.  Returns false if the sentence is rejected.
+ */
+static bool nmea_sentence(nmea_reader *r, const char *s, size_t len)
+{
+    if (len < 6 || s[0] != '$')
+    {
+        return false;
+    }
+    const char *star = memchr(s, '*', len);
+    if (star == NULL || s + len - star != 3)
+    {
+        return false;
+    }
+    unsigned char sum = 0;
+    for (const char *c=s+1; c<star; c++)
+    {
+        sum ^= (unsigned char) *c;
+    }
+    int high = nmea_hex(star[1]);
+    int low = nmea_hex(star[2]);
+    if (high < 0 || low < 0 || sum != (high << 4 | low))
+    {
+        return false;
+    }
+
+    const char *fields[MAX_FIELDS];
+    size_t lens[MAX_FIELDS];
+    int n = 0;
+    const char *field = s + 1;
+    while (n < MAX_FIELDS)
+    {
+        const char *comma = memchr(field, ',', star - field);
+        const char *end = (comma != NULL ? comma : star);
+        fields[n] = field;
+        lens[n] = end - field;
+        n++;
+        if (comma == NULL)
+        {
+            break;
+        }
+        field = comma + 1;
+    }
+
+    // the address is a talker ID and the sentence type
+    if (lens[0] != 5)
+    {
+        return true;
+    }
+    if (memcmp(fields[0] + 2, "RMC", 3) == 0)
+    {
+        return nmea_rmc(r, fields, lens, n);
+    }
+    if (memcmp(fields[0] + 2, "GGA", 3) == 0)
+    {
+        return nmea_gga(r, fields, lens, n);
+    }
+    return true;
+}
+
+/**
+ * Handles the line of the given length at the given position in the
+ * input, reading it in place in the ring buffer or, if it wraps around
+ * the end, from a copy on the stack.
+ */
+static void nmea_line(nmea_reader *r, size_t pos, size_t len)
+{
+    char scratch[NMEA_MAX_SENTENCE];
+    const char *s = r->ring + (pos & RING_MASK);
+    size_t first = NMEA_BUFFER_SIZE - (pos & RING_MASK);
+    if (len > NMEA_MAX_SENTENCE)
+    {
+        r->stats.lines++;
+        r->stats.rejected++;
+        return;
+    }
+    if (len > first)
+    {
+        memcpy(scratch, s, first);
+        memcpy(scratch + first, r->ring, len - first);
+        s = scratch;
+    }
+
+    // blank lines are not counted
+    len -= (len > 0 && s[len-1] == '\r');
+    if (len == 0)
+    {
+        return;
+    }
+    r->stats.lines++;
+    if (!nmea_sentence(r, s, len))
+    {
+        r->stats.rejected++;
+    }
+}
+
+/**
+ * Handles each complete line in the buffer.  A line that grows past
+ * the longest sentence without ending is dropped as it arrives, so
+ * that the buffer never holds more than one sentence between calls.
+ */
+static void nmea_process(nmea_reader *r)
+{
+    while (r->scanned < r->head)
+    {
+        size_t start = r->scanned & RING_MASK;
+        size_t run = r->head - r->scanned;
+        run = (start + run > NMEA_BUFFER_SIZE ? NMEA_BUFFER_SIZE - start : run);
+        const char *newline = memchr(r->ring + start, '\n', run);
+        if (newline == NULL)
+        {
+            r->scanned += run;
+            if (r->scanned - r->tail > NMEA_MAX_SENTENCE)
+            {
+                r->discarding = true;
+                r->tail = r->scanned;
+            }
+            continue;
+        }
+
+        size_t end = r->scanned + (newline - (r->ring + start));
+        if (r->discarding)
+        {
+            r->stats.lines++;
+            r->stats.rejected++;
+            r->discarding = false;
+        }
+        else
+        {
+            nmea_line(r, r->tail, end - r->tail);
+        }
+        r->tail = r->scanned = end + 1;
+    }
+}
+
+/**
+ * Returns the number of bytes that can be added to the buffer in one
+ * piece, and where.
+ */
+static size_t nmea_room(nmea_reader *r, char **at)
+{
+    size_t start = r->head & RING_MASK;
+    size_t room = NMEA_BUFFER_SIZE - (r->head - r->tail);
+    *at = r->ring + start;
+    return (start + room > NMEA_BUFFER_SIZE ? NMEA_BUFFER_SIZE - start : room);
+}
+
+nmea_reader *nmea_reader_create(track *trk, long max_gap)
+{
+    nmea_reader *r = malloc(sizeof(nmea_reader));
+    if (r == NULL)
+    {
+        return NULL;
+    }
+    r->trk = trk;
+    r->max_gap = max_gap;
+    r->head = r->tail = r->scanned = 0;
+    r->discarding = false;
+    r->has_date = false;
+    r->midnight = 0;
+    r->has_fix = false;
+    r->last_time = 0;
+    r->lost = false;
+    memset(&r->stats, 0, sizeof(r->stats));
+    return r;
+}
+
+void nmea_reader_destroy(nmea_reader *r)
+{
+    free(r);
+}
+
+nmea_status nmea_read_fd(nmea_reader *r, int fd)
+{
+    while (true)
+    {
+        char *at;
+        size_t room = nmea_room(r, &at);
+        ssize_t got = read(fd, at, room);
+        if (got > 0)
+        {
+            r->head += got;
+            nmea_process(r);
+        }
+        else if (got == 0)
+        {
+            // a last line with no newline
+            if (r->tail < r->head && !r->discarding)
+            {
+                nmea_line(r, r->tail, r->head - r->tail);
+            }
+            r->tail = r->scanned = r->head;
+            r->discarding = false;
+            return NMEA_END;
+        }
+        else if (errno != EINTR)
+        {
+            return (errno == EAGAIN || errno == EWOULDBLOCK ? NMEA_MORE : NMEA_ERROR);
+        }
+    }
+}
+
+void nmea_feed(nmea_reader *r, const char *data, size_t n)
+{
+    while (n > 0)
+    {
+        char *at;
+        size_t room = nmea_room(r, &at);
+        size_t piece = (n < room ? n : room);
+        memcpy(at, data, piece);
+        r->head += piece;
+        data += piece;
+        n -= piece;
+        nmea_process(r);
+    }
+}
+
+void nmea_reader_stats(const nmea_reader *r, nmea_stats *stats)
+{
+    *stats = r->stats;
+}
@@ -0,0 +1,102 @@
+#ifndef __NMEA_H__
+#define __NMEA_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "track.h"
+
+// bytes of input held between sentences; a power of two
+#define NMEA_BUFFER_SIZE 4096
+
+// the longest line taken for a sentence; NMEA 0183 allows 82 characters
+#define NMEA_MAX_SENTENCE 128
+
+typedef struct nmea_reader nmea_reader;
+
+/**
+ * What an NMEA reader has seen so far: the lines it finished, those it
+ * rejected (not a sentence, a bad or missing checksum, a line that is
+ * too long, or an RMC or GGA sentence with unreadable fields), the RMC
+ * and GGA sentences with a valid fix, the points those added to the
+ * track, and the times the receiver reported losing its fix.
+ */
+typedef struct nmea_stats
+{
+    long lines;
+    long rejected;
+    long fixes;
+    long points;
+    long losses;
+} nmea_stats;
+
+/**
+ * How nmea_read_fd stopped: with no more input for now, at the end of
+ * the input, or on a read error.
+ */
+typedef enum
+{
+    NMEA_MORE,
+    NMEA_END,
+    NMEA_ERROR
+} nmea_status;
+
+/**
+ * Creates a reader that adds the fixes in NMEA 0183 input to the given
+ * track as the input arrives.  Fixes come from RMC sentences, which
+ * carry the date, and GGA sentences, which take the date from the last
+ * RMC and are skipped until there is one; any talker ID is accepted.
+ * Each fix is added with track_add_points, so the second sentence for
+ * the same second, and any fractions of a second, are dropped.  After
+ * the receiver reports losing its fix (an RMC with status V or a GGA
+ * with quality 0), the next fix starts a new segment, as does a fix
+ * more than max_gap seconds after the last one if max_gap is positive.
+ * The reader's input buffer is allocated here, once; reading never
+ * allocates.  The track must outlive the reader.
+ *
+ * @param trk a pointer to a valid track
+ * @param max_gap the longest time between fixes in a segment, or 0
+ * @return a pointer to the new reader, or NULL if there was an allocation error
+ */
+nmea_reader *nmea_reader_create(track *trk, long max_gap);
+
+/**
+ * Destroys the given reader; a partial sentence left in it is dropped.
+ *
+ * @param r a pointer to a valid reader
+ */
+void nmea_reader_destroy(nmea_reader *r);
+
+/**
+ * Reads what is available from the given file descriptor into the
+ * reader's ring buffer and handles every complete sentence, each in
+ * place unless it wraps around the end of the buffer.  With a
+ * nonblocking descriptor this returns NMEA_MORE once a read would
+ * block, so it can be called again whenever the descriptor is ready;
+ * with a blocking one it reads to the end of the input.
+ *
+ * @param r a pointer to a valid reader
+ * @param fd a file descriptor open for reading
+ * @return how reading stopped
+ */
+nmea_status nmea_read_fd(nmea_reader *r, int fd);
+
+/**
+ * Handles the given bytes of input as nmea_read_fd handles what it
+ * reads, for input that does not come from a file descriptor.
+ *
+ * @param r a pointer to a valid reader
+ * @param data a pointer to n bytes
+ * @param n the number of bytes
+ */
+void nmea_feed(nmea_reader *r, const char *data, size_t n);
+
+/**
+ * Stores what the given reader has seen so far in *stats.
+ *
+ * @param r a pointer to a valid reader
+ * @param stats a pointer to where to store the counts
+ */
+void nmea_reader_stats(const nmea_reader *r, nmea_stats *stats);
+
+#endif
@@ -0,0 +1,967 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "service.h"
+
+// events taken from epoll at a time
+#define SERVICE_EVENTS 64
+
+// bytes read from a connection at a time
+#define SERVICE_READ_SIZE 65536
+
+// reads from one connection before the others get a turn
+#define SERVICE_READS_PER_TURN 16
+
+// points handed to track_add_points at a time
+#define SERVICE_BATCH_POINTS 1024
+
+/**
+ * A client's connection: the requests read but not yet whole, the
+ * responses not yet sent, and the queries being answered for it.  A
+ * closed connection is freed once those queries are done.
+ */
+typedef struct connection
+{
+    int fd;
+    char *in;
+    size_t in_used;
+    size_t in_capacity;
+    char *out;
+    size_t out_used;
+    size_t out_sent;
+    size_t out_capacity;
+    bool writing;
+    bool closed;
+    int queries;
+    struct connection *next;
+} connection;
+
+/**
+ * A query on its way through the service, and then its response.
+ */
+typedef struct query
+{
+    connection *conn;
+    service_header header;
+    double cell_width;
+    double cell_height;
+    char *reply;
+    size_t reply_size;
+    struct query *next;
+} query;
+
+typedef struct query_queue
+{
+    query *head;
+    query *tail;
+} query_queue;
+
+/**
+ * The tracks and everything that reaches them.  The event loop alone
+ * touches the connections, the held points and the waiting queries.
+ * The tracks change only under the write lock, and a track is stale
+ * from then until its caches are refreshed, which happens before any
+ * query reads it.  Jobs and finished queries pass between the loop and
+ * the workers under the jobs mutex, and a byte down the wake pipe tells
+ * the loop that one has finished.  A byte down the halt pipe tells it
+ * to stop; that pipe never fills, so the byte cannot be lost.
+ */
+struct service
+{
+    char *path;
+    int listener;
+    int epoll;
+    int wake[2];
+    int halt[2];
+    track_options opts;
+    track *tracks[SERVICE_MAX_TRACKS];
+    bool stale[SERVICE_MAX_TRACKS];
+    bool any_stale;
+    pthread_rwlock_t lock;
+    char *pending;
+    size_t pending_used;
+    size_t pending_capacity;
+    query_queue waiting;
+    long active;
+    pthread_mutex_t jobs_lock;
+    pthread_cond_t jobs_ready;
+    query_queue jobs;
+    query_queue done;
+    bool quitting;
+    int workers;
+    pthread_t threads[SERVICE_MAX_WORKERS];
+    connection *conns;
+};
+
+/**
+ * Adds a query to the end of a queue.
+ */
+static void queue_push(query_queue *queue, query *q)
+{
+    q->next = NULL;
+    if (queue->tail != NULL)
+    {
+        queue->tail->next = q;
+    }
+    else
+    {
+        queue->head = q;
+    }
+    queue->tail = q;
+}
+
+/**
+ * Takes the query at the front of a queue, or returns NULL if it is empty.
+ */
+static query *queue_pop(query_queue *queue)
+{
+    query *q = queue->head;
+    if (q != NULL)
+    {
+        queue->head = q->next;
+        if (queue->head == NULL)
+        {
+            queue->tail = NULL;
+        }
+    }
+    return q;
+}
+
+/**
+ * Makes room for at least need bytes in a buffer, at least doubling it
+ * when it grows.  Returns false if there is a memory allocation error,
+ * leaving the buffer unchanged.
+ */
+static bool buffer_reserve(char **buffer, size_t *capacity, size_t need)
+{
+    if (need <= *capacity)
+    {
+        return true;
+    }
+    size_t grown = (*capacity * 2 > need ? *capacity * 2 : need);
+    char *bigger = realloc(*buffer, grown);
+    if (bigger == NULL)
+    {
+        return false;
+    }
+    *buffer = bigger;
+    *capacity = grown;
+    return true;
+}
+
+/**
+ * Makes a descriptor nonblocking.
+ */
+static bool set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/**
+ * Stops waiting on a connection and closes it; it is freed later, once
+ * no query is being answered for it.
+ */
+static void connection_close(service *s, connection *c)
+{
+    if (!c->closed)
+    {
+        epoll_ctl(s->epoll, EPOLL_CTL_DEL, c->fd, NULL);
+        close(c->fd);
+        c->closed = true;
+    }
+}
+
+/**
+ * Sends as much of a connection's responses as it will take, waiting
+ * for it to be writable again only while some are left.
+ */
+static void connection_flush(service *s, connection *c)
+{
+    while (!c->closed && c->out_sent < c->out_used)
+    {
+        ssize_t sent = send(c->fd, c->out + c->out_sent, c->out_used - c->out_sent, MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            c->out_sent += sent;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            break;
+        }
+        else if (errno != EINTR)
+        {
+            connection_close(s, c);
+        }
+    }
+    if (c->closed)
+    {
+        return;
+    }
+
+    bool writing = (c->out_sent < c->out_used);
+    if (!writing)
+    {
+        c->out_used = 0;
+        c->out_sent = 0;
+    }
+    if (writing != c->writing)
+    {
+        struct epoll_event event;
+        event.events = EPOLLIN | (writing ? EPOLLOUT : 0);
+        event.data.ptr = c;
+        epoll_ctl(s->epoll, EPOLL_CTL_MOD, c->fd, &event);
+        c->writing = writing;
+    }
+}
+
+/**
+ * Queues a response on a connection and sends what it can of it.  A
+ * client whose response cannot be stored is disconnected, since it
+ * would otherwise wait for it forever.
+ */
+static void connection_reply(service *s, connection *c, const char *frame, size_t size)
+{
+    if (c->closed)
+    {
+        return;
+    }
+    if (!buffer_reserve(&c->out, &c->out_capacity, c->out_used + size))
+    {
+        connection_close(s, c);
+        return;
+    }
+    memcpy(c->out + c->out_used, frame, size);
+    c->out_used += size;
+    connection_flush(s, c);
+}
+
+/**
+ * Queues a response with an empty body of the given type.
+ */
+static void connection_status(service *s, connection *c, service_type type, const service_header *request)
+{
+    service_header header = {0, type, request->track, request->id};
+    connection_reply(s, c, (const char *) &header, sizeof(header));
+}
+
+/**
+ * Adds the points in, or starts the segment asked for by, a request
+ * whose body may not be aligned, creating the track if it is new.  The
+ * caller holds the write lock.  If the track cannot be created then
+ * the request is dropped.
+ */
+static void service_ingest(service *s, const service_header *header, const char *body)
+{
+    int t = header->track;
+    if (s->tracks[t] == NULL)
+    {
+        s->tracks[t] = track_create_with(&s->opts);
+        if (s->tracks[t] == NULL)
+        {
+            return;
+        }
+    }
+    s->stale[t] = true;
+    s->any_stale = true;
+
+    if (header->type == SERVICE_SEGMENT)
+    {
+        track_start_segment(s->tracks[t]);
+        return;
+    }
+
+    location locs[SERVICE_BATCH_POINTS];
+    long times[SERVICE_BATCH_POINTS];
+    size_t n = header->length / sizeof(service_point);
+    for (size_t done=0; done<n; )
+    {
+        int batch = (n - done < SERVICE_BATCH_POINTS ? (int) (n - done) : SERVICE_BATCH_POINTS);
+        for (int k=0; k<batch; k++)
+        {
+            service_point pt;
+            memcpy(&pt, body + (done + k) * sizeof(service_point), sizeof(pt));
+            locs[k].lat = pt.lat;
+            locs[k].lon = pt.lon;
+            times[k] = (long) pt.time;
+        }
+        track_add_points(s->tracks[t], locs, times, batch);
+        done += batch;
+    }
+}
+
+/**
+ * Refreshes the caches of the tracks changed since they were last
+ * refreshed, so that queries can read them at once.  The caller holds
+ * the write lock.  A track whose caches cannot be refreshed stays
+ * stale, and queries on it are refused rather than left to refresh it
+ * from several threads.
+ */
+static void service_settle(service *s)
+{
+    for (int t=0; t<SERVICE_MAX_TRACKS && s->any_stale; t++)
+    {
+        if (s->stale[t] && track_refresh(s->tracks[t]))
+        {
+            s->stale[t] = false;
+        }
+    }
+    s->any_stale = false;
+}
+
+/**
+ * Hands a query to the workers.
+ */
+static void service_dispatch(service *s, query *q)
+{
+    s->active++;
+    pthread_mutex_lock(&s->jobs_lock);
+    queue_push(&s->jobs, q);
+    pthread_cond_signal(&s->jobs_ready);
+    pthread_mutex_unlock(&s->jobs_lock);
+}
+
+/**
+ * Adds the points held while queries had the tracks, if no query has
+ * them now, and refreshes the tracks if queries are waiting for them;
+ * then lets the waiting queries go.
+ */
+static void service_apply(service *s)
+{
+    if ((s->pending_used > 0 || (s->any_stale && s->waiting.head != NULL))
+        && pthread_rwlock_trywrlock(&s->lock) == 0)
+    {
+        for (size_t off=0; off<s->pending_used; )
+        {
+            service_header header;
+            memcpy(&header, s->pending + off, sizeof(header));
+            service_ingest(s, &header, s->pending + off + sizeof(header));
+            off += sizeof(header) + header.length;
+        }
+        s->pending_used = 0;
+        service_settle(s);
+        pthread_rwlock_unlock(&s->lock);
+    }
+
+    if (s->pending_used == 0 && !s->any_stale)
+    {
+        query *q;
+        while ((q = queue_pop(&s->waiting)) != NULL)
+        {
+            service_dispatch(s, q);
+        }
+    }
+}
+
+/**
+ * Handles one whole request from a connection.  Points are added at
+ * once if the tracks are free and nothing is held before them, and are
+ * otherwise held; either way they are acknowledged now.  Queries go to
+ * the workers, or wait if points are held or tracks are stale.
+ */
+static void service_request(service *s, connection *c, const service_header *header, const char *body)
+{
+    bool ingest = (header->type == SERVICE_APPEND && header->length % sizeof(service_point) == 0)
+        || (header->type == SERVICE_SEGMENT && header->length == 0);
+    bool ask = (header->type == SERVICE_HEATMAP && header->length == 2 * sizeof(double))
+        || (header->type == SERVICE_LENGTHS && header->length == 0);
+
+    if (header->track >= SERVICE_MAX_TRACKS || (!ingest && !ask))
+    {
+        connection_status(s, c, SERVICE_ERROR, header);
+    }
+    else if (ingest)
+    {
+        if (s->pending_used == 0 && pthread_rwlock_trywrlock(&s->lock) == 0)
+        {
+            service_ingest(s, header, body);
+
+            // queries already handed out must find the caches fresh
+            if (s->active > 0)
+            {
+                service_settle(s);
+            }
+            pthread_rwlock_unlock(&s->lock);
+        }
+        else
+        {
+            size_t size = sizeof(service_header) + header->length;
+            if (!buffer_reserve(&s->pending, &s->pending_capacity, s->pending_used + size))
+            {
+                connection_status(s, c, SERVICE_ERROR, header);
+                return;
+            }
+            memcpy(s->pending + s->pending_used, header, sizeof(service_header));
+            memcpy(s->pending + s->pending_used + sizeof(service_header), body, header->length);
+            s->pending_used += size;
+        }
+        connection_status(s, c, SERVICE_OK, header);
+    }
+    else
+    {
+        query *q = calloc(1, sizeof(query));
+        if (q == NULL)
+        {
+            connection_status(s, c, SERVICE_ERROR, header);
+            return;
+        }
+        q->conn = c;
+        q->header = *header;
+        if (header->type == SERVICE_HEATMAP)
+        {
+            memcpy(&q->cell_width, body, sizeof(double));
+            memcpy(&q->cell_height, body + sizeof(double), sizeof(double));
+        }
+        c->queries++;
+        if (s->pending_used > 0 || s->any_stale)
+        {
+            queue_push(&s->waiting, q);
+        }
+        else
+        {
+            service_dispatch(s, q);
+        }
+    }
+}
+
+/**
+ * Reads what has arrived on a connection and handles each whole
+ * request in it.  A request too long to accept ends the connection,
+ * since the rest of the stream cannot be trusted to be framed.
+ */
+static void connection_read(service *s, connection *c)
+{
+    for (int turn=0; turn<SERVICE_READS_PER_TURN && !c->closed; turn++)
+    {
+        if (!buffer_reserve(&c->in, &c->in_capacity, c->in_used + SERVICE_READ_SIZE))
+        {
+            connection_close(s, c);
+            return;
+        }
+        ssize_t got = recv(c->fd, c->in + c->in_used, SERVICE_READ_SIZE, 0);
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            connection_close(s, c);
+            return;
+        }
+        if (got < 0)
+        {
+            return;
+        }
+        c->in_used += got;
+
+        size_t off = 0;
+        while (!c->closed && c->in_used - off >= sizeof(service_header))
+        {
+            service_header header;
+            memcpy(&header, c->in + off, sizeof(header));
+            if (header.length > SERVICE_MAX_REQUEST)
+            {
+                connection_close(s, c);
+                return;
+            }
+            if (c->in_used - off - sizeof(header) < header.length)
+            {
+                break;
+            }
+            service_request(s, c, &header, c->in + off + sizeof(header));
+            off += sizeof(header) + header.length;
+        }
+        memmove(c->in, c->in + off, c->in_used - off);
+        c->in_used -= off;
+    }
+}
+
+/**
+ * Takes every connection waiting to be accepted.
+ */
+static void service_accept(service *s)
+{
+    while (true)
+    {
+        int fd = accept(s->listener, NULL, NULL);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        connection *c = calloc(1, sizeof(connection));
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = c;
+        if (c == NULL || !set_nonblocking(fd) || epoll_ctl(s->epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->next = s->conns;
+        s->conns = c;
+    }
+}
+
+/**
+ * Answers a query from the tracks, storing the whole response frame in
+ * it.  The caller holds the read lock.  The reply is left NULL if there
+ * is a memory allocation error.
+ */
+static void service_answer(service *s, query *q)
+{
+    const track *trk = s->tracks[q->header.track];
+    service_header header = {0, SERVICE_ERROR, q->header.track, q->header.id};
+    char *body = NULL;
+    uint64_t length = 0;
+
+    if (trk != NULL && !s->stale[q->header.track] && q->header.type == SERVICE_LENGTHS)
+    {
+        int count = track_count_segments(trk);
+        double *lengths = track_get_lengths(trk);
+        length = sizeof(double) * count;
+        body = (char *) lengths;
+    }
+    else if (trk != NULL && !s->stale[q->header.track])
+    {
+        int **map;
+        int rows, cols;
+        track_heatmap(trk, q->cell_width, q->cell_height, &map, &rows, &cols);
+        if (map != NULL)
+        {
+            length = 2 * sizeof(int32_t) + (uint64_t) rows * cols * sizeof(int32_t);
+            body = (length <= UINT32_MAX ? malloc(length) : NULL);
+            for (int i=0; i<rows; i++)
+            {
+                for (int j=0; j<cols && body != NULL; j++)
+                {
+                    int32_t count = map[i][j];
+                    memcpy(body + 2 * sizeof(int32_t) + ((size_t) i * cols + j) * sizeof(int32_t),
+                           &count, sizeof(count));
+                }
+                free(map[i]);
+            }
+            free(map);
+            if (body != NULL)
+            {
+                int32_t dims[2] = {rows, cols};
+                memcpy(body, dims, sizeof(dims));
+            }
+        }
+    }
+
+    if (body != NULL)
+    {
+        header.type = SERVICE_OK;
+        header.length = (uint32_t) length;
+    }
+    q->reply_size = sizeof(header) + header.length;
+    q->reply = malloc(q->reply_size);
+    if (q->reply != NULL)
+    {
+        memcpy(q->reply, &header, sizeof(header));
+        if (body != NULL)
+        {
+            memcpy(q->reply + sizeof(header), body, header.length);
+        }
+    }
+    free(body);
+}
+
+/**
+ * Answers queries, taking them from the jobs until the service stops.
+ */
+static void *service_worker(void *arg)
+{
+    service *s = arg;
+
+    pthread_mutex_lock(&s->jobs_lock);
+    while (true)
+    {
+        while (s->jobs.head == NULL && !s->quitting)
+        {
+            pthread_cond_wait(&s->jobs_ready, &s->jobs_lock);
+        }
+        if (s->quitting)
+        {
+            break;
+        }
+        query *q = queue_pop(&s->jobs);
+        pthread_mutex_unlock(&s->jobs_lock);
+
+        pthread_rwlock_rdlock(&s->lock);
+        service_answer(s, q);
+        pthread_rwlock_unlock(&s->lock);
+
+        // a full pipe already has the loop's attention
+        pthread_mutex_lock(&s->jobs_lock);
+        queue_push(&s->done, q);
+        char wake = 0;
+        if (write(s->wake[1], &wake, 1) < 0)
+        {
+            // nothing to do
+        }
+    }
+    pthread_mutex_unlock(&s->jobs_lock);
+    return NULL;
+}
+
+/**
+ * Sends the responses to the queries the workers have finished.
+ */
+static void service_finish(service *s)
+{
+    char drain[256];
+    while (read(s->wake[0], drain, sizeof(drain)) > 0)
+    {
+    }
+
+    pthread_mutex_lock(&s->jobs_lock);
+    query *q = s->done.head;
+    s->done.head = s->done.tail = NULL;
+    pthread_mutex_unlock(&s->jobs_lock);
+
+    while (q != NULL)
+    {
+        query *next = q->next;
+        s->active--;
+        q->conn->queries--;
+        if (q->reply != NULL)
+        {
+            connection_reply(s, q->conn, q->reply, q->reply_size);
+        }
+        else
+        {
+            connection_close(s, q->conn);
+        }
+        free(q->reply);
+        free(q);
+        q = next;
+    }
+}
+
+/**
+ * Frees the closed connections no query is being answered for.
+ */
+static void service_reap(service *s)
+{
+    connection **link = &s->conns;
+    while (*link != NULL)
+    {
+        connection *c = *link;
+        if (c->closed && c->queries == 0)
+        {
+            *link = c->next;
+            free(c->in);
+            free(c->out);
+            free(c);
+        }
+        else
+        {
+            link = &c->next;
+        }
+    }
+}
+
+/**
+ * Frees every query in a queue.
+ */
+static void queue_clear(query_queue *queue)
+{
+    query *q;
+    while ((q = queue_pop(queue)) != NULL)
+    {
+        q->conn->queries--;
+        free(q->reply);
+        free(q);
+    }
+}
+
+service *service_create(const char *path, const track_options *opts)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        return NULL;
+    }
+
+    service *s = calloc(1, sizeof(service));
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    s->opts = *opts;
+    s->listener = -1;
+    s->epoll = -1;
+    s->wake[0] = s->wake[1] = -1;
+    s->halt[0] = s->halt[1] = -1;
+    s->path = malloc(strlen(path) + 1);
+    if (s->path == NULL)
+    {
+        free(s);
+        return NULL;
+    }
+    strcpy(s->path, path);
+
+    // a socket left by an earlier service only stands in the way
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    s->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool ready = (s->listener >= 0 && bind(s->listener, (struct sockaddr *) &addr, sizeof(addr)) == 0
+                  && listen(s->listener, SOMAXCONN) == 0 && set_nonblocking(s->listener));
+    if (!ready)
+    {
+        if (s->listener >= 0)
+        {
+            close(s->listener);
+        }
+        free(s->path);
+        free(s);
+        return NULL;
+    }
+
+    s->epoll = epoll_create1(0);
+    struct epoll_event listen_event = {EPOLLIN, {.ptr = &s->listener}};
+    struct epoll_event wake_event = {EPOLLIN, {.ptr = s->wake}};
+    struct epoll_event halt_event = {EPOLLIN, {.ptr = s->halt}};
+    ready = (s->epoll >= 0 && pipe(s->wake) == 0 && set_nonblocking(s->wake[0]) && set_nonblocking(s->wake[1])
+             && pipe(s->halt) == 0
+             && epoll_ctl(s->epoll, EPOLL_CTL_ADD, s->listener, &listen_event) == 0
+             && epoll_ctl(s->epoll, EPOLL_CTL_ADD, s->wake[0], &wake_event) == 0
+             && epoll_ctl(s->epoll, EPOLL_CTL_ADD, s->halt[0], &halt_event) == 0);
+
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    s->workers = (workers < 1 ? 1 : (workers > SERVICE_MAX_WORKERS ? SERVICE_MAX_WORKERS : (int) workers));
+    pthread_rwlock_init(&s->lock, NULL);
+    pthread_mutex_init(&s->jobs_lock, NULL);
+    pthread_cond_init(&s->jobs_ready, NULL);
+    if (!ready)
+    {
+        service_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+bool service_run(service *s)
+{
+    int started = 0;
+    s->quitting = false;
+    while (started < s->workers && pthread_create(&s->threads[started], NULL, service_worker, s) == 0)
+    {
+        started++;
+    }
+    bool ok = (started > 0);
+
+    struct epoll_event events[SERVICE_EVENTS];
+    bool stopped = false;
+    while (ok && !stopped)
+    {
+        int n = epoll_wait(s->epoll, events, SERVICE_EVENTS, -1);
+        if (n < 0 && errno != EINTR)
+        {
+            ok = false;
+        }
+
+        for (int e=0; e<n; e++)
+        {
+            if (events[e].data.ptr == &s->listener)
+            {
+                service_accept(s);
+            }
+            else if (events[e].data.ptr == s->wake)
+            {
+                service_finish(s);
+            }
+            else if (events[e].data.ptr == s->halt)
+            {
+                char halt;
+                stopped = (read(s->halt[0], &halt, 1) == 1);
+            }
+            else
+            {
+                connection *c = events[e].data.ptr;
+                if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                {
+                    connection_read(s, c);
+                }
+                if (events[e].events & EPOLLOUT)
+                {
+                    connection_flush(s, c);
+                }
+            }
+        }
+
+        service_apply(s);
+        service_reap(s);
+    }
+
+    pthread_mutex_lock(&s->jobs_lock);
+    s->quitting = true;
+    pthread_cond_broadcast(&s->jobs_ready);
+    pthread_mutex_unlock(&s->jobs_lock);
+    for (int w=0; w<started; w++)
+    {
+        pthread_join(s->threads[w], NULL);
+    }
+
+    // the queries still in hand are dropped with their connections
+    service_finish(s);
+    queue_clear(&s->jobs);
+    queue_clear(&s->waiting);
+    s->active = 0;
+    return ok;
+}
+
+void service_stop(service *s)
+{
+    char halt = 0;
+    if (write(s->halt[1], &halt, 1) < 0)
+    {
+        // the service is being destroyed
+    }
+}
+
+void service_destroy(service *s)
+{
+    for (connection *c=s->conns; c!=NULL; c=c->next)
+    {
+        connection_close(s, c);
+        c->queries = 0;
+    }
+    service_reap(s);
+
+    if (s->listener >= 0)
+    {
+        close(s->listener);
+        unlink(s->path);
+    }
+    if (s->epoll >= 0)
+    {
+        close(s->epoll);
+    }
+    for (int k=0; k<2; k++)
+    {
+        if (s->wake[k] >= 0)
+        {
+            close(s->wake[k]);
+        }
+        if (s->halt[k] >= 0)
+        {
+            close(s->halt[k]);
+        }
+    }
+    for (int t=0; t<SERVICE_MAX_TRACKS; t++)
+    {
+        if (s->tracks[t] != NULL)
+        {
+            track_destroy(s->tracks[t]);
+        }
+    }
+    pthread_rwlock_destroy(&s->lock);
+    pthread_mutex_destroy(&s->jobs_lock);
+    pthread_cond_destroy(&s->jobs_ready);
+    free(s->pending);
+    free(s->path);
+    free(s);
+}
+
+int service_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/**
+ * Sends all of the given bytes, or returns false.
+ */
+static bool send_all(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+/**
+ * Receives exactly the given number of bytes, or returns false.
+ */
+static bool receive_all(int fd, char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t got = recv(fd, data, size, 0);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return false;
+        }
+        data += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool service_send(int fd, service_type type, int track, uint32_t id, const void *body, uint32_t length)
+{
+    service_header header = {length, (uint16_t) type, (uint16_t) track, id};
+    return send_all(fd, (const char *) &header, sizeof(header)) && send_all(fd, body, length);
+}
+
+void *service_receive(int fd, service_header *header)
+{
+    if (!receive_all(fd, (char *) header, sizeof(*header)))
+    {
+        return NULL;
+    }
+    char *body = malloc((size_t) header->length + 1);
+    if (body != NULL && !receive_all(fd, body, header->length))
+    {
+        free(body);
+        body = NULL;
+    }
+    return body;
+}
@@ -0,0 +1,155 @@
+#ifndef __SERVICE_H__
+#define __SERVICE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "track.h"
+
+// the tracks a service holds are numbered from 0 up to this
+#define SERVICE_MAX_TRACKS 256
+
+// the longest body of a request, in bytes
+#define SERVICE_MAX_REQUEST (1 << 20)
+
+// the most threads answering queries at once
+#define SERVICE_MAX_WORKERS 8
+
+/**
+ * The type of a frame: the requests a client sends and the two
+ * responses it gets back.
+ *
+ * SERVICE_APPEND carries service_point records to add to the end of the
+ * last segment of the track, as track_add_points adds them, and
+ * SERVICE_SEGMENT, with no body, starts a new segment; either creates
+ * the track if it is new.  Both are answered with an empty
+ * SERVICE_OK as soon as the points are accepted, before they are added.
+ *
+ * SERVICE_HEATMAP carries two doubles, the cell width and height, and
+ * is answered with the track's heatmap from track_heatmap: its rows and
+ * columns as two int32_t and then the counts, an int32_t each, a row at
+ * a time.  SERVICE_LENGTHS has no body and is answered with the length
+ * of each segment as a double, from track_get_lengths.  A query sees
+ * every point accepted before it, from any client.
+ *
+ * A request that is not understood, names a track that does not exist
+ * or cannot be answered gets an empty SERVICE_ERROR.
+ */
+typedef enum
+{
+    SERVICE_APPEND = 1,
+    SERVICE_SEGMENT = 2,
+    SERVICE_HEATMAP = 3,
+    SERVICE_LENGTHS = 4,
+    SERVICE_OK = 128,
+    SERVICE_ERROR = 129
+} service_type;
+
+/**
+ * The header of every frame in both directions: the length of the body
+ * that follows, the type of frame, the track it is about and a number
+ * the client chooses, which the response repeats so that requests can
+ * be sent without waiting for each answer.  Responses to queries come
+ * back as they finish, not necessarily in order.  Both ends are on the
+ * same machine, so every field is in its byte order.
+ */
+typedef struct service_header
+{
+    uint32_t length;
+    uint16_t type;
+    uint16_t track;
+    uint32_t id;
+} service_header;
+
+/**
+ * One point in the body of a SERVICE_APPEND request.
+ */
+typedef struct service_point
+{
+    double lat;
+    double lon;
+    int64_t time;
+} service_point;
+
+typedef struct service service;
+
+/**
+ * Creates a service holding tracks in memory for clients connecting to
+ * a Unix domain socket at the given path.  A socket left at the path by
+ * an earlier service is replaced.  The tracks are created with the given
+ * options as clients first add to them.  Nothing is served until
+ * service_run is called.  Returns NULL if the socket cannot be created
+ * or there is a memory allocation error.
+ *
+ * @param path the name for the socket
+ * @param opts a pointer to the options to create each track with
+ * @return a pointer to the new service, or NULL
+ */
+service *service_create(const char *path, const track_options *opts);
+
+/**
+ * Serves clients until service_stop is called.  One thread waits on
+ * every connection with epoll, reads requests and adds points, so
+ * adding never waits for a query.  Queries are answered by up to
+ * SERVICE_MAX_WORKERS threads at once, which share the tracks through
+ * a reader-writer lock.  Points that arrive while a query holds the
+ * lock are held and added once it is free, and queries that arrive
+ * while points are held wait for them, so that every query sees all of
+ * the points accepted before it.  Returns false if waiting for
+ * connections fails.
+ *
+ * @param s a pointer to a valid service
+ * @return true if and only if the service stopped because it was asked to
+ */
+bool service_run(service *s);
+
+/**
+ * Asks the given service to stop once it has finished the requests in
+ * hand.  This may be called from any thread or from a signal handler.
+ *
+ * @param s a pointer to a valid service
+ */
+void service_stop(service *s);
+
+/**
+ * Destroys the given service that is not running, closing its
+ * connections, removing its socket and destroying its tracks.
+ *
+ * @param s a pointer to a valid service
+ */
+void service_destroy(service *s);
+
+/**
+ * Connects to the service at the given path.
+ *
+ * @param path the name of the service's socket
+ * @return a descriptor for the connection, or -1 if it could not be made
+ */
+int service_connect(const char *path);
+
+/**
+ * Sends one frame over the given connection, waiting until all of it
+ * has been sent.
+ *
+ * @param fd a descriptor from service_connect
+ * @param type the type of the frame
+ * @param track the number of the track
+ * @param id a number to find in the response
+ * @param body a pointer to length bytes
+ * @param length the size of the body
+ * @return true if and only if the frame was sent
+ */
+bool service_send(int fd, service_type type, int track, uint32_t id, const void *body, uint32_t length);
+
+/**
+ * Receives one frame from the given connection, waiting until all of it
+ * has arrived, and returns its body, which the caller must free.
+ *
+ * @param fd a descriptor from service_connect
+ * @param header a pointer to where to store the frame's header
+ * @return a pointer to the body, or NULL if the connection closed or
+ * failed or there is a memory allocation error
+ */
+void *service_receive(int fd, service_header *header);
+
+#endif
@@ -1,27 +1,193 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "track.h"
+#include "arena.h"
+
+#define PI 3.14159265358979
+#define RADIANS(x) ((x) / 180.0 * PI)
+
+// meters along a meridian per degree of latitude on a spherical earth
+#define METERS_PER_DEGREE (6371000.0 * PI / 180.0)
+
+// points per full block of segment storage
+#define TRACK_BLOCK_SHIFT 10
+#define TRACK_BLOCK_POINTS (1 << TRACK_BLOCK_SHIFT)
+#define TRACK_BLOCK_MASK (TRACK_BLOCK_POINTS - 1)
+
+// points in the first block of a new segment
+#define TRACK_FIRST_BLOCK 16
+
+// compact coordinates are in units of 1e-7 degrees
+#define COMPACT_SCALE 1e7
+
+// longitude bins for keeping the smallest wedge up to date
+#define LON_BINS 4096
+#define LON_BIN_WIDTH (360.0 / LON_BINS)
+
+/**
+ * A point as stored in a segment.
+ */
+typedef struct trkrec
+{
+    location loc;
+    long time;
+} trkrec;
+
+/**
+ * A point as stored in a segment of a compact track: the coordinates
+ * in units of 1e-7 degrees and the seconds since the first point of
+ * the segment.
+ */
+typedef struct trkrec_compact
+{
+    int32_t lat;
+    int32_t lon;
+    int32_t offset;
+} trkrec_compact;
+
+/**
+ * A point of a segment that stands in for a run of nearby points
+ * collapsed at ingest, and the seconds from it to the last of the run.
+ */
+typedef struct dwell
+{
+    int point;
+    long seconds;
+} dwell;
 
+/**
+ * A segment stores its points in blocks that are never moved once
+ * allocated.  Every block but the first holds TRACK_BLOCK_POINTS
+ * points; the first starts small and doubles until it is full size,
+ * and only then are more blocks added, so point j is always at
+ * offset j & TRACK_BLOCK_MASK in block j >> TRACK_BLOCK_SHIFT.  The
+ * blocks hold trkrec or, in a compact track, trkrec_compact records
+ * with times relative to base_time.  The bounds and last time of the
+ * points are kept as they are added; after the last point is moved the
+ * bounds are stale until recomputed by segment_rebuild_bounds, which
+ * the operation that moved it does before returning.  The dwell times
+ * of points that absorbed others are kept apart, in increasing order of
+ * point, since few points have them.  A track with running lengths
+ * keeps the distance from the first point to each point in blocks of
+ * doubles laid out like the points, or dists is NULL.
+ */
 typedef struct segment
 {
     int count;
     int capacity;
     double length;
-    trackpoint **trkpt;
+    long base_time;
+    char **blocks;
+    double **dists;
+    int num_blocks;
+    int max_blocks;
+
+    // the summary; base_time is the first time once there are points
+    long last_time;
+    double south;
+    double north;
+    double min_lon;
+    double max_lon;
+    bool bounds_stale;
+
+    dwell *dwells;
+    int num_dwells;
+    int max_dwells;
 } segment;
 
+/**
+ * The occupied longitudes of a track at a resolution of LON_BINS bins
+ * around the globe, with the exact least and greatest longitude in
+ * each occupied bin.  Longitudes outside [-180, 180] do not fit in a
+ * bin and are only noted in out_of_range.
+ */
+typedef struct lon_bins
+{
+    uint64_t occupied[LON_BINS / 64];
+    double min[LON_BINS];
+    double max[LON_BINS];
+    bool out_of_range;
+} lon_bins;
+
+/**
+ * The bounds of the last segment and the longitude bin of its last
+ * point as they were before that point was added, so that a
+ * provisional last point can be replaced without a rescan.  Either
+ * part is invalid if it was stale when saved or if points have moved
+ * since.
+ */
+typedef struct tail_undo
+{
+    bool bounds_valid;
+    double south;
+    double north;
+    double min_lon;
+    double max_lon;
+    bool bin_valid;
+    int bin;
+    bool occupied;
+    double bin_min;
+    double bin_max;
+    bool out_of_range;
+} tail_undo;
+
+/**
+ * The longitude bins are allocated with the first point and kept up to
+ * date as points are added; when points move they are rebuilt by
+ * track_rebuild_lons before the operation returns, and they are only
+ * left stale if they cannot be allocated.  A track with a memory budget
+ * keeps one of every rate points offered to the current segment,
+ * counting them in received, and holds the latest other one as a
+ * provisional last point until the next arrives; stored counts the
+ * points in all segments and is brought back under max_points by
+ * doubling the rate and thinning every segment, or until it reaches
+ * next_decimation if the segment ends alone are over the budget.  A
+ * track restored from a snapshot keeps its storage in the mapped image
+ * until it is destroyed or reset, and anything new in its arena.
+ */
 struct track
 {
     segment *segments;
     int count;
     int capacity;
+    arena *mem;
+    bool compact;
+    bool running_lengths;
+    size_t rec_size;
+    lon_bins *lons;
+    bool lons_stale;
+    double jitter_radius;
+    long collapsed;
+    size_t budget;
+    long max_points;
+    long rate;
+    long stored;
+    long received;
+    long next_decimation;
+    bool tail_provisional;
+    tail_undo undo;
+    void *image;
+    size_t image_size;
 };
 
 /**
- * Resized the trkpt array by doubling its size.  There is no effect if
- * there is a memory allocation error.
+ * Makes room for more points in segment i, by doubling the first
+ * block while it is smaller than full size and by adding a block
+ * after that.  There is no effect if there is a memory allocation error.
  *
  * @param trk a pointer to a valid track
  */
@@ -33,616 +199,5514 @@ void track_trkpt_embiggen(track *trk, int i);
  * @param trk a pointer to a valid track
  */
 void track_seg_embiggen(track *trk);
+
+static bool track_append(track *trk, location loc, long time);
+static bool track_add(track *trk, location loc, long time);
+static inline bool jitter_within(location a, location b, double radius);
+static bool segment_note_dwell(track *trk, segment *seg, long seconds);
+static bool track_append_sampled(track *trk, location loc, long time);
+static void track_decimate(track *trk);
+static void track_restart_sampling(track *trk);
+
 /**
- * Creates a track with one empty segment.
- *
- * @return a pointer to the new track, or NULL if there was an allocation error
+ * Allocates the given number of bytes for the given track's storage,
+ * from its arena if it has one.
  */
-track *track_create()
+static void *track_alloc(track *trk, size_t size)
 {
-    track *trk = malloc(sizeof(track));
-    if (trk != NULL)
+    if (trk->mem != NULL)
     {
-        trk->segments = malloc(10 * sizeof(segment));
-        if (trk->segments != NULL)
-        {
-            trk->segments[0].count = 0;
-            trk->segments[0].capacity = 10;
-            trk->segments[0].length = 0;
-            trk->segments[0].trkpt = calloc(trk->segments[0].capacity, sizeof(trackpoint*));
-        }
-        else
-        {
-            return NULL;
-        }
-        trk->count = 1;
-        trk->capacity = 10; 
-        
-        return trk;
+        return arena_alloc(trk->mem, size);
     }
-    else 
+    else
     {
-        return NULL;
+        // blocks start on a cache line in either case
+        void *ptr;
+        return (posix_memalign(&ptr, ARENA_ALIGNMENT, size > 0 ? size : 1) == 0 ? ptr : NULL);
     }
 }
 
 /**
- * Destroys the given track, releasing all memory held by it.
- *
- * @param trk a pointer to a valid track
+ * Resizes storage allocated by track_alloc.  Returns NULL and leaves
+ * the storage unchanged if there is a memory allocation error.
  */
-void track_destroy(track *trk)
+static void *track_realloc(track *trk, void *ptr, size_t old_size, size_t new_size)
 {
-    for (int i=0; i<trk->count; i++)
+    if (trk->mem != NULL)
+    {
+        return arena_grow(trk->mem, ptr, old_size, new_size);
+    }
+    else
     {
-        for (int j=0; j<trk->segments[i].count; j++)
+        void *resized = track_alloc(trk, new_size);
+        if (resized != NULL && ptr != NULL)
         {
-            free(trk->segments[i].trkpt[j]);
+            memcpy(resized, ptr, old_size < new_size ? old_size : new_size);
+            free(ptr);
         }
-        free(trk->segments[i].trkpt);
+        return resized;
     }
-    free(trk->segments);
-    free(trk);
 }
 
 /**
- * Returns the number of segments in the given track.
- *
- * @param trk a pointer to a valid track
+ * Releases storage allocated by track_alloc.  Storage from an arena is
+ * only released with the whole arena.
  */
-int track_count_segments(const track *trk)
+static void track_free(track *trk, void *ptr)
 {
-    return trk->count;
+    if (trk->mem == NULL)
+    {
+        free(ptr);
+    }
 }
 
 /**
- * Returns the number of trackpoints in the given segment of the given
- * track.  The segment is specified by a 0-based index.  The return
- * value is 0 if the segment index is invalid.
- *
- * @param trk a pointer to a valid track
- * @param i a nonnegative integer less than the number of segments in trk
- * @return the number of trackpoints in the corresponding segment
+ * Resets the summary of the given segment to that of an empty segment.
  */
-int track_count_points(const track *trk, int i)
+static void segment_clear(segment *seg)
 {
-    if (i >= 0 && i < trk->count)
+    seg->count = 0;
+    seg->length = 0;
+    seg->base_time = 0;
+    seg->last_time = 0;
+    seg->south = 90;
+    seg->north = -90;
+    seg->min_lon = 180;
+    seg->max_lon = -180;
+    seg->bounds_stale = false;
+    seg->num_dwells = 0;
+}
+
+/**
+ * Extends the bounds of the given segment to include the given location.
+ */
+static inline void segment_extend(segment *seg, location loc)
+{
+    if (loc.lat < seg->south)
     {
-        return trk->segments[i].count;
+        seg->south = loc.lat;
     }
-    else 
+    if (loc.lat > seg->north)
     {
-        return 0;
+        seg->north = loc.lat;
+    }
+    if (loc.lon < seg->min_lon)
+    {
+        seg->min_lon = loc.lon;
+    }
+    if (loc.lon > seg->max_lon)
+    {
+        seg->max_lon = loc.lon;
     }
 }
 
 /**
- * Returns a copy of the given point in this track.  The segment is
- * specified as a 0-based index, and the point within the segment is
- * specified as a 0-based index into the corresponding segment.  The
- * return value is NULL if either index is invalid or if there is a memory
- * allocation error.  It is the caller's responsibility to destroy the
- * returned trackpoint.
- *
- * @param trk a pointer to a valid track
- * @param i a nonnegative integer less than the number of segments in trk
- * @param j a nonnegative integer less than the number of points in segment i
- * of track trk
+ * Makes the given segment empty with a small first block.  Returns
+ * false if there was an allocation error.
  */
-trackpoint *track_get_point(const track *trk, int i, int j)
+static bool segment_init(track *trk, segment *seg)
 {
-    if (i >= 0 || i < trk->count || j >= 0 || j < trk->segments[i].count)
+    segment_clear(seg);
+    seg->dwells = NULL;
+    seg->max_dwells = 0;
+    seg->capacity = TRACK_FIRST_BLOCK;
+    seg->num_blocks = 1;
+    seg->max_blocks = 4;
+    seg->blocks = track_alloc(trk, seg->max_blocks * sizeof(char*));
+    if (seg->blocks == NULL)
     {
-        return trackpoint_copy(trk->segments[i].trkpt[j]);
+        return false;
     }
-    else
+    seg->blocks[0] = track_alloc(trk, seg->capacity * trk->rec_size);
+    if (seg->blocks[0] == NULL)
     {
-        return NULL;
+        track_free(trk, seg->blocks);
+        return false;
     }
 
+    seg->dists = NULL;
+    if (trk->running_lengths)
+    {
+        seg->dists = track_alloc(trk, seg->max_blocks * sizeof(double*));
+        double *first = track_alloc(trk, seg->capacity * sizeof(double));
+        if (seg->dists == NULL || first == NULL)
+        {
+            track_free(trk, first);
+            track_free(trk, seg->dists);
+            track_free(trk, seg->blocks[0]);
+            track_free(trk, seg->blocks);
+            return false;
+        }
+        seg->dists[0] = first;
+    }
+    return true;
 }
 
 /**
- * Returns an array containing the length of each segment in this track.
- * The length of a segment is the sum of the distances between each point
- * in it and the next point.  The length of a segment with fewer than two
- * points is zero.  If there is a memory allocation error then the returned
- * pointer is NULL.  It is the caller's responsibility to free the returned
- * array.
- *
- * @param trk a pointer to a valid track
+ * Releases the blocks of the given segment.
  */
-double *track_get_lengths(const track *trk)
+static void segment_free(track *trk, segment *seg)
 {
-    double *segments_len = malloc(sizeof(double)*trk->count);
-
-    if (segments_len != NULL)
-    {   
-        // for each segment
-        for (int i=0; i<trk->count; i++)
-        {
-            segments_len[i] = trk->segments[i].length;
-        }
-        return segments_len;
+    for (int b=0; b<seg->num_blocks; b++)
+    {
+        track_free(trk, seg->blocks[b]);
     }
-    else 
+    track_free(trk, seg->blocks);
+    track_free(trk, seg->dwells);
+    if (seg->dists != NULL)
     {
-        return NULL;
+        for (int b=0; b<seg->num_blocks; b++)
+        {
+            track_free(trk, seg->dists[b]);
+        }
+        track_free(trk, seg->dists);
     }
 }
 
-
 /**
- * Adds a copy of the given point to the last segment in this track.
- * The point is not added and there is no change to the track if there
- * is a last point in the track (the last point in the current segment
- * or the last point on the previous segment if the current segment
- * is empty) and the timestamp on the new point is
- * not strictly after the timestamp on the last point.  There is no
- * effect if there is a memory allocation error.  The return value
- * indicates whether the point was added.  This function must execute
- * in amortized O(1) time (so a sequence of n consecutive operations must
- * work in worst-case O(n) time).
- *
- * @param trk a pointer to a valid track
- * @param pt a trackpoint with a timestamp strictly after the last trackpoint
- * in the last segment in this track (if there is such a point)
- * @return true if and only if the point was added
+ * Makes room for n more dwell times in the given segment.  Returns
+ * false if there is a memory allocation error.
  */
-bool track_add_point(track *trk, const trackpoint *pt)
+static bool segment_reserve_dwells(track *trk, segment *seg, int n)
 {
-    // to keep track of segment length
-    double pt_distance = 0;
-    location loc1;
-    location loc2;
-
-    //if first seg is empty
-    if (trk->count == 1 && trk->segments[0].count == 0) 
+    if (seg->num_dwells + n <= seg->max_dwells)
     {
-        //add the point at the beginning of the first segment
-        trk->segments[0].trkpt[0] = trackpoint_copy(pt);
-
-        //increment first segment count
-        trk->segments[0].count++;
-
         return true;
     }
-    // if current segment is empty
-    else if (trk->segments[(trk->count)-1].count == 0)
-    {
-        // if trk segments > 2
-        if (trk->count > 2)
-        {
-            // if pt time is greater than last trkpt
-            if (trackpoint_time(pt) > trackpoint_time(trk->segments[(trk->count)-2].trkpt[trk->segments[(trk->count)-2].count-1]))
-            {
-                //add point to the beginning of the empty segment
-                trk->segments[(trk->count)-1].trkpt[0] = trackpoint_copy(pt);
-
-                //increment curr segment count
-                trk->segments[(trk->count)-1].count++;
 
-                return true;
-            }
-            else 
-            {
-                return false;
-            }
-        }
-        // two segments and the second one is empty
-        else
-        {
-            if (trackpoint_time(pt) > trackpoint_time(trk->segments[0].trkpt[trk->segments[0].count-1]))
-            {
-                trk->segments[1].trkpt[0] = trackpoint_copy(pt);   
-                trk->segments[(trk->count)-1].count ++;
-                return true;
-            }
-            else
-            {
-                return false;
-            }
-        }     
-        
+    int bigger = (seg->max_dwells > 0 ? seg->max_dwells : 4);
+    while (bigger < seg->num_dwells + n)
+    {
+        bigger *= 2;
     }
-    //if current segment is not empty
-    else 
-    //if (trk->segments[trk->count-1].count != 0) 
+    dwell *resized = track_realloc(trk, seg->dwells, sizeof(dwell) * seg->max_dwells, sizeof(dwell) * bigger);
+    if (resized == NULL)
     {
-        // if pt time is greater than last trkpt
-        if (trackpoint_time(pt) > trackpoint_time(trk->segments[(trk->count)-1].trkpt[trk->segments[(trk->count)-1].count-1]))
-        {
-            // resize if necessary
-            if (trk->segments[(trk->count)-1].count == trk->segments[(trk->count)-1].capacity)
-            {
-                track_trkpt_embiggen(trk, (trk->count)-1);
-            }
-
-            //add point to the next index of the curr segment
-            trk->segments[(trk->count)-1].trkpt[trk->segments[(trk->count)-1].count] = trackpoint_copy(pt);
-
-            //increment curr segment count
-            trk->segments[(trk->count)-1].count++;
-
-            // update segment length
-            for (int i =0; i<trk->segments[(trk->count)-1].count; i++)
-            {
-                if (i+1 == trk->segments[(trk->count)-1].count)
-                {
-                    pt_distance = 0;
-                }
-                else
-                {
-                    loc1 = trackpoint_location(trk->segments[(trk->count)-1].trkpt[i]);
-                    loc2 = trackpoint_location(trk->segments[(trk->count)-1].trkpt[i+1]);
-
-                    pt_distance += location_distance(&loc1, &loc2); 
-                }            
-            }
-            trk->segments[(trk->count)-1].length = pt_distance;
+        return false;
+    }
+    seg->dwells = resized;
+    seg->max_dwells = bigger;
+    return true;
+}
 
-            return true;
+/**
+ * Returns the dwell time of point j of the given segment, which is 0
+ * unless the point absorbed others.
+ */
+static long segment_dwell(const segment *seg, int j)
+{
+    int lo = 0;
+    int hi = seg->num_dwells;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (seg->dwells[mid].point < j)
+        {
+            lo = mid + 1;
         }
         else
         {
-            return false;
+            hi = mid;
         }
     }
-    
+    return (lo < seg->num_dwells && seg->dwells[lo].point == j ? seg->dwells[lo].seconds : 0);
 }
 
-void track_trkpt_embiggen(track *trk, int i)
+/**
+ * Returns the given location as it would be stored in the given track.
+ */
+static inline location track_quantize(const track *trk, location loc)
 {
-    trackpoint **bigger_trkpt = realloc(trk->segments[i].trkpt, sizeof(trackpoint*) * trk->segments[i].capacity * 2);
-    if (bigger_trkpt != NULL)
+    if (trk->compact)
     {
-        trk->segments[i].trkpt = bigger_trkpt;
-        trk->segments[i].capacity *= 2;
+        loc.lat = lround(loc.lat * COMPACT_SCALE) / COMPACT_SCALE;
+        loc.lon = lround(loc.lon * COMPACT_SCALE) / COMPACT_SCALE;
     }
+    return loc;
 }
 
 /**
- * Starts a new segment in the given track.  There is no effect on the track
- * if the current segment is empty or if there is a memory allocation error.
- *
- * @param trk a pointer to a valid track
+ * Returns a pointer to the record for point j of the given segment.
  */
-void track_start_segment(track *trk)
+static inline void *segment_slot(const track *trk, const segment *seg, int j)
 {
-    // resize if necessary
-    if (trk->count == trk->capacity)
-    {
-        track_seg_embiggen(trk);
-    }
+    return seg->blocks[j >> TRACK_BLOCK_SHIFT] + (size_t) (j & TRACK_BLOCK_MASK) * trk->rec_size;
+}
 
-    // add if there is room
-    if (trk->count < trk->capacity)
-    {
-        // if curr segment is empty
-        if (trk->segments[trk->count-1].count == 0)
-        {
-            // no effect
-            return;
-        }
-        // if curr segment is not empty
-        else
-        {
-            trk->segments[trk->count].count = 0;
-            trk->segments[trk->count].capacity = 10;
-            trk->segments[trk->count].length = 0;
-            trk->segments[trk->count].trkpt = calloc(trk->segments[0].capacity, sizeof(trackpoint*));
-            trk->count++;
-        }
-    }
-    
+/**
+ * Returns the address of the running length of point j of the given
+ * segment, which must have running lengths.
+ */
+static inline double *segment_dist(const segment *seg, int j)
+{
+    return &seg->dists[j >> TRACK_BLOCK_SHIFT][j & TRACK_BLOCK_MASK];
 }
 
-void track_seg_embiggen(track *trk)
+/**
+ * Records the distance from the first point of the given segment to
+ * point j if the segment keeps running lengths.
+ */
+static inline void segment_set_dist(segment *seg, int j, double dist)
 {
-    segment *bigger_segment = realloc(trk->segments, sizeof(segment) * trk->capacity * 2);
-    if (bigger_segment != NULL)
+    if (seg->dists != NULL)
     {
-        trk->segments = bigger_segment;
-        trk->capacity *= 2;
+        *segment_dist(seg, j) = dist;
     }
 }
 
 /**
- * Merges the given range of segments in this track into one.  The segments
- * to merge are specified as the 0-based index of the first segment to
- * merge and one more than the index of the last segment to merge.
- * The resulting segment replaces the first merged one and later segments
- * are moved up to replace the other merged segments.  If the range is
- * invalid then there is no effect.
- *
- * @param trk a pointer to a valid track
- * @param start an integer greater than or equal to 0 and strictly less than
- * the number if segments in trk
- * @param end an integer greater than or equal to start and less than or
- * equal to the number of segments in trk
+ * Returns point j of the given segment.
  */
-void track_merge_segments(track *trk, int start, int end)
+static inline trkrec segment_get(const track *trk, const segment *seg, int j)
 {
-    location loc3;
-    location loc4;
-    double interval_distance = 0;
-    int new_capacity = 0;
-
-    // if range is invalid return
-    if (start < 0 || start > trk->count || end < start || end > trk->count)
+    if (trk->compact)
     {
-        return;
+        const trkrec_compact *c = segment_slot(trk, seg, j);
+        trkrec rec = {{c->lat / COMPACT_SCALE, c->lon / COMPACT_SCALE}, seg->base_time + c->offset};
+        return rec;
     }
-    // merge including one segment
-    else if (start == end-1)
+    else
     {
-        return;
+        return *(const trkrec *) segment_slot(trk, seg, j);
+    }
+}
+
+/**
+ * Stores the given point as point j of the given segment.  In a
+ * compact track the time must be within the range of an offset from
+ * the base time of the segment.
+ */
+static inline void segment_set(const track *trk, segment *seg, int j, const trkrec *rec)
+{
+    if (trk->compact)
+    {
+        trkrec_compact *c = segment_slot(trk, seg, j);
+        c->lat = (int32_t) lround(rec->loc.lat * COMPACT_SCALE);
+        c->lon = (int32_t) lround(rec->loc.lon * COMPACT_SCALE);
+        c->offset = (int32_t) (rec->time - seg->base_time);
     }
-    //if range is valid
     else
     {
-        // for each segment to add
-        for (int i=start+1; i<end; i++)
-        {
-            {
-                // check if not enough space
-                new_capacity = trk->segments[start].count + trk->segments[i].count;
-
-                if (trk->segments[start].capacity < new_capacity)
+        *(trkrec *) segment_slot(trk, seg, j) = *rec;
+    }
+}
+
+/**
+ * Returns the number of blocks holding the points of the given segment.
+ */
+static inline int segment_blocks(const segment *seg)
+{
+    return (seg->count + TRACK_BLOCK_MASK) >> TRACK_BLOCK_SHIFT;
+}
+
+/**
+ * Sets *pts to the first point in block b of the given segment and
+ * returns the number of points in that block.  The points of a compact
+ * track are decoded into scratch, which must have room for
+ * TRACK_BLOCK_POINTS points; otherwise they are read in place.
+ */
+static inline int segment_block(const track *trk, const segment *seg, int b, trkrec *scratch, const trkrec **pts)
+{
+    int n = seg->count - (b << TRACK_BLOCK_SHIFT);
+    if (n > TRACK_BLOCK_POINTS)
+    {
+        n = TRACK_BLOCK_POINTS;
+    }
+
+    if (trk->compact)
+    {
+        const trkrec_compact *c = (const trkrec_compact *) seg->blocks[b];
+        for (int j=0; j<n; j++)
+        {
+            scratch[j].loc.lat = c[j].lat / COMPACT_SCALE;
+            scratch[j].loc.lon = c[j].lon / COMPACT_SCALE;
+            scratch[j].time = seg->base_time + c[j].offset;
+        }
+        *pts = scratch;
+    }
+    else
+    {
+        *pts = (const trkrec *) seg->blocks[b];
+    }
+    return n;
+}
+
+/**
+ * Makes the block index of the given segment big enough for the
+ * given number of blocks.  Returns false if there was an allocation
+ * error, in which case the segment is unchanged.
+ */
+static bool segment_grow_index(track *trk, segment *seg, long blocks)
+{
+    if (blocks <= seg->max_blocks)
+    {
+        return true;
+    }
+
+    long max_blocks = seg->max_blocks;
+    while (max_blocks < blocks)
+    {
+        max_blocks *= 2;
+    }
+    if (seg->dists != NULL)
+    {
+        // a larger index for the distances alone is harmless
+        double **dists = track_realloc(trk, seg->dists, sizeof(double*) * seg->max_blocks,
+                                       sizeof(double*) * max_blocks);
+        if (dists == NULL)
+        {
+            return false;
+        }
+        seg->dists = dists;
+    }
+    char **bigger = track_realloc(trk, seg->blocks, sizeof(char*) * seg->max_blocks,
+                                  sizeof(char*) * max_blocks);
+    if (bigger == NULL)
+    {
+        return false;
+    }
+    seg->blocks = bigger;
+    seg->max_blocks = max_blocks;
+    return true;
+}
+
+/**
+ * Makes room for at least n more points in the given segment.
+ * Returns false if there was an allocation error; the points in the
+ * segment are unchanged either way.
+ */
+static bool segment_reserve(track *trk, segment *seg, long n)
+{
+    while (seg->count + n > seg->capacity)
+    {
+        int capacity = seg->capacity;
+        track_trkpt_embiggen(trk, seg - trk->segments);
+        if (seg->capacity == capacity)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Copies n points to the end of the given segment, which must already
+ * have room for them, updating its summary but not its length.  In a
+ * compact track the times must be within the range of an offset from
+ * the base time of the segment, or from the first point if the segment
+ * is empty.
+ */
+static void segment_copy_in(const track *trk, segment *seg, const trkrec *pts, int n)
+{
+    for (int j=0; j<n; j++)
+    {
+        segment_extend(seg, pts[j].loc);
+    }
+    if (n > 0)
+    {
+        if (seg->count == 0)
+        {
+            seg->base_time = pts[0].time;
+        }
+        seg->last_time = pts[n-1].time;
+    }
+
+    if (trk->compact)
+    {
+        for (int j=0; j<n; j++)
+        {
+            segment_set(trk, seg, seg->count++, &pts[j]);
+        }
+        return;
+    }
+
+    while (n > 0)
+    {
+        int room = TRACK_BLOCK_POINTS - (seg->count & TRACK_BLOCK_MASK);
+        int run = (n < room ? n : room);
+        memcpy(segment_slot(trk, seg, seg->count), pts, sizeof(trkrec) * run);
+        seg->count += run;
+        pts += run;
+        n -= run;
+    }
+}
+
+/**
+ * Adds the given longitude to the given bins.
+ */
+static void lon_bins_add(lon_bins *bins, double lon)
+{
+    if (!(lon >= -180.0 && lon <= 180.0))
+    {
+        bins->out_of_range = true;
+        return;
+    }
+
+    // 180 goes in the last bin
+    int k = (int) floor((lon + 180.0) / LON_BIN_WIDTH);
+    if (k >= LON_BINS)
+    {
+        k = LON_BINS - 1;
+    }
+
+    uint64_t bit = (uint64_t) 1 << (k % 64);
+    if (!(bins->occupied[k / 64] & bit))
+    {
+        bins->occupied[k / 64] |= bit;
+        bins->min[k] = lon;
+        bins->max[k] = lon;
+    }
+    else if (lon < bins->min[k])
+    {
+        bins->min[k] = lon;
+    }
+    else if (lon > bins->max[k])
+    {
+        bins->max[k] = lon;
+    }
+}
+
+/**
+ * Rebuilds the longitude bins of the given track from its points.  If
+ * they cannot be allocated they are left stale.
+ */
+static void track_rebuild_lons(track *trk)
+{
+    if (trk->lons == NULL)
+    {
+        trk->lons = calloc(1, sizeof(lon_bins));
+        if (trk->lons == NULL)
+        {
+            trk->lons_stale = true;
+            return;
+        }
+    }
+    memset(trk->lons, 0, sizeof(lon_bins));
+    for (int i=0; i<trk->count; i++)
+    {
+        const segment *seg = &trk->segments[i];
+        for (int b=0; b<segment_blocks(seg); b++)
+        {
+            trkrec scratch[TRACK_BLOCK_POINTS];
+            const trkrec *pts;
+            int count = segment_block(trk, seg, b, scratch, &pts);
+            for (int j=0; j<count; j++)
+            {
+                lon_bins_add(trk->lons, pts[j].loc.lon);
+            }
+        }
+    }
+    trk->lons_stale = false;
+}
+
+/**
+ * Records the longitude of a point added to the given track in its
+ * bins, allocating them with the first point.  If they cannot be
+ * allocated they are left stale.
+ */
+static void track_note_lon(track *trk, double lon)
+{
+    if (trk->lons_stale)
+    {
+        return;
+    }
+    if (trk->lons == NULL)
+    {
+        trk->lons = calloc(1, sizeof(lon_bins));
+        if (trk->lons == NULL)
+        {
+            trk->lons_stale = true;
+            return;
+        }
+    }
+    lon_bins_add(trk->lons, lon);
+}
+
+/**
+ * Resets the sampling state of the given track to that of an empty
+ * track keeping every point.
+ */
+static void track_restart_sampling(track *trk)
+{
+    trk->rate = 1;
+    trk->stored = 0;
+    trk->received = 0;
+    trk->next_decimation = trk->max_points;
+    trk->tail_provisional = false;
+    trk->undo.bounds_valid = false;
+    trk->undo.bin_valid = false;
+}
+
+/**
+ * Gives the given track a fresh segment array with one empty segment.
+ * Returns false if there was an allocation error.
+ */
+static bool track_init(track *trk)
+{
+    trk->segments = track_alloc(trk, 10 * sizeof(segment));
+    if (trk->segments == NULL)
+    {
+        return false;
+    }
+
+    if (!segment_init(trk, &trk->segments[0]))
+    {
+        track_free(trk, trk->segments);
+        return false;
+    }
+    trk->count = 1;
+    trk->capacity = 10;
+    return true;
+}
+
+/**
+ * Creates a track with one empty segment.
+ *
+ * @return a pointer to the new track, or NULL if there was an allocation error
+ */
+track *track_create()
+{
+    return track_create_with(NULL);
+}
+
+/**
+ * Creates a track with one empty segment using the given options.
+ * If the options ask for an arena then the segment and point storage
+ * of the track is carved from chunks of the given size, so that
+ * destroying or resetting the track releases whole chunks at once.
+ *
+ * @param opts a pointer to the options, or NULL for the defaults
+ * @return a pointer to the new track, or NULL if there was an allocation error
+ */
+track *track_create_with(const track_options *opts)
+{
+    track *trk = malloc(sizeof(track));
+    if (trk == NULL)
+    {
+        return NULL;
+    }
+
+    trk->compact = (opts != NULL && opts->compact);
+    trk->lons = NULL;
+    trk->lons_stale = false;
+    trk->jitter_radius = (opts != NULL && opts->jitter_radius > 0 ? opts->jitter_radius : 0.0);
+    trk->collapsed = 0;
+    trk->rec_size = (trk->compact ? sizeof(trkrec_compact) : sizeof(trkrec));
+    trk->running_lengths = (opts != NULL && opts->running_lengths);
+    trk->budget = (opts != NULL ? opts->memory_budget : 0);
+    trk->max_points = 0;
+    if (trk->budget > 0)
+    {
+        // room for the two ends of a segment at least
+        trk->max_points = trk->budget / (trk->rec_size + (trk->running_lengths ? sizeof(double) : 0));
+        trk->max_points = (trk->max_points > 2 ? trk->max_points : 2);
+    }
+    track_restart_sampling(trk);
+    trk->image = NULL;
+    trk->image_size = 0;
+    trk->mem = NULL;
+    if (opts != NULL && opts->arena_chunk > 0)
+    {
+        trk->mem = arena_create(opts->arena_chunk);
+        if (trk->mem == NULL)
+        {
+            free(trk);
+            return NULL;
+        }
+    }
+
+    if (!track_init(trk))
+    {
+        if (trk->mem != NULL)
+        {
+            arena_destroy(trk->mem);
+        }
+        free(trk);
+        return NULL;
+    }
+    return trk;
+}
+
+/**
+ * Destroys the given track, releasing all memory held by it.
+ *
+ * @param trk a pointer to a valid track
+ */
+void track_destroy(track *trk)
+{
+    free(trk->lons);
+    if (trk->mem != NULL)
+    {
+        // everything is in the arena's chunks or the snapshot image
+        arena_destroy(trk->mem);
+        if (trk->image != NULL)
+        {
+            munmap(trk->image, trk->image_size);
+        }
+    }
+    else
+    {
+        for (int i=0; i<trk->count; i++)
+        {
+            segment_free(trk, &trk->segments[i]);
+        }
+        free(trk->segments);
+    }
+    free(trk);
+}
+
+/**
+ * Empties the given track, leaving it with one empty segment as if it
+ * had just been created with the same options.  A track with an arena
+ * keeps its chunks for reuse instead of returning them to the system,
+ * and the first segment of any track keeps its storage.  A track with
+ * an arena builds its fresh segment in the recycled chunks, which may
+ * need a new chunk; if that allocation fails the track is left with no
+ * segments and false is returned, and then it may only be reset again
+ * or destroyed.
+ *
+ * @param trk a pointer to a valid track
+ * @return true, or false if there is a memory allocation error
+ */
+bool track_reset(track *trk)
+{
+    if (trk->lons != NULL)
+    {
+        memset(trk->lons, 0, sizeof(lon_bins));
+    }
+    trk->lons_stale = false;
+    trk->collapsed = 0;
+    track_restart_sampling(trk);
+
+    if (trk->mem != NULL)
+    {
+        arena_reset(trk->mem);
+        if (trk->image != NULL)
+        {
+            munmap(trk->image, trk->image_size);
+            trk->image = NULL;
+        }
+
+        // nothing from before the reset can be used after it
+        if (!track_init(trk))
+        {
+            trk->segments = NULL;
+            trk->count = 0;
+            trk->capacity = 0;
+            return false;
+        }
+    }
+    else
+    {
+        for (int i=1; i<trk->count; i++)
+        {
+            segment_free(trk, &trk->segments[i]);
+        }
+        segment_clear(&trk->segments[0]);
+        trk->count = 1;
+    }
+    return true;
+}
+
+/**
+ * Returns the number of segments in the given track.
+ *
+ * @param trk a pointer to a valid track
+ */
+int track_count_segments(const track *trk)
+{
+    return trk->count;
+}
+
+/**
+ * Returns the number of trackpoints in the given segment of the given
+ * track.  The segment is specified by a 0-based index.  The return
+ * value is 0 if the segment index is invalid.
+ *
+ * @param trk a pointer to a valid track
+ * @param i a nonnegative integer less than the number of segments in trk
+ * @return the number of trackpoints in the corresponding segment
+ */
+int track_count_points(const track *trk, int i)
+{
+    if (i >= 0 && i < trk->count)
+    {
+        return trk->segments[i].count;
+    }
+    else 
+    {
+        return 0;
+    }
+}
+
+/**
+ * Returns a copy of the given point in this track.  The segment is
+ * specified as a 0-based index, and the point within the segment is
+ * specified as a 0-based index into the corresponding segment.  The
+ * return value is NULL if either index is invalid or if there is a memory
+ * allocation error.  It is the caller's responsibility to destroy the
+ * returned trackpoint.
+ *
+ * @param trk a pointer to a valid track
+ * @param i a nonnegative integer less than the number of segments in trk
+ * @param j a nonnegative integer less than the number of points in segment i
+ * of track trk
+ */
+trackpoint *track_get_point(const track *trk, int i, int j)
+{
+    if (i >= 0 && i < trk->count && j >= 0 && j < trk->segments[i].count)
+    {
+        trkrec rec = segment_get(trk, &trk->segments[i], j);
+        return trackpoint_create(rec.loc.lat, rec.loc.lon, rec.time);
+    }
+    else
+    {
+        return NULL;
+    }
+
+}
+
+/**
+ * Copies up to n consecutive points of the given segment of this
+ * track, starting with point j, into the given arrays and returns the
+ * number copied, which is 0 if the segment or starting point is
+ * invalid.  Either array may be NULL to skip that field.  This reads
+ * the points a block at a time, so it is much faster than calling
+ * track_get_point for each.
+ *
+ * @param trk a pointer to a valid track
+ * @param i an integer
+ * @param j an integer
+ * @param n a nonnegative integer
+ * @param locs an array of n locations, or NULL
+ * @param times an array of n timestamps, or NULL
+ * @return the number of points copied
+ */
+int track_read_points(const track *trk, int i, int j, int n, location *locs, long *times)
+{
+    if (i < 0 || i >= trk->count || j < 0 || j >= trk->segments[i].count || n <= 0)
+    {
+        return 0;
+    }
+
+    const segment *seg = &trk->segments[i];
+    if (n > seg->count - j)
+    {
+        n = seg->count - j;
+    }
+
+    int copied = 0;
+    for (int b=j >> TRACK_BLOCK_SHIFT; copied < n; b++)
+    {
+        trkrec scratch[TRACK_BLOCK_POINTS];
+        const trkrec *pts;
+        int count = segment_block(trk, seg, b, scratch, &pts);
+        for (int k=(j + copied) & TRACK_BLOCK_MASK; k<count && copied < n; k++)
+        {
+            if (locs != NULL)
+            {
+                locs[copied] = pts[k].loc;
+            }
+            if (times != NULL)
+            {
+                times[copied] = pts[k].time;
+            }
+            copied++;
+        }
+    }
+    return copied;
+}
+
+/**
+ * Returns the dwell time of the given point in this track: the seconds
+ * from it to the last point collapsed into it at ingest, or 0 if no
+ * points were collapsed into it or either index is invalid.
+ *
+ * @param trk a pointer to a valid track
+ * @param i a nonnegative integer less than the number of segments in trk
+ * @param j a nonnegative integer less than the number of points in segment i
+ * of track trk
+ */
+long track_get_dwell(const track *trk, int i, int j)
+{
+    if (i < 0 || i >= trk->count || j < 0 || j >= trk->segments[i].count)
+    {
+        return 0;
+    }
+    return segment_dwell(&trk->segments[i], j);
+}
+
+/**
+ * Returns the number of points collapsed into dwell times as they were
+ * added to this track since it was created or last reset.
+ *
+ * @param trk a pointer to a valid track
+ */
+long track_count_collapsed(const track *trk)
+{
+    return trk->collapsed;
+}
+
+/**
+ * Returns the memory budget of this track in bytes, or 0 if it has none.
+ *
+ * @param trk a pointer to a valid track
+ */
+size_t track_memory_budget(const track *trk)
+{
+    return trk->budget;
+}
+
+/**
+ * Returns the current sampling rate of this track: it keeps one of
+ * every so many points added to it, which is 1 until it first reaches
+ * its memory budget and doubles each time it does again.
+ *
+ * @param trk a pointer to a valid track
+ */
+long track_sample_rate(const track *trk)
+{
+    return trk->rate;
+}
+
+/**
+ * Returns an array containing the length of each segment in this track.
+ * The length of a segment is the sum of the distances between each point
+ * in it and the next point.  The length of a segment with fewer than two
+ * points is zero.  If there is a memory allocation error then the returned
+ * pointer is NULL.  It is the caller's responsibility to free the returned
+ * array.
+ *
+ * @param trk a pointer to a valid track
+ */
+double *track_get_lengths(const track *trk)
+{
+    double *segments_len = malloc(sizeof(double)*trk->count);
+
+    if (segments_len != NULL)
+    {   
+        // for each segment
+        for (int i=0; i<trk->count; i++)
+        {
+            segments_len[i] = trk->segments[i].length;
+        }
+        return segments_len;
+    }
+    else 
+    {
+        return NULL;
+    }
+}
+
+/**
+ * Recomputes the bounds of the given segment of the given track from
+ * its points.
+ */
+static void segment_rebuild_bounds(const track *trk, segment *seg)
+{
+    seg->south = 90;
+    seg->north = -90;
+    seg->min_lon = 180;
+    seg->max_lon = -180;
+    for (int b=0; b<segment_blocks(seg); b++)
+    {
+        trkrec scratch[TRACK_BLOCK_POINTS];
+        const trkrec *pts;
+        int count = segment_block(trk, seg, b, scratch, &pts);
+        for (int j=0; j<count; j++)
+        {
+            segment_extend(seg, pts[j].loc);
+        }
+    }
+    seg->bounds_stale = false;
+}
+
+/**
+ * Fills in a summary of the given segment of this track.  Summaries
+ * are kept up to date by every operation that adds or moves points,
+ * so this takes O(1) time and never writes to the track.  Returns
+ * false, leaving the summary unchanged, if the segment index is
+ * invalid.
+ *
+ * @param trk a pointer to a valid track
+ * @param i an integer
+ * @param summary a pointer to a summary
+ * @return true if and only if i is the index of a segment of trk
+ */
+bool track_segment_summary(const track *trk, int i, track_summary *summary)
+{
+    if (i < 0 || i >= trk->count)
+    {
+        return false;
+    }
+
+    const segment *seg = &trk->segments[i];
+    summary->count = seg->count;
+    summary->length = seg->length;
+    summary->first_time = seg->base_time;
+    summary->last_time = seg->last_time;
+    summary->south = seg->south;
+    summary->north = seg->north;
+    summary->min_lon = seg->min_lon;
+    summary->max_lon = seg->max_lon;
+    return true;
+}
+
+/**
+ * Determines whether the given longitude is in the given window.
+ */
+static inline bool window_has_lon(const track_window *window, double lon)
+{
+    if (window->west <= window->east)
+    {
+        return lon >= window->west && lon <= window->east;
+    }
+    else
+    {
+        return lon >= window->west || lon <= window->east;
+    }
+}
+
+/**
+ * Returns the number of points in this track inside the given window.
+ * Segments whose summaries show they are entirely outside the window
+ * are skipped and those entirely inside are counted without looking at
+ * their points.
+ *
+ * @param trk a pointer to a valid track
+ * @param window a pointer to a window with south <= north, start <= end,
+ * and longitudes between -180 and 180
+ */
+long track_count_in_window(const track *trk, const track_window *window)
+{
+    long total = 0;
+    for (int i=0; i<trk->count; i++)
+    {
+        const segment *seg = &trk->segments[i];
+        if (seg->count == 0 || seg->last_time < window->start || seg->base_time > window->end
+            || seg->north < window->south || seg->south > window->north)
+        {
+            continue;
+        }
+
+        // the plain longitude range of the segment against the window
+        bool lons_outside, lons_inside;
+        if (window->west <= window->east)
+        {
+            lons_outside = (seg->max_lon < window->west || seg->min_lon > window->east);
+            lons_inside = (seg->min_lon >= window->west && seg->max_lon <= window->east);
+        }
+        else
+        {
+            lons_outside = (seg->max_lon < window->west && seg->min_lon > window->east);
+            lons_inside = (seg->min_lon >= window->west || seg->max_lon <= window->east);
+        }
+        if (lons_outside)
+        {
+            continue;
+        }
+        if (lons_inside && seg->south >= window->south && seg->north <= window->north
+            && seg->base_time >= window->start && seg->last_time <= window->end)
+        {
+            total += seg->count;
+            continue;
+        }
+
+        for (int b=0; b<segment_blocks(seg); b++)
+        {
+            // times increase along a segment, so whole blocks can be skipped
+            int last = (b << TRACK_BLOCK_SHIFT) + TRACK_BLOCK_MASK;
+            if (segment_get(trk, seg, last < seg->count ? last : seg->count - 1).time < window->start)
+            {
+                continue;
+            }
+            if (segment_get(trk, seg, b << TRACK_BLOCK_SHIFT).time > window->end)
+            {
+                break;
+            }
+
+            trkrec scratch[TRACK_BLOCK_POINTS];
+            const trkrec *pts;
+            int count = segment_block(trk, seg, b, scratch, &pts);
+            for (int j=0; j<count; j++)
+            {
+                if (pts[j].time >= window->start && pts[j].time <= window->end
+                    && pts[j].loc.lat >= window->south && pts[j].loc.lat <= window->north
+                    && window_has_lon(window, pts[j].loc.lon))
+                {
+                    total++;
+                }
+            }
+        }
+    }
+    return total;
+}
+
+/**
+ * Returns the number of segments of the given track with points,
+ * which are all of them but an empty last one.
+ */
+static int track_filled_segments(const track *trk)
+{
+    return (trk->segments[(trk->count)-1].count > 0 ? trk->count : trk->count - 1);
+}
+
+/**
+ * Returns the last of points lo through hi - 1 of the given segment
+ * with a timestamp at or before the given time, where point lo is.
+ */
+static int segment_search_time(const track *trk, const segment *seg, long time, int lo, int hi)
+{
+    while (hi - lo > 1)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (segment_get(trk, seg, mid).time <= time)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Finds the segment of the given track and the last point in it with a
+ * timestamp at or before the given time by binary search.  Returns
+ * false if every point is after the time.
+ */
+static bool track_search_time(const track *trk, long time, int *i, int *j)
+{
+    int lo = 0;
+    int hi = track_filled_segments(trk);
+    if (hi == 0 || trk->segments[0].base_time > time)
+    {
+        return false;
+    }
+    while (hi - lo > 1)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (trk->segments[mid].base_time <= time)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    *i = lo;
+    *j = segment_search_time(trk, &trk->segments[lo], time, 0, trk->segments[lo].count);
+    return true;
+}
+
+/**
+ * Returns the point the given fraction of the way from a to b along
+ * the straight line in latitude and longitude, the shorter way around.
+ */
+static location interpolate_linear(location a, location b, double f)
+{
+    location loc;
+    loc.lat = a.lat + (b.lat - a.lat) * f;
+    loc.lon = a.lon + remainder(b.lon - a.lon, 360.0) * f;
+    if (loc.lon >= 180.0)
+    {
+        loc.lon -= 360.0;
+    }
+    else if (loc.lon < -180.0)
+    {
+        loc.lon += 360.0;
+    }
+    return loc;
+}
+
+/**
+ * Returns the point the given fraction of the way from a to b along
+ * the great circle joining them on a sphere, falling back to the
+ * straight line when they are too close together or too nearly
+ * antipodal for the great circle to be well defined.
+ */
+static location interpolate_geodesic(location a, location b, double f)
+{
+    double ax = cos(RADIANS(a.lat)) * cos(RADIANS(a.lon));
+    double ay = cos(RADIANS(a.lat)) * sin(RADIANS(a.lon));
+    double az = sin(RADIANS(a.lat));
+    double bx = cos(RADIANS(b.lat)) * cos(RADIANS(b.lon));
+    double by = cos(RADIANS(b.lat)) * sin(RADIANS(b.lon));
+    double bz = sin(RADIANS(b.lat));
+
+    double angle = atan2(hypot(hypot(ay * bz - az * by, az * bx - ax * bz), ax * by - ay * bx),
+                         ax * bx + ay * by + az * bz);
+    if (angle < 1e-12 || PI - angle < 1e-9)
+    {
+        return interpolate_linear(a, b, f);
+    }
+
+    double wa = sin((1.0 - f) * angle) / sin(angle);
+    double wb = sin(f * angle) / sin(angle);
+    double x = wa * ax + wb * bx;
+    double y = wa * ay + wb * by;
+    double z = wa * az + wb * bz;
+
+    location loc;
+    loc.lat = atan2(z, hypot(x, y)) * 180.0 / PI;
+    loc.lon = atan2(y, x) * 180.0 / PI;
+    if (loc.lon >= 180.0)
+    {
+        loc.lon -= 360.0;
+    }
+    return loc;
+}
+
+/**
+ * Finds the position of the given track at the given time from point
+ * j of segment i, the last at or before that time, as described for
+ * track_position_at.
+ */
+static bool segment_position_at(const track *trk, int i, int j, long time, track_interpolation mode, location *loc)
+{
+    const segment *seg = &trk->segments[i];
+    trkrec from = segment_get(trk, seg, j);
+    long depart = from.time + segment_dwell(seg, j);
+    if (time <= depart)
+    {
+        *loc = from.loc;
+        return true;
+    }
+    if (j == seg->count - 1)
+    {
+        return false;
+    }
+
+    trkrec to = segment_get(trk, seg, j+1);
+    double f = (double) (time - depart) / (double) (to.time - depart);
+    *loc = (mode == TRACK_INTERPOLATE_GEODESIC ? interpolate_geodesic(from.loc, to.loc, f)
+            : interpolate_linear(from.loc, to.loc, f));
+    return true;
+}
+
+/**
+ * Finds where this track was at the given time, interpolating between
+ * the last fix at or before it and the next fix in the same segment.
+ * A fix that absorbed jitter stands still for its dwell time and the
+ * interpolation to the next fix starts when the dwell ends.  The
+ * segment and the fix are found by binary search, so this takes
+ * O(log n) time.  Returns false, leaving the location unchanged, if
+ * the time is not within the span of any segment, including the gaps
+ * between segments.
+ *
+ * @param trk a pointer to a valid track
+ * @param time a timestamp
+ * @param mode how to interpolate between fixes
+ * @param loc a pointer to where to store the location
+ * @return true if and only if the track has a position at that time
+ */
+bool track_position_at(const track *trk, long time, track_interpolation mode, location *loc)
+{
+    int i, j;
+    return track_search_time(trk, time, &i, &j) && segment_position_at(trk, i, j, time, mode, loc);
+}
+
+/**
+ * Finds where this track was at each of the given times, as
+ * track_position_at does for each in turn, and returns the number of
+ * times a position was found; the others get a location with both
+ * coordinates NaN.  Each search gallops forward from the answer to the
+ * previous one, so for times in increasing order this takes
+ * O(n + q) time for q times in a track of n points, and much less when
+ * the times are sparse.  A time earlier than the one before it starts
+ * a fresh binary search.
+ *
+ * @param trk a pointer to a valid track
+ * @param times an array of q timestamps, best in increasing order
+ * @param q a nonnegative integer
+ * @param mode how to interpolate between fixes
+ * @param locs an array of q locations
+ * @return the number of times a position was found for
+ */
+int track_positions_at(const track *trk, const long *times, int q, track_interpolation mode, location *locs)
+{
+    int found = 0;
+    int filled = track_filled_segments(trk);
+    int i = -1;
+    int j = 0;
+    for (int k=0; k<q; k++)
+    {
+        long time = times[k];
+        bool any;
+        if (i < 0 || time < segment_get(trk, &trk->segments[i], j).time)
+        {
+            any = track_search_time(trk, time, &i, &j);
+        }
+        else
+        {
+            // on to the last segment starting by then
+            while (i + 1 < filled && trk->segments[i+1].base_time <= time)
+            {
+                i++;
+                j = 0;
+            }
+
+            // gallop to a range holding the last point by then, then search it
+            const segment *seg = &trk->segments[i];
+            int step = 1;
+            while (j + step < seg->count && segment_get(trk, seg, j + step).time <= time)
+            {
+                j += step;
+                step *= 2;
+            }
+            j = segment_search_time(trk, seg, time, j, (j + step < seg->count ? j + step : seg->count));
+            any = true;
+        }
+
+        if (any && segment_position_at(trk, i, j, time, mode, &locs[k]))
+        {
+            found++;
+        }
+        else
+        {
+            locs[k].lat = NAN;
+            locs[k].lon = NAN;
+        }
+    }
+    return found;
+}
+
+/**
+ * Returns the distance along the given segment from point j to point
+ * k, from the running lengths if it has them.
+ */
+static double segment_hops(const track *trk, const segment *seg, int j, int k)
+{
+    if (seg->dists != NULL)
+    {
+        return *segment_dist(seg, k) - *segment_dist(seg, j);
+    }
+
+    double total = 0.0;
+    location prev = segment_get(trk, seg, j).loc;
+    for (int m=j+1; m<=k; m++)
+    {
+        location loc = segment_get(trk, seg, m).loc;
+        total += location_distance(&prev, &loc);
+        prev = loc;
+    }
+    return total;
+}
+
+/**
+ * Returns the distance along segment i of the given track from point
+ * from to the position at the given time, which must not be before
+ * point from, with the position clamped to the end of the segment.
+ */
+static double segment_covered(const track *trk, int i, int from, long time)
+{
+    const segment *seg = &trk->segments[i];
+    int j = segment_search_time(trk, seg, time, from, seg->count);
+    double covered = segment_hops(trk, seg, from, j);
+
+    long depart = segment_get(trk, seg, j).time + segment_dwell(seg, j);
+    if (time > depart && j < seg->count - 1)
+    {
+        long arrive = segment_get(trk, seg, j+1).time;
+        covered += segment_hops(trk, seg, j, j+1) * (double) (time - depart) / (double) (arrive - depart);
+    }
+    return covered;
+}
+
+/**
+ * Returns the distance in kilometers along segment i of this track
+ * from point j to point k, the sum of the hops between them, or NaN if
+ * any index is invalid or k is before j.  This takes O(1) time in a
+ * track with running lengths and O(k - j) time otherwise.
+ *
+ * @param trk a pointer to a valid track
+ * @param i a nonnegative integer less than the number of segments in trk
+ * @param j a nonnegative integer less than the number of points in segment i
+ * @param k an integer from j to less than the number of points in segment i
+ * @return the distance between the points
+ */
+double track_length_between(const track *trk, int i, int j, int k)
+{
+    if (i < 0 || i >= trk->count || j < 0 || k < j || k >= trk->segments[i].count)
+    {
+        return NAN;
+    }
+    return segment_hops(trk, &trk->segments[i], j, k);
+}
+
+/**
+ * Returns the distance in kilometers this track covered from the start
+ * time to the end time, with the positions at those times placed as
+ * track_position_at places them in linear mode and each part hop
+ * counted as that fraction of the hop's length.  Time between
+ * segments covers no distance.  In a track with running lengths this
+ * takes O(log n) time for each segment the times fall inside and O(1)
+ * for each in between; otherwise the hops are summed.
+ *
+ * @param trk a pointer to a valid track
+ * @param start a timestamp
+ * @param end a timestamp not before start
+ * @return the distance covered, or 0 if end is before start
+ */
+double track_length_during(const track *trk, long start, long end)
+{
+    double total = 0.0;
+    int filled = track_filled_segments(trk);
+    for (int i=0; i<filled && end >= start; i++)
+    {
+        const segment *seg = &trk->segments[i];
+        if (seg->base_time > end)
+        {
+            break;
+        }
+        if (seg->last_time < start)
+        {
+            continue;
+        }
+
+        // from the first point or the position at the start
+        double before = 0.0;
+        int from = 0;
+        if (start > seg->base_time)
+        {
+            from = segment_search_time(trk, seg, start, 0, seg->count);
+            before = segment_covered(trk, i, from, start);
+        }
+        total += segment_covered(trk, i, from, end) - before;
+    }
+    return total;
+}
+
+
+/**
+ * Adds a copy of the given point to the last segment in this track.
+ * The point is not added and there is no change to the track if there
+ * is a last point in the track (the last point in the current segment
+ * or the last point on the previous segment if the current segment
+ * is empty) and the timestamp on the new point is
+ * not strictly after the timestamp on the last point, or if the track
+ * is compact and the point is too long after the first point of its
+ * segment.  There is no effect if there is a memory allocation error.  If
+ * the track collapses jitter and the point is within the jitter radius
+ * of the last point of the current segment, the point is not stored but
+ * extends the dwell time of that point, and counts as the last point
+ * for later timestamps.  A track with a memory budget may then thin
+ * its points as described for track_options.  The return value
+ * indicates whether the point was added.  This function must execute
+ * in amortized O(1) time (so a sequence of n consecutive operations must
+ * work in worst-case O(n) time).
+ *
+ * @param trk a pointer to a valid track
+ * @param pt a trackpoint with a timestamp strictly after the last trackpoint
+ * in the last segment in this track (if there is such a point)
+ * @return true if and only if the point was added
+ */
+bool track_add_point(track *trk, const trackpoint *pt)
+{
+    return track_add(trk, trackpoint_location(pt), trackpoint_time(pt));
+}
+
+/**
+ * Adds n points given as parallel arrays of locations and timestamps
+ * to the last segment in this track, each as track_add_point would
+ * add it, and returns the number added.  A point is skipped if its
+ * latitude is not from -90 to 90 or its longitude not from -180 up to
+ * 180, as trackpoint_create would refuse it.  This makes no copies of
+ * the points, so readers of large files should prefer it.
+ *
+ * @param trk a pointer to a valid track
+ * @param locs an array of n locations
+ * @param times an array of n timestamps
+ * @param n a nonnegative integer
+ * @return the number of points added
+ */
+int track_add_points(track *trk, const location *locs, const long *times, int n)
+{
+    int added = 0;
+    for (int k=0; k<n; k++)
+    {
+        if (locs[k].lat >= -90.0 && locs[k].lat <= 90.0 && locs[k].lon >= -180.0 && locs[k].lon < 180.0
+            && track_add(trk, locs[k], times[k]))
+        {
+            added++;
+        }
+    }
+    return added;
+}
+
+/**
+ * Adds a point at the given location and time as track_add_point does.
+ */
+static bool track_add(track *trk, location loc, long time)
+{
+    // the last point is on the current segment, or on the previous
+    // one if the current segment is empty
+    const segment *last = &trk->segments[(trk->count)-1];
+    if (last->count == 0 && trk->count > 1)
+    {
+        last = &trk->segments[(trk->count)-2];
+    }
+
+    // if pt time is not greater than last trkpt or the end of its dwell
+    if (last->count > 0
+        && time <= segment_get(trk, last, last->count-1).time + segment_dwell(last, last->count-1))
+    {
+        return false;
+    }
+
+    segment *seg = &trk->segments[(trk->count)-1];
+    if (trk->jitter_radius > 0 && seg->count > 0)
+    {
+        // the stored point standing in for the current run, if any
+        trkrec anchor = segment_get(trk, seg, seg->count-1);
+        if (jitter_within(anchor.loc, loc, trk->jitter_radius))
+        {
+            return segment_note_dwell(trk, seg, time - anchor.time);
+        }
+    }
+
+    return (trk->max_points > 0 ? track_append_sampled(trk, loc, time) : track_append(trk, loc, time));
+}
+
+/**
+ * Returns whether b is within the given radius in meters of a, on an
+ * equirectangular projection centered on a.  This takes one cosine
+ * and no square roots, and at the few meters jitter spans it is as
+ * good as the geodesic distance.
+ */
+static inline bool jitter_within(location a, location b, double radius)
+{
+    double dx = remainder(b.lon - a.lon, 360.0) * cos(RADIANS(a.lat)) * METERS_PER_DEGREE;
+    double dy = (b.lat - a.lat) * METERS_PER_DEGREE;
+    return dx * dx + dy * dy <= radius * radius;
+}
+
+/**
+ * Sets the dwell time of the last point of the given segment of the
+ * given track to the given number of seconds and counts a collapsed
+ * point.  Returns false, leaving the track unchanged, if there is a
+ * memory allocation error.
+ */
+static bool segment_note_dwell(track *trk, segment *seg, long seconds)
+{
+    int last = seg->count - 1;
+    if (seg->num_dwells == 0 || seg->dwells[seg->num_dwells-1].point != last)
+    {
+        if (!segment_reserve_dwells(trk, seg, 1))
+        {
+            return false;
+        }
+        seg->dwells[seg->num_dwells].point = last;
+        seg->num_dwells++;
+    }
+    seg->dwells[seg->num_dwells-1].seconds = seconds;
+    trk->collapsed++;
+    return true;
+}
+
+/**
+ * Returns the longitude bin of the given longitude, or -1 if it is
+ * out of range.
+ */
+static int lon_bin(double lon)
+{
+    if (!(lon >= -180.0 && lon <= 180.0))
+    {
+        return -1;
+    }
+    int k = (int) floor((lon + 180.0) / LON_BIN_WIDTH);
+    return (k < LON_BINS ? k : LON_BINS - 1);
+}
+
+/**
+ * Saves what adding a point at the given stored location to the last
+ * segment of the given track will change, so that the point can be
+ * replaced by segment_drop_tail.
+ */
+static void track_save_tail(track *trk, location loc)
+{
+    const segment *seg = &trk->segments[(trk->count)-1];
+    tail_undo *undo = &trk->undo;
+
+    undo->bounds_valid = !seg->bounds_stale;
+    undo->south = seg->south;
+    undo->north = seg->north;
+    undo->min_lon = seg->min_lon;
+    undo->max_lon = seg->max_lon;
+
+    undo->bin_valid = (trk->lons != NULL && !trk->lons_stale);
+    if (undo->bin_valid)
+    {
+        int k = lon_bin(loc.lon);
+        undo->bin = k;
+        undo->out_of_range = trk->lons->out_of_range;
+        if (k >= 0)
+        {
+            undo->occupied = (trk->lons->occupied[k / 64] >> (k % 64)) & 1;
+            undo->bin_min = trk->lons->min[k];
+            undo->bin_max = trk->lons->max[k];
+        }
+    }
+}
+
+/**
+ * Removes the provisional last point of the last segment of the given
+ * track, which must not be its first point, along with its dwell time.
+ */
+static void track_drop_tail(track *trk)
+{
+    segment *seg = &trk->segments[(trk->count)-1];
+    location tail = segment_get(trk, seg, seg->count-1).loc;
+    seg->count--;
+    trk->stored--;
+
+    trkrec last = segment_get(trk, seg, seg->count-1);
+    seg->length -= location_distance(&last.loc, &tail);
+    seg->last_time = last.time;
+    if (seg->num_dwells > 0 && seg->dwells[seg->num_dwells-1].point == seg->count)
+    {
+        seg->num_dwells--;
+    }
+
+    tail_undo *undo = &trk->undo;
+    if (undo->bounds_valid && !seg->bounds_stale)
+    {
+        seg->south = undo->south;
+        seg->north = undo->north;
+        seg->min_lon = undo->min_lon;
+        seg->max_lon = undo->max_lon;
+    }
+    else
+    {
+        segment_rebuild_bounds(trk, seg);
+    }
+
+    if (undo->bin_valid && !trk->lons_stale)
+    {
+        int k = undo->bin;
+        trk->lons->out_of_range = undo->out_of_range;
+        if (k >= 0)
+        {
+            uint64_t bit = (uint64_t) 1 << (k % 64);
+            trk->lons->occupied[k / 64] = (trk->lons->occupied[k / 64] & ~bit) | (undo->occupied ? bit : 0);
+            trk->lons->min[k] = undo->bin_min;
+            trk->lons->max[k] = undo->bin_max;
+        }
+    }
+    else
+    {
+        track_rebuild_lons(trk);
+    }
+    undo->bounds_valid = false;
+    undo->bin_valid = false;
+}
+
+/**
+ * Adds a point to the end of the last segment of the given track as
+ * track_append does, keeping one of every rate points offered to the
+ * segment and the latest point as a provisional last point until the
+ * next replaces it, then thins the track if it is over its budget.
+ * Returns false if the point could not be added, in which case the
+ * track is unchanged.
+ *
+ * @param trk a pointer to a valid track with a budget
+ * @param loc the location of the point
+ * @param time the timestamp of the point
+ */
+static bool track_append_sampled(track *trk, location loc, long time)
+{
+    segment *seg = &trk->segments[(trk->count)-1];
+    if (trk->tail_provisional)
+    {
+        // the slot freed is reused, so only the offset can be out of range
+        if (trk->compact && time - seg->base_time > INT32_MAX)
+        {
+            return false;
+        }
+        track_drop_tail(trk);
+    }
+
+    bool kept = (trk->received % trk->rate == 0);
+    if (!kept)
+    {
+        track_save_tail(trk, track_quantize(trk, loc));
+    }
+    if (!track_append(trk, loc, time))
+    {
+        return false;
+    }
+    trk->received++;
+    trk->tail_provisional = !kept;
+
+    if (trk->stored > trk->next_decimation)
+    {
+        track_decimate(trk);
+    }
+    return true;
+}
+
+/**
+ * Gives back the blocks of the given segment beyond those its points
+ * need.
+ */
+static void segment_trim(track *trk, segment *seg)
+{
+    int needed = (segment_blocks(seg) > 1 ? segment_blocks(seg) : 1);
+    if (seg->num_blocks > needed)
+    {
+        for (int b=needed; b<seg->num_blocks; b++)
+        {
+            track_free(trk, seg->blocks[b]);
+            if (seg->dists != NULL)
+            {
+                track_free(trk, seg->dists[b]);
+            }
+        }
+        seg->num_blocks = needed;
+        seg->capacity = needed * TRACK_BLOCK_POINTS;
+    }
+}
+
+/**
+ * Halves the given segment of the given track, keeping the points at
+ * even positions and the last point with their dwell times, and
+ * recomputing its length and bounds from the points kept.  A
+ * provisional last point of the last segment stays provisional, and
+ * the last point kept otherwise becomes provisional if it is not on
+ * the stride of the doubled rate.
+ */
+static void segment_decimate(track *trk, int i)
+{
+    segment *seg = &trk->segments[i];
+    int n = seg->count;
+    if (n <= 2)
+    {
+        return;
+    }
+    bool current = (i == trk->count - 1);
+    bool provisional = current && trk->tail_provisional;
+    int fixed = (provisional ? n - 1 : n);
+
+    int kept = 0;
+    int d = 0;
+    int dwells = 0;
+    bool stride = true;
+    trkrec prev;
+    seg->length = 0;
+    seg->south = 90;
+    seg->north = -90;
+    seg->min_lon = 180;
+    seg->max_lon = -180;
+    seg->bounds_stale = false;
+    for (int j=0; j<n; j++)
+    {
+        bool stop = (d < seg->num_dwells && seg->dwells[d].point == j);
+        bool even = (j < fixed && j % 2 == 0);
+        if (even || j == n-1)
+        {
+            trkrec rec = segment_get(trk, seg, j);
+            if (kept > 0)
+            {
+                seg->length += location_distance(&prev.loc, &rec.loc);
+            }
+            segment_set_dist(seg, kept, seg->length);
+            if (j == n-1 && current)
+            {
+                // the bounds without the last point, in case it is replaced
+                track_save_tail(trk, rec.loc);
+                trk->undo.bin_valid = false;
+                stride = even;
+            }
+            if (stop)
+            {
+                seg->dwells[dwells].point = kept;
+                seg->dwells[dwells++].seconds = seg->dwells[d].seconds;
+            }
+            segment_set(trk, seg, kept++, &rec);
+            segment_extend(seg, rec.loc);
+            prev = rec;
+        }
+        if (stop)
+        {
+            d++;
+        }
+    }
+    trk->stored -= n - kept;
+    seg->count = kept;
+    seg->num_dwells = dwells;
+    if (current)
+    {
+        trk->tail_provisional = !stride;
+    }
+    segment_trim(trk, seg);
+}
+
+/**
+ * Doubles the sampling rate of the given track and halves its
+ * segments until it is within its budget again.  If the segment ends
+ * alone are over the budget then the track is let grow to
+ * twice its size before trying again, so that adding points stays
+ * amortized O(1).
+ */
+static void track_decimate(track *trk)
+{
+    while (trk->stored > trk->max_points)
+    {
+        long before = trk->stored;
+        trk->rate *= 2;
+        for (int i=0; i<trk->count; i++)
+        {
+            segment_decimate(trk, i);
+        }
+        if (trk->stored == before)
+        {
+            break;
+        }
+    }
+    track_rebuild_lons(trk);
+    trk->next_decimation = (trk->stored > trk->max_points ? 2 * trk->stored : trk->max_points);
+}
+
+/**
+ * Adds a point to the end of the last segment of the given track
+ * without checking its timestamp, keeping the segment length up to
+ * date.  Returns false if there is a memory allocation error or if the
+ * segment is compact and the time is out of range of its base time, in
+ * which case the track is unchanged.
+ *
+ * @param trk a pointer to a valid track
+ * @param loc the location of the point
+ * @param time the timestamp of the point
+ */
+static bool track_append(track *trk, location loc, long time)
+{
+    segment *seg = &trk->segments[(trk->count)-1];
+
+    // a compact segment only spans as many seconds as an offset holds
+    if (trk->compact && seg->count > 0 && (time - seg->base_time > INT32_MAX || time < seg->base_time))
+    {
+        return false;
+    }
+
+    // resize if necessary
+    if (seg->count == seg->capacity)
+    {
+        track_trkpt_embiggen(trk, (trk->count)-1);
+        if (seg->count == seg->capacity)
+        {
+            return false;
+        }
+    }
+
+    // update segment length with the hop to the new point as stored
+    trkrec rec = {track_quantize(trk, loc), time};
+    if (seg->count > 0)
+    {
+        location prev = segment_get(trk, seg, seg->count-1).loc;
+        double hop = location_distance(&prev, &rec.loc);
+        seg->length += hop;
+        segment_set_dist(seg, seg->count, (seg->dists != NULL ? *segment_dist(seg, seg->count-1) + hop : 0.0));
+    }
+    else
+    {
+        seg->base_time = time;
+        segment_set_dist(seg, 0, 0.0);
+    }
+
+    //add point to the next index of the curr segment
+    segment_set(trk, seg, seg->count, &rec);
+    seg->count++;
+    trk->stored++;
+    seg->last_time = time;
+    segment_extend(seg, rec.loc);
+    track_note_lon(trk, rec.loc.lon);
+    return true;
+}
+
+void track_trkpt_embiggen(track *trk, int i)
+{
+    segment *seg = &trk->segments[i];
+
+    if (seg->capacity < TRACK_BLOCK_POINTS)
+    {
+        // the first block is small enough that copying it is cheap
+        if (seg->dists != NULL)
+        {
+            double *dists = track_realloc(trk, seg->dists[0], sizeof(double) * seg->capacity,
+                                          sizeof(double) * seg->capacity * 2);
+            if (dists == NULL)
+            {
+                return;
+            }
+            seg->dists[0] = dists;
+        }
+        char *bigger = track_realloc(trk, seg->blocks[0], trk->rec_size * seg->capacity,
+                                     trk->rec_size * seg->capacity * 2);
+        if (bigger != NULL)
+        {
+            seg->blocks[0] = bigger;
+            seg->capacity *= 2;
+        }
+    }
+    else if (segment_grow_index(trk, seg, seg->num_blocks + 1))
+    {
+        // later blocks are added whole and existing points never move
+        double *dists = NULL;
+        if (seg->dists != NULL)
+        {
+            dists = track_alloc(trk, sizeof(double) * TRACK_BLOCK_POINTS);
+            if (dists == NULL)
+            {
+                return;
+            }
+        }
+        char *block = track_alloc(trk, trk->rec_size * TRACK_BLOCK_POINTS);
+        if (block != NULL)
+        {
+            if (seg->dists != NULL)
+            {
+                seg->dists[seg->num_blocks] = dists;
+            }
+            seg->blocks[seg->num_blocks++] = block;
+            seg->capacity += TRACK_BLOCK_POINTS;
+        }
+        else
+        {
+            track_free(trk, dists);
+        }
+    }
+}
+
+/**
+ * Starts a new segment in the given track.  There is no effect on the track
+ * if the current segment is empty or if there is a memory allocation error.
+ *
+ * @param trk a pointer to a valid track
+ */
+void track_start_segment(track *trk)
+{
+    // resize if necessary
+    if (trk->count == trk->capacity)
+    {
+        track_seg_embiggen(trk);
+    }
+
+    // add if there is room
+    if (trk->count < trk->capacity)
+    {
+        // if curr segment is empty
+        if (trk->segments[trk->count-1].count == 0)
+        {
+            // no effect
+            return;
+        }
+        // if curr segment is not empty
+        else if (segment_init(trk, &trk->segments[trk->count]))
+        {
+            // the last point of the segment ended is kept whatever the rate
+            trk->count++;
+            trk->received = 0;
+            trk->tail_provisional = false;
+        }
+    }
+    
+}
+
+void track_seg_embiggen(track *trk)
+{
+    segment *bigger_segment = track_realloc(trk, trk->segments, sizeof(segment) * trk->capacity,
+                                            sizeof(segment) * trk->capacity * 2);
+    if (bigger_segment != NULL)
+    {
+        trk->segments = bigger_segment;
+        trk->capacity *= 2;
+    }
+}
+
+/**
+ * Merges the given range of segments in this track into one.  The segments
+ * to merge are specified as the 0-based index of the first segment to
+ * merge and one more than the index of the last segment to merge.
+ * The resulting segment replaces the first merged one and later segments
+ * are moved up to replace the other merged segments.  If the range is
+ * invalid then there is no effect.
+ *
+ * @param trk a pointer to a valid track
+ * @param start an integer greater than or equal to 0 and strictly less than
+ * the number if segments in trk
+ * @param end an integer greater than or equal to start and less than or
+ * equal to the number of segments in trk
+ */
+void track_merge_segments(track *trk, int start, int end)
+{
+    // merging an empty range or a single segment has no effect
+    if (end <= start + 1)
+    {
+        return;
+    }
+
+    track_range range = {start, end};
+    track_merge_segment_ranges(trk, &range, 1);
+}
+
+/**
+ * Merges each of the given ranges of segments in this track into one
+ * segment, as track_merge_segments does for a single range.  The ranges
+ * must be in increasing order and must not overlap; if any range is
+ * invalid or out of order then there is no effect; in a compact track,
+ * a range whose points span more than 2^31 - 1 seconds is invalid.
+ * Room for each merged segment is made once up front, the points are
+ * copied in bulk onto the end of the first segment of each range, and
+ * the segments after each range are moved up in a single pass, so the
+ * time taken is linear in the number of segments plus the number of
+ * points moved.  The length of a merged segment is the sum of the
+ * lengths of its parts plus the hops joining them.
+ *
+ * @param trk a pointer to a valid track
+ * @param ranges an array of n ranges, each with 0 <= start < end <= the
+ * number of segments in trk, in increasing order and not overlapping
+ * @param n a nonnegative integer
+ */
+void track_merge_segment_ranges(track *trk, const track_range *ranges, int n)
+{
+    // if any range is invalid return
+    for (int r=0; r<n; r++)
+    {
+        if (ranges[r].start < 0 || ranges[r].end <= ranges[r].start || ranges[r].end > trk->count
+            || (r > 0 && ranges[r].start < ranges[r-1].end))
+        {
+            return;
+        }
+
+        // a compact segment only spans as many seconds as an offset holds
+        if (trk->compact)
+        {
+            long first_time = 0;
+            long last_time = 0;
+            bool any = false;
+            for (int i=ranges[r].start; i<ranges[r].end; i++)
+            {
+                const segment *seg = &trk->segments[i];
+                if (seg->count > 0)
+                {
+                    if (!any)
+                    {
+                        first_time = seg->base_time;
+                        any = true;
+                    }
+                    last_time = segment_get(trk, seg, seg->count-1).time;
+                }
+            }
+            if (last_time - first_time > INT32_MAX)
+            {
+                return;
+            }
+        }
+    }
+
+    // make room in each merged segment first so that nothing changes on failure
+    for (int r=0; r<n; r++)
+    {
+        long total = 0;
+        int dwells = 0;
+        for (int i=ranges[r].start+1; i<ranges[r].end; i++)
+        {
+            total += trk->segments[i].count;
+            dwells += trk->segments[i].num_dwells;
+        }
+        if (!segment_reserve(trk, &trk->segments[ranges[r].start], total)
+            || !segment_reserve_dwells(trk, &trk->segments[ranges[r].start], dwells))
+        {
+            return;
+        }
+    }
+
+    for (int r=0; r<n; r++)
+    {
+        segment *first = &trk->segments[ranges[r].start];
+
+        for (int i=ranges[r].start+1; i<ranges[r].end; i++)
+        {
+            segment *seg = &trk->segments[i];
+
+            // the hop joining the previous part to this one
+            double base = 0.0;
+            if (first->count > 0 && seg->count > 0)
+            {
+                location loc1 = segment_get(trk, first, first->count-1).loc;
+                location loc2 = segment_get(trk, seg, 0).loc;
+                double hop = location_distance(&loc1, &loc2);
+                first->length += hop;
+                base = (first->dists != NULL ? *segment_dist(first, first->count-1) + hop : 0.0);
+            }
+            int offset = first->count;
+
+            // the dwell times follow their points to the end of the first part
+            for (int d=0; d<seg->num_dwells; d++)
+            {
+                first->dwells[first->num_dwells].point = first->count + seg->dwells[d].point;
+                first->dwells[first->num_dwells++].seconds = seg->dwells[d].seconds;
+            }
+
+            for (int b=0; b<segment_blocks(seg); b++)
+            {
+                trkrec scratch[TRACK_BLOCK_POINTS];
+                const trkrec *pts;
+                int count = segment_block(trk, seg, b, scratch, &pts);
+                segment_copy_in(trk, first, pts, count);
+            }
+            for (int j=0; first->dists != NULL && j<seg->count; j++)
+            {
+                *segment_dist(first, offset + j) = base + *segment_dist(seg, j);
+            }
+            first->length += seg->length;
+            segment_free(trk, seg);
+        }
+    }
+
+    // move the remaining segments up in one pass
+    int kept = 0;
+    int r = 0;
+    for (int i=0; i<trk->count; i++)
+    {
+        while (r < n && ranges[r].end <= i)
+        {
+            r++;
+        }
+        if (r < n && i > ranges[r].start && i < ranges[r].end)
+        {
+            continue;
+        }
+        trk->segments[kept++] = trk->segments[i];
+    }
+
+    // updated track count
+    trk->count = kept;
+    trk->undo.bounds_valid = false;
+}
+
+/**
+ * Makes room in the block index of the last segment of the given track
+ * for at least n more points, so that appending them never resizes the
+ * index; the blocks themselves are added as they fill.  Returns false
+ * if there is a memory allocation error.
+ *
+ * @param trk a pointer to a valid track
+ * @param n a nonnegative integer
+ */
+static bool track_reserve(track *trk, long n)
+{
+    segment *seg = &trk->segments[(trk->count)-1];
+    return segment_grow_index(trk, seg, (seg->count + n + TRACK_BLOCK_MASK) >> TRACK_BLOCK_SHIFT);
+}
+
+/**
+ * A position in one of the tracks being merged by track_merge_tracks:
+ * the input, the segment and the point within it.
+ */
+typedef struct merge_cursor
+{
+    const track *trk;
+    int input;
+    int seg;
+    int j;
+} merge_cursor;
+
+/**
+ * Returns the timestamp of the point at the given cursor.
+ */
+static long merge_cursor_time(const merge_cursor *c)
+{
+    return segment_get(c->trk, &c->trk->segments[c->seg], c->j).time;
+}
+
+/**
+ * Determines if the first cursor comes before the second: earlier
+ * timestamps first, and the earlier input first for equal ones.
+ */
+static bool merge_cursor_before(const merge_cursor *a, const merge_cursor *b)
+{
+    long ta = merge_cursor_time(a);
+    long tb = merge_cursor_time(b);
+    return ta < tb || (ta == tb && a->input < b->input);
+}
+
+/**
+ * Restores the heap property for the binary heap of n cursors by
+ * moving the cursor at index i down.
+ */
+static void merge_sift_down(merge_cursor *heap, int n, int i)
+{
+    while (true)
+    {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = 2 * i + 2;
+        if (left < n && merge_cursor_before(&heap[left], &heap[smallest]))
+        {
+            smallest = left;
+        }
+        if (right < n && merge_cursor_before(&heap[right], &heap[smallest]))
+        {
+            smallest = right;
+        }
+        if (smallest == i)
+        {
+            return;
+        }
+        merge_cursor temp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = temp;
+        i = smallest;
+    }
+}
+
+/**
+ * Moves the given cursor to the next point in its track, skipping
+ * empty segments.  Returns false if there is no next point.
+ */
+static bool merge_cursor_advance(merge_cursor *c)
+{
+    c->j++;
+    while (c->seg < c->trk->count && c->j >= c->trk->segments[c->seg].count)
+    {
+        c->seg++;
+        c->j = 0;
+    }
+    return c->seg < c->trk->count;
+}
+
+/**
+ * Merges the given tracks, such as the logs of several devices carried
+ * by one team, into a new track with all their points in timestamp
+ * order, using the default policy: when several inputs have points
+ * with the same timestamp only the one from the input earliest in the
+ * array is kept, and a new segment starts only where none of the
+ * inputs is in the middle of a segment.  The inputs are not changed.
+ * The return value is NULL if there is a memory allocation error.
+ * It is the caller's responsibility to destroy the returned track.
+ *
+ * @param inputs an array of k pointers to valid tracks
+ * @param k a nonnegative integer
+ * @return a pointer to the merged track, or NULL
+ */
+track *track_merge_tracks(track **inputs, int k)
+{
+    return track_merge_tracks_with(inputs, k, NULL);
+}
+
+/**
+ * Merges the given tracks into a new track with all their points in
+ * timestamp order, as for track_merge_tracks but with the given policy
+ * for points with the same timestamp and for where segments break.
+ * The merge takes O(n log k) time for n points in total.  The block
+ * index of the first segment is reserved up front with entries for all
+ * the points; later segments grow a block at a time as they fill.
+ *
+ * @param inputs an array of k pointers to valid tracks
+ * @param k a nonnegative integer
+ * @param policy a pointer to a policy, or NULL for the default
+ * @return a pointer to the merged track, or NULL
+ */
+track *track_merge_tracks_with(track **inputs, int k, const track_merge_policy *policy)
+{
+    track_merge_policy defaults = {TRACK_MERGE_KEEP_FIRST, TRACK_MERGE_BREAK_ALL, 0};
+    if (policy == NULL)
+    {
+        policy = &defaults;
+    }
+
+    track *merged = track_create();
+    if (merged == NULL)
+    {
+        return NULL;
+    }
+
+    merge_cursor *heap = malloc(sizeof(merge_cursor) * (k > 0 ? k : 1));
+    if (heap == NULL)
+    {
+        track_destroy(merged);
+        return NULL;
+    }
+
+    // a cursor at the first point of each nonempty input
+    long total = 0;
+    int n = 0;
+    for (int i=0; i<k; i++)
+    {
+        merge_cursor c = {inputs[i], i, 0, -1};
+        for (int s=0; s<inputs[i]->count; s++)
+        {
+            total += inputs[i]->segments[s].count;
+        }
+        if (merge_cursor_advance(&c))
+        {
+            heap[n++] = c;
+        }
+    }
+    for (int i=n/2-1; i>=0; i--)
+    {
+        merge_sift_down(heap, n, i);
+    }
+
+    if (!track_reserve(merged, total))
+    {
+        free(heap);
+        track_destroy(merged);
+        return NULL;
+    }
+
+    // the number of inputs in the middle of a segment
+    int active = 0;
+    long last_time = 0;
+    bool any = false;
+
+    // the number of points averaged into the last one added
+    int copies = 0;
+
+    while (n > 0)
+    {
+        merge_cursor c = heap[0];
+        const segment *from = &c.trk->segments[c.seg];
+        trkrec rec = segment_get(c.trk, from, c.j);
+        location loc = rec.loc;
+        long time = rec.time;
+
+        if (any && time == last_time)
+        {
+            // a duplicate of the point just added
+            if (policy->duplicates == TRACK_MERGE_AVERAGE)
+            {
+                segment *to = &merged->segments[merged->count-1];
+                trkrec last = segment_get(merged, to, to->count-1);
+                location old = last.loc;
+                location avg = old;
+                double east = fmod(loc.lon - avg.lon + 540.0, 360.0) - 180.0;
+                copies++;
+
+                avg.lat += (loc.lat - avg.lat) / copies;
+                avg.lon += east / copies;
+                if (avg.lon >= 180.0)
+                {
+                    avg.lon -= 360.0;
+                }
+                else if (avg.lon < -180.0)
+                {
+                    avg.lon += 360.0;
+                }
+
+                // move the point, fixing up the length of its hop
+                if (to->count > 1)
+                {
+                    location before = segment_get(merged, to, to->count-2).loc;
+                    to->length += location_distance(&before, &avg) - location_distance(&before, &old);
+                }
+                last.loc = avg;
+                segment_set(merged, to, to->count-1, &last);
+                to->bounds_stale = true;
+                merged->lons_stale = true;
+            }
+        }
+        else
+        {
+            bool gap = (policy->breaks == TRACK_MERGE_BREAK_GAP && time - last_time > policy->max_gap);
+            bool uncovered = (policy->breaks == TRACK_MERGE_BREAK_ALL && active == 0);
+            if (any && (gap || uncovered))
+            {
+                // later segments grow a block at a time, which never moves points
+                track_start_segment(merged);
+                if (merged->segments[merged->count-1].count != 0)
+                {
+                    free(heap);
+                    track_destroy(merged);
+                    return NULL;
+                }
+            }
+
+            copies = 1;
+            if (!track_append(merged, loc, time))
+            {
+                free(heap);
+                track_destroy(merged);
+                return NULL;
+            }
+            last_time = time;
+            any = true;
+        }
+
+        // an input is in the middle of a segment from its first point
+        // up to but not including its last
+        if (c.j == 0 && from->count > 1)
+        {
+            active++;
+        }
+        else if (c.j == from->count - 1 && from->count > 1)
+        {
+            active--;
+        }
+
+        if (merge_cursor_advance(&heap[0]))
+        {
+            merge_sift_down(heap, n, 0);
+        }
+        else
+        {
+            heap[0] = heap[--n];
+            merge_sift_down(heap, n, 0);
+        }
+    }
+
+    // the bounds of segments with averaged points, and the bins, once each
+    for (int i=0; i<merged->count; i++)
+    {
+        if (merged->segments[i].bounds_stale)
+        {
+            segment_rebuild_bounds(merged, &merged->segments[i]);
+        }
+    }
+    track_refresh(merged);
+
+    free(heap);
+    return merged;
+}
+
+/**
+ * Returns the distance in meters from b to the straight path from a to
+ * c, on a local projection centered on b.
+ */
+static double simplify_offset(location a, location b, location c)
+{
+    double scale = cos(RADIANS(b.lat)) * METERS_PER_DEGREE;
+    double ax = remainder(a.lon - b.lon, 360.0) * scale;
+    double ay = (a.lat - b.lat) * METERS_PER_DEGREE;
+    double dx = remainder(c.lon - b.lon, 360.0) * scale - ax;
+    double dy = (c.lat - b.lat) * METERS_PER_DEGREE - ay;
+
+    // the nearest point on the path to b, which is the origin
+    double len_sq = dx * dx + dy * dy;
+    double t = (len_sq > 0 ? -(ax * dx + ay * dy) / len_sq : 0.0);
+    t = fmax(0.0, fmin(1.0, t));
+    return hypot(ax + t * dx, ay + t * dy);
+}
+
+/**
+ * A binary min-heap of the points of a segment being simplified, keyed
+ * by their offsets with ties broken by position, and where each point
+ * is in the heap so its key can change.
+ */
+typedef struct simplify_heap
+{
+    int *items;
+    int *where;
+    const double *key;
+    int count;
+} simplify_heap;
+
+static bool simplify_before(const simplify_heap *h, int a, int b)
+{
+    return h->key[a] < h->key[b] || (h->key[a] == h->key[b] && a < b);
+}
+
+static void simplify_swap(simplify_heap *h, int i, int j)
+{
+    int swap = h->items[i];
+    h->items[i] = h->items[j];
+    h->items[j] = swap;
+    h->where[h->items[i]] = i;
+    h->where[h->items[j]] = j;
+}
+
+/**
+ * Restores the heap property around position i after its key changed.
+ */
+static void simplify_fix(simplify_heap *h, int i)
+{
+    while (i > 0 && simplify_before(h, h->items[i], h->items[(i - 1) / 2]))
+    {
+        simplify_swap(h, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (true)
+    {
+        int least = i;
+        int left = 2 * i + 1;
+        int right = 2 * i + 2;
+        if (left < h->count && simplify_before(h, h->items[left], h->items[least]))
+        {
+            least = left;
+        }
+        if (right < h->count && simplify_before(h, h->items[right], h->items[least]))
+        {
+            least = right;
+        }
+        if (least == i)
+        {
+            return;
+        }
+        simplify_swap(h, i, least);
+        i = least;
+    }
+}
+
+/**
+ * Simplifies the given segment as described for track_simplify.
+ * Returns false, leaving the segment unchanged, if there is a memory
+ * allocation error.
+ */
+static bool segment_simplify(track *trk, segment *seg, double tolerance)
+{
+    int n = seg->count;
+    if (n < 3)
+    {
+        return true;
+    }
+
+    trkrec *pts = malloc(sizeof(trkrec) * n);
+    double *key = malloc(sizeof(double) * n);
+    int *prev = malloc(sizeof(int) * n);
+    int *next = malloc(sizeof(int) * n);
+    simplify_heap heap = {malloc(sizeof(int) * n), malloc(sizeof(int) * n), key, 0};
+    if (pts == NULL || key == NULL || prev == NULL || next == NULL || heap.items == NULL || heap.where == NULL)
+    {
+        free(pts);
+        free(key);
+        free(prev);
+        free(next);
+        free(heap.items);
+        free(heap.where);
+        return false;
+    }
+
+    for (int j=0; j<n; j++)
+    {
+        pts[j] = segment_get(trk, seg, j);
+        prev[j] = j - 1;
+        next[j] = j + 1;
+    }
+
+    // the interior points, heapified in one pass; points with dwell
+    // times mark stops and are never removed
+    int d = 0;
+    for (int j=1; j<n-1; j++)
+    {
+        while (d < seg->num_dwells && seg->dwells[d].point < j)
+        {
+            d++;
+        }
+        if (d < seg->num_dwells && seg->dwells[d].point == j)
+        {
+            heap.where[j] = -1;
+            continue;
+        }
+        key[j] = simplify_offset(pts[j-1].loc, pts[j].loc, pts[j+1].loc);
+        heap.items[heap.count] = j;
+        heap.where[j] = heap.count++;
+    }
+    for (int i=heap.count/2-1; i>=0; i--)
+    {
+        simplify_fix(&heap, i);
+    }
+
+    while (heap.count > 0 && key[heap.items[0]] <= tolerance)
+    {
+        int j = heap.items[0];
+        simplify_swap(&heap, 0, --heap.count);
+        simplify_fix(&heap, 0);
+
+        // unlink the point and remeasure its neighbors
+        int p = prev[j];
+        int q = next[j];
+        next[p] = q;
+        prev[q] = p;
+        if (p > 0 && heap.where[p] >= 0)
+        {
+            key[p] = simplify_offset(pts[prev[p]].loc, pts[p].loc, pts[q].loc);
+            simplify_fix(&heap, heap.where[p]);
+        }
+        if (q < n-1 && heap.where[q] >= 0)
+        {
+            key[q] = simplify_offset(pts[p].loc, pts[q].loc, pts[next[q]].loc);
+            simplify_fix(&heap, heap.where[q]);
+        }
+    }
+
+    // write the points kept back in order, each at or before where it was
+    int kept = 0;
+    seg->length = 0;
+    seg->south = 90;
+    seg->north = -90;
+    seg->min_lon = 180;
+    seg->max_lon = -180;
+    d = 0;
+    for (int j=0; j<n; j=next[j])
+    {
+        if (kept > 0)
+        {
+            seg->length += location_distance(&pts[prev[j]].loc, &pts[j].loc);
+        }
+        segment_set_dist(seg, kept, seg->length);
+        if (d < seg->num_dwells && seg->dwells[d].point == j)
+        {
+            seg->dwells[d++].point = kept;
+        }
+        segment_set(trk, seg, kept++, &pts[j]);
+        segment_extend(seg, pts[j].loc);
+    }
+    trk->stored -= n - kept;
+    seg->count = kept;
+    segment_trim(trk, seg);
+
+    free(pts);
+    free(key);
+    free(prev);
+    free(next);
+    free(heap.items);
+    free(heap.where);
+    return true;
+}
+
+/**
+ * Simplifies each segment of this track in place with the
+ * Visvalingam-Whyatt algorithm, measuring each point by its distance in
+ * meters from the path that would join its neighbors if it were
+ * removed.  The point with the smallest such distance is removed
+ * repeatedly, with its neighbors remeasured each time, until every
+ * remaining point is more than the tolerance from the path without it.
+ * The first and last points of every segment and the points with dwell
+ * times are kept, and the order of the points is unchanged, so
+ * timestamps stay strictly increasing.  This takes O(n log n) time for
+ * a segment of n points.  Segment lengths are
+ * recomputed from the points kept.  If stats is not NULL it is filled in
+ * with the number of points and total length before and after.  A
+ * segment for which there is a memory allocation error is left as it
+ * was.
+ *
+ * @param trk a pointer to a valid track
+ * @param tolerance a nonnegative distance in meters
+ * @param stats a pointer to a place for statistics, or NULL
+ */
+void track_simplify(track *trk, double tolerance, track_simplify_stats *stats)
+{
+    track_simplify_stats totals = {0, 0, 0.0, 0.0};
+    bool removed = false;
+    for (int i=0; i<trk->count; i++)
+    {
+        segment *seg = &trk->segments[i];
+        totals.points_before += seg->count;
+        totals.length_before += seg->length;
+        int before = seg->count;
+        if (segment_simplify(trk, seg, tolerance) && seg->count < before)
+        {
+            // points are gone, so the bins may have emptied
+            removed = true;
+            trk->undo.bounds_valid = false;
+            trk->undo.bin_valid = false;
+        }
+        totals.points_after += seg->count;
+        totals.length_after += seg->length;
+    }
+    if (removed)
+    {
+        track_rebuild_lons(trk);
+    }
+
+    if (stats != NULL)
+    {
+        *stats = totals;
+    }
+}
+
+/**
+ * The geometry shared by all the heatmap modes: the latitude of the
+ * top of the first row, the longitude of the left of the first column,
+ * the size of each cell in degrees, and the dimensions of the map.
+ */
+typedef struct heatmap_grid
+{
+    double north;
+    double west;
+    double cell_width;
+    double cell_height;
+    int rows;
+    int cols;
+} heatmap_grid;
+
+/**
+ * Compares two doubles for qsort.
+ */
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Finds the smallest wedge bounded by two meridians that contains all
+ * the given longitudes.  The smallest wedge is the complement of the
+ * largest gap between circularly consecutive longitudes, so sorting
+ * them is enough; ties go to the lowest western edge.  The array is
+ * sorted in place.
+ *
+ * @param lons an array of n longitudes in [-180, 180)
+ * @param n a positive integer
+ * @param west a pointer to where to store the western edge
+ * @param span a pointer to where to store the width of the wedge in degrees
+ */
+static void track_find_wedge(double *lons, long n, double *west, double *span)
+{
+    qsort(lons, n, sizeof(double), compare_doubles);
+
+    // the wedge that starts at the westernmost longitude
+    double best_west = lons[0];
+    double best_span = lons[n-1] - lons[0];
+
+    // the wedges that wrap around past 180
+    for (long i=1; i<n; i++)
+    {
+        double wrapped_span = lons[i-1] + 360.0 - lons[i];
+        if (wrapped_span < best_span)
+        {
+            best_span = wrapped_span;
+            best_west = lons[i];
+        }
+    }
+
+    *west = best_west;
+    *span = best_span;
+}
+
+/**
+ * Returns the longitude bins of the given track, or NULL if they are
+ * stale after a memory allocation error.  A track with no bins has no
+ * points, so it gets bins with none occupied.
+ */
+static const lon_bins *track_lon_bins(const track *trk)
+{
+    static const lon_bins empty;
+    if (trk->lons_stale)
+    {
+        return NULL;
+    }
+    return (trk->lons != NULL ? trk->lons : &empty);
+}
+
+/**
+ * Rebuilds the longitude bins this track caches if they are stale.
+ * The operations that add or move points rebuild them before
+ * returning, so they are only stale after a memory allocation error,
+ * when heatmaps find the wedge by sorting the longitudes instead.
+ * Returns false if the bins still cannot be rebuilt.
+ *
+ * @param trk a pointer to a valid track
+ * @return true if and only if the bins are up to date
+ */
+bool track_refresh(track *trk)
+{
+    if (trk->lons_stale)
+    {
+        track_rebuild_lons(trk);
+    }
+    return !trk->lons_stale;
+}
+
+/**
+ * Finds the smallest wedge containing the longitudes of all the given
+ * tracks from their longitude bins, with the same result that
+ * track_find_wedge would give for the longitudes themselves.  The
+ * candidates are the wedges west of each gap between occupied bins, in
+ * the same order and with the same arithmetic as track_find_wedge; the
+ * gaps it skips are those within bins, which are narrower than a bin.
+ * So when the largest gap between bins is at least two bins wide, none
+ * of them could win, and the bins settle the wedge in time independent
+ * of the number of points.  Returns false when they do not, or if there
+ * is a memory allocation error.
+ *
+ * @param trks an array of n pointers to valid tracks with at least one
+ * point among them
+ * @param n a positive integer
+ * @param west a pointer to where to store the western edge
+ * @param span a pointer to where to store the width of the wedge in degrees
+ */
+static bool track_find_wedge_binned(const track *const *trks, int n, double *west, double *span)
+{
+    const lon_bins *bins = track_lon_bins(trks[0]);
+    lon_bins *merged = NULL;
+    if (bins != NULL && n > 1)
+    {
+        merged = malloc(sizeof(lon_bins));
+        if (merged != NULL)
+        {
+            *merged = *bins;
+        }
+        for (int t=1; t<n && merged != NULL; t++)
+        {
+            const lon_bins *more = track_lon_bins(trks[t]);
+            if (more == NULL)
+            {
+                free(merged);
+                merged = NULL;
+                break;
+            }
+            for (int k=0; k<LON_BINS; k++)
+            {
+                if (more->occupied[k / 64] & ((uint64_t) 1 << (k % 64)))
+                {
+                    lon_bins_add(merged, more->min[k]);
+                    lon_bins_add(merged, more->max[k]);
+                }
+            }
+            merged->out_of_range = merged->out_of_range || more->out_of_range;
+        }
+        bins = merged;
+    }
+    if (bins == NULL || bins->out_of_range)
+    {
+        free(merged);
+        return false;
+    }
+
+    int first = -1;
+    int last = -1;
+    for (int k=0; k<LON_BINS; k++)
+    {
+        if (bins->occupied[k / 64] & ((uint64_t) 1 << (k % 64)))
+        {
+            if (first < 0)
+            {
+                first = k;
+            }
+            last = k;
+        }
+    }
+
+    // the wedge that starts at the westernmost longitude, then the
+    // wedges that wrap around past 180 at each gap between bins
+    double best_west = bins->min[first];
+    double best_span = bins->max[last] - bins->min[first];
+    int prev = first;
+    for (int k=first+1; k<=last; k++)
+    {
+        if (bins->occupied[k / 64] & ((uint64_t) 1 << (k % 64)))
+        {
+            double wrapped_span = bins->max[prev] + 360.0 - bins->min[k];
+            if (wrapped_span < best_span)
+            {
+                best_span = wrapped_span;
+                best_west = bins->min[k];
+            }
+            prev = k;
+        }
+    }
+    free(merged);
+
+    if (best_span > 360.0 - 2 * LON_BIN_WIDTH)
+    {
+        return false;
+    }
+    *west = best_west;
+    *span = best_span;
+    return true;
+}
+
+/**
+ * Allocates a zeroed rows x cols heatmap with each row separately
+ * allocated.  Returns NULL if there is a memory allocation error, in
+ * which case nothing remains allocated.
+ *
+ * @param rows a positive integer
+ * @param cols a positive integer
+ * @param size the size of each element
+ */
+static void **heatmap_alloc(int rows, int cols, size_t size)
+{
+    void **map = malloc(sizeof(void*) * rows);
+    if (map == NULL)
+    {
+        return NULL;
+    }
+
+    for (int r=0; r<rows; r++)
+    {
+        map[r] = calloc(cols, size);
+        if (map[r] == NULL)
+        {
+            while (r > 0)
+            {
+                free(map[--r]);
+            }
+            free(map);
+            return NULL;
+        }
+    }
+    return map;
+}
+
+/**
+ * Frees a heatmap allocated by heatmap_alloc.
+ *
+ * @param map a pointer to an array of rows
+ * @param rows the number of rows in map
+ */
+static void free_map(int **map, int rows)
+{
+    for (int r=0; r<rows; r++)
+    {
+        free(map[r]);
+    }
+    free(map);
+}
+
+/**
+ * Finds the least and greatest latitudes of the points of the given
+ * tracks from their segment summaries.  There must be at least one
+ * point among them.
+ */
+static void track_lat_bounds(const track *const *trks, int n, double *south, double *north)
+{
+    *north = -90;
+    *south = 90;
+    for (int t=0; t<n; t++)
+    {
+        const track *trk = trks[t];
+        for (int i=0; i<trk->count; i++)
+        {
+            const segment *seg = &trk->segments[i];
+            if (seg->count > 0 && seg->north > *north)
+            {
+                *north = seg->north;
+            }
+            if (seg->count > 0 && seg->south < *south)
+            {
+                *south = seg->south;
+            }
+        }
+    }
+}
+
+/**
+ * Finds the smallest wedge containing the longitudes of the points of
+ * the given tracks, of which there are total, from the longitude bins
+ * or failing that from sorting all the longitudes.  Returns false if
+ * there is a memory allocation error.
+ */
+static bool track_wedge(const track *const *trks, int n, long total, double *west, double *span)
+{
+    if (track_find_wedge_binned(trks, n, west, span))
+    {
+        return true;
+    }
+
+    double *lons = malloc(sizeof(double) * total);
+    if (lons == NULL)
+    {
+        return false;
+    }
+
+    long k = 0;
+    for (int t=0; t<n; t++)
+    {
+        const track *trk = trks[t];
+        for (int i=0; i<trk->count; i++)
+        {
+            const segment *seg = &trk->segments[i];
+            for (int b=0; b<segment_blocks(seg); b++)
+            {
+                trkrec scratch[TRACK_BLOCK_POINTS];
+                const trkrec *pts;
+                int count = segment_block(trk, seg, b, scratch, &pts);
+                for (int j=0; j<count; j++)
+                {
+                    lons[k++] = pts[j].loc.lon;
+                }
+            }
+        }
+    }
+
+    track_find_wedge(lons, total, west, span);
+    free(lons);
+    return true;
+}
+
+/**
+ * Computes the heatmap geometry shared by the given tracks as described
+ * for track_heatmap, treating all their points as if they were on one
+ * track.  An empty set of points gets a 1x1 grid.  Returns false if
+ * the cell size is invalid or there is a memory allocation error.
+ *
+ * @param trks an array of pointers to valid tracks
+ * @param n the number of tracks in trks
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param grid a pointer to the grid to fill in
+ */
+static bool track_heatmap_grid_multi(const track *const *trks, int n, double cell_width,
+                                     double cell_height, heatmap_grid *grid)
+{
+    if (!(cell_width > 0 && cell_width <= 360.0 && cell_height > 0 && cell_height <= 180.0))
+    {
+        return false;
+    }
+
+    grid->cell_width = cell_width;
+    grid->cell_height = cell_height;
+    grid->north = 0;
+    grid->west = 0;
+    grid->rows = 1;
+    grid->cols = 1;
+
+    long total_trkpts = 0;
+    for (int t=0; t<n; t++)
+    {
+        for (int i=0; i<trks[t]->count; i++)
+        {
+            total_trkpts += trks[t]->segments[i].count;
+        }
+    }
+    if (total_trkpts == 0)
+    {
+        return true;
+    }
+
+    double north_bound, south_bound, span;
+    track_lat_bounds(trks, n, &south_bound, &north_bound);
+    if (!track_wedge(trks, n, total_trkpts, &grid->west, &span))
+    {
+        return false;
+    }
+
+    // always at least one row and column so every point has a cell
+    grid->north = north_bound;
+    grid->rows = (int) ceil((north_bound - south_bound) / cell_height);
+    grid->cols = (int) ceil(span / cell_width);
+    if (grid->rows < 1)
+    {
+        grid->rows = 1;
+    }
+    if (grid->cols < 1)
+    {
+        grid->cols = 1;
+    }
+    return true;
+}
+
+/**
+ * Computes the heatmap geometry of the given track as described for
+ * track_heatmap.  An empty track gets a 1x1 grid.  Returns false if
+ * the cell size is invalid or there is a memory allocation error.
+ *
+ * @param trk a pointer to a valid track
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param grid a pointer to the grid to fill in
+ */
+static bool track_heatmap_grid(const track *trk, double cell_width, double cell_height,
+                               heatmap_grid *grid)
+{
+    return track_heatmap_grid_multi(&trk, 1, cell_width, cell_height, grid);
+}
+
+/**
+ * Converts a location to continuous grid coordinates, with x counting
+ * columns east of the western edge and y counting rows south of the
+ * northern edge.  Points on the south and east borders are pulled
+ * just inside so that they land in the existing bottommost and
+ * rightmost cells.
+ *
+ * @param grid a pointer to a valid grid containing loc
+ * @param loc a location
+ * @param x a pointer to where to store the column coordinate
+ * @param y a pointer to where to store the row coordinate
+ */
+static void heatmap_position(const heatmap_grid *grid, location loc, double *x, double *y)
+{
+    double east = loc.lon - grid->west;
+    if (east < 0)
+    {
+        east += 360.0;
+    }
+
+    *x = fmin(east / grid->cell_width, nextafter((double) grid->cols, 0.0));
+    *y = fmin((grid->north - loc.lat) / grid->cell_height, nextafter((double) grid->rows, 0.0));
+}
+
+/**
+ * State for walking the unit cells crossed by a line segment from
+ * (x0, y0) to (x1, y1), following Amanatides and Woo.  The segment is
+ * parameterized by t from 0 to 1; the divisions all happen in
+ * grid_walk_start so that each step is a comparison and an addition.
+ */
+typedef struct grid_walk
+{
+    int col;
+    int row;
+    int step_col;
+    int step_row;
+    double t;
+    double t_max_col;
+    double t_max_row;
+    double t_delta_col;
+    double t_delta_row;
+} grid_walk;
+
+/**
+ * Initializes the given walk along one axis.
+ */
+static void grid_walk_axis(double p0, double p1, int *cell, int *step, double *t_max, double *t_delta)
+{
+    double d = p1 - p0;
+    double base = floor(p0);
+
+    *cell = (int) base;
+    if (d > 0)
+    {
+        *step = 1;
+        *t_delta = 1.0 / d;
+        *t_max = (base + 1.0 - p0) * *t_delta;
+    }
+    else if (d < 0)
+    {
+        *step = -1;
+        *t_delta = -1.0 / d;
+        *t_max = (p0 - base) * *t_delta;
+    }
+    else
+    {
+        *step = 0;
+        *t_delta = HUGE_VAL;
+        *t_max = HUGE_VAL;
+    }
+}
+
+/**
+ * Starts a walk along the segment from (x0, y0) to (x1, y1).
+ */
+static void grid_walk_start(grid_walk *w, double x0, double y0, double x1, double y1)
+{
+    grid_walk_axis(x0, x1, &w->col, &w->step_col, &w->t_max_col, &w->t_delta_col);
+    grid_walk_axis(y0, y1, &w->row, &w->step_row, &w->t_max_row, &w->t_delta_row);
+    w->t = 0.0;
+}
+
+/**
+ * Advances the walk to the next cell.  Returns false when the walk is
+ * over; otherwise the cell and the parameter interval [t0, t1] the
+ * segment spends in it are stored in the reference parameters.
+ */
+static bool grid_walk_next(grid_walk *w, int *col, int *row, double *t0, double *t1)
+{
+    if (w->t >= 1.0)
+    {
+        return false;
+    }
+
+    *col = w->col;
+    *row = w->row;
+    *t0 = w->t;
+    if (w->t_max_col < w->t_max_row)
+    {
+        w->t = w->t_max_col;
+        w->t_max_col += w->t_delta_col;
+        w->col += w->step_col;
+    }
+    else
+    {
+        w->t = w->t_max_row;
+        w->t_max_row += w->t_delta_row;
+        w->row += w->step_row;
+    }
+    if (w->t > 1.0)
+    {
+        w->t = 1.0;
+    }
+    *t1 = w->t;
+    return true;
+}
+
+/**
+ * A piece of a hop in grid coordinates, covering the parameter
+ * interval [t0, t1] of the whole hop.
+ */
+typedef struct hop_piece
+{
+    double x0, y0, x1, y1;
+    double t0, t1;
+} hop_piece;
+
+/**
+ * Splits the hop between two locations into the pieces that lie on
+ * the unwrapped grid.  The hop follows the shorter way around in
+ * longitude; if that crosses the meridian 360 degrees from the
+ * western edge (at x = 0 going west or x = 360 / cell_width going
+ * east) the hop is cut there and continues from the other side.
+ * Returns the number of pieces (1 or 2).
+ *
+ * @param grid a pointer to a valid grid containing both locations
+ * @param from the location at the start of the hop
+ * @param to the location at the end of the hop
+ * @param pieces an array of at least two pieces
+ */
+static int heatmap_hop_pieces(const heatmap_grid *grid, location from, location to, hop_piece *pieces)
+{
+    double x0, y0, x1, y1;
+    heatmap_position(grid, from, &x0, &y0);
+    heatmap_position(grid, to, &x1, &y1);
+
+    double delta_lon = fmod(to.lon - from.lon + 540.0, 360.0) - 180.0;
+    double x_end = x0 + delta_lon / grid->cell_width;
+    double around = 360.0 / grid->cell_width;
+    double seam;
+
+    if (x_end < 0)
+    {
+        seam = 0;
+    }
+    else if (x_end > around)
+    {
+        seam = around;
+    }
+    else
+    {
+        pieces[0] = (hop_piece) {x0, y0, x1, y1, 0.0, 1.0};
+        return 1;
+    }
+
+    double f = (seam - x0) / (x_end - x0);
+    double y_seam = y0 + f * (y1 - y0);
+    double other_side = around - seam;
+    pieces[0] = (hop_piece) {x0, y0, seam, y_seam, 0.0, f};
+    pieces[1] = (hop_piece) {other_side, y_seam, x1, y1, f, 1.0};
+    return 2;
+}
+
+
+/**
+ * The smallest number of points worth handing to a thread of its own
+ * when binning in parallel, and the most memory the extra per-thread
+ * maps may take.
+ */
+#define HEATMAP_POINTS_PER_WORKER 32768
+#define HEATMAP_WORKER_MAP_BYTES (64L * 1024 * 1024)
+#define HEATMAP_MAX_WORKERS 64
+
+/**
+ * A share of the points of a track to bin into a heatmap of its own.
+ * The share runs from point first_point of segment first_segment up
+ * to but not including point end_point of segment end_segment (or
+ * through the last segment if end_segment is the number of segments).
+ * The bin function is called for each point in the share with the
+ * point's segment and index; for a point other than the first in its
+ * segment it is expected to bin the hop that ends there.
+ */
+typedef struct heatmap_job
+{
+    const track *trk;
+    const heatmap_grid *grid;
+    int first_segment;
+    int first_point;
+    int end_segment;
+    int end_point;
+    int **map;
+    const void *arg;
+    void (*bin)(struct heatmap_job *job, int seg, int j);
+} heatmap_job;
+
+/**
+ * Runs the given job over its share of the points.
+ */
+static void *heatmap_job_run(void *arg)
+{
+    heatmap_job *job = arg;
+    const track *trk = job->trk;
+
+    for (int i=job->first_segment; i<trk->count && i<=job->end_segment; i++)
+    {
+        int from = (i == job->first_segment ? job->first_point : 0);
+        int to = (i == job->end_segment ? job->end_point : trk->segments[i].count);
+        for (int j=from; j<to; j++)
+        {
+            job->bin(job, i, j);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Bins the points and hops of the given track into a new heatmap by
+ * splitting them into contiguous shares of about the same number of
+ * points, binning each share on its own thread into its own map, and
+ * summing the maps at the end.  Small tracks, and grids too big to
+ * copy per thread, are binned on the calling thread alone.  Returns
+ * NULL if there is a memory allocation error.
+ *
+ * @param trk a pointer to a valid track
+ * @param grid a pointer to the grid for the track
+ * @param bin the function binning one point or hop
+ * @param arg extra data for bin
+ */
+static int **track_heatmap_parallel(const track *trk, const heatmap_grid *grid,
+                                    void (*bin)(heatmap_job *job, int seg, int j), const void *arg)
+{
+    long total_trkpts = 0;
+    for (int i=0; i<trk->count; i++)
+    {
+        total_trkpts += trk->segments[i].count;
+    }
+
+    // decide how many threads are worth it
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    long map_bytes = (long) grid->rows * grid->cols * (long) sizeof(int);
+    if (workers > total_trkpts / HEATMAP_POINTS_PER_WORKER)
+    {
+        workers = total_trkpts / HEATMAP_POINTS_PER_WORKER;
+    }
+    if (workers > 1 + HEATMAP_WORKER_MAP_BYTES / map_bytes)
+    {
+        workers = 1 + HEATMAP_WORKER_MAP_BYTES / map_bytes;
+    }
+    if (workers > HEATMAP_MAX_WORKERS)
+    {
+        workers = HEATMAP_MAX_WORKERS;
+    }
+    if (workers < 1)
+    {
+        workers = 1;
+    }
+
+    heatmap_job jobs[HEATMAP_MAX_WORKERS];
+    pthread_t threads[HEATMAP_MAX_WORKERS];
+    bool started[HEATMAP_MAX_WORKERS];
+
+    // split the points into shares at segment and point boundaries
+    long share = (total_trkpts + workers - 1) / workers;
+    int seg = 0;
+    int point = 0;
+    for (int w=0; w<workers; w++)
+    {
+        jobs[w].trk = trk;
+        jobs[w].grid = grid;
+        jobs[w].arg = arg;
+        jobs[w].bin = bin;
+        jobs[w].first_segment = seg;
+        jobs[w].first_point = point;
+
+        long needed = share;
+        while (seg < trk->count && needed >= trk->segments[seg].count - point)
+        {
+            needed -= trk->segments[seg].count - point;
+            seg++;
+            point = 0;
+        }
+        if (seg < trk->count)
+        {
+            point += needed;
+        }
+        jobs[w].end_segment = seg;
+        jobs[w].end_point = point;
+
+        jobs[w].map = (int **) heatmap_alloc(grid->rows, grid->cols, sizeof(int));
+        if (jobs[w].map == NULL)
+        {
+            for (int k=0; k<w; k++)
+            {
+                free_map(jobs[k].map, grid->rows);
+            }
+            return NULL;
+        }
+    }
+
+    for (int w=1; w<workers; w++)
+    {
+        started[w] = (pthread_create(&threads[w], NULL, heatmap_job_run, &jobs[w]) == 0);
+    }
+    heatmap_job_run(&jobs[0]);
+    for (int w=1; w<workers; w++)
+    {
+        if (started[w])
+        {
+            pthread_join(threads[w], NULL);
+        }
+        else
+        {
+            heatmap_job_run(&jobs[w]);
+        }
+    }
+
+    // sum into the first map
+    for (int w=1; w<workers; w++)
+    {
+        for (int r=0; r<grid->rows; r++)
+        {
+            for (int c=0; c<grid->cols; c++)
+            {
+                jobs[0].map[r][c] += jobs[w].map[r][c];
+            }
+        }
+        free_map(jobs[w].map, grid->rows);
+    }
+    return jobs[0].map;
+}
+
+/**
+ * Marks the cell at the given grid position in the given job's map
+ * unless it is the same as the previously marked cell.
+ */
+static void coverage_mark(heatmap_job *job, int col, int row, int *last_col, int *last_row)
+{
+    if ((col != *last_col || row != *last_row)
+        && row >= 0 && row < job->grid->rows && col >= 0 && col < job->grid->cols)
+    {
+        job->map[row][col]++;
+    }
+    *last_col = col;
+    *last_row = row;
+}
+
+/**
+ * Bins point j of segment seg for a coverage heatmap.  The first point
+ * of a segment marks its own cell; every other point marks the cells
+ * the hop ending there enters, including its own cell but not the cell
+ * the hop starts in.
+ */
+static void coverage_bin(heatmap_job *job, int seg, int j)
+{
+    const heatmap_grid *grid = job->grid;
+    const segment *s = &job->trk->segments[seg];
+    double x, y;
+
+    if (j == 0)
+    {
+        heatmap_position(grid, segment_get(job->trk, s, 0).loc, &x, &y);
+        job->map[(int) y][(int) x]++;
+        return;
+    }
+
+    location from = segment_get(job->trk, s, j-1).loc;
+    location to = segment_get(job->trk, s, j).loc;
+
+    heatmap_position(grid, from, &x, &y);
+    int last_col = (int) x;
+    int last_row = (int) y;
+
+    hop_piece pieces[2];
+    int num_pieces = heatmap_hop_pieces(grid, from, to, pieces);
+    for (int p=0; p<num_pieces; p++)
+    {
+        grid_walk walk;
+        int col, row;
+        double t0, t1;
+        grid_walk_start(&walk, pieces[p].x0, pieces[p].y0, pieces[p].x1, pieces[p].y1);
+        while (grid_walk_next(&walk, &col, &row, &t0, &t1))
+        {
+            // corners the hop only touches are not crossed
+            if (t1 > t0)
+            {
+                coverage_mark(job, col, row, &last_col, &last_row);
+            }
+        }
+    }
+
+    heatmap_position(grid, to, &x, &y);
+    coverage_mark(job, (int) x, (int) y, &last_col, &last_row);
+}
+
+
+/**
+ * Scale factors for rasterizing sweep-width corridors: the number of
+ * grid columns per meter east-west at the center of each row (computed
+ * once per row) and the number of grid rows per meter north-south.
+ */
+typedef struct corridor_scale
+{
+    double half_width;
+    double rows_per_meter;
+    double *cols_per_meter;
+} corridor_scale;
+
+/**
+ * Marks every cell of the given job's map that the convex polygon with
+ * the given vertices (in grid coordinates, in order around the polygon)
+ * overlaps, each at most once.  Each row the polygon spans is filled
+ * between the leftmost and rightmost points of the polygon within that
+ * row, found by clipping each edge to the row.
+ */
+static void corridor_fill(heatmap_job *job, const double *xs, const double *ys, int n)
+{
+    const heatmap_grid *grid = job->grid;
+
+    double y_min = ys[0];
+    double y_max = ys[0];
+    for (int k=1; k<n; k++)
+    {
+        y_min = fmin(y_min, ys[k]);
+        y_max = fmax(y_max, ys[k]);
+    }
+
+    int first_row = (int) floor(y_min);
+    int last_row = (int) ceil(y_max) - 1;
+    if (last_row < first_row)
+    {
+        last_row = first_row;
+    }
+    if (first_row < 0)
+    {
+        first_row = 0;
+    }
+    if (last_row > grid->rows - 1)
+    {
+        last_row = grid->rows - 1;
+    }
+
+    for (int r=first_row; r<=last_row; r++)
+    {
+        double top = fmax((double) r, y_min);
+        double bottom = fmin((double) r + 1, y_max);
+        double x_min = HUGE_VAL;
+        double x_max = -HUGE_VAL;
+
+        for (int k=0; k<n; k++)
+        {
+            double ax = xs[k], ay = ys[k];
+            double bx = xs[(k+1) % n], by = ys[(k+1) % n];
+
+            // clip the edge to the row
+            if (ay > by)
+            {
+                double tx = ax, ty = ay;
+                ax = bx; ay = by;
+                bx = tx; by = ty;
+            }
+            if (by < top || ay > bottom)
+            {
+                continue;
+            }
+            if (by == ay)
+            {
+                x_min = fmin(x_min, fmin(ax, bx));
+                x_max = fmax(x_max, fmax(ax, bx));
+                continue;
+            }
+            double slope = (bx - ax) / (by - ay);
+            double lo = fmax(ay, top);
+            double hi = fmin(by, bottom);
+            double x_lo = ax + (lo - ay) * slope;
+            double x_hi = ax + (hi - ay) * slope;
+            x_min = fmin(x_min, fmin(x_lo, x_hi));
+            x_max = fmax(x_max, fmax(x_lo, x_hi));
+        }
+
+        if (x_min > x_max)
+        {
+            continue;
+        }
+
+        int first_col = (int) floor(x_min);
+        int last_col = (int) ceil(x_max) - 1;
+        if (last_col < first_col)
+        {
+            last_col = first_col;
+        }
+        if (first_col < 0)
+        {
+            first_col = 0;
+        }
+        if (last_col > grid->cols - 1)
+        {
+            last_col = grid->cols - 1;
+        }
+        for (int c=first_col; c<=last_col; c++)
+        {
+            job->map[r][c]++;
+        }
+    }
+}
+
+/**
+ * Rasterizes the corridor around the piece of a hop from (x0, y0) to
+ * (x1, y1) in grid coordinates: a rectangle extending half the sweep
+ * width to either side of the piece and past each end, so that the
+ * corridors of consecutive hops overlap at the turns.  A piece of no
+ * length gets a square centered on it.
+ */
+static void corridor_piece(heatmap_job *job, double x0, double y0, double x1, double y1)
+{
+    const corridor_scale *scale = job->arg;
+    const heatmap_grid *grid = job->grid;
+
+    // the longitude scale of the row the middle of the piece is in
+    int row = (int) floor((y0 + y1) / 2);
+    if (row < 0)
+    {
+        row = 0;
+    }
+    if (row > grid->rows - 1)
+    {
+        row = grid->rows - 1;
+    }
+    double cols_per_meter = scale->cols_per_meter[row];
+    double rows_per_meter = scale->rows_per_meter;
+
+    // direction of the piece in meters
+    double east = (x1 - x0) / cols_per_meter;
+    double south = (y1 - y0) / rows_per_meter;
+    double length = sqrt(east * east + south * south);
+    double ue = 1.0;
+    double us = 0.0;
+    if (length > 0)
+    {
+        ue = east / length;
+        us = south / length;
+    }
+
+    // half-width offsets along and across the piece, back in grid units
+    double along_x = ue * scale->half_width * cols_per_meter;
+    double along_y = us * scale->half_width * rows_per_meter;
+    double across_x = -us * scale->half_width * cols_per_meter;
+    double across_y = ue * scale->half_width * rows_per_meter;
+
+    double xs[4] = {x0 - along_x + across_x, x1 + along_x + across_x,
+                    x1 + along_x - across_x, x0 - along_x - across_x};
+    double ys[4] = {y0 - along_y + across_y, y1 + along_y + across_y,
+                    y1 + along_y - across_y, y0 - along_y - across_y};
+    corridor_fill(job, xs, ys, 4);
+}
+
+/**
+ * Bins point j of segment seg for a corridor heatmap.  A point other
+ * than the first in its segment rasterizes the corridor of the hop
+ * ending there; a segment with a single point gets a square the sweep
+ * width across around it.
+ */
+static void corridor_bin(heatmap_job *job, int seg, int j)
+{
+    const segment *s = &job->trk->segments[seg];
+
+    if (j == 0)
+    {
+        if (s->count == 1)
+        {
+            double x, y;
+            heatmap_position(job->grid, segment_get(job->trk, s, 0).loc, &x, &y);
+            corridor_piece(job, x, y, x, y);
+        }
+        return;
+    }
+
+    hop_piece pieces[2];
+    int num_pieces = heatmap_hop_pieces(job->grid, segment_get(job->trk, s, j-1).loc,
+                                        segment_get(job->trk, s, j).loc, pieces);
+    for (int p=0; p<num_pieces; p++)
+    {
+        corridor_piece(job, pieces[p].x0, pieces[p].y0, pieces[p].x1, pieces[p].y1);
+    }
+}
+
+
+/**
+ * Creates a heapmap of the given track.  The heatmap will be a
+ * rectangular 2-D array with each row separately allocated.  The last
+ * three paramters are (simulated) reference parameters used to return
+ * the heatmap and its dimensions.  Each element in the heatmap
+ * represents an area bounded by two circles of latitude and two
+ * meridians of longitude.  
+ * 
+ * The circle of latitude bounding the top of
+ * the top row is the northernmost (highest) latitude of any
+ * trackpoint in the given track.  The meridian bounding the left of
+ * the first column is the western edge of the smallest spherical
+ * wedge bounded by two meridians the contains all the points in the
+ * track (the "western edge" for a nontrivial wedge being the one
+ * that, when you move east from it along the equator, you stay in the
+ * wedge).  When there are multple such wedges, choose the one with
+ * the lowest normalized (adjusted to the range -180 (inclusive) to
+ * 180 (exclusive)) longitude.  The distance (in degrees) between the
+ * bounds of adjacent rows and columns is given by the last two
+ * parameters.  
+ * 
+ * The heat map will have just enough rows and just
+ * enough columns so that all points in the track fall into some cell.
+ * The value in each entry in the heatmap is the number of trackpoints
+ * located in the corresponding cell.  If a trackpoint is on the
+ * border of two or more cells then it is counted in the bottommost
+ * and rightmost cell it is on the border of, but do not add a row or
+ * column just to place points on the south and east borders into
+ * them and instead place the points on those borders by breaking ties
+ * only between cells that already exist.
+ * 
+ * If there are no trackpoints in the track then the function
+ * creates a 1x1 heatmap with the single element having a value of 0.
+ * 
+ * If the cell size is invalid or if there is a memory allocation
+ * error then the map is set to NULL and the rows and columns
+ * parameters are unchanged.  It is the caller's responsibility to
+ * free each row in the returned array and the array itself.
+ *
+ * @param trk a pointer to a valid trackpoint
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_heatmap(const track *trk, double cell_width, double cell_height,
+		    int ***map, int *rows, int *cols)
+{
+    heatmap_grid grid;
+
+    if (map == NULL)
+    {
+        return;
+    }
+    *map = NULL;
+
+    if (trk == NULL || !track_heatmap_grid(trk, cell_width, cell_height, &grid))
+    {
+        return;
+    }
+
+    int **map_temp = (int **) heatmap_alloc(grid.rows, grid.cols, sizeof(int));
+    if (map_temp == NULL)
+    {
+        return;
+    }
+
+    // for each trkpt, a block at a time
+    for (int i=0; i<trk->count; i++)
+    {
+        const segment *seg = &trk->segments[i];
+        for (int b=0; b<segment_blocks(seg); b++)
+        {
+            trkrec scratch[TRACK_BLOCK_POINTS];
+            const trkrec *pts;
+            int count = segment_block(trk, seg, b, scratch, &pts);
+            for (int j=0; j<count; j++)
+            {
+                double x, y;
+                heatmap_position(&grid, pts[j].loc, &x, &y);
+                map_temp[(int) y][(int) x]++;
+            }
+        }
+    }
+
+    *map = map_temp;
+    *rows = grid.rows;
+    *cols = grid.cols;
+}
+
+// rows per degree of latitude in the table of cosines for projecting
+#define COS_ROWS_PER_DEGREE 256
+
+/**
+ * A sinusoidal projection of the points of a track: the parallel
+ * scale at each of a table of latitudes from the south bound at
+ * COS_ROWS_PER_DEGREE rows per degree, interpolated linearly between
+ * rows, and the offsets in degrees that put the central meridian at 0.
+ */
+typedef struct sinusoidal
+{
+    double *scale;
+    double south;
+    double west;
+    double half_span;
+} sinusoidal;
+
+/**
+ * Projects n points, storing their distances in meters east of the
+ * central meridian in x.  The loop has no branches or calls so that
+ * the compiler can vectorize it.
+ */
+static void sinusoidal_project(const sinusoidal *proj, const trkrec *pts, int n, double *x)
+{
+    for (int j=0; j<n; j++)
+    {
+        double row = (pts[j].loc.lat - proj->south) * COS_ROWS_PER_DEGREE;
+        int k = (int) row;
+        double f = row - k;
+        double scale = proj->scale[k] + (proj->scale[k+1] - proj->scale[k]) * f;
+        double east = pts[j].loc.lon - proj->west;
+        east += (east < 0) * 360.0;
+        x[j] = (east - proj->half_span) * scale;
+    }
+}
+
+/**
+ * Creates a heatmap of the given track on a grid of cells measured in
+ * meters, counting the trackpoints in each cell as track_heatmap does.
+ * The points are placed on a sinusoidal projection of a spherical
+ * earth centered on the middle of the smallest wedge holding the
+ * track's longitudes: y is the distance south of the track's northmost
+ * latitude and x is the distance east of the central meridian along
+ * the point's parallel.  That projection is equal-area, so every cell
+ * covers the same area of ground wherever it is, and near the central
+ * meridian it barely distorts distances either.  The first row's top
+ * is the northmost point and the columns are whole cells east and west
+ * of the central meridian, with just enough rows and columns to hold
+ * every point.  A point on a border is counted in the cell east or
+ * south of it, except that points on the south border of the last row
+ * are counted in that row.  Points are projected and counted in one
+ * pass with a table of the scale of each parallel, so this is not much
+ * slower than track_heatmap.  An empty track gets a 1x1 heatmap
+ * holding 0.
+ *
+ * If the cell size is invalid or if there is a memory allocation
+ * error then the map is set to NULL and the rows and columns
+ * parameters are unchanged.  It is the caller's responsibility to
+ * free each row in the returned array and the array itself.
+ *
+ * @param trk a pointer to a valid track
+ * @param cell_width a positive width in meters
+ * @param cell_height a positive height in meters
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_heatmap_meters(const track *trk, double cell_width, double cell_height,
+                          int ***map, int *rows, int *cols)
+{
+    if (map == NULL)
+    {
+        return;
+    }
+    *map = NULL;
+    if (trk == NULL || !(cell_width > 0 && cell_height > 0))
+    {
+        return;
+    }
+
+    long total = 0;
+    for (int i=0; i<trk->count; i++)
+    {
+        total += trk->segments[i].count;
+    }
+    if (total == 0)
+    {
+        int **empty = (int **) heatmap_alloc(1, 1, sizeof(int));
+        if (empty != NULL)
+        {
+            *map = empty;
+            *rows = 1;
+            *cols = 1;
+        }
+        return;
+    }
+
+    double north, span;
+    sinusoidal proj;
+    track_lat_bounds(&trk, 1, &proj.south, &north);
+    if (!track_wedge(&trk, 1, total, &proj.west, &span))
+    {
+        return;
+    }
+    proj.half_span = span / 2;
+
+    // two rows past the north bound so interpolation never reads past the end
+    int table_rows = (int) ((north - proj.south) * COS_ROWS_PER_DEGREE) + 2;
+    proj.scale = malloc(sizeof(double) * table_rows);
+    if (proj.scale == NULL)
+    {
+        return;
+    }
+    for (int k=0; k<table_rows; k++)
+    {
+        proj.scale[k] = cos(RADIANS(proj.south + (double) k / COS_ROWS_PER_DEGREE)) * METERS_PER_DEGREE;
+    }
+
+    // columns are whole cells either side of the central meridian, as
+    // many as the widest parallel could need; the empty ones are trimmed
+    double widest = (proj.south <= 0 && north >= 0 ? 1.0 : fmax(cos(RADIANS(proj.south)), cos(RADIANS(north))));
+    int half_cols = (int) ceil(proj.half_span * widest * METERS_PER_DEGREE / cell_width) + 1;
+    int num_rows = (int) ceil((north - proj.south) * METERS_PER_DEGREE / cell_height);
+    num_rows = (num_rows > 1 ? num_rows : 1);
+    int num_cols = 2 * half_cols;
+    int **map_temp = (int **) heatmap_alloc(num_rows, num_cols, sizeof(int));
+    if (map_temp == NULL)
+    {
+        free(proj.scale);
+        return;
+    }
+
+    double x[TRACK_BLOCK_POINTS];
+    double last_row = nextafter((double) num_rows, 0.0);
+    int west_col = num_cols;
+    int east_col = -1;
+    for (int i=0; i<trk->count; i++)
+    {
+        const segment *seg = &trk->segments[i];
+        for (int b=0; b<segment_blocks(seg); b++)
+        {
+            trkrec scratch[TRACK_BLOCK_POINTS];
+            const trkrec *pts;
+            int count = segment_block(trk, seg, b, scratch, &pts);
+            sinusoidal_project(&proj, pts, count, x);
+            for (int j=0; j<count; j++)
+            {
+                int col = (int) floor(x[j] / cell_width) + half_cols;
+                col = (col < 0 ? 0 : (col >= num_cols ? num_cols - 1 : col));
+                double row = fmin((north - pts[j].loc.lat) * METERS_PER_DEGREE / cell_height, last_row);
+                map_temp[(int) row][col]++;
+                west_col = (col < west_col ? col : west_col);
+                east_col = (col > east_col ? col : east_col);
+            }
+        }
+    }
+
+    // keep the columns from the westmost point to the eastmost
+    num_cols = east_col - west_col + 1;
+    for (int r=0; r<num_rows && west_col > 0; r++)
+    {
+        memmove(map_temp[r], map_temp[r] + west_col, sizeof(int) * num_cols);
+    }
+    free(proj.scale);
+
+    *map = map_temp;
+    *rows = num_rows;
+    *cols = num_cols;
+}
+
+// the width of a hexagon across its flat sides over its size
+#define SQRT3 1.7320508075688772
+
+/**
+ * Returns the largest integer not greater than v, which must be in the
+ * range of an int.  Unlike floor this compiles to a conversion and a
+ * compare that vectorize without SSE4.1.
+ */
+static inline double hex_floor(double v)
+{
+    double t = (double) (int) v;
+    return t - (t > v);
+}
+
+/**
+ * Finds the hexagon holding each of n points on a grid of pointy-top
+ * hexagons of the given size with one centered on (0, 0), where a runs
+ * along the rows and b across them.  The row of the hexagon goes in
+ * major and its place in the row in minor, with odd rows shifted half
+ * a hexagon toward positive a.  Each point is rounded to the nearest
+ * cube coordinates and the one that rounded furthest is recomputed
+ * from the other two, with selects rather than branches so that the
+ * loop vectorizes.
+ */
+static void hex_round(const double *a, const double *b, int n, double size, int *major, int *minor)
+{
+    double qa = SQRT3 / 3 / size;
+    double qb = -1.0 / 3 / size;
+    double rb = 2.0 / 3 / size;
+    for (int j=0; j<n; j++)
+    {
+        double q = a[j] * qa + b[j] * qb;
+        double r = b[j] * rb;
+        double s = -q - r;
+        double rq = hex_floor(q + 0.5);
+        double rr = hex_floor(r + 0.5);
+        double rs = hex_floor(s + 0.5);
+        double dq = fabs(rq - q);
+        double dr = fabs(rr - r);
+        double ds = fabs(rs - s);
+        int fix_q = (dq > dr) & (dq > ds);
+        int fix_r = !fix_q & (dr > ds);
+        rq = (fix_q ? -rr - rs : rq);
+        rr = (fix_r ? -rq - rs : rr);
+        int row = (int) rr;
+        major[j] = row;
+        minor[j] = (int) rq + (row - (row & 1)) / 2;
+    }
+}
+
+/**
+ * Creates a heatmap of the given track on a grid of hexagons, counting
+ * the trackpoints in each.  Every hexagon has six neighbors all the
+ * same distance away, where a square cell's diagonal neighbors are
+ * further than the others.  The hexagons are of the given size, from
+ * center to corner, in degrees of latitude and longitude or, if meters
+ * is true, in meters on the projection track_heatmap_meters uses.  The
+ * northmost point is on the top row and there are just enough rows and
+ * columns to hold every point.  A point is counted in the hexagon whose
+ * center is nearest, with ties going to one of them the same way each
+ * time.
+ *
+ * The map is rectangular, with each row separately allocated, in
+ * offset coordinates: with pointy hexagons each row of the map is a row
+ * of hexagons, and the odd rows are shifted half a hexagon east of the
+ * even ones; with flat hexagons each column of the map is a column of
+ * hexagons, and the odd columns are shifted half a hexagon south.  That
+ * packs the cells without the empty corners a map in axial coordinates
+ * would need.  The dimensions of the map and the position of its cells
+ * are stored in *layout.  An empty track gets a 1x1 heatmap holding 0.
+ *
+ * If the size is invalid or if there is a memory allocation error then
+ * the map is set to NULL and the layout is unchanged.  It is the
+ * caller's responsibility to free each row in the returned array and
+ * the array itself.
+ *
+ * @param trk a pointer to a valid track
+ * @param size a positive size in degrees or meters
+ * @param orientation which way the hexagons are turned
+ * @param meters true for a size in meters, false for degrees
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param layout a pointer to where to store the layout of the map
+ */
+void track_heatmap_hex(const track *trk, double size, track_hex_orientation orientation, bool meters,
+                       int ***map, track_hex_layout *layout)
+{
+    if (map == NULL)
+    {
+        return;
+    }
+    *map = NULL;
+    if (trk == NULL || layout == NULL || !(size > 0 && size < INFINITY))
+    {
+        return;
+    }
+
+    bool pointy = (orientation == TRACK_HEX_POINTY);
+    long total = 0;
+    for (int i=0; i<trk->count; i++)
+    {
+        total += trk->segments[i].count;
+    }
+    if (total == 0)
+    {
+        int **empty = (int **) heatmap_alloc(1, 1, sizeof(int));
+        if (empty != NULL)
+        {
+            *map = empty;
+            *layout = (track_hex_layout) {orientation, meters, size, 0, 0, 0, 0, 1, 1};
+        }
+        return;
+    }
+
+    double north, span;
+    sinusoidal proj = {NULL};
+    track_lat_bounds(&trk, 1, &proj.south, &north);
+    if (!track_wedge(&trk, 1, total, &proj.west, &span))
+    {
+        return;
+    }
+    proj.half_span = span / 2;
+
+    // x and y are kept nonnegative by measuring x from the west of the
+    // widest parallel, in meters, or from the west bound, in degrees
+    double x_shift = 0;
+    double width = span;
+    double height = north - proj.south;
+    if (meters)
+    {
+        int table_rows = (int) ((north - proj.south) * COS_ROWS_PER_DEGREE) + 2;
+        proj.scale = malloc(sizeof(double) * table_rows);
+        if (proj.scale == NULL)
+        {
+            return;
+        }
+        for (int k=0; k<table_rows; k++)
+        {
+            proj.scale[k] = cos(RADIANS(proj.south + (double) k / COS_ROWS_PER_DEGREE)) * METERS_PER_DEGREE;
+        }
+        double widest = (proj.south <= 0 && north >= 0 ? 1.0 : fmax(cos(RADIANS(proj.south)), cos(RADIANS(north))));
+        x_shift = proj.half_span * widest * METERS_PER_DEGREE;
+        width = 2 * x_shift;
+        height *= METERS_PER_DEGREE;
+    }
+
+    // enough rows of hexagons (major) and places in them (minor) for
+    // any point in the bounds, with a spare place at either end of a
+    // row since a point can be nearer a center just outside them; the
+    // empty ones are trimmed
+    double along = (pointy ? width : height);
+    double across = (pointy ? height : width);
+    int num_major = (int) floor(across / (1.5 * size)) + 2;
+    int num_minor = (int) floor(along / (SQRT3 * size)) + 3;
+    int **map_temp = (int **) heatmap_alloc(pointy ? num_major : num_minor, pointy ? num_minor : num_major,
+                                            sizeof(int));
+    if (map_temp == NULL)
+    {
+        free(proj.scale);
+        return;
+    }
+
+    double x[TRACK_BLOCK_POINTS];
+    double y[TRACK_BLOCK_POINTS];
+    int major[TRACK_BLOCK_POINTS];
+    int minor[TRACK_BLOCK_POINTS];
+    double y_scale = (meters ? METERS_PER_DEGREE : 1.0);
+    int minor_lo = num_minor;
+    int minor_hi = -1;
+    int major_hi = 0;
+    for (int i=0; i<trk->count; i++)
+    {
+        const segment *seg = &trk->segments[i];
+        for (int b=0; b<segment_blocks(seg); b++)
+        {
+            trkrec scratch[TRACK_BLOCK_POINTS];
+            const trkrec *pts;
+            int count = segment_block(trk, seg, b, scratch, &pts);
+            if (meters)
+            {
+                sinusoidal_project(&proj, pts, count, x);
+            }
+            for (int j=0; j<count; j++)
+            {
+                double east = pts[j].loc.lon - proj.west;
+                east += (east < 0) * 360.0;
+                x[j] = (meters ? x[j] + x_shift : east);
+                y[j] = (north - pts[j].loc.lat) * y_scale;
+            }
+            hex_round(pointy ? x : y, pointy ? y : x, count, size, major, minor);
+
+            for (int j=0; j<count; j++)
+            {
+                int maj = major[j];
+                int min = minor[j] + 1;
+                maj = (maj < 0 ? 0 : (maj >= num_major ? num_major - 1 : maj));
+                min = (min < 0 ? 0 : (min >= num_minor ? num_minor - 1 : min));
+                if (pointy)
+                {
+                    map_temp[maj][min]++;
+                }
+                else
+                {
+                    map_temp[min][maj]++;
+                }
+                minor_lo = (min < minor_lo ? min : minor_lo);
+                minor_hi = (min > minor_hi ? min : minor_hi);
+                major_hi = (maj > major_hi ? maj : major_hi);
+            }
+        }
+    }
+    free(proj.scale);
+
+    // keep the rows of hexagons to the southmost point and the places
+    // in them from the first used to the last; the northmost point is
+    // always in the first row, and dropping whole places keeps the
+    // shifted rows the odd ones
+    int kept_minor = minor_hi - minor_lo + 1;
+    if (pointy)
+    {
+        for (int r=major_hi+1; r<num_major; r++)
+        {
+            free(map_temp[r]);
+        }
+        for (int r=0; r<=major_hi && minor_lo > 0; r++)
+        {
+            memmove(map_temp[r], map_temp[r] + minor_lo, sizeof(int) * kept_minor);
+        }
+    }
+    else
+    {
+        for (int r=0; r<num_minor; r++)
+        {
+            if (r < minor_lo || r > minor_hi)
+            {
+                free(map_temp[r]);
+            }
+        }
+        memmove(map_temp, map_temp + minor_lo, sizeof(int *) * kept_minor);
+    }
+    int kept_major = major_hi + 1;
+
+    // the center of the first cell, with the spare place taken off
+    double first = SQRT3 * size * (minor_lo - 1);
+    *map = map_temp;
+    layout->orientation = orientation;
+    layout->meters = meters;
+    layout->size = size;
+    layout->north = north;
+    layout->lon0 = (meters ? proj.west + proj.half_span : proj.west);
+    layout->x0 = (pointy ? first : 0.0) - x_shift;
+    layout->y0 = (pointy ? 0.0 : first);
+    layout->rows = (pointy ? kept_major : kept_minor);
+    layout->cols = (pointy ? kept_minor : kept_major);
+}
+
+/**
+ * Returns the location of the center of the cell in the given row and
+ * column of a hexagonal heatmap with the given layout.  Rows and
+ * columns outside the map are allowed.
+ *
+ * @param layout a pointer to the layout track_heatmap_hex stored
+ * @param row a row of the map
+ * @param col a column of the map
+ * @return the location of the cell's center
+ */
+location track_hex_center(const track_hex_layout *layout, int row, int col)
+{
+    bool pointy = (layout->orientation == TRACK_HEX_POINTY);
+    int major = (pointy ? row : col);
+    int minor = (pointy ? col : row);
+    double along = SQRT3 * layout->size * (minor + 0.5 * (major & 1));
+    double across = 1.5 * layout->size * major;
+    double x = layout->x0 + (pointy ? along : across);
+    double y = layout->y0 + (pointy ? across : along);
+
+    location loc;
+    loc.lat = layout->north - (layout->meters ? y / METERS_PER_DEGREE : y);
+    loc.lat = fmax(-90.0, fmin(90.0, loc.lat));
+    double scale = cos(RADIANS(loc.lat)) * METERS_PER_DEGREE;
+    double east = (!layout->meters ? x : (scale > 0 ? x / scale : 0.0));
+    loc.lon = fmod(layout->lon0 + east + 180.0, 360.0);
+    loc.lon += (loc.lon < 0 ? 360.0 : 0.0) - 180.0;
+    return loc;
+}
+
+/**
+ * Creates a dwell-time heatmap of the given track.  The grid is the
+ * same as the one track_heatmap would create for the same cell sizes,
+ * but each element is the number of seconds spent in the corresponding
+ * cell rather than the number of trackpoints in it.  The interval
+ * between two consecutive points in a segment is apportioned across
+ * the cells the straight line between them (in latitude and longitude)
+ * passes through, in proportion to the part of the line inside each
+ * cell.  Time between segments is not counted, and the part of a hop
+ * that passes outside the grid (which can only happen when the hop
+ * wraps around the west bound) is dropped.  The dwell time of a point
+ * that absorbed jitter is counted in that point's cell, and only the
+ * rest of the time to the next point is apportioned along the hop.
+ *
+ * If the cell size is invalid or if there is a memory allocation
+ * error then the map is set to NULL and the rows and columns
+ * parameters are unchanged.  It is the caller's responsibility to
+ * free each row in the returned array and the array itself.
+ *
+ * @param trk a pointer to a valid track
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param map a pointer to a pointer to a 2-D array of doubles
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_heatmap_dwell(const track *trk, double cell_width, double cell_height,
+                         double ***map, int *rows, int *cols)
+{
+    heatmap_grid grid;
+
+    if (map == NULL)
+    {
+        return;
+    }
+    *map = NULL;
+
+    if (trk == NULL || !track_heatmap_grid(trk, cell_width, cell_height, &grid))
+    {
+        return;
+    }
+
+    double **map_temp = (double **) heatmap_alloc(grid.rows, grid.cols, sizeof(double));
+    if (map_temp == NULL)
+    {
+        return;
+    }
+
+    for (int i=0; i<trk->count; i++)
+    {
+        // one pass over each hop of the segment, a block at a time
+        const segment *seg = &trk->segments[i];
+        trkrec from;
+        long from_dwell = 0;
+        int d = 0;
+        for (int b=0; b<segment_blocks(seg); b++)
+        {
+            trkrec scratch[TRACK_BLOCK_POINTS];
+            const trkrec *pts;
+            int count = segment_block(trk, seg, b, scratch, &pts);
+            for (int j=0; j<count; j++)
+            {
+                const trkrec *to = &pts[j];
+
+                // the time spent at a point that absorbed jitter is its cell's
+                long to_dwell = 0;
+                if (d < seg->num_dwells && seg->dwells[d].point == (b << TRACK_BLOCK_SHIFT) + j)
+                {
+                    double x, y;
+                    to_dwell = seg->dwells[d++].seconds;
+                    heatmap_position(&grid, to->loc, &x, &y);
+                    map_temp[(int) y][(int) x] += (double) to_dwell;
+                }
+
+                if (b == 0 && j == 0)
+                {
+                    from = *to;
+                    from_dwell = to_dwell;
+                    continue;
+                }
+                double seconds = (double) (to->time - from.time - from_dwell);
+
+                hop_piece pieces[2];
+                int num_pieces = heatmap_hop_pieces(&grid, from.loc, to->loc, pieces);
+                for (int p=0; p<num_pieces; p++)
+                {
+                    double piece_seconds = seconds * (pieces[p].t1 - pieces[p].t0);
+
+                    grid_walk walk;
+                    int col, row;
+                    double t0, t1;
+                    grid_walk_start(&walk, pieces[p].x0, pieces[p].y0, pieces[p].x1, pieces[p].y1);
+                    while (grid_walk_next(&walk, &col, &row, &t0, &t1))
+                    {
+                        if (row >= 0 && row < grid.rows && col >= 0 && col < grid.cols)
+                        {
+                            map_temp[row][col] += piece_seconds * (t1 - t0);
+                        }
+                    }
+                }
+                from = *to;
+                from_dwell = to_dwell;
+            }
+        }
+    }
+
+    *map = map_temp;
+    *rows = grid.rows;
+    *cols = grid.cols;
+}
+
+/**
+ * Creates a coverage heatmap of the given track.  The grid is the
+ * same as the one track_heatmap would create for the same cell sizes,
+ * but each element counts the number of times the path of a segment
+ * enters the corresponding cell, where the path between two
+ * consecutive points in a segment is the straight line between them
+ * (in latitude and longitude) the shorter way around.  The first point
+ * of a segment enters its own cell, so a segment with a single point
+ * counts like track_heatmap does, and cells between sparse points are
+ * marked even though no point is in them.  The part of a hop that
+ * wraps around the west bound and passes outside the grid marks
+ * nothing.  The work is split across threads by segment for large
+ * tracks.
+ *
+ * If the cell size is invalid or if there is a memory allocation
+ * error then the map is set to NULL and the rows and columns
+ * parameters are unchanged.  It is the caller's responsibility to
+ * free each row in the returned array and the array itself.
+ *
+ * @param trk a pointer to a valid track
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_heatmap_coverage(const track *trk, double cell_width, double cell_height,
+                            int ***map, int *rows, int *cols)
+{
+    heatmap_grid grid;
+
+    if (map == NULL)
+    {
+        return;
+    }
+    *map = NULL;
+
+    if (trk == NULL || !track_heatmap_grid(trk, cell_width, cell_height, &grid))
+    {
+        return;
+    }
+
+    int **map_temp = track_heatmap_parallel(trk, &grid, coverage_bin, NULL);
+    if (map_temp == NULL)
+    {
+        return;
+    }
+
+    *map = map_temp;
+    *rows = grid.rows;
+    *cols = grid.cols;
+}
+
+/**
+ * Creates a sweep-width heatmap of the given track.  The grid is the
+ * same as the one track_heatmap would create for the same cell sizes,
+ * but each hop between consecutive points in a segment is treated as
+ * a corridor the given width in meters wide (extending half the width
+ * to each side of the hop and past each end) and each element counts
+ * the number of hops whose corridor overlaps the corresponding cell.
+ * A segment with a single point counts as a square the sweep width
+ * across.  Each hop counts at most once in each cell, but consecutive
+ * hops overlap at their shared point.  Distances are converted to
+ * degrees on a spherical earth using the scale at the middle of the
+ * row containing the middle of the hop.  The parts of corridors
+ * outside the grid are dropped.  The work is split across threads for
+ * large tracks.
+ *
+ * If the cell size or width is invalid or if there is a memory
+ * allocation error then the map is set to NULL and the rows and
+ * columns parameters are unchanged.  It is the caller's
+ * responsibility to free each row in the returned array and the array
+ * itself.
+ *
+ * @param trk a pointer to a valid track
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param sweep_width a positive double
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_heatmap_corridor(const track *trk, double cell_width, double cell_height,
+                            double sweep_width, int ***map, int *rows, int *cols)
+{
+    heatmap_grid grid;
+
+    if (map == NULL)
+    {
+        return;
+    }
+    *map = NULL;
+
+    if (trk == NULL || !(sweep_width > 0)
+        || !track_heatmap_grid(trk, cell_width, cell_height, &grid))
+    {
+        return;
+    }
+
+    // longitude scale for each row, computed once
+    corridor_scale scale;
+    scale.half_width = sweep_width / 2;
+    scale.rows_per_meter = 1.0 / (METERS_PER_DEGREE * cell_height);
+    scale.cols_per_meter = malloc(sizeof(double) * grid.rows);
+    if (scale.cols_per_meter == NULL)
+    {
+        return;
+    }
+    for (int r=0; r<grid.rows; r++)
+    {
+        double lat = grid.north - (r + 0.5) * cell_height;
+        double shrink = fmax(cos(RADIANS(fmax(fmin(lat, 90.0), -90.0))), 1e-9);
+        scale.cols_per_meter[r] = 1.0 / (METERS_PER_DEGREE * shrink * cell_width);
+    }
+
+    int **map_temp = track_heatmap_parallel(trk, &grid, corridor_bin, &scale);
+    free(scale.cols_per_meter);
+    if (map_temp == NULL)
+    {
+        return;
+    }
+
+    *map = map_temp;
+    *rows = grid.rows;
+    *cols = grid.cols;
+}
+
+/**
+ * The work shared by the threads of track_heatmap_multi.  Each thread
+ * takes the next unbinned track under the lock.
+ */
+typedef struct multi_work
+{
+    track *const *trks;
+    int n;
+    const heatmap_grid *grid;
+    track_heatmap_layer *layers;
+    pthread_mutex_t lock;
+    int next;
+} multi_work;
+
+/**
+ * One thread of track_heatmap_multi, the map it bins into and whether
+ * it had a memory allocation error.
+ */
+typedef struct multi_job
+{
+    multi_work *work;
+    int **map;
+    bool failed;
+} multi_job;
+
+/**
+ * Compares two longs for qsort.
+ */
+static int compare_longs(const void *a, const void *b)
+{
+    long x = *(const long *) a;
+    long y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Fills in the layer for a single track from the row-major indices of
+ * the cells its points are in, sorting them to count each cell.
+ * Returns false if there is a memory allocation error.
+ */
+static bool multi_layer(track_heatmap_layer *layer, long *cells, long count, int cols)
+{
+    qsort(cells, count, sizeof(long), compare_longs);
+
+    int distinct = 0;
+    for (long k=0; k<count; k++)
+    {
+        if (k == 0 || cells[k] != cells[k-1])
+        {
+            distinct++;
+        }
+    }
+
+    layer->count = 0;
+    layer->rows = malloc(sizeof(int) * (distinct > 0 ? distinct : 1));
+    layer->cols = malloc(sizeof(int) * (distinct > 0 ? distinct : 1));
+    layer->values = malloc(sizeof(int) * (distinct > 0 ? distinct : 1));
+    if (layer->rows == NULL || layer->cols == NULL || layer->values == NULL)
+    {
+        return false;
+    }
+
+    for (long k=0; k<count; k++)
+    {
+        if (k == 0 || cells[k] != cells[k-1])
+        {
+            layer->rows[layer->count] = (int) (cells[k] / cols);
+            layer->cols[layer->count] = (int) (cells[k] % cols);
+            layer->values[layer->count] = 0;
+            layer->count++;
+        }
+        layer->values[layer->count-1]++;
+    }
+    return true;
+}
+
+/**
+ * Bins tracks for track_heatmap_multi until there are none left.
+ */
+static void *multi_job_run(void *arg)
+{
+    multi_job *job = arg;
+    multi_work *work = job->work;
+    const heatmap_grid *grid = work->grid;
+
+    while (true)
+    {
+        pthread_mutex_lock(&work->lock);
+        int t = work->next++;
+        pthread_mutex_unlock(&work->lock);
+        if (t >= work->n)
+        {
+            return NULL;
+        }
+
+        const track *trk = work->trks[t];
+        long count = 0;
+        for (int i=0; i<trk->count; i++)
+        {
+            count += trk->segments[i].count;
+        }
+
+        long *cells = NULL;
+        if (work->layers != NULL)
+        {
+            cells = malloc(sizeof(long) * (count > 0 ? count : 1));
+            if (cells == NULL)
+            {
+                job->failed = true;
+                continue;
+            }
+        }
+
+        long k = 0;
+        for (int i=0; i<trk->count; i++)
+        {
+            const segment *seg = &trk->segments[i];
+            for (int b=0; b<segment_blocks(seg); b++)
+            {
+                trkrec scratch[TRACK_BLOCK_POINTS];
+                const trkrec *pts;
+                int block_count = segment_block(trk, seg, b, scratch, &pts);
+                for (int j=0; j<block_count; j++)
                 {
-                     // malloc space for new trkpt* array at the last index of the start trkpt array
-                        trk->segments[start].trkpt = realloc(trk->segments[start].trkpt, sizeof(trackpoint*) * 2);
-                        if (trk->segments[start].trkpt == NULL)
-                        {
-                            return;
-                        }
+                    double x, y;
+                    heatmap_position(grid, pts[j].loc, &x, &y);
+                    job->map[(int) y][(int) x]++;
+                    if (cells != NULL)
+                    {
+                        cells[k++] = (long) (int) y * grid->cols + (int) x;
+                    }
                 }
+            }
+        }
+
+        if (cells != NULL)
+        {
+            if (!multi_layer(&work->layers[t], cells, count, grid->cols))
+            {
+                job->failed = true;
+            }
+            free(cells);
+        }
+    }
+}
+
+/**
+ * Creates one heatmap of all the points on the given tracks, such as
+ * the logs of several teams in one operation.  The grid is the one
+ * track_heatmap would create for a single track holding all of the
+ * points, so the bounding box and wedge are shared.  The tracks are
+ * binned in parallel, each thread taking one track at a time into its
+ * own map and the maps being summed at the end.  If layers is not
+ * NULL then it is set to a newly allocated array with one entry per
+ * track listing the nonzero cells of that track alone, in row-major
+ * order; those are released with track_heatmap_layers_destroy.  The
+ * time taken grows with the total number of points (and the size of
+ * the map once per thread), not with the number of tracks times the
+ * size of the map.
+ *
+ * If the cell size is invalid or if there is a memory allocation
+ * error then the map (and layers, if not NULL) is set to NULL and the
+ * rows and columns parameters are unchanged.  It is the caller's
+ * responsibility to free each row in the returned array and the array
+ * itself.
+ *
+ * @param trks an array of n pointers to valid tracks
+ * @param n a positive integer
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ * @param layers a pointer to a pointer to an array of n layers, or NULL
+ */
+void track_heatmap_multi(track *const *trks, int n, double cell_width, double cell_height,
+                         int ***map, int *rows, int *cols, track_heatmap_layer **layers)
+{
+    heatmap_grid grid;
+
+    if (map == NULL)
+    {
+        return;
+    }
+    *map = NULL;
+    if (layers != NULL)
+    {
+        *layers = NULL;
+    }
+
+    if (trks == NULL || n < 1
+        || !track_heatmap_grid_multi((const track *const *) trks, n, cell_width, cell_height, &grid))
+    {
+        return;
+    }
+
+    multi_work work;
+    work.trks = trks;
+    work.n = n;
+    work.grid = &grid;
+    work.next = 0;
+    work.layers = NULL;
+    if (layers != NULL)
+    {
+        work.layers = calloc(n, sizeof(track_heatmap_layer));
+        if (work.layers == NULL)
+        {
+            return;
+        }
+    }
+
+    // one thread per track, up to the number of processors and the
+    // memory allowed for the extra maps
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    long map_bytes = (long) grid.rows * grid.cols * (long) sizeof(int);
+    if (workers > n)
+    {
+        workers = n;
+    }
+    if (workers > 1 + HEATMAP_WORKER_MAP_BYTES / map_bytes)
+    {
+        workers = 1 + HEATMAP_WORKER_MAP_BYTES / map_bytes;
+    }
+    if (workers > HEATMAP_MAX_WORKERS)
+    {
+        workers = HEATMAP_MAX_WORKERS;
+    }
+    if (workers < 1)
+    {
+        workers = 1;
+    }
+
+    multi_job jobs[HEATMAP_MAX_WORKERS];
+    pthread_t threads[HEATMAP_MAX_WORKERS];
+    bool started[HEATMAP_MAX_WORKERS];
+    for (int w=0; w<workers; w++)
+    {
+        jobs[w].work = &work;
+        jobs[w].failed = false;
+        jobs[w].map = (int **) heatmap_alloc(grid.rows, grid.cols, sizeof(int));
+        if (jobs[w].map == NULL)
+        {
+            for (int k=0; k<w; k++)
+            {
+                free_map(jobs[k].map, grid.rows);
+            }
+            free(work.layers);
+            return;
+        }
+    }
+
+    pthread_mutex_init(&work.lock, NULL);
+    for (int w=1; w<workers; w++)
+    {
+        started[w] = (pthread_create(&threads[w], NULL, multi_job_run, &jobs[w]) == 0);
+    }
+    multi_job_run(&jobs[0]);
+    for (int w=1; w<workers; w++)
+    {
+        if (started[w])
+        {
+            pthread_join(threads[w], NULL);
+        }
+    }
+    pthread_mutex_destroy(&work.lock);
+
+    // sum into the first map, noting any thread that failed
+    bool failed = jobs[0].failed;
+    for (int w=1; w<workers; w++)
+    {
+        failed = failed || jobs[w].failed;
+        for (int r=0; r<grid.rows; r++)
+        {
+            for (int c=0; c<grid.cols; c++)
+            {
+                jobs[0].map[r][c] += jobs[w].map[r][c];
+            }
+        }
+        free_map(jobs[w].map, grid.rows);
+    }
+
+    if (failed)
+    {
+        free_map(jobs[0].map, grid.rows);
+        track_heatmap_layers_destroy(work.layers, n);
+        return;
+    }
+
+    *map = jobs[0].map;
+    *rows = grid.rows;
+    *cols = grid.cols;
+    if (layers != NULL)
+    {
+        *layers = work.layers;
+    }
+}
+
+/**
+ * Releases the per-track layers created by track_heatmap_multi.
+ *
+ * @param layers an array of n layers returned by track_heatmap_multi
+ * @param n the number of tracks passed to track_heatmap_multi
+ */
+void track_heatmap_layers_destroy(track_heatmap_layer *layers, int n)
+{
+    if (layers == NULL)
+    {
+        return;
+    }
+
+    for (int t=0; t<n; t++)
+    {
+        free(layers[t].rows);
+        free(layers[t].cols);
+        free(layers[t].values);
+    }
+    free(layers);
+}
+
+/**
+ * A heatmap kept up to date as points are appended to a track.  Row
+ * and column numbers are counted from the anchor, the first point
+ * binned, and may be negative; counts holds capacity_rows by
+ * capacity_cols cells starting at first_row and first_col, and the
+ * cells holding points lie within the min and max rows and columns.
+ * The track's points before segment and point have been binned.
+ */
+struct track_live_heatmap
+{
+    double cell_width;
+    double cell_height;
+    bool anchored;
+    double north;
+    double west;
+    int *counts;
+    int first_row;
+    int first_col;
+    int capacity_rows;
+    int capacity_cols;
+    int min_row;
+    int max_row;
+    int min_col;
+    int max_col;
+    int segment;
+    int point;
+};
+
+/**
+ * Creates an empty heatmap to be kept up to date with
+ * track_live_heatmap_update.  The circle of latitude and meridian
+ * through the first point binned are borders of its cells, and every
+ * other border is a whole number of cells from those, so the cells
+ * never move as points arrive and a point is counted once, when it is
+ * binned.  A point on the border of two or more cells is counted in
+ * the bottommost and rightmost, so with the first point at the
+ * northwest corner of the track the grid is the one track_heatmap
+ * creates, except that points on its south or east edge get a row or
+ * column of their own.
+ * Returns NULL if the cell size is invalid or if there is a memory
+ * allocation error.
+ *
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @return a pointer to the new heatmap, or NULL
+ */
+track_live_heatmap *track_live_heatmap_create(double cell_width, double cell_height)
+{
+    if (!(cell_width > 0 && cell_width <= 360.0 && cell_height > 0 && cell_height <= 180.0))
+    {
+        return NULL;
+    }
+
+    track_live_heatmap *live = calloc(1, sizeof(track_live_heatmap));
+    if (live == NULL)
+    {
+        return NULL;
+    }
+    live->cell_width = cell_width;
+    live->cell_height = cell_height;
+    return live;
+}
+
+/**
+ * Destroys the given heatmap.
+ *
+ * @param live a pointer to a valid heatmap
+ */
+void track_live_heatmap_destroy(track_live_heatmap *live)
+{
+    if (live != NULL)
+    {
+        free(live->counts);
+        free(live);
+    }
+}
+
+/**
+ * Finds the extent along one dimension of the grid that holds the
+ * given index: the current one if it already does, otherwise one at
+ * least twice as long grown toward the index, so that a track moving
+ * steadily away from its start is copied a logarithmic number of times.
+ */
+static void live_extent(int first, int capacity, int index, int *new_first, int *new_capacity)
+{
+    *new_first = first;
+    *new_capacity = capacity;
+    if (capacity > 0 && index >= first && index < first + capacity)
+    {
+        return;
+    }
+
+    long lo = (capacity > 0 && first < index ? first : index);
+    long hi = (capacity > 0 && first + capacity - 1 > index ? first + capacity - 1 : index);
+    long grown = hi - lo + 1;
+    if (grown < 2L * capacity)
+    {
+        grown = 2L * capacity;
+    }
+    grown = (grown > INT_MAX ? INT_MAX : grown);
+    *new_first = (int) (index < first ? hi - grown + 1 : lo);
+    *new_capacity = (int) grown;
+}
+
+/**
+ * Makes room in the grid for the given cell, moving the counts into a
+ * larger array if it is outside the current one.  Returns false if
+ * there is a memory allocation error, leaving the grid unchanged.
+ */
+static bool live_reserve(track_live_heatmap *live, int row, int col)
+{
+    int first_row, capacity_rows, first_col, capacity_cols;
+    live_extent(live->first_row, live->capacity_rows, row, &first_row, &capacity_rows);
+    live_extent(live->first_col, live->capacity_cols, col, &first_col, &capacity_cols);
+    if (capacity_rows == live->capacity_rows && capacity_cols == live->capacity_cols)
+    {
+        return true;
+    }
+
+    if ((size_t) capacity_rows > SIZE_MAX / sizeof(int) / (size_t) capacity_cols)
+    {
+        return false;
+    }
+    int *counts = calloc((size_t) capacity_rows * capacity_cols, sizeof(int));
+    if (counts == NULL)
+    {
+        return false;
+    }
+
+    for (int r=0; r<live->capacity_rows; r++)
+    {
+        memcpy(counts + (size_t) (live->first_row + r - first_row) * capacity_cols
+               + (live->first_col - first_col),
+               live->counts + (size_t) r * live->capacity_cols, sizeof(int) * live->capacity_cols);
+    }
+    free(live->counts);
+    live->counts = counts;
+    live->first_row = first_row;
+    live->first_col = first_col;
+    live->capacity_rows = capacity_rows;
+    live->capacity_cols = capacity_cols;
+    return true;
+}
+
+/**
+ * Counts the given point in its cell.  Returns false if there is a
+ * memory allocation error, leaving the grid unchanged.
+ */
+static bool live_bin(track_live_heatmap *live, location loc)
+{
+    if (!live->anchored)
+    {
+        live->north = loc.lat;
+        live->west = loc.lon;
+    }
+
+    // east of the anchor the short way round
+    double east = loc.lon - live->west;
+    east += (east < -180.0) * 360.0 - (east >= 180.0) * 360.0;
+    int row = (int) floor((live->north - loc.lat) / live->cell_height);
+    int col = (int) floor(east / live->cell_width);
+
+    if (!live_reserve(live, row, col))
+    {
+        return false;
+    }
+    live->counts[(size_t) (row - live->first_row) * live->capacity_cols + (col - live->first_col)]++;
+
+    if (!live->anchored)
+    {
+        live->anchored = true;
+        live->min_row = live->max_row = row;
+        live->min_col = live->max_col = col;
+    }
+    live->min_row = (row < live->min_row ? row : live->min_row);
+    live->max_row = (row > live->max_row ? row : live->max_row);
+    live->min_col = (col < live->min_col ? col : live->min_col);
+    live->max_col = (col > live->max_col ? col : live->max_col);
+    return true;
+}
+
+/**
+ * Counts the points added to the given track since the last update of
+ * the given heatmap, and returns how many there were.  The time taken
+ * grows with the number of new points, not with the size of the track,
+ * except when the grid grows, which copies it.  The track must be the
+ * same one each time, and its points must only have been added since
+ * the last update, not simplified, merged, reset or thinned out by a
+ * memory budget.  If there is a memory allocation error then -1 is
+ * returned, and the points counted so far stay counted; a later update
+ * carries on from the first point that was not.
+ *
+ * @param live a pointer to a valid heatmap
+ * @param trk a pointer to a valid track
+ * @return the number of points counted, or -1
+ */
+long track_live_heatmap_update(track_live_heatmap *live, const track *trk)
+{
+    long binned = 0;
+
+    while (live->segment < trk->count)
+    {
+        const segment *seg = &trk->segments[live->segment];
+        for (; live->point < seg->count; live->point++)
+        {
+            if (!live_bin(live, segment_get(trk, seg, live->point).loc))
+            {
+                return -1;
+            }
+            binned++;
+        }
+
+        // the last segment may still grow
+        if (live->segment + 1 >= trk->count)
+        {
+            break;
+        }
+        live->segment++;
+        live->point = 0;
+    }
+    return binned;
+}
+
+/**
+ * Creates a copy of the given heatmap in the form track_heatmap
+ * returns, with just enough rows and columns to hold every cell
+ * counted so far; copying it takes time proportional to its size.  If
+ * nothing has been counted then the map is 1x1 holding 0.
+ *
+ * If there is a memory allocation error then the map is set to NULL
+ * and the other parameters are unchanged.  It is the caller's
+ * responsibility to free each row in the returned array and the array
+ * itself.
+ *
+ * @param live a pointer to a valid heatmap
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_live_heatmap_map(const track_live_heatmap *live, int ***map, int *rows, int *cols)
+{
+    if (map == NULL)
+    {
+        return;
+    }
+
+    int num_rows = (live->anchored ? live->max_row - live->min_row + 1 : 1);
+    int num_cols = (live->anchored ? live->max_col - live->min_col + 1 : 1);
+    *map = (int **) heatmap_alloc(num_rows, num_cols, sizeof(int));
+    if (*map == NULL)
+    {
+        return;
+    }
+
+    for (int i=0; i<num_rows && live->anchored; i++)
+    {
+        memcpy((*map)[i], live->counts + (size_t) (live->min_row + i - live->first_row) * live->capacity_cols
+               + (live->min_col - live->first_col), sizeof(int) * num_cols);
+    }
+    *rows = num_rows;
+    *cols = num_cols;
+}
 
-                // for each of the new trkpt ptrs
-                for (int j=0; j<trk->segments[i].count; j++)
-                {
-                    // copy them into the start segment
-                    trk->segments[start].trkpt[trk->segments[start].count+j] = trk->segments[i].trkpt[j];
-                }
+// the first bytes of a snapshot and the version of its layout
+#define SNAPSHOT_MAGIC "TRKSNAP"
+#define SNAPSHOT_VERSION 1
 
-                //update distance
+// marks the byte order of the machine that wrote a snapshot
+#define SNAPSHOT_BYTE_ORDER 0x01020304
 
-                // find the distance at each interval when merging
-                loc3 = trackpoint_location(trk->segments[start].trkpt[trk->segments[start].count-1]);
-                loc4 = trackpoint_location(trk->segments[start].trkpt[trk->segments[start].count]);
+// the size of the chunks a restored track grows into
+#define SNAPSHOT_ARENA_CHUNK (1 << 20)
 
-                interval_distance += location_distance(&loc3, &loc4);
-                trk->segments[start].length += interval_distance;
+// the longest name a snapshot can be written under
+#define SNAPSHOT_MAX_PATH 4096
 
-                // add the length of each added segment
-                trk->segments[start].length += trk->segments[i].length;
+// bytes gathered before each write to a snapshot
+#define SNAPSHOT_BUFFER_SIZE 65536
 
-                //update count of start segment
-                trk->segments[start].count += trk->segments[i].count;
-                
-                //update capacity
-                trk->segments[start].capacity += trk->segments[i].capacity;
-                
-                // free the prev trkptn array
-                free(trk->segments[i].trkpt);
-            }
-        }
-        // move the remaining segments up
-        for (int k=0; end+k<trk->count; k++)
-        {
-            trk->segments[start+1+k].trkpt = trk->segments[end+k].trkpt;
+// the most zero bytes written out rather than skipped over
+#define SNAPSHOT_MAX_PADDING 4096
 
-            // update count and capacity
-            trk->segments[start+1+k].count = trk->segments[end+k].count;
-            trk->segments[start+1+k].capacity = trk->segments[end+k].capacity;
+#define SNAPSHOT_ALIGN(n) (((n) + ARENA_ALIGNMENT - 1) & ~((uint64_t) ARENA_ALIGNMENT - 1))
 
-            // make the curr point to null
-            trk->segments[end+k].trkpt = NULL;
-        }
+/**
+ * The start of a snapshot.  The structures in a snapshot are stored as
+ * they are in memory, so the sizes and byte order check that it was
+ * written by the same build on the same kind of machine.  The track is
+ * stored with the offsets of its segment array and longitude bins (0
+ * if it has none) given separately, and each segment with the offsets
+ * of its tables and dwell times where its pointers were.
+ */
+typedef struct snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t sizes[6];
+    uint64_t size;
+    uint64_t segments;
+    uint64_t lons;
+    track trk;
+} snapshot_header;
 
-        // updated track count
-        trk->count -= (end - (start+1));
-    }
+/**
+ * A snapshot being written: the bytes gathered, how far into the
+ * image they go, and whether any write has failed.  Nothing here is
+ * allocated, so that a child process forked from a threaded one can
+ * write a snapshot safely.
+ */
+typedef struct snapshot_writer
+{
+    int fd;
+    uint64_t written;
+    size_t used;
+    bool failed;
+    char buffer[SNAPSHOT_BUFFER_SIZE];
+} snapshot_writer;
+
+/**
+ * Stores the sizes a snapshot must agree on to be restored.
+ */
+static void snapshot_sizes(uint32_t sizes[6])
+{
+    sizes[0] = sizeof(track);
+    sizes[1] = sizeof(segment);
+    sizes[2] = sizeof(lon_bins);
+    sizes[3] = sizeof(dwell);
+    sizes[4] = ARENA_ALIGNMENT;
+    sizes[5] = TRACK_BLOCK_POINTS;
 }
 
 /**
- * Creates a heapmap of the given track.  The heatmap will be a
- * rectangular 2-D array with each row separately allocated.  The last
- * three paramters are (simulated) reference parameters used to return
- * the heatmap and its dimensions.  Each element in the heatmap
- * represents an area bounded by two circles of latitude and two
- * meridians of longitude.  
- * 
- * The circle of latitude bounding the top of
- * the top row is the northernmost (highest) latitude of any
- * trackpoint in the given track.  The meridian bounding the left of
- * the first column is the western edge of the smallest spherical
- * wedge bounded by two meridians the contains all the points in the
- * track (the "western edge" for a nontrivial wedge being the one
- * that, when you move east from it along the equator, you stay in the
- * wedge).  When there are multple such wedges, choose the one with
- * the lowest normalized (adjusted to the range -180 (inclusive) to
- * 180 (exclusive)) longitude.  The distance (in degrees) between the
- * bounds of adjacent rows and columns is given by the last two
- * parameters.  
- * 
- * The heat map will have just enough rows and just
- * enough columns so that all points in the track fall into some cell.
- * The value in each entry in the heatmap is the number of trackpoints
- * located in the corresponding cell.  If a trackpoint is on the
- * border of two or more cells then it is counted in the bottommost
- * and rightmost cell it is on the border of, but do not add a row or
- * column just to place points on the south and east borders into
- * them and instead place the points on those borders by breaking ties
- * only between cells that already exist.
- * 
- * If there are no trackpoints in the track then the function
- * creates a 1x1 heatmap with the single element having a value of 0.
- * 
- * If the cell size is invalid or if there is a memory allocation
- * error then the map is set to NULL and the rows and columns
- * parameters are unchanged.  It is the caller's responsibility to
- * free each row in the returned array and the array itself.
- *
- * @param trk a pointer to a valid trackpoint
- * @param cell_width a positive double less than or equal to 360.0
- * @param cell_height a positive double less than or equal to 180.0
- * @param map a pointer to a pointer to a 2-D array of ints
- * @param rows a pointer to an int
- * @param cols a pointer to an int
+ * Returns the number of records in each block of the given segment.
  */
-void track_heatmap(const track *trk, double cell_width, double cell_height,
-		    int ***map, int *rows, int *cols)
+static int segment_block_size(const segment *seg)
 {
-    if (trk!= NULL && cell_width >= 0 && cell_height >= 0 && map != NULL)
+    return (seg->capacity < TRACK_BLOCK_POINTS ? seg->capacity : TRACK_BLOCK_POINTS);
+}
+
+/**
+ * Returns the bytes a segment's storage takes in a snapshot: its block
+ * table, its table of running lengths if it has one, room for all its
+ * dwell times, and then each block followed by its running lengths.
+ */
+static uint64_t segment_image_size(const track *trk, const segment *seg)
+{
+    uint64_t tables = SNAPSHOT_ALIGN(sizeof(char *) * (uint64_t) seg->max_blocks) * (seg->dists != NULL ? 2 : 1);
+    uint64_t dwells = SNAPSHOT_ALIGN(sizeof(dwell) * (uint64_t) seg->max_dwells);
+    uint64_t block = SNAPSHOT_ALIGN((uint64_t) trk->rec_size * segment_block_size(seg));
+    uint64_t dists = (seg->dists != NULL ? SNAPSHOT_ALIGN(sizeof(double) * (uint64_t) segment_block_size(seg)) : 0);
+    return tables + dwells + (block + dists) * seg->num_blocks;
+}
+
+/**
+ * Writes out the bytes gathered.
+ */
+static void snapshot_flush(snapshot_writer *w)
+{
+    const char *data = w->buffer;
+    while (w->used > 0 && !w->failed)
     {
-        // if there are no trackpoints in trk
-        if (trk->segments[0].count == 0)
+        ssize_t done = write(w->fd, data, w->used);
+        if (done < 0 && errno == EINTR)
         {
-            *map = malloc(sizeof(int*));
-            if (*map != NULL)
-            {
-                **map = calloc(1, sizeof(int));
-                *rows = *cols = 1;
-            }   
+            continue;
         }
-        // if trk has trkpts
-        else
+        w->failed = (done <= 0);
+        if (done > 0)
+        {
+            data += done;
+            w->used -= done;
+        }
+    }
+    w->used = 0;
+}
+
+/**
+ * Adds the given bytes to the snapshot.
+ */
+static void snapshot_put(snapshot_writer *w, const void *data, size_t n)
+{
+    const char *bytes = data;
+    w->written += n;
+    while (n > 0 && !w->failed)
+    {
+        if (w->used == SNAPSHOT_BUFFER_SIZE)
         {
-            double north_bound = -90;
-            double south_bound = 90;
-            double west_bound;
-            double min_distance = 400;
+            snapshot_flush(w);
+        }
+        size_t room = SNAPSHOT_BUFFER_SIZE - w->used;
+        size_t take = (n < room ? n : room);
+        memcpy(w->buffer + w->used, bytes, take);
+        w->used += take;
+        bytes += take;
+        n -= take;
+    }
+}
+
+/**
+ * Pads the snapshot with zeros up to the given offset, leaving a hole
+ * in the file rather than writing long runs of them.
+ */
+static void snapshot_skip_to(snapshot_writer *w, uint64_t offset)
+{
+    static const char zeros[SNAPSHOT_MAX_PADDING];
+    uint64_t gap = offset - w->written;
+    if (gap <= SNAPSHOT_MAX_PADDING)
+    {
+        snapshot_put(w, zeros, gap);
+        return;
+    }
+    snapshot_flush(w);
+    if (!w->failed && lseek(w->fd, (off_t) gap, SEEK_CUR) < 0)
+    {
+        w->failed = true;
+    }
+    w->written = offset;
+}
+
+/**
+ * Writes the image of the given track to the given file: the header,
+ * the segment array, the longitude bins, and then the storage of each
+ * segment in turn, with every part starting on an ARENA_ALIGNMENT
+ * boundary.  Returns false if a write fails.
+ */
+static bool snapshot_write(const track *trk, int fd)
+{
+    snapshot_writer w;
+    w.fd = fd;
+    w.written = 0;
+    w.used = 0;
+    w.failed = false;
+
+    bool lons = (trk->lons != NULL && !trk->lons_stale);
+    uint64_t segments = SNAPSHOT_ALIGN(sizeof(snapshot_header));
+    uint64_t lons_at = SNAPSHOT_ALIGN(segments + sizeof(segment) * (uint64_t) trk->capacity);
+    uint64_t data = lons_at + (lons ? SNAPSHOT_ALIGN(sizeof(lon_bins)) : 0);
+    uint64_t size = data;
+    for (int i=0; i<trk->count; i++)
+    {
+        size += segment_image_size(trk, &trk->segments[i]);
+    }
+
+    snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    snapshot_sizes(header.sizes);
+    header.size = size;
+    header.segments = segments;
+    header.lons = (lons ? lons_at : 0);
+    header.trk = *trk;
+    header.trk.segments = NULL;
+    header.trk.mem = NULL;
+    header.trk.lons = NULL;
+    header.trk.image = NULL;
+    header.trk.image_size = 0;
+    snapshot_put(&w, &header, sizeof(header));
+
+    // the segments, pointing at where their storage will be
+    snapshot_skip_to(&w, segments);
+    uint64_t at = data;
+    for (int i=0; i<trk->count; i++)
+    {
+        const segment *seg = &trk->segments[i];
+        segment copy = *seg;
+        uint64_t table = SNAPSHOT_ALIGN(sizeof(char *) * (uint64_t) seg->max_blocks);
+        uint64_t dwells = at + table * (seg->dists != NULL ? 2 : 1);
+        copy.blocks = (char **) (uintptr_t) at;
+        copy.dists = (seg->dists != NULL ? (double **) (uintptr_t) (at + table) : NULL);
+        copy.dwells = (seg->max_dwells > 0 ? (dwell *) (uintptr_t) dwells : NULL);
+        snapshot_put(&w, &copy, sizeof(copy));
+        at += segment_image_size(trk, seg);
+    }
+    if (lons)
+    {
+        snapshot_skip_to(&w, lons_at);
+        snapshot_put(&w, trk->lons, sizeof(lon_bins));
+    }
 
-            int total_trkpts = 0;
+    // then that storage, with the points only as far as they go
+    at = data;
+    for (int i=0; i<trk->count && !w.failed; i++)
+    {
+        const segment *seg = &trk->segments[i];
+        int block_size = segment_block_size(seg);
+        uint64_t table = SNAPSHOT_ALIGN(sizeof(char *) * (uint64_t) seg->max_blocks);
+        uint64_t block_bytes = SNAPSHOT_ALIGN((uint64_t) trk->rec_size * block_size);
+        uint64_t dist_bytes = (seg->dists != NULL ? SNAPSHOT_ALIGN(sizeof(double) * (uint64_t) block_size) : 0);
+        uint64_t first = at + table * (seg->dists != NULL ? 2 : 1) + SNAPSHOT_ALIGN(sizeof(dwell) * (uint64_t) seg->max_dwells);
 
-            // find total number of trkpt
-            for (int i=0; i<trk->count; i++)
+        for (int t=0; t<(seg->dists != NULL ? 2 : 1); t++)
+        {
+            snapshot_skip_to(&w, at + t * table);
+            for (int b=0; b<seg->max_blocks; b++)
             {
-                total_trkpts += trk->segments[i].count;
+                char *entry = (b < seg->num_blocks ? (char *) (uintptr_t) (first + b * (block_bytes + dist_bytes) + t * block_bytes) : NULL);
+                snapshot_put(&w, &entry, sizeof(entry));
             }
+        }
+        if (seg->num_dwells > 0)
+        {
+            snapshot_skip_to(&w, at + table * (seg->dists != NULL ? 2 : 1));
+            snapshot_put(&w, seg->dwells, sizeof(dwell) * seg->num_dwells);
+        }
 
-            // find locations
-            location *locations = malloc(total_trkpts * sizeof(location));
-            int k = 0;
-            for (int i = 0; i < trk->count; i++)
+        for (int b=0; b<seg->num_blocks; b++)
+        {
+            int used = seg->count - b * TRACK_BLOCK_POINTS;
+            used = (used < 0 ? 0 : (used > block_size ? block_size : used));
+            snapshot_skip_to(&w, first + b * (block_bytes + dist_bytes));
+            snapshot_put(&w, seg->blocks[b], trk->rec_size * used);
+            if (seg->dists != NULL)
             {
-                for (int j = 0; j<trk->segments[i].count; j++)
-                {
-                    locations[k] = trackpoint_location(trk->segments[i].trkpt[j]);
-                    k++;
-                }
+                snapshot_skip_to(&w, first + b * (block_bytes + dist_bytes) + block_bytes);
+                snapshot_put(&w, seg->dists[b], sizeof(double) * used);
             }
+        }
+        at += segment_image_size(trk, seg);
+    }
 
-            for (int i=0; i<total_trkpts; i++)
-            {
-                // keep track of the farthest dist
-                double farthest_east = 0;
+    // the file runs to the end of the image even if it ends in a hole
+    snapshot_flush(&w);
+    return !w.failed && ftruncate(fd, (off_t) size) == 0;
+}
 
-                for (int j=0; j<total_trkpts; j++)
-                {
-                    // distance with each trkpt
-                    double eastern_distance = 0;
+/**
+ * Writes the given track to a snapshot at the given path, from which
+ * track_restore can bring it back.  The segment storage and every
+ * summary the track keeps (the bounds, lengths, running lengths, dwell
+ * times, longitude bins and sampling state) are written as they are
+ * in memory, as one image with each part aligned as it is in a track,
+ * so that restoring it needs no parsing.  The image is written to the
+ * path with ".tmp" appended, flushed to the disk, and then renamed
+ * over the path, so that a crash at any point leaves either the old
+ * snapshot or the new one there whole.  Nothing is allocated, so this
+ * is safe in a child forked from a threaded process, as
+ * track_snapshot_background does.  Only one snapshot should be written
+ * to a path at a time.
+ *
+ * @param trk a pointer to a valid track
+ * @param path the name to write the snapshot under
+ * @return true if and only if the snapshot was written
+ */
+bool track_snapshot(const track *trk, const char *path)
+{
+    char temp[SNAPSHOT_MAX_PATH];
+    size_t len = strlen(path);
+    if (len + sizeof(".tmp") > sizeof(temp))
+    {
+        return false;
+    }
+    memcpy(temp, path, len);
+    memcpy(temp + len, ".tmp", sizeof(".tmp"));
 
-                    if (i != j)
-                    {
-                        // if i is east of j
-                        if (locations[j].lon >= locations[i].lon)
-                        {
-                            eastern_distance = locations[j].lon - locations[i].lon;
-                        }
-                        // if i is west of j
-                        else
-                        {
-                            eastern_distance = locations[i].lon - locations[j].lon + 360;   
-                        }
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = snapshot_write(trk, fd) && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(temp, path) != 0)
+    {
+        unlink(temp);
+        return false;
+    }
 
-                        // update farthest distance
-                        if (eastern_distance > farthest_east)
-                        {
-                            farthest_east = eastern_distance;
-                        }
+    // the rename lasts once the directory holding it is flushed
+    char *slash = strrchr(temp, '/');
+    if (slash == NULL)
+    {
+        strcpy(temp, ".");
+    }
+    else
+    {
+        slash[slash == temp ? 1 : 0] = '\0';
+    }
+    int dir = open(temp, O_RDONLY);
+    if (dir >= 0)
+    {
+        fsync(dir);
+        close(dir);
+    }
+    return true;
+}
 
-                    }
-                    
-                }
-                // find north bound -> greatest lat
-                if (locations[i].lat > north_bound)
-                {
-                    north_bound = locations[i].lat;
-                }
-                // find south bound -> smallest lat
-                if (locations[i].lat < south_bound)
-                {
-                    south_bound = locations[i].lat;
-                }
+/**
+ * Starts writing a snapshot of the given track in the background, so
+ * that points can go on being added while it is written.  A child
+ * process is forked with a copy-on-write view of the track as it is
+ * now and writes it with track_snapshot; only the pages the parent
+ * changes meanwhile are copied.  The snapshot is finished once
+ * track_snapshot_wait says so.
+ *
+ * @param trk a pointer to a valid track
+ * @param path the name to write the snapshot under
+ * @return the process ID of the writer, or -1 if it could not be started
+ */
+pid_t track_snapshot_background(const track *trk, const char *path)
+{
+    pid_t writer = fork();
+    if (writer == 0)
+    {
+        _exit(track_snapshot(trk, path) ? 0 : 1);
+    }
+    return writer;
+}
 
-                // update min distance
-                if (farthest_east < min_distance || (farthest_east == min_distance && locations[i].lon < west_bound))
-                {
-                    min_distance = farthest_east;
-                    west_bound = locations[i].lon;
-                }
+/**
+ * Waits for a snapshot started by track_snapshot_background to be
+ * finished.
+ *
+ * @param writer the process ID track_snapshot_background returned
+ * @return true if and only if the snapshot was written
+ */
+bool track_snapshot_wait(pid_t writer)
+{
+    int status;
+    while (waitpid(writer, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
 
-            }
+/**
+ * Returns the address in the image of the given offset, or NULL if the
+ * given number of bytes from there are not all in the image or are not
+ * aligned as the snapshot aligns them.
+ */
+static void *snapshot_pointer(char *image, uint64_t size, const void *offset, uint64_t bytes)
+{
+    uint64_t at = (uintptr_t) offset;
+    if (at == 0 || at % ARENA_ALIGNMENT != 0 || at > size || bytes > size - at)
+    {
+        return NULL;
+    }
+    return image + at;
+}
 
-            // get rows and columns
-            int row_num = (int) ceil((north_bound - south_bound) / cell_height);
-            int col_num = (int) ceil(min_distance / cell_width);
+/**
+ * Turns the offsets in the segments of a mapped snapshot back into
+ * pointers, after checking that every part of each one is within the
+ * image.  Returns false if the snapshot is not sound.
+ */
+static bool snapshot_fix(char *image, uint64_t size, const track *trk, segment *segments)
+{
+    for (int i=0; i<trk->count; i++)
+    {
+        segment *seg = &segments[i];
+        bool sound = seg->num_blocks >= 1 && seg->max_blocks >= seg->num_blocks
+            && seg->count >= 0 && seg->count <= seg->capacity
+            && (seg->capacity < TRACK_BLOCK_POINTS
+                ? seg->num_blocks == 1 && seg->capacity > 0
+                : seg->capacity == seg->num_blocks * TRACK_BLOCK_POINTS)
+            && seg->num_dwells >= 0 && seg->num_dwells <= seg->max_dwells
+            && (seg->dists != NULL) == trk->running_lengths;
+        if (!sound)
+        {
+            return false;
+        }
 
-            // make heatmap
-            int** map_temp = malloc(sizeof(int*) * row_num);
-            if (map_temp != NULL)
+        int block_size = segment_block_size(seg);
+        seg->blocks = snapshot_pointer(image, size, seg->blocks, sizeof(char *) * (uint64_t) seg->max_blocks);
+        if (seg->dists != NULL)
+        {
+            seg->dists = snapshot_pointer(image, size, seg->dists, sizeof(double *) * (uint64_t) seg->max_blocks);
+            if (seg->dists == NULL)
             {
-                // for each row create cols
-                for (int l=0; l<row_num; l++)
-                {
-                    map_temp[l] = calloc(col_num , sizeof(int)); 
-                    if (map_temp[l] == NULL)
-                    {
-                        return;
-                    }
-                }
+                return false;
             }
-        
-            *rows = row_num;
-            *cols = col_num;
-
-            // for each trkpt
-            for (int i=0; i<total_trkpts; i++)
+        }
+        if (seg->max_dwells > 0)
+        {
+            seg->dwells = snapshot_pointer(image, size, seg->dwells, sizeof(dwell) * (uint64_t) seg->max_dwells);
+            if (seg->dwells == NULL)
             {
-                // insert trkpts
-                int col_index, row_index;
-
-                row_index = (int) floor((north_bound - locations[i].lat) / cell_height);
-                if (row_index == row_num)
-                {
-                    row_index --;
-                }
+                return false;
+            }
+        }
+        else
+        {
+            seg->dwells = NULL;
+        }
+        if (seg->blocks == NULL)
+        {
+            return false;
+        }
 
-                if (locations[i].lon >= west_bound)
-                {
-                    col_index = (int) floor((locations[i].lon - west_bound) / cell_width);
-                    if (col_index == col_num)
-                    {
-                        col_index --;
-                    }
-                }
-                else
+        for (int b=0; b<seg->num_blocks; b++)
+        {
+            seg->blocks[b] = snapshot_pointer(image, size, seg->blocks[b], (uint64_t) trk->rec_size * block_size);
+            if (seg->blocks[b] == NULL)
+            {
+                return false;
+            }
+            if (seg->dists != NULL)
+            {
+                seg->dists[b] = snapshot_pointer(image, size, seg->dists[b], sizeof(double) * (uint64_t) block_size);
+                if (seg->dists[b] == NULL)
                 {
-                    col_index = (int) floor((west_bound - locations[i].lon + 360) / cell_width);
-                    if (col_index == col_num)
-                    {
-                        col_index --;
-                    }
+                    return false;
                 }
-                map_temp[row_index][col_index] ++;
-                
             }
-            *map = map_temp;
-            free(locations);
         }
     }
+    return true;
 }
 
+/**
+ * Restores a track from a snapshot written by track_snapshot.  The
+ * file is mapped into memory privately, so the track's points are read
+ * from it as they are needed and changes to them are the track's alone,
+ * and only the pointers in each segment's tables are fixed up: the
+ * time taken grows with the number of segments and blocks of
+ * TRACK_BLOCK_POINTS points, not with the number of points, and the
+ * points themselves are not touched.  The restored track has the
+ * options it was created with, except that what it allocates from
+ * then on comes from an arena, as if it had been created with one, so
+ * that storage in the image is never freed piece by piece; the image
+ * is unmapped when the track is destroyed or reset.  Returns NULL if
+ * the file cannot be read or mapped, if it is not a snapshot written
+ * by the same build on the same kind of machine or is damaged, or if
+ * there is a memory allocation error.
+ *
+ * @param path the name of a snapshot
+ * @return a pointer to the restored track, or NULL
+ */
+track *track_restore(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(snapshot_header))
+    {
+        close(fd);
+        return NULL;
+    }
+    uint64_t size = (uint64_t) st.st_size;
+    char *image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    snapshot_header header;
+    uint32_t sizes[6];
+    memcpy(&header, image, sizeof(header));
+    snapshot_sizes(sizes);
+    const track *saved = &header.trk;
+    bool sound = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+        && header.version == SNAPSHOT_VERSION && header.byte_order == SNAPSHOT_BYTE_ORDER
+        && memcmp(header.sizes, sizes, sizeof(sizes)) == 0 && header.size == size
+        && saved->count >= 1 && saved->capacity >= saved->count
+        && (header.lons == 0 || snapshot_pointer(image, size, (void *) (uintptr_t) header.lons, sizeof(lon_bins)) != NULL);
+    segment *segments = (sound ? snapshot_pointer(image, size, (void *) (uintptr_t) header.segments,
+                                                  sizeof(segment) * (uint64_t) saved->capacity) : NULL);
 
+    track *trk = NULL;
+    if (segments != NULL && snapshot_fix(image, size, saved, segments))
+    {
+        trk = malloc(sizeof(track));
+    }
+    if (trk != NULL)
+    {
+        *trk = *saved;
+        trk->segments = segments;
+        trk->image = image;
+        trk->image_size = size;
+        trk->mem = arena_create(SNAPSHOT_ARENA_CHUNK);
+        trk->lons = (header.lons != 0 ? malloc(sizeof(lon_bins)) : NULL);
+        if (trk->lons != NULL)
+        {
+            memcpy(trk->lons, image + header.lons, sizeof(lon_bins));
+        }
+        if (trk->mem == NULL || (header.lons != 0 && trk->lons == NULL))
+        {
+            if (trk->mem != NULL)
+            {
+                arena_destroy(trk->mem);
+            }
+            free(trk->lons);
+            free(trk);
+            trk = NULL;
+        }
+    }
+    if (trk == NULL)
+    {
+        munmap(image, size);
+    }
+    return trk;
+}
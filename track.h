@@ -2,11 +2,214 @@
 #define __TRACK_H__
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
 
 #include "trackpoint.h"
 
 typedef struct track track;
 
+typedef struct track_live_heatmap track_live_heatmap;
+
+/**
+ * A range of segments in a track, from the 0-based index start up to
+ * but not including the index end.
+ */
+typedef struct track_range
+{
+    int start;
+    int end;
+} track_range;
+
+/**
+ * A summary of one segment of a track: the number of points, the
+ * length, the first and last timestamps, and the bounding box of the
+ * points.  The longitude bounds are the plain minimum and maximum and
+ * do not wrap around the antimeridian.  The times and bounds of an
+ * empty segment are meaningless; its south bound is greater than its
+ * north bound.
+ */
+typedef struct track_summary
+{
+    int count;
+    double length;
+    long first_time;
+    long last_time;
+    double south;
+    double north;
+    double min_lon;
+    double max_lon;
+} track_summary;
+
+/**
+ * The effect of track_simplify: the number of points and the total
+ * length of the segments, in kilometers, before and after.
+ */
+typedef struct track_simplify_stats
+{
+    long points_before;
+    long points_after;
+    double length_before;
+    double length_after;
+} track_simplify_stats;
+
+/**
+ * A region and time window for querying a track: latitudes from south
+ * to north and longitudes from west eastward to east (which wraps
+ * around the antimeridian if west is greater than east), and times
+ * from start to end, all inclusive.
+ */
+typedef struct track_window
+{
+    double south;
+    double north;
+    double west;
+    double east;
+    long start;
+    long end;
+} track_window;
+
+/**
+ * The nonzero cells of the heatmap of one of several tracks binned
+ * onto a shared grid.  Cell k is at row rows[k] and column cols[k]
+ * and holds values[k] points; the cells are in row-major order.
+ */
+typedef struct track_heatmap_layer
+{
+    int count;
+    int *rows;
+    int *cols;
+    int *values;
+} track_heatmap_layer;
+
+/**
+ * How track_merge_tracks_with treats points on different inputs with
+ * the same timestamp: keep the one from the input earliest in the
+ * array, or keep one point at the average of their locations.
+ */
+typedef enum
+{
+    TRACK_MERGE_KEEP_FIRST,
+    TRACK_MERGE_AVERAGE
+} track_merge_duplicates;
+
+/**
+ * Where track_merge_tracks_with starts new segments: never, where
+ * none of the inputs is in the middle of a segment, or where
+ * consecutive points are more than a given number of seconds apart.
+ */
+typedef enum
+{
+    TRACK_MERGE_BREAK_NONE,
+    TRACK_MERGE_BREAK_ALL,
+    TRACK_MERGE_BREAK_GAP
+} track_merge_breaks;
+
+/**
+ * The policy for merging tracks; max_gap is only used with
+ * TRACK_MERGE_BREAK_GAP.
+ */
+typedef struct track_merge_policy
+{
+    track_merge_duplicates duplicates;
+    track_merge_breaks breaks;
+    long max_gap;
+} track_merge_policy;
+
+/**
+ * How track_position_at places a point between two fixes: along the
+ * straight line between them in latitude and longitude, the shorter way
+ * around, or along the great circle joining them on a spherical earth.
+ */
+typedef enum
+{
+    TRACK_INTERPOLATE_LINEAR,
+    TRACK_INTERPOLATE_GEODESIC
+} track_interpolation;
+
+/**
+ * Which way the hexagons of track_heatmap_hex are turned: with a
+ * corner at the top, so that the hexagons form rows running east-west,
+ * or with a flat side at the top, so that they form columns running
+ * north-south.
+ */
+typedef enum
+{
+    TRACK_HEX_POINTY,
+    TRACK_HEX_FLAT
+} track_hex_orientation;
+
+/**
+ * Where the cells of a hexagonal heatmap lie.  The grid is laid out in
+ * x, the distance east of longitude lon0, and y, the distance south of
+ * latitude north, both in degrees or both in meters along a sinusoidal
+ * projection as track_heatmap_meters uses.  Size is the distance from
+ * the center of each hexagon to its corners and (x0, y0) is the center
+ * of the cell in row 0 and column 0.  Use track_hex_center to find the
+ * center of any cell.
+ */
+typedef struct track_hex_layout
+{
+    track_hex_orientation orientation;
+    bool meters;
+    double size;
+    double north;
+    double lon0;
+    double x0;
+    double y0;
+    int rows;
+    int cols;
+} track_hex_layout;
+
+/**
+ * Options for creating a track.  A nonzero arena_chunk makes the track
+ * allocate its storage from an arena of chunks of that many bytes.
+ *
+ * A compact track stores each point in 12 bytes instead of 24: the
+ * coordinates are rounded to the nearest 1e-7 degrees, which moves a
+ * point by at most about 6 mm north-south and less east-west, and the
+ * time is kept as a 32-bit offset from the first point of its segment,
+ * so a segment can span at most 2^31 - 1 seconds (about 68 years).
+ * Points read back from a compact track, and the lengths and heatmaps
+ * computed from it, use the rounded coordinates.
+ *
+ * A positive jitter_radius, in meters, collapses the fixes of a
+ * receiver standing still as they are added: a point within that
+ * distance of the last stored point of the current segment is not
+ * stored, and instead that point's dwell time runs to the new point's
+ * time.  The radius is measured from the first point of the run, so a
+ * slow drift still moves on once it leaves the circle.  The dwell times
+ * follow their points when segments are merged, but tracks made by
+ * track_merge_tracks have none.
+ *
+ * A nonzero memory_budget bounds the bytes of point records the track
+ * holds (12 or 24 per point, plus 8 with running_lengths, so at least
+ * two points).  When adding a point takes it over the budget, the track
+ * doubles its sampling rate and keeps only every other point of each
+ * segment, along with the last point of each segment.  From then on one
+ * of every rate points offered to the current segment is kept, with the
+ * latest point always held as its provisional last point, so the points
+ * kept stay evenly spaced in the order they arrived and every segment
+ * keeps its ends.  The dwell time of a point thinned out is lost, so
+ * the stop it marked only counts as time on the hop between the points
+ * either side.  The storage of a track in an arena is only reused, not
+ * released, when it shrinks.  A track with more segments than the
+ * budget has room for two points each can still exceed it.
+ *
+ * With running_lengths, each segment also keeps the distance along it
+ * from its first point to each point, 8 more bytes per point, so that
+ * track_length_between and track_length_during take O(1) and O(log n)
+ * time instead of summing the hops in between.
+ */
+typedef struct track_options
+{
+    size_t arena_chunk;
+    bool compact;
+    double jitter_radius;
+    size_t memory_budget;
+    bool running_lengths;
+} track_options;
+
 /**
  * Creates a track with one empty segment.
  *
@@ -14,6 +217,17 @@ typedef struct track track;
  */
 track *track_create();
 
+/**
+ * Creates a track with one empty segment using the given options.
+ * If the options ask for an arena then the segment and point storage
+ * of the track is carved from chunks of the given size, so that
+ * destroying or resetting the track releases whole chunks at once.
+ *
+ * @param opts a pointer to the options, or NULL for the defaults
+ * @return a pointer to the new track, or NULL if there was an allocation error
+ */
+track *track_create_with(const track_options *opts);
+
 /**
  * Destroys the given track, releasing all memory held by it.
  *
@@ -21,6 +235,21 @@ track *track_create();
  */
 void track_destroy(track *trk);
 
+/**
+ * Empties the given track, leaving it with one empty segment as if it
+ * had just been created with the same options.  A track with an arena
+ * keeps its chunks for reuse instead of returning them to the system,
+ * and the first segment of any track keeps its storage.  A track with
+ * an arena builds its fresh segment in the recycled chunks, which may
+ * need a new chunk; if that allocation fails the track is left with no
+ * segments and false is returned, and then it may only be reset again
+ * or destroyed.
+ *
+ * @param trk a pointer to a valid track
+ * @return true, or false if there is a memory allocation error
+ */
+bool track_reset(track *trk);
+
 /**
  * Returns the number of segments in the given track.
  *
@@ -54,6 +283,72 @@ int track_count_points(const track *trk, int i);
  */
 trackpoint *track_get_point(const track *trk, int i, int j);
 
+/**
+ * Copies up to n consecutive points of the given segment of this
+ * track, starting with point j, into the given arrays and returns the
+ * number copied, which is 0 if the segment or starting point is
+ * invalid.  Either array may be NULL to skip that field.  This reads
+ * the points a block at a time, so it is much faster than calling
+ * track_get_point for each.
+ *
+ * @param trk a pointer to a valid track
+ * @param i an integer
+ * @param j an integer
+ * @param n a nonnegative integer
+ * @param locs an array of n locations, or NULL
+ * @param times an array of n timestamps, or NULL
+ * @return the number of points copied
+ */
+int track_read_points(const track *trk, int i, int j, int n, location *locs, long *times);
+
+/**
+ * Returns the dwell time of the given point in this track: the seconds
+ * from it to the last point collapsed into it at ingest, or 0 if no
+ * points were collapsed into it or either index is invalid.
+ *
+ * @param trk a pointer to a valid track
+ * @param i a nonnegative integer less than the number of segments in trk
+ * @param j a nonnegative integer less than the number of points in segment i
+ * of track trk
+ */
+long track_get_dwell(const track *trk, int i, int j);
+
+/**
+ * Returns the number of points collapsed into dwell times as they were
+ * added to this track since it was created or last reset.
+ *
+ * @param trk a pointer to a valid track
+ */
+long track_count_collapsed(const track *trk);
+
+/**
+ * Returns the memory budget of this track in bytes, or 0 if it has none.
+ *
+ * @param trk a pointer to a valid track
+ */
+size_t track_memory_budget(const track *trk);
+
+/**
+ * Returns the current sampling rate of this track: it keeps one of
+ * every so many points added to it, which is 1 until it first reaches
+ * its memory budget and doubles each time it does again.
+ *
+ * @param trk a pointer to a valid track
+ */
+long track_sample_rate(const track *trk);
+
+/**
+ * Rebuilds the longitude bins this track caches if they are stale.
+ * The operations that add or move points rebuild them before
+ * returning, so they are only stale after a memory allocation error,
+ * when heatmaps find the wedge by sorting the longitudes instead.
+ * Returns false if the bins still cannot be rebuilt.
+ *
+ * @param trk a pointer to a valid track
+ * @return true if and only if the bins are up to date
+ */
+bool track_refresh(track *trk);
+
 /**
  * Returns an array containing the length of each segment in this track.
  * The length of a segment is the sum of the distances between each point
@@ -66,14 +361,113 @@ trackpoint *track_get_point(const track *trk, int i, int j);
  */
 double *track_get_lengths(const track *trk);
 
+/**
+ * Fills in a summary of the given segment of this track.  Summaries
+ * are kept up to date by every operation that adds or moves points,
+ * so this takes O(1) time and never writes to the track.  Returns
+ * false, leaving the summary unchanged, if the segment index is
+ * invalid.
+ *
+ * @param trk a pointer to a valid track
+ * @param i an integer
+ * @param summary a pointer to a summary
+ * @return true if and only if i is the index of a segment of trk
+ */
+bool track_segment_summary(const track *trk, int i, track_summary *summary);
+
+/**
+ * Returns the number of points in this track inside the given window.
+ * Segments whose summaries show they are entirely outside the window
+ * are skipped and those entirely inside are counted without looking at
+ * their points.
+ *
+ * @param trk a pointer to a valid track
+ * @param window a pointer to a window with south <= north, start <= end,
+ * and longitudes between -180 and 180
+ */
+long track_count_in_window(const track *trk, const track_window *window);
+
+/**
+ * Finds where this track was at the given time, interpolating between
+ * the last fix at or before it and the next fix in the same segment.
+ * A fix that absorbed jitter stands still for its dwell time and the
+ * interpolation to the next fix starts when the dwell ends.  The
+ * segment and the fix are found by binary search, so this takes
+ * O(log n) time.  Returns false, leaving the location unchanged, if
+ * the time is not within the span of any segment, including the gaps
+ * between segments.
+ *
+ * @param trk a pointer to a valid track
+ * @param time a timestamp
+ * @param mode how to interpolate between fixes
+ * @param loc a pointer to where to store the location
+ * @return true if and only if the track has a position at that time
+ */
+bool track_position_at(const track *trk, long time, track_interpolation mode, location *loc);
+
+/**
+ * Finds where this track was at each of the given times, as
+ * track_position_at does for each in turn, and returns the number of
+ * times a position was found; the others get a location with both
+ * coordinates NaN.  Each search gallops forward from the answer to the
+ * previous one, so for times in increasing order this takes
+ * O(n + q) time for q times in a track of n points, and much less when
+ * the times are sparse.  A time earlier than the one before it starts
+ * a fresh binary search.
+ *
+ * @param trk a pointer to a valid track
+ * @param times an array of q timestamps, best in increasing order
+ * @param q a nonnegative integer
+ * @param mode how to interpolate between fixes
+ * @param locs an array of q locations
+ * @return the number of times a position was found for
+ */
+int track_positions_at(const track *trk, const long *times, int q, track_interpolation mode, location *locs);
+
+/**
+ * Returns the distance in kilometers along segment i of this track
+ * from point j to point k, the sum of the hops between them, or NaN if
+ * any index is invalid or k is before j.  This takes O(1) time in a
+ * track with running lengths and O(k - j) time otherwise.
+ *
+ * @param trk a pointer to a valid track
+ * @param i a nonnegative integer less than the number of segments in trk
+ * @param j a nonnegative integer less than the number of points in segment i
+ * @param k an integer from j to less than the number of points in segment i
+ * @return the distance between the points
+ */
+double track_length_between(const track *trk, int i, int j, int k);
+
+/**
+ * Returns the distance in kilometers this track covered from the start
+ * time to the end time, with the positions at those times placed as
+ * track_position_at places them in linear mode and each part hop
+ * counted as that fraction of the hop's length.  Time between
+ * segments covers no distance.  In a track with running lengths this
+ * takes O(log n) time for each segment the times fall inside and O(1)
+ * for each in between; otherwise the hops are summed.
+ *
+ * @param trk a pointer to a valid track
+ * @param start a timestamp
+ * @param end a timestamp not before start
+ * @return the distance covered, or 0 if end is before start
+ */
+double track_length_during(const track *trk, long start, long end);
+
 /**
  * Adds a copy of the given point to the last segment in this track.
  * The point is not added and there is no change to the track if there
  * is a last point in the track (the last point in the current segment
  * or the last point on the previous segment if the current segment
  * is empty) and the timestamp on the new point is
- * not strictly after the timestamp on the last point.  There is no
- * effect if there is a memory allocation error.  The return value
+ * not strictly after the timestamp on the last point, or if the track
+ * is compact and the point is too long after the first point of its
+ * segment.  There is no effect if there is a memory allocation error.  If
+ * the track collapses jitter and the point is within the jitter radius
+ * of the last point of the current segment, the point is not stored but
+ * extends the dwell time of that point, and counts as the last point
+ * for later timestamps.  A track with a memory budget may then thin
+ * its points as described for track_options.  The return value
  * indicates whether the point was added.  This function must execute
  * in amortized O(1) time (so a sequence of n consecutive operations must
  * work in worst-case O(n) time).
@@ -85,6 +479,22 @@ double *track_get_lengths(const track *trk);
  */
 bool track_add_point(track *trk, const trackpoint *pt);
 
+/**
+ * Adds n points given as parallel arrays of locations and timestamps
+ * to the last segment in this track, each as track_add_point would
+ * add it, and returns the number added.  A point is skipped if its
+ * latitude is not from -90 to 90 or its longitude not from -180 up to
+ * 180, as trackpoint_create would refuse it.  This makes no copies of
+ * the points, so readers of large files should prefer it.
+ *
+ * @param trk a pointer to a valid track
+ * @param locs an array of n locations
+ * @param times an array of n timestamps
+ * @param n a nonnegative integer
+ * @return the number of points added
+ */
+int track_add_points(track *trk, const location *locs, const long *times, int n);
+
 /**
  * Starts a new segment in the given track.  There is no effect on the track
  * if the current segment is empty or if there is a memory allocation error.
@@ -109,6 +519,79 @@ void track_start_segment(track *trk);
  */
 void track_merge_segments(track *trk, int start, int end);
 
+/**
+ * Merges each of the given ranges of segments in this track into one
+ * segment, as track_merge_segments does for a single range.  The ranges
+ * must be in increasing order and must not overlap; if any range is
+ * invalid or out of order then there is no effect; in a compact track,
+ * a range whose points span more than 2^31 - 1 seconds is invalid.
+ * Room for each merged segment is made once up front, the points are
+ * copied in bulk onto the end of the first segment of each range, and
+ * the segments after each range are moved up in a single pass, so the
+ * time taken is linear in the number of segments plus the number of
+ * points moved.  The length of a merged segment is the sum of the
+ * lengths of its parts plus the hops joining them.
+ *
+ * @param trk a pointer to a valid track
+ * @param ranges an array of n ranges, each with 0 <= start < end <= the
+ * number of segments in trk, in increasing order and not overlapping
+ * @param n a nonnegative integer
+ */
+void track_merge_segment_ranges(track *trk, const track_range *ranges, int n);
+
+/**
+ * Merges the given tracks, such as the logs of several devices carried
+ * by one team, into a new track with all their points in timestamp
+ * order, using the default policy: when several inputs have points
+ * with the same timestamp only the one from the input earliest in the
+ * array is kept, and a new segment starts only where none of the
+ * inputs is in the middle of a segment.  The inputs are not changed.
+ * The return value is NULL if there is a memory allocation error.
+ * It is the caller's responsibility to destroy the returned track.
+ *
+ * @param inputs an array of k pointers to valid tracks
+ * @param k a nonnegative integer
+ * @return a pointer to the merged track, or NULL
+ */
+track *track_merge_tracks(track **inputs, int k);
+
+/**
+ * Merges the given tracks into a new track with all their points in
+ * timestamp order, as for track_merge_tracks but with the given policy
+ * for points with the same timestamp and for where segments break.
+ * The merge takes O(n log k) time for n points in total.  The block
+ * index of the first segment is reserved up front with entries for all
+ * the points; later segments grow a block at a time as they fill.
+ *
+ * @param inputs an array of k pointers to valid tracks
+ * @param k a nonnegative integer
+ * @param policy a pointer to a policy, or NULL for the default
+ * @return a pointer to the merged track, or NULL
+ */
+track *track_merge_tracks_with(track **inputs, int k, const track_merge_policy *policy);
+
+/**
+ * Simplifies each segment of this track in place with the
+ * Visvalingam-Whyatt algorithm, measuring each point by its distance in
+ * meters from the path that would join its neighbors if it were
+ * removed.  The point with the smallest such distance is removed
+ * repeatedly, with its neighbors remeasured each time, until every
+ * remaining point is more than the tolerance from the path without it.
+ * The first and last points of every segment and the points with dwell
+ * times are kept, and the order of the points is unchanged, so
+ * timestamps stay strictly increasing.  This takes O(n log n) time for
+ * a segment of n points.  Segment lengths are
+ * recomputed from the points kept.  If stats is not NULL it is filled in
+ * with the number of points and total length before and after.  A
+ * segment for which there is a memory allocation error is left as it
+ * was.
+ *
+ * @param trk a pointer to a valid track
+ * @param tolerance a nonnegative distance in meters
+ * @param stats a pointer to a place for statistics, or NULL
+ */
+void track_simplify(track *trk, double tolerance, track_simplify_stats *stats);
+
 /**
  * Creates a heapmap of the given track.  The heatmap will be a
  * rectangular 2-D array with each row separately allocated.  The last
@@ -152,4 +635,342 @@ void track_merge_segments(track *trk, int start, int end);
 void track_heatmap(const track *trk, double cell_width, double cell_height,
 		    int ***map, int *rows, int *cols);
 
+/**
+ * Creates a heatmap of the given track on a grid of cells measured in
+ * meters, counting the trackpoints in each cell as track_heatmap does.
+ * The points are placed on a sinusoidal projection of a spherical
+ * earth centered on the middle of the smallest wedge holding the
+ * track's longitudes: y is the distance south of the track's northmost
+ * latitude and x is the distance east of the central meridian along
+ * the point's parallel.  That projection is equal-area, so every cell
+ * covers the same area of ground wherever it is, and near the central
+ * meridian it barely distorts distances either.  The first row's top
+ * is the northmost point and the columns are whole cells east and west
+ * of the central meridian, with just enough rows and columns to hold
+ * every point.  A point on a border is counted in the cell east or
+ * south of it, except that points on the south border of the last row
+ * are counted in that row.  Points are projected and counted in one
+ * pass with a table of the scale of each parallel, so this is not much
+ * slower than track_heatmap.  An empty track gets a 1x1 heatmap
+ * holding 0.
+ *
+ * If the cell size is invalid or if there is a memory allocation
+ * error then the map is set to NULL and the rows and columns
+ * parameters are unchanged.  It is the caller's responsibility to
+ * free each row in the returned array and the array itself.
+ *
+ * @param trk a pointer to a valid track
+ * @param cell_width a positive width in meters
+ * @param cell_height a positive height in meters
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_heatmap_meters(const track *trk, double cell_width, double cell_height,
+                          int ***map, int *rows, int *cols);
+
+/**
+ * Creates a heatmap of the given track on a grid of hexagons, counting
+ * the trackpoints in each.  Every hexagon has six neighbors all the
+ * same distance away, where a square cell's diagonal neighbors are
+ * further than the others.  The hexagons are of the given size, from
+ * center to corner, in degrees of latitude and longitude or, if meters
+ * is true, in meters on the projection track_heatmap_meters uses.  The
+ * northmost point is on the top row and there are just enough rows and
+ * columns to hold every point.  A point is counted in the hexagon whose
+ * center is nearest, with ties going to one of them the same way each
+ * time.
+ *
+ * The map is rectangular, with each row separately allocated, in
+ * offset coordinates: with pointy hexagons each row of the map is a row
+ * of hexagons, and the odd rows are shifted half a hexagon east of the
+ * even ones; with flat hexagons each column of the map is a column of
+ * hexagons, and the odd columns are shifted half a hexagon south.  That
+ * packs the cells without the empty corners a map in axial coordinates
+ * would need.  The dimensions of the map and the position of its cells
+ * are stored in *layout.  An empty track gets a 1x1 heatmap holding 0.
+ *
+ * If the size is invalid or if there is a memory allocation error then
+ * the map is set to NULL and the layout is unchanged.  It is the
+ * caller's responsibility to free each row in the returned array and
+ * the array itself.
+ *
+ * @param trk a pointer to a valid track
+ * @param size a positive size in degrees or meters
+ * @param orientation which way the hexagons are turned
+ * @param meters true for a size in meters, false for degrees
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param layout a pointer to where to store the layout of the map
+ */
+void track_heatmap_hex(const track *trk, double size, track_hex_orientation orientation, bool meters,
+                       int ***map, track_hex_layout *layout);
+
+/**
+ * Returns the location of the center of the cell in the given row and
+ * column of a hexagonal heatmap with the given layout.  Rows and
+ * columns outside the map are allowed.
+ *
+ * @param layout a pointer to the layout track_heatmap_hex stored
+ * @param row a row of the map
+ * @param col a column of the map
+ * @return the location of the cell's center
+ */
+location track_hex_center(const track_hex_layout *layout, int row, int col);
+
+/**
+ * Creates a dwell-time heatmap of the given track.  The grid is the
+ * same as the one track_heatmap would create for the same cell sizes,
+ * but each element is the number of seconds spent in the corresponding
+ * cell rather than the number of trackpoints in it.  The interval
+ * between two consecutive points in a segment is apportioned across
+ * the cells the straight line between them (in latitude and longitude)
+ * passes through, in proportion to the part of the line inside each
+ * cell.  Time between segments is not counted, and the part of a hop
+ * that passes outside the grid (which can only happen when the hop
+ * wraps around the west bound) is dropped.  The dwell time of a point
+ * that absorbed jitter is counted in that point's cell, and only the
+ * rest of the time to the next point is apportioned along the hop.
+ *
+ * If the cell size is invalid or if there is a memory allocation
+ * error then the map is set to NULL and the rows and columns
+ * parameters are unchanged.  It is the caller's responsibility to
+ * free each row in the returned array and the array itself.
+ *
+ * @param trk a pointer to a valid track
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param map a pointer to a pointer to a 2-D array of doubles
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_heatmap_dwell(const track *trk, double cell_width, double cell_height,
+                         double ***map, int *rows, int *cols);
+
+/**
+ * Creates a coverage heatmap of the given track.  The grid is the
+ * same as the one track_heatmap would create for the same cell sizes,
+ * but each element counts the number of times the path of a segment
+ * enters the corresponding cell, where the path between two
+ * consecutive points in a segment is the straight line between them
+ * (in latitude and longitude) the shorter way around.  The first point
+ * of a segment enters its own cell, so a segment with a single point
+ * counts like track_heatmap does, and cells between sparse points are
+ * marked even though no point is in them.  The part of a hop that
+ * wraps around the west bound and passes outside the grid marks
+ * nothing.  The work is split across threads by segment for large
+ * tracks.
+ *
+ * If the cell size is invalid or if there is a memory allocation
+ * error then the map is set to NULL and the rows and columns
+ * parameters are unchanged.  It is the caller's responsibility to
+ * free each row in the returned array and the array itself.
+ *
+ * @param trk a pointer to a valid track
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_heatmap_coverage(const track *trk, double cell_width, double cell_height,
+                            int ***map, int *rows, int *cols);
+
+/**
+ * Creates a sweep-width heatmap of the given track.  The grid is the
+ * same as the one track_heatmap would create for the same cell sizes,
+ * but each hop between consecutive points in a segment is treated as
+ * a corridor the given width in meters wide (extending half the width
+ * to each side of the hop and past each end) and each element counts
+ * the number of hops whose corridor overlaps the corresponding cell.
+ * A segment with a single point counts as a square the sweep width
+ * across.  Each hop counts at most once in each cell, but consecutive
+ * hops overlap at their shared point.  Distances are converted to
+ * degrees on a spherical earth using the scale at the middle of the
+ * row containing the middle of the hop.  The parts of corridors
+ * outside the grid are dropped.  The work is split across threads for
+ * large tracks.
+ *
+ * If the cell size or width is invalid or if there is a memory
+ * allocation error then the map is set to NULL and the rows and
+ * columns parameters are unchanged.  It is the caller's
+ * responsibility to free each row in the returned array and the array
+ * itself.
+ *
+ * @param trk a pointer to a valid track
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param sweep_width a positive double
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_heatmap_corridor(const track *trk, double cell_width, double cell_height,
+                            double sweep_width, int ***map, int *rows, int *cols);
+
+/**
+ * Creates one heatmap of all the points on the given tracks, such as
+ * the logs of several teams in one operation.  The grid is the one
+ * track_heatmap would create for a single track holding all of the
+ * points, so the bounding box and wedge are shared.  The tracks are
+ * binned in parallel, each thread taking one track at a time into its
+ * own map and the maps being summed at the end.  If layers is not
+ * NULL then it is set to a newly allocated array with one entry per
+ * track listing the nonzero cells of that track alone, in row-major
+ * order; those are released with track_heatmap_layers_destroy.  The
+ * time taken grows with the total number of points (and the size of
+ * the map once per thread), not with the number of tracks times the
+ * size of the map.
+ *
+ * If the cell size is invalid or if there is a memory allocation
+ * error then the map (and layers, if not NULL) is set to NULL and the
+ * rows and columns parameters are unchanged.  It is the caller's
+ * responsibility to free each row in the returned array and the array
+ * itself.
+ *
+ * @param trks an array of n pointers to valid tracks
+ * @param n a positive integer
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ * @param layers a pointer to a pointer to an array of n layers, or NULL
+ */
+void track_heatmap_multi(track *const *trks, int n, double cell_width, double cell_height,
+                         int ***map, int *rows, int *cols, track_heatmap_layer **layers);
+
+/**
+ * Releases the per-track layers created by track_heatmap_multi.
+ *
+ * @param layers an array of n layers returned by track_heatmap_multi
+ * @param n the number of tracks passed to track_heatmap_multi
+ */
+void track_heatmap_layers_destroy(track_heatmap_layer *layers, int n);
+
+/**
+ * Creates an empty heatmap to be kept up to date with
+ * track_live_heatmap_update.  The circle of latitude and meridian
+ * through the first point binned are borders of its cells, and every
+ * other border is a whole number of cells from those, so the cells
+ * never move as points arrive and a point is counted once, when it is
+ * binned.  A point on the border of two or more cells is counted in
+ * the bottommost and rightmost, so with the first point at the
+ * northwest corner of the track the grid is the one track_heatmap
+ * creates, except that points on its south or east edge get a row or
+ * column of their own.
+ * Returns NULL if the cell size is invalid or if there is a memory
+ * allocation error.
+ *
+ * @param cell_width a positive double less than or equal to 360.0
+ * @param cell_height a positive double less than or equal to 180.0
+ * @return a pointer to the new heatmap, or NULL
+ */
+track_live_heatmap *track_live_heatmap_create(double cell_width, double cell_height);
+
+/**
+ * Destroys the given heatmap.
+ *
+ * @param live a pointer to a valid heatmap
+ */
+void track_live_heatmap_destroy(track_live_heatmap *live);
+
+/**
+ * Counts the points added to the given track since the last update of
+ * the given heatmap, and returns how many there were.  The time taken
+ * grows with the number of new points, not with the size of the track,
+ * except when the grid grows, which copies it.  The track must be the
+ * same one each time, and its points must only have been added since
+ * the last update, not simplified, merged, reset or thinned out by a
+ * memory budget.  If there is a memory allocation error then -1 is
+ * returned, and the points counted so far stay counted; a later update
+ * carries on from the first point that was not.
+ *
+ * @param live a pointer to a valid heatmap
+ * @param trk a pointer to a valid track
+ * @return the number of points counted, or -1
+ */
+long track_live_heatmap_update(track_live_heatmap *live, const track *trk);
+
+/**
+ * Creates a copy of the given heatmap in the form track_heatmap
+ * returns, with just enough rows and columns to hold every cell
+ * counted so far; copying it takes time proportional to its size.  If
+ * nothing has been counted then the map is 1x1 holding 0.
+ *
+ * If there is a memory allocation error then the map is set to NULL
+ * and the other parameters are unchanged.  It is the caller's
+ * responsibility to free each row in the returned array and the array
+ * itself.
+ *
+ * @param live a pointer to a valid heatmap
+ * @param map a pointer to a pointer to a 2-D array of ints
+ * @param rows a pointer to an int
+ * @param cols a pointer to an int
+ */
+void track_live_heatmap_map(const track_live_heatmap *live, int ***map, int *rows, int *cols);
+
+/**
+ * Writes the given track to a snapshot at the given path, from which
+ * track_restore can bring it back.  The segment storage and every
+ * summary the track keeps (the bounds, lengths, running lengths, dwell
+ * times, longitude bins and sampling state) are written as they are
+ * in memory, as one image with each part aligned as it is in a track,
+ * so that restoring it needs no parsing.  The image is written to the
+ * path with ".tmp" appended, flushed to the disk, and then renamed
+ * over the path, so that a crash at any point leaves either the old
+ * snapshot or the new one there whole.  Nothing is allocated, so this
+ * is safe in a child forked from a threaded process, as
+ * track_snapshot_background does.  Only one snapshot should be written
+ * to a path at a time.
+ *
+ * @param trk a pointer to a valid track
+ * @param path the name to write the snapshot under
+ * @return true if and only if the snapshot was written
+ */
+bool track_snapshot(const track *trk, const char *path);
+
+/**
+ * Starts writing a snapshot of the given track in the background, so
+ * that points can go on being added while it is written.  A child
+ * process is forked with a copy-on-write view of the track as it is
+ * now and writes it with track_snapshot; only the pages the parent
+ * changes meanwhile are copied.  The snapshot is finished once
+ * track_snapshot_wait says so.
+ *
+ * @param trk a pointer to a valid track
+ * @param path the name to write the snapshot under
+ * @return the process ID of the writer, or -1 if it could not be started
+ */
+pid_t track_snapshot_background(const track *trk, const char *path);
+
+/**
+ * Waits for a snapshot started by track_snapshot_background to be
+ * finished.
+ *
+ * @param writer the process ID track_snapshot_background returned
+ * @return true if and only if the snapshot was written
+ */
+bool track_snapshot_wait(pid_t writer);
+
+/**
+ * Restores a track from a snapshot written by track_snapshot.  The
+ * file is mapped into memory privately, so the track's points are read
+ * from it as they are needed and changes to them are the track's alone,
+ * and only the pointers in each segment's tables are fixed up: the
+ * time taken grows with the number of segments and blocks of
+ * TRACK_BLOCK_POINTS points, not with the number of points, and the
+ * points themselves are not touched.  The restored track has the
+ * options it was created with, except that what it allocates from
+ * then on comes from an arena, as if it had been created with one, so
+ * that storage in the image is never freed piece by piece; the image
+ * is unmapped when the track is destroyed or reset.  Returns NULL if
+ * the file cannot be read or mapped, if it is not a snapshot written
+ * by the same build on the same kind of machine or is damaged, or if
+ * there is a memory allocation error.
+ *
+ * @param path the name of a snapshot
+ * @return a pointer to the restored track, or NULL
+ */
+track *track_restore(const char *path);
+
 #endif
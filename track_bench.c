@@ -0,0 +1,764 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "track.h"
+#include "trackindex.h"
+#include "trackpoint.h"
+#include "location.h"
+#include "image.h"
+#include "gpx.h"
+#include "service.h"
+
+double now();
+long peak_kb();
+track *random_track(long n, unsigned int seed, const track_options *opts);
+
+void append_latency(long n, const track_options *opts);
+void heatmap_throughput(long n, const track_options *opts);
+void index_queries(long n, const track_options *opts);
+void position_queries(long n, const track_options *opts);
+void image_throughput(int side);
+void gpx_throughput(long n, const track_options *opts);
+void service_load(long n, int clients);
+void snapshot_restart(long n, const track_options *opts);
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+    {
+      fprintf(stderr, "USAGE: %s bench-number [points [compact]]\n", argv[0]);
+      return 1;
+    }
+
+  int bench = atoi(argv[1]);
+  long n = (argc > 2 ? atol(argv[2]) : 10000000);
+  track_options opts = {.compact = (argc > 3 && strcmp(argv[3], "compact") == 0)};
+  switch (bench)
+    {
+    case 1:
+      append_latency(n, &opts);
+      break;
+
+    case 2:
+      heatmap_throughput(n, &opts);
+      break;
+
+    case 3:
+      index_queries(n, &opts);
+      break;
+
+    case 4:
+      position_queries(n, &opts);
+      break;
+
+    case 5:
+      image_throughput(argc > 2 ? atoi(argv[2]) : 20000);
+      break;
+
+    case 6:
+      gpx_throughput(n, opts.compact ? &opts : NULL);
+      break;
+
+    case 7:
+      service_load(argc > 2 ? n : 1000000, argc > 3 ? atoi(argv[3]) : 8);
+      break;
+
+    case 8:
+      snapshot_restart(n, &opts);
+      break;
+
+    default:
+      fprintf(stderr, "%s: invalid bench number %s\n", argv[0], argv[1]);
+      return 1;
+    }
+
+  return 0;
+}
+
+/**
+ * Returns the time in seconds from an arbitrary fixed point.
+ */
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Returns the peak resident set size of this process in kilobytes.
+ */
+long peak_kb()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+/**
+ * Returns a track with one segment of n points on a random walk.
+ */
+track *random_track(long n, unsigned int seed, const track_options *opts)
+{
+  track *trk = track_create_with(opts);
+  if (trk == NULL)
+    {
+      return NULL;
+    }
+
+  srand(seed);
+  double lat = 41.3;
+  double lon = -72.9;
+  for (long i = 0; i < n; i++)
+    {
+      lat += (rand() / (double) RAND_MAX - 0.5) * 0.001;
+      lon += (rand() / (double) RAND_MAX - 0.5) * 0.001;
+      trackpoint *pt = trackpoint_create(lat, lon, i);
+      track_add_point(trk, pt);
+      trackpoint_destroy(pt);
+    }
+  return trk;
+}
+
+void append_latency(long n, const track_options *opts)
+{
+  track *trk = track_create_with(opts);
+  if (trk == NULL)
+    {
+      printf("ERROR: could not create track\n");
+      return;
+    }
+
+  trackpoint *pt = trackpoint_create(41.3, -72.9, 0);
+  double worst = 0.0;
+  double start = now();
+  for (long i = 0; i < n; i++)
+    {
+      // the same point at a later time each append
+      trackpoint_destroy(pt);
+      pt = trackpoint_create(41.3 + (i % 1000) * 1e-5, -72.9, i);
+
+      double before = now();
+      track_add_point(trk, pt);
+      double took = now() - before;
+      if (took > worst)
+	{
+	  worst = took;
+	}
+    }
+  double total = now() - start;
+  trackpoint_destroy(pt);
+
+  printf("appended %ld points in %.3f s, worst append %.3f ms, peak RSS %ld KB\n",
+	 (long) track_count_points(trk, 0), total, worst * 1e3, peak_kb());
+  track_destroy(trk);
+}
+
+void heatmap_throughput(long n, const track_options *opts)
+{
+  track *trk = random_track(n, 1, opts);
+  if (trk == NULL)
+    {
+      printf("ERROR: could not create track\n");
+      return;
+    }
+
+  int **map;
+  int rows, cols;
+  double start = now();
+  track_heatmap(trk, 0.001, 0.001, &map, &rows, &cols);
+  double took = now() - start;
+  if (map == NULL)
+    {
+      printf("ERROR: could not create heatmap\n");
+      track_destroy(trk);
+      return;
+    }
+
+  printf("binned %ld points onto %d x %d cells in %.3f s (%.1f M points/s), peak RSS %ld KB\n",
+	 n, rows, cols, took, n / took * 1e-6, peak_kb());
+  for (int r = 0; r < rows; r++)
+    {
+      free(map[r]);
+    }
+  free(map);
+
+  // the same points on cells about as big in meters
+  start = now();
+  track_heatmap_meters(trk, 100.0, 100.0, &map, &rows, &cols);
+  took = now() - start;
+  if (map == NULL)
+    {
+      printf("ERROR: could not create heatmap\n");
+      track_destroy(trk);
+      return;
+    }
+  printf("binned %ld points onto %d x %d cells of 100 m in %.3f s (%.1f M points/s)\n",
+	 n, rows, cols, took, n / took * 1e-6);
+  for (int r = 0; r < rows; r++)
+    {
+      free(map[r]);
+    }
+  free(map);
+
+  // and onto hexagons of about the same area, in degrees and in meters
+  for (int meters = 0; meters < 2; meters++)
+    {
+      track_hex_layout layout;
+      start = now();
+      track_heatmap_hex(trk, meters ? 62.0 : 0.00062, TRACK_HEX_POINTY, meters, &map, &layout);
+      took = now() - start;
+      if (map == NULL)
+	{
+	  printf("ERROR: could not create heatmap\n");
+	  track_destroy(trk);
+	  return;
+	}
+      printf("binned %ld points onto %d x %d hexagons of %s in %.3f s (%.1f M points/s)\n",
+	     n, layout.rows, layout.cols, meters ? "62 m" : "0.00062 degrees", took, n / took * 1e-6);
+      for (int r = 0; r < layout.rows; r++)
+	{
+	  free(map[r]);
+	}
+      free(map);
+    }
+  track_destroy(trk);
+}
+
+void index_queries(long n, const track_options *opts)
+{
+  track *trk = random_track(n, 1, opts);
+  if (trk == NULL)
+    {
+      printf("ERROR: could not create track\n");
+      return;
+    }
+
+  double start = now();
+  track_index *idx = track_index_create(trk);
+  double build = now() - start;
+  if (idx == NULL)
+    {
+      printf("ERROR: could not create index\n");
+      track_destroy(trk);
+      return;
+    }
+
+  // queries near the walk, which wanders about 0.5 degrees per million points
+  int num_queries = 10000;
+  location *queries = malloc(sizeof(location) * num_queries);
+  double *distances = malloc(sizeof(double) * num_queries);
+  for (int q = 0; q < num_queries; q++)
+    {
+      queries[q].lat = 41.3 + (rand() / (double) RAND_MAX - 0.5);
+      queries[q].lon = -72.9 + (rand() / (double) RAND_MAX - 0.5);
+    }
+
+  start = now();
+  for (int q = 0; q < num_queries; q++)
+    {
+      track_index_nearest(idx, queries[q], NULL, &distances[q]);
+    }
+  double indexed = (now() - start) / num_queries;
+
+  start = now();
+  track_index_nearest_batch(idx, queries, num_queries, NULL, distances);
+  double batched = (now() - start) / num_queries;
+
+  // brute force with point copies, as before the index
+  int num_brute = 5;
+  start = now();
+  for (int q = 0; q < num_brute; q++)
+    {
+      double best = INFINITY;
+      for (int i = 0; i < track_count_segments(trk); i++)
+	{
+	  for (int j = 0; j < track_count_points(trk, i); j++)
+	    {
+	      trackpoint *pt = track_get_point(trk, i, j);
+	      location loc = trackpoint_location(pt);
+	      double d = location_distance(&queries[q], &loc);
+	      best = (d < best ? d : best);
+	      trackpoint_destroy(pt);
+	    }
+	}
+      if (best != distances[q])
+	{
+	  printf("ERROR: brute force found %f for query %d, index %f\n", best, q, distances[q]);
+	}
+    }
+  double brute = (now() - start) / num_brute;
+
+  track_window window = {41.2, 41.3, -73.0, -72.9, 0, n};
+  track_fix *fixes;
+  start = now();
+  long found = track_index_box(idx, &window, &fixes);
+  double box = now() - start;
+  free(fixes);
+  start = now();
+  long counted = track_count_in_window(trk, &window);
+  double scan = now() - start;
+
+  printf("indexed %ld points in %.3f s\n", n, build);
+  printf("nearest: %.1f us indexed, %.1f us batched, %.1f ms brute force\n",
+	 indexed * 1e6, batched * 1e6, brute * 1e3);
+  printf("box: %ld points in %.3f ms indexed, %ld in %.3f ms scanning\n", found, box * 1e3, counted, scan * 1e3);
+
+  free(queries);
+  free(distances);
+  track_index_destroy(idx);
+  track_destroy(trk);
+}
+
+void position_queries(long n, const track_options *opts)
+{
+  track *trk = random_track(n, 1, opts);
+  if (trk == NULL)
+    {
+      printf("ERROR: could not create track\n");
+      return;
+    }
+
+  // sorted times at a tenth of a second apart on average
+  int num_queries = 1000000;
+  long *times = malloc(sizeof(long) * num_queries);
+  location *locs = malloc(sizeof(location) * num_queries);
+  for (int q = 0; q < num_queries; q++)
+    {
+      times[q] = (long) ((double) q * n / num_queries);
+    }
+
+  double start = now();
+  for (int q = 0; q < num_queries; q++)
+    {
+      track_position_at(trk, times[q], TRACK_INTERPOLATE_LINEAR, &locs[q]);
+    }
+  double single = now() - start;
+
+  start = now();
+  int found = track_positions_at(trk, times, num_queries, TRACK_INTERPOLATE_LINEAR, locs);
+  double batched = now() - start;
+
+  // a scan with point copies for a few queries, as before
+  int num_scans = 20;
+  start = now();
+  for (int q = 0; q < num_scans; q++)
+    {
+      long time = times[q * (num_queries / num_scans)];
+      for (int j = 0; j < track_count_points(trk, 0); j++)
+	{
+	  trackpoint *pt = track_get_point(trk, 0, j);
+	  bool after = trackpoint_time(pt) > time;
+	  trackpoint_destroy(pt);
+	  if (after)
+	    {
+	      break;
+	    }
+	}
+    }
+  double scan = (now() - start) / num_scans;
+
+  printf("positions at %d times in %ld points: %.3f s single, %.3f s batched (%d found), scanning %.3f ms each\n",
+	 num_queries, n, single, batched, found, scan * 1e3);
+  free(times);
+  free(locs);
+  track_destroy(trk);
+}
+
+void image_throughput(int side)
+{
+  // a row of counts reused for every row, as a map freed row by row would be
+  int *row = malloc(sizeof(int) * side);
+  for (int j = 0; j < side; j++)
+    {
+      row[j] = (j * 7919) % 5000;
+    }
+
+  FILE *out = fopen("/dev/null", "wb");
+  if (row == NULL || out == NULL)
+    {
+      printf("ERROR: could not set up image\n");
+      free(row);
+      return;
+    }
+
+  for (int format = 0; format < 2; format++)
+    {
+      double start = now();
+      image_writer *w = image_writer_create(out, format ? IMAGE_COLOR : IMAGE_GRAY, IMAGE_SCALE_LOG,
+					    side, side, 5000.0);
+      bool ok = w != NULL;
+      for (int r = 0; r < side && ok; r++)
+	{
+	  ok = image_write_row(w, row);
+	}
+      ok = w != NULL && image_writer_finish(w) && ok;
+      double took = now() - start;
+      if (!ok)
+	{
+	  printf("ERROR: could not write image\n");
+	  break;
+	}
+      double megabytes = (double) side * side * (format ? 3 : 1) / (1 << 20);
+      printf("wrote %d x %d %s in %.3f s (%.0f MB/s), peak RSS %ld KB\n",
+	     side, side, format ? "PPM" : "PGM", took, megabytes / took, peak_kb());
+    }
+  fclose(out);
+  free(row);
+}
+
+void gpx_throughput(long n, const track_options *opts)
+{
+  // a file of n points in segments of 100000, about 120 bytes a point
+  char path[] = "/tmp/track_bench_XXXXXX";
+  int fd = mkstemp(path);
+  FILE *out = (fd >= 0 ? fdopen(fd, "w") : NULL);
+  if (out == NULL)
+    {
+      printf("ERROR: could not create GPX file\n");
+      return;
+    }
+  fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<gpx version=\"1.1\" creator=\"track_bench\">\n<trk>\n");
+  double lat = 41.3;
+  double lon = -72.9;
+  for (long i = 0; i < n; i++)
+    {
+      if (i % 100000 == 0)
+	{
+	  fprintf(out, "%s<trkseg>\n", i > 0 ? "</trkseg>\n" : "");
+	}
+      lat += (rand() / (double) RAND_MAX - 0.5) * 0.001;
+      lon += (rand() / (double) RAND_MAX - 0.5) * 0.001;
+      time_t t = 1600000000 + i;
+      struct tm tm;
+      char stamp[32];
+      strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&t, &tm));
+      fprintf(out, "<trkpt lat=\"%.7f\" lon=\"%.7f\"><ele>%.1f</ele><time>%s</time></trkpt>\n",
+	      lat, lon, 10.0 + i % 50, stamp);
+    }
+  fprintf(out, "</trkseg>\n</trk>\n</gpx>\n");
+  long size = ftell(out);
+  fclose(out);
+
+  track *trk = (opts != NULL ? track_create_with(opts) : track_create());
+  double start = now();
+  long added = gpx_read_file(path, trk);
+  double took = now() - start;
+  unlink(path);
+
+  printf("read %ld of %ld points from %.0f MB of GPX in %.3f s (%.0f MB/s, %.1f M points/s), peak RSS %ld KB\n",
+	 added, n, size / 1048576.0, took, size / 1048576.0 / took, added / took * 1e-6, peak_kb());
+  track_destroy(trk);
+}
+
+/**
+ * One client of the service under load: it appends batches of points to
+ * its own track, or asks for the heatmap of track 0 until told to stop,
+ * recording how long each request took to be answered.
+ */
+typedef struct load_client
+{
+  const char *path;
+  int track;
+  long requests;
+  pthread_mutex_t *lock;
+  bool *stop;
+  double *latencies;
+  long count;
+  bool failed;
+} load_client;
+
+// points in each append request of the load test
+#define LOAD_BATCH 100
+
+bool load_stopped(load_client *client)
+{
+  pthread_mutex_lock(client->lock);
+  bool stop = *client->stop;
+  pthread_mutex_unlock(client->lock);
+  return stop;
+}
+
+void *load_client_run(void *arg)
+{
+  load_client *client = arg;
+  int fd = service_connect(client->path);
+  client->failed = (fd < 0);
+
+  service_point pts[LOAD_BATCH];
+  double cells[2] = {0.01, 0.01};
+  for (long r = 0; !client->failed && (client->track > 0 ? r < client->requests : !load_stopped(client)); r++)
+    {
+      double start = now();
+      if (client->track > 0)
+	{
+	  for (int k = 0; k < LOAD_BATCH; k++)
+	    {
+	      pts[k].lat = 41.3 + ((r * LOAD_BATCH + k) % 1000) * 1e-4;
+	      pts[k].lon = -72.9 + client->track * 0.01;
+	      pts[k].time = r * LOAD_BATCH + k;
+	    }
+	  client->failed = !service_send(fd, SERVICE_APPEND, client->track, (uint32_t) r, pts, sizeof(pts));
+	}
+      else
+	{
+	  client->failed = !service_send(fd, SERVICE_HEATMAP, 0, (uint32_t) r, cells, sizeof(cells));
+	}
+
+      service_header header;
+      void *body = (client->failed ? NULL : service_receive(fd, &header));
+      client->failed = (body == NULL || header.type != SERVICE_OK);
+      free(body);
+      if (client->count < client->requests)
+	{
+	  client->latencies[client->count++] = now() - start;
+	}
+    }
+
+  if (fd >= 0)
+    {
+      close(fd);
+    }
+  return NULL;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Prints the percentiles of the latencies of all the given clients.
+ */
+void print_latencies(const char *what, load_client *clients, int n)
+{
+  long total = 0;
+  for (int c = 0; c < n; c++)
+    {
+      total += clients[c].count;
+    }
+  double *all = malloc(sizeof(double) * (total > 0 ? total : 1));
+  if (all == NULL || total == 0)
+    {
+      printf("%s: no requests answered\n", what);
+      free(all);
+      return;
+    }
+
+  long k = 0;
+  for (int c = 0; c < n; c++)
+    {
+      memcpy(all + k, clients[c].latencies, sizeof(double) * clients[c].count);
+      k += clients[c].count;
+    }
+  qsort(all, total, sizeof(double), compare_doubles);
+  printf("%s: %ld requests, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n", what, total,
+	 all[total / 2] * 1e3, all[total * 9 / 10] * 1e3, all[total * 99 / 100] * 1e3, all[total - 1] * 1e3);
+  free(all);
+}
+
+/**
+ * Runs the given clients at once, the ones appending to completion and
+ * the ones querying until the appending ones are done.
+ */
+bool run_clients(load_client *clients, int n)
+{
+  pthread_t threads[n];
+  bool ok = true;
+  for (int c = 0; c < n; c++)
+    {
+      clients[c].count = 0;
+      ok = ok && pthread_create(&threads[c], NULL, load_client_run, &clients[c]) == 0;
+    }
+  for (int c = 0; c < n; c++)
+    {
+      if (clients[c].track > 0)
+	{
+	  pthread_join(threads[c], NULL);
+	}
+    }
+  pthread_mutex_lock(clients[0].lock);
+  *clients[0].stop = true;
+  pthread_mutex_unlock(clients[0].lock);
+  for (int c = 0; c < n; c++)
+    {
+      if (clients[c].track <= 0)
+	{
+	  pthread_join(threads[c], NULL);
+	}
+      ok = ok && !clients[c].failed;
+    }
+  return ok;
+}
+
+void *serve_load(void *s)
+{
+  service_run(s);
+  return NULL;
+}
+
+void service_load(long n, int clients)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/track_bench_%ld.sock", (long) getpid());
+  track_options opts = {0};
+  service *s = service_create(path, &opts);
+  pthread_t thread;
+  if (clients < 2 || s == NULL || pthread_create(&thread, NULL, serve_load, s) != 0)
+    {
+      printf("ERROR: could not start service\n");
+      return;
+    }
+
+  // track 0 holds the n points the readers' heatmaps cover
+  int fd = service_connect(path);
+  service_point *pts = malloc(sizeof(service_point) * 10000);
+  bool ok = (fd >= 0 && pts != NULL);
+  for (long i = 0; ok && i < n; i += 10000)
+    {
+      int batch = (n - i < 10000 ? (int) (n - i) : 10000);
+      for (int k = 0; k < batch; k++)
+	{
+	  pts[k].lat = 41.0 + ((i + k) % 7919) * 1e-4;
+	  pts[k].lon = -73.0 + ((i + k) % 6733) * 1e-4;
+	  pts[k].time = i + k;
+	}
+      service_header header;
+      void *body = NULL;
+      ok = service_send(fd, SERVICE_APPEND, 0, 0, pts, batch * sizeof(service_point))
+	&& (body = service_receive(fd, &header)) != NULL;
+      free(body);
+    }
+  free(pts);
+
+  // half the clients append and half ask for heatmaps, first the
+  // appending ones alone and then with the others
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  bool stop = false;
+  load_client load[clients];
+  for (int c = 0; c < clients; c++)
+    {
+      load[c].path = path;
+      load[c].track = (c < clients / 2 ? c + 1 : 0);
+      load[c].requests = 2000;
+      load[c].lock = &lock;
+      load[c].stop = &stop;
+      load[c].latencies = malloc(sizeof(double) * 2000);
+      load[c].failed = false;
+      ok = ok && load[c].latencies != NULL;
+    }
+
+  if (ok)
+    {
+      double start = now();
+      ok = run_clients(load, clients / 2);
+      printf("%d clients appending %d points at a time, %.3f s\n", clients / 2, LOAD_BATCH, now() - start);
+      print_latencies("  append", load, clients / 2);
+    }
+  if (ok)
+    {
+      stop = false;
+      for (int c = 0; c < clients / 2; c++)
+	{
+	  load[c].track += clients;
+	}
+      double start = now();
+      ok = run_clients(load, clients);
+      printf("with %d clients asking for heatmaps of %ld points, %.3f s\n", clients - clients / 2, n, now() - start);
+      print_latencies("  append", load, clients / 2);
+      print_latencies("  heatmap", load + clients / 2, clients - clients / 2);
+    }
+  if (!ok)
+    {
+      printf("ERROR: service load test failed\n");
+    }
+
+  for (int c = 0; c < clients; c++)
+    {
+      free(load[c].latencies);
+    }
+  if (fd >= 0)
+    {
+      close(fd);
+    }
+  service_stop(s);
+  pthread_join(thread, NULL);
+  service_destroy(s);
+  printf("peak RSS %ld KB\n", peak_kb());
+}
+
+void snapshot_restart(long n, const track_options *opts)
+{
+  track *trk = random_track(n, 31, opts);
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/track_bench_%ld.snap", (long) getpid());
+  if (trk == NULL || !track_refresh(trk))
+    {
+      printf("ERROR: could not create track\n");
+      return;
+    }
+
+  double start = now();
+  bool written = track_snapshot(trk, path);
+  double write = now() - start;
+
+  // appending while a snapshot is written in the background
+  start = now();
+  pid_t writer = track_snapshot_background(trk, path);
+  double forked = now() - start;
+  double worst = 0.0;
+  for (long i = 0; i < 100000; i++)
+    {
+      trackpoint *pt = trackpoint_create(41.3 + (i % 1000) * 1e-5, -72.9, n + i);
+      double before = now();
+      track_add_point(trk, pt);
+      double took = now() - before;
+      worst = (took > worst ? took : worst);
+      trackpoint_destroy(pt);
+    }
+  written = track_snapshot_wait(writer) && written;
+  double background = now() - start;
+
+  start = now();
+  track *restored = track_restore(path);
+  double restore = now() - start;
+  long count = 0;
+  start = now();
+  if (restored != NULL)
+    {
+      for (int i = 0; i < track_count_segments(restored); i++)
+	{
+	  count += track_count_points(restored, i);
+	}
+      double *lengths = track_get_lengths(restored);
+      free(lengths);
+    }
+  double first = now() - start;
+  unlink(path);
+  if (!written || restored == NULL || count != n)
+    {
+      printf("ERROR: could not snapshot and restore the track\n");
+      track_destroy(trk);
+      if (restored != NULL)
+	{
+	  track_destroy(restored);
+	}
+      return;
+    }
+
+  printf("snapshot of %ld points in %.3f s; background snapshot in %.3f s (fork %.3f ms, worst append %.3f ms); "
+	 "restored in %.3f ms, first lengths %.3f ms\n",
+	 n, write, background, forked * 1e3, worst * 1e3, restore * 1e3, first * 1e3);
+  track_destroy(restored);
+  track_destroy(trk);
+}
@@ -1,9 +1,22 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "track.h"
+#include "trackindex.h"
 #include "trackpoint.h"
 #include "location.h"
+#include "image.h"
+#include "gpx.h"
+#include "nmea.h"
+#include "service.h"
 
 location short_segment[] = {{41.3078680, -72.9342120},
 			  {41.3078780, -72.9342340},
@@ -34,6 +47,33 @@ void merge(int start_segments, int merge_start, int merge_end);
 void copy_in_add();
 void heatmap(int rows, int cols, int counts[][cols]);
 void free_heatmap(int **map, int rows);
+void heatmap_dwell();
+void heatmap_coverage();
+void heatmap_corridor();
+void heatmap_multi();
+void merge_tracks();
+void merge_ranges();
+void arena_track();
+void block_storage();
+void compact_track();
+void segment_summaries();
+void incremental_wedge();
+void spatial_index();
+void simplify();
+void jitter_collapse();
+void memory_budget();
+void position_at();
+void running_lengths();
+void heatmap_meters();
+void heatmap_hex();
+void image_output();
+void gpx_input();
+void nmea_input();
+void live_heatmap();
+void service_requests();
+void snapshot_restore();
+bool nmea_check(const track *trk, const nmea_reader *r);
+bool add_at(track *trk, double lat, double lon, long time);
 
 int main(int argc, char **argv)
 {
@@ -102,6 +142,106 @@ int main(int argc, char **argv)
       heatmap(small_map_rows, small_map_cols, small_map_counts);
       break;
 
+    case 14:
+      heatmap_dwell();
+      break;
+
+    case 15:
+      heatmap_coverage();
+      break;
+
+    case 16:
+      heatmap_corridor();
+      break;
+
+    case 17:
+      heatmap_multi();
+      break;
+
+    case 18:
+      merge_tracks();
+      break;
+
+    case 19:
+      merge_ranges();
+      break;
+
+    case 20:
+      arena_track();
+      break;
+
+    case 21:
+      block_storage();
+      break;
+
+    case 22:
+      compact_track();
+      break;
+
+    case 23:
+      segment_summaries();
+      break;
+
+    case 24:
+      incremental_wedge();
+      break;
+
+    case 25:
+      spatial_index();
+      break;
+
+    case 26:
+      simplify();
+      break;
+
+    case 27:
+      jitter_collapse();
+      break;
+
+    case 28:
+      memory_budget();
+      break;
+
+    case 29:
+      position_at();
+      break;
+
+    case 30:
+      running_lengths();
+      break;
+
+    case 31:
+      heatmap_meters();
+      break;
+
+    case 32:
+      heatmap_hex();
+      break;
+
+    case 33:
+      image_output();
+      break;
+
+    case 34:
+      gpx_input();
+      break;
+
+    case 35:
+      nmea_input();
+      break;
+
+    case 36:
+      live_heatmap();
+      break;
+
+    case 37:
+      service_requests();
+      break;
+
+    case 38:
+      snapshot_restore();
+      break;
+
     default:
       fprintf(stderr, "%s: invalid test number %s\n", argv[0], argv[1]);
       return 1;
@@ -729,3 +869,2267 @@ void free_heatmap(int **map, int rows)
     }
   free(map);
 }
+
+void heatmap_dwell()
+{
+  // one segment east along the equator from 0 through 170 to -170,
+  // then a hop that wraps west around the west bound
+  double lons[] = {0.0, 170.0, -170.0, 5.0, -170.0};
+  long times[] = {0, 170, 190, 300, 475};
+  int n = sizeof(lons) / sizeof(double);
+
+  track *trk = track_create();
+  if (trk == NULL)
+    {
+      printf("ERROR: couldn't make track\n");
+      return;
+    }
+
+  for (int i = 0; i < n; i++)
+    {
+      if (i == 3)
+	{
+	  track_start_segment(trk);
+	}
+
+      trackpoint *pt = trackpoint_create(0.0, lons[i], times[i]);
+      if (pt == NULL || !track_add_point(trk, pt))
+	{
+	  printf("ERROR: creating track for dwell heatmap failed\n");
+	  trackpoint_destroy(pt);
+	  track_destroy(trk);
+	  return;
+	}
+      trackpoint_destroy(pt);
+    }
+
+  double **map;
+  int rows;
+  int cols;
+  track_heatmap_dwell(trk, 10.0, 10.0, &map, &rows, &cols);
+  if (map == NULL)
+    {
+      printf("ERROR: couldn't make dwell heatmap\n");
+      track_destroy(trk);
+      return;
+    }
+
+  if (rows != 1 || cols != 19)
+    {
+      printf("ERROR: dwell heatmap dimensions %d %d incorrect\n", rows, cols);
+      free_heatmap((int **) map, rows);
+      track_destroy(trk);
+      return;
+    }
+
+  // 10 seconds in each cell on the first segment, plus the 5 seconds
+  // the wrapping hop spends in the first column before leaving the grid
+  for (int c = 0; c < cols; c++)
+    {
+      double expected = (c == 0 ? 15.0 : 10.0);
+      if (map[0][c] < expected - 1e-6 || map[0][c] > expected + 1e-6)
+	{
+	  printf("ERROR: dwell heatmap entry %d is incorrect %f\n", c, map[0][c]);
+	  free_heatmap((int **) map, rows);
+	  track_destroy(trk);
+	  return;
+	}
+    }
+
+  free_heatmap((int **) map, rows);
+  track_destroy(trk);
+  printf("PASSED\n");
+}
+
+void heatmap_coverage()
+{
+  // a sparse diagonal through corners, then a sparse hop along the top row
+  location diagonal[] = {{3.0, 0.0}, {0.0, 3.0}};
+  location across[] = {{2.5, 0.5}, {2.5, 2.5}};
+  const location *segments[] = {diagonal, across};
+  int lengths[] = {2, 2};
+  int expected[3][3] = {{2, 1, 1}, {0, 1, 0}, {0, 0, 1}};
+
+  track *trk = make_track(segments, 2, lengths, 1000);
+  if (trk == NULL)
+    {
+      printf("ERROR: couldn't make track\n");
+      return;
+    }
+
+  int **map;
+  int rows;
+  int cols;
+  track_heatmap_coverage(trk, 1.0, 1.0, &map, &rows, &cols);
+  if (map == NULL)
+    {
+      printf("ERROR: couldn't make coverage heatmap\n");
+      track_destroy(trk);
+      return;
+    }
+
+  if (rows != 3 || cols != 3)
+    {
+      printf("ERROR: coverage heatmap dimensions %d %d incorrect\n", rows, cols);
+      free_heatmap(map, rows);
+      track_destroy(trk);
+      return;
+    }
+
+  for (int r = 0; r < rows; r++)
+    {
+      for (int c = 0; c < cols; c++)
+	{
+	  if (map[r][c] != expected[r][c])
+	    {
+	      printf("ERROR: coverage heatmap entry %d %d is incorrect %d\n", r, c, map[r][c]);
+	      free_heatmap(map, rows);
+	      track_destroy(trk);
+	      return;
+	    }
+	}
+    }
+
+  free_heatmap(map, rows);
+  track_destroy(trk);
+  printf("PASSED\n");
+}
+
+void heatmap_corridor()
+{
+  // a hop along the border between the rows and two lone points in the
+  // northwest and southeast corners
+  location hop[] = {{1.0, 0.5}, {1.0, 3.5}};
+  location northwest[] = {{2.0, 0.0}};
+  location southeast[] = {{0.0, 4.0}};
+  const location *segments[] = {hop, northwest, southeast};
+  int lengths[] = {2, 1, 1};
+  int expected[2][4] = {{2, 1, 1, 1}, {1, 1, 1, 2}};
+
+  // half a degree of latitude wide
+  double sweep_width = 0.5 * 6371000.0 * 3.14159265358979 / 180.0;
+
+  track *trk = make_track(segments, 3, lengths, 1000);
+  if (trk == NULL)
+    {
+      printf("ERROR: couldn't make track\n");
+      return;
+    }
+
+  int **map;
+  int rows;
+  int cols;
+  track_heatmap_corridor(trk, 1.0, 1.0, sweep_width, &map, &rows, &cols);
+  if (map == NULL)
+    {
+      printf("ERROR: couldn't make corridor heatmap\n");
+      track_destroy(trk);
+      return;
+    }
+
+  if (rows != 2 || cols != 4)
+    {
+      printf("ERROR: corridor heatmap dimensions %d %d incorrect\n", rows, cols);
+      free_heatmap(map, rows);
+      track_destroy(trk);
+      return;
+    }
+
+  for (int r = 0; r < rows; r++)
+    {
+      for (int c = 0; c < cols; c++)
+	{
+	  if (map[r][c] != expected[r][c])
+	    {
+	      printf("ERROR: corridor heatmap entry %d %d is incorrect %d\n", r, c, map[r][c]);
+	      free_heatmap(map, rows);
+	      track_destroy(trk);
+	      return;
+	    }
+	}
+    }
+
+  free_heatmap(map, rows);
+  track_destroy(trk);
+  printf("PASSED\n");
+}
+
+void heatmap_multi()
+{
+  // two teams in opposite corners of the shared grid
+  location northwest[] = {{2.0, 0.0}, {1.5, 0.5}};
+  location southeast[] = {{0.0, 2.0}, {0.5, 1.5}};
+  const location *team1 = northwest;
+  const location *team2 = southeast;
+  int length = 2;
+  int expected[2][2] = {{2, 0}, {0, 2}};
+
+  track *trks[2];
+  trks[0] = make_track(&team1, 1, &length, 1000);
+  trks[1] = make_track(&team2, 1, &length, 1000);
+  if (trks[0] == NULL || trks[1] == NULL)
+    {
+      printf("ERROR: couldn't make tracks\n");
+      return;
+    }
+
+  int **map;
+  int rows;
+  int cols;
+  track_heatmap_layer *layers;
+  track_heatmap_multi(trks, 2, 1.0, 1.0, &map, &rows, &cols, &layers);
+  if (map == NULL || layers == NULL)
+    {
+      printf("ERROR: couldn't make combined heatmap\n");
+      track_destroy(trks[0]);
+      track_destroy(trks[1]);
+      return;
+    }
+
+  bool ok = (rows == 2 && cols == 2);
+  for (int r = 0; ok && r < rows; r++)
+    {
+      for (int c = 0; c < cols; c++)
+	{
+	  if (map[r][c] != expected[r][c])
+	    {
+	      printf("ERROR: combined heatmap entry %d %d is incorrect %d\n", r, c, map[r][c]);
+	      ok = false;
+	    }
+	}
+    }
+
+  if (ok && (layers[0].count != 1 || layers[0].rows[0] != 0 || layers[0].cols[0] != 0 || layers[0].values[0] != 2
+	     || layers[1].count != 1 || layers[1].rows[0] != 1 || layers[1].cols[0] != 1 || layers[1].values[0] != 2))
+    {
+      printf("ERROR: per-track layers are incorrect\n");
+      ok = false;
+    }
+
+  free_heatmap(map, rows);
+  track_heatmap_layers_destroy(layers, 2);
+  track_destroy(trks[0]);
+  track_destroy(trks[1]);
+  if (ok)
+    {
+      printf("PASSED\n");
+    }
+}
+
+long merged_storage(int segs)
+{
+  // two inputs taking turns with segments of two points, so that the
+  // merge starts a segment for each; a snapshot holds the storage of
+  // every segment, so its size shows what the merge kept room for
+  track *inputs[] = {track_create(), track_create()};
+  for (int s = 0; s < segs; s++)
+    {
+      for (int t = 0; t < 2; t++)
+	{
+	  track_start_segment(inputs[t]);
+	  add_at(inputs[t], 1.0, s * 1e-3, s * 4 + t * 2);
+	  add_at(inputs[t], 1.0, s * 1e-3 + 1e-4, s * 4 + t * 2 + 1);
+	}
+    }
+  track *merged = track_merge_tracks(inputs, 2);
+  track_destroy(inputs[0]);
+  track_destroy(inputs[1]);
+
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/track_unit_%ld.merge", (long) getpid());
+  struct stat st;
+  long size = -1;
+  if (merged != NULL && track_count_segments(merged) == 2 * segs
+      && track_snapshot(merged, path) && stat(path, &st) == 0)
+    {
+      size = st.st_size;
+    }
+  unlink(path);
+  if (merged != NULL)
+    {
+      track_destroy(merged);
+    }
+  return size;
+}
+
+void merge_tracks()
+{
+  // a handheld and a phone logging the same walk east along the equator
+  double lats[] = {0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0};
+  double lons[] = {0.0, 0.2, 0.4, 1.0, 0.1, 0.6, 0.5};
+  long times[] = {10, 20, 30, 100, 15, 30, 40};
+  int breaks_before[] = {3, 4};
+
+  track *inputs[2];
+  inputs[0] = track_create();
+  inputs[1] = track_create();
+  if (inputs[0] == NULL || inputs[1] == NULL)
+    {
+      printf("ERROR: couldn't make tracks\n");
+      return;
+    }
+  for (int i = 0; i < 7; i++)
+    {
+      track *trk = inputs[i < breaks_before[1] ? 0 : 1];
+      if (i == breaks_before[0])
+	{
+	  track_start_segment(trk);
+	}
+      trackpoint *pt = trackpoint_create(lats[i], lons[i], times[i]);
+      track_add_point(trk, pt);
+      trackpoint_destroy(pt);
+    }
+
+  track_merge_policy average = {TRACK_MERGE_AVERAGE, TRACK_MERGE_BREAK_ALL, 0};
+  track_merge_policy none = {TRACK_MERGE_KEEP_FIRST, TRACK_MERGE_BREAK_NONE, 0};
+  track *first = track_merge_tracks(inputs, 2);
+  track *averaged = track_merge_tracks_with(inputs, 2, &average);
+  track *single = track_merge_tracks_with(inputs, 2, &none);
+  track_destroy(inputs[0]);
+  track_destroy(inputs[1]);
+  if (first == NULL || averaged == NULL || single == NULL)
+    {
+      printf("ERROR: merge failed\n");
+      return;
+    }
+
+  long expected_times[] = {10, 15, 20, 30, 40, 100};
+  double expected_lons[] = {0.0, 0.1, 0.2, 0.4, 0.5, 1.0};
+  bool ok = true;
+
+  if (track_count_segments(first) != 2 || track_count_points(first, 0) != 5
+      || track_count_points(first, 1) != 1 || track_count_segments(single) != 1
+      || track_count_points(single, 0) != 6)
+    {
+      printf("ERROR: merged segments incorrect\n");
+      ok = false;
+    }
+
+  for (int i = 0; ok && i < 6; i++)
+    {
+      trackpoint *pt = track_get_point(first, i < 5 ? 0 : 1, i < 5 ? i : 0);
+      location loc = trackpoint_location(pt);
+      if (trackpoint_time(pt) != expected_times[i] || loc.lon != expected_lons[i])
+	{
+	  printf("ERROR: merged point %d incorrect %ld %f\n", i, trackpoint_time(pt), loc.lon);
+	  ok = false;
+	}
+      trackpoint_destroy(pt);
+    }
+
+  if (ok)
+    {
+      trackpoint *pt = track_get_point(averaged, 0, 3);
+      location loc = trackpoint_location(pt);
+      if (loc.lon < 0.5 - 1e-9 || loc.lon > 0.5 + 1e-9)
+	{
+	  printf("ERROR: averaged duplicate incorrect %f\n", loc.lon);
+	  ok = false;
+	}
+      trackpoint_destroy(pt);
+    }
+
+  if (ok)
+    {
+      // the hops are collinear, so the length is the end to end distance
+      location start = {0.0, 0.0};
+      location end = {0.0, 0.5};
+      double *lengths = track_get_lengths(first);
+      double expected = location_distance(&start, &end);
+      if (lengths[0] < expected - 1e-6 || lengths[0] > expected + 1e-6 || lengths[1] != 0.0)
+	{
+	  printf("ERROR: merged lengths incorrect %f %f\n", lengths[0], lengths[1]);
+	  ok = false;
+	}
+      free(lengths);
+    }
+
+  track_destroy(first);
+  track_destroy(averaged);
+  track_destroy(single);
+
+  // the storage of a merge grows with the points, not with segments
+  // times points
+  long small = merged_storage(5000);
+  long large = merged_storage(40000);
+  if (ok && (small <= 0 || large <= 0 || large > small * 9))
+    {
+      printf("ERROR: merge storage grew from %ld to %ld bytes for 8 times the points\n", small, large);
+      ok = false;
+    }
+  if (ok)
+    {
+      printf("PASSED\n");
+    }
+}
+
+void merge_ranges()
+{
+  // segment i has i + 1 points on a diagonal
+  track *trk = track_create();
+  if (trk == NULL)
+    {
+      printf("ERROR: could not create track\n");
+      return;
+    }
+
+  double lat = 0.0;
+  double lon = 0.0;
+  long time = 1000;
+  for (int i = 0; i < 10; i++)
+    {
+      track_start_segment(trk);
+      for (int j = 0; j < i + 1; j++)
+	{
+	  trackpoint *pt = trackpoint_create(lat, lon, time);
+	  track_add_point(trk, pt);
+	  trackpoint_destroy(pt);
+	  lat += 0.1;
+	  lon += 0.05;
+	  time += 10;
+	}
+    }
+
+  // overlapping ranges have no effect
+  track_range overlapping[] = {{1, 4}, {3, 5}};
+  track_merge_segment_ranges(trk, overlapping, 2);
+  if (track_count_segments(trk) != 10)
+    {
+      printf("ERROR: overlapping ranges changed the track\n");
+      track_destroy(trk);
+      return;
+    }
+
+  track_range ranges[] = {{1, 3}, {4, 7}, {8, 10}};
+  track_merge_segment_ranges(trk, ranges, 3);
+
+  int expected_counts[] = {1, 5, 4, 18, 8, 19};
+  if (track_count_segments(trk) != 6)
+    {
+      printf("ERROR: incorrect number of segments %d after merge\n", track_count_segments(trk));
+      track_destroy(trk);
+      return;
+    }
+
+  double *lengths = track_get_lengths(trk);
+  lat = 0.0;
+  lon = 0.0;
+  time = 1000;
+  for (int i = 0; i < 6; i++)
+    {
+      if (track_count_points(trk, i) != expected_counts[i])
+	{
+	  printf("ERROR: segment %d has size %d after merge\n", i, track_count_points(trk, i));
+	  free(lengths);
+	  track_destroy(trk);
+	  return;
+	}
+
+      // the length includes the hops joining the merged parts
+      double expected_length = 0.0;
+      location prev;
+      for (int j = 0; j < expected_counts[i]; j++)
+	{
+	  trackpoint *pt = track_get_point(trk, i, j);
+	  location loc = trackpoint_location(pt);
+	  if (loc.lat != lat || loc.lon != lon || trackpoint_time(pt) != time)
+	    {
+	      printf("ERROR: got point %f %f from segment %d point %d after merge\n", loc.lat, loc.lon, i, j);
+	      trackpoint_destroy(pt);
+	      free(lengths);
+	      track_destroy(trk);
+	      return;
+	    }
+	  if (j > 0)
+	    {
+	      expected_length += location_distance(&prev, &loc);
+	    }
+	  prev = loc;
+	  trackpoint_destroy(pt);
+	  lat += 0.1;
+	  lon += 0.05;
+	  time += 10;
+	}
+
+      if (lengths[i] < expected_length - 1e-6 || lengths[i] > expected_length + 1e-6)
+	{
+	  printf("ERROR: segment %d has length %f after merge, expected %f\n", i, lengths[i], expected_length);
+	  free(lengths);
+	  track_destroy(trk);
+	  return;
+	}
+    }
+
+  free(lengths);
+  track_destroy(trk);
+  printf("PASSED\n");
+}
+
+void arena_track()
+{
+  // small chunks so that the points spill over several of them
+  track_options opts = {.arena_chunk = 256};
+  track *trk = track_create_with(&opts);
+  if (trk == NULL)
+    {
+      printf("ERROR: could not create track\n");
+      return;
+    }
+
+  for (int round = 0; round < 3; round++)
+    {
+      long time = 1000;
+      for (int i = 0; i < 4; i++)
+	{
+	  track_start_segment(trk);
+	  for (int j = 0; j < 100; j++)
+	    {
+	      trackpoint *pt = trackpoint_create(i, j * 0.01, time);
+	      track_add_point(trk, pt);
+	      trackpoint_destroy(pt);
+	      time += 5;
+	    }
+	}
+
+      if (track_count_segments(trk) != 4)
+	{
+	  printf("ERROR: round %d has %d segments\n", round, track_count_segments(trk));
+	  track_destroy(trk);
+	  return;
+	}
+
+      // an out of range point is NULL rather than a stray read
+      if (track_get_point(trk, 4, 0) != NULL || track_get_point(trk, 0, 100) != NULL)
+	{
+	  printf("ERROR: got a point out of range\n");
+	  track_destroy(trk);
+	  return;
+	}
+
+      time = 1000;
+      for (int i = 0; i < 4; i++)
+	{
+	  for (int j = 0; j < 100; j++)
+	    {
+	      trackpoint *pt = track_get_point(trk, i, j);
+	      location loc = trackpoint_location(pt);
+	      if (loc.lat != i || loc.lon != j * 0.01 || trackpoint_time(pt) != time)
+		{
+		  printf("ERROR: got point %f %f in round %d segment %d point %d\n", loc.lat, loc.lon, round, i, j);
+		  trackpoint_destroy(pt);
+		  track_destroy(trk);
+		  return;
+		}
+	      trackpoint_destroy(pt);
+	      time += 5;
+	    }
+	}
+
+      if (!track_reset(trk) || track_count_segments(trk) != 1 || track_count_points(trk, 0) != 0)
+	{
+	  printf("ERROR: track not empty after reset\n");
+	  track_destroy(trk);
+	  return;
+	}
+    }
+
+  track_destroy(trk);
+  printf("PASSED\n");
+}
+
+void block_storage()
+{
+  // segments bigger than a block, merged across block boundaries
+  track *trk = track_create();
+  if (trk == NULL)
+    {
+      printf("ERROR: could not create track\n");
+      return;
+    }
+
+  int sizes[] = {3000, 1, 1024, 2500};
+  long time = 0;
+  for (int i = 0; i < 4; i++)
+    {
+      track_start_segment(trk);
+      for (int j = 0; j < sizes[i]; j++)
+	{
+	  trackpoint *pt = trackpoint_create((time % 1000) * 0.001, (time % 777) * 0.001, time);
+	  track_add_point(trk, pt);
+	  trackpoint_destroy(pt);
+	  time++;
+	}
+    }
+
+  track_merge_segments(trk, 0, 4);
+  if (track_count_segments(trk) != 1 || track_count_points(trk, 0) != 6525)
+    {
+      printf("ERROR: got %d segments and %d points after merge\n", track_count_segments(trk), track_count_points(trk, 0));
+      track_destroy(trk);
+      return;
+    }
+
+  for (int j = 0; j < 6525; j++)
+    {
+      trackpoint *pt = track_get_point(trk, 0, j);
+      location loc = trackpoint_location(pt);
+      if (trackpoint_time(pt) != j || loc.lat != (j % 1000) * 0.001 || loc.lon != (j % 777) * 0.001)
+	{
+	  printf("ERROR: got point %f %f at time %ld for point %d\n", loc.lat, loc.lon, trackpoint_time(pt), j);
+	  trackpoint_destroy(pt);
+	  track_destroy(trk);
+	  return;
+	}
+      trackpoint_destroy(pt);
+    }
+
+  int **map;
+  int rows, cols;
+  track_heatmap(trk, 0.1, 0.1, &map, &rows, &cols);
+  if (map == NULL)
+    {
+      printf("ERROR: could not create heatmap\n");
+      track_destroy(trk);
+      return;
+    }
+  long total = 0;
+  for (int r = 0; r < rows; r++)
+    {
+      for (int c = 0; c < cols; c++)
+	{
+	  total += map[r][c];
+	}
+    }
+  free_heatmap(map, rows);
+  if (total != 6525)
+    {
+      printf("ERROR: heatmap has %ld points\n", total);
+      track_destroy(trk);
+      return;
+    }
+
+  track_destroy(trk);
+  printf("PASSED\n");
+}
+
+void compact_track()
+{
+  track_options opts = {.compact = true};
+  track *compact = track_create_with(&opts);
+  track *full = track_create();
+  if (compact == NULL || full == NULL)
+    {
+      printf("ERROR: could not create tracks\n");
+      return;
+    }
+
+  // a few segments far from the epoch, crossing block boundaries
+  long time = 1700000000;
+  for (int i = 0; i < 3; i++)
+    {
+      track_start_segment(compact);
+      track_start_segment(full);
+      for (int j = 0; j < 1500; j++)
+	{
+	  trackpoint *pt = trackpoint_create(41.30786812345 + j * 1.23456e-5, -72.93421234567 - i * 0.01, time);
+	  track_add_point(compact, pt);
+	  track_add_point(full, pt);
+	  trackpoint_destroy(pt);
+	  time += 3;
+	}
+    }
+
+  for (int i = 0; i < 3; i++)
+    {
+      for (int j = 0; j < 1500; j++)
+	{
+	  trackpoint *pt1 = track_get_point(compact, i, j);
+	  trackpoint *pt2 = track_get_point(full, i, j);
+	  location loc1 = trackpoint_location(pt1);
+	  location loc2 = trackpoint_location(pt2);
+	  if (fabs(loc1.lat - loc2.lat) > 0.51e-7 || fabs(loc1.lon - loc2.lon) > 0.51e-7
+	      || trackpoint_time(pt1) != trackpoint_time(pt2))
+	    {
+	      printf("ERROR: compact point %d %d is %f %f %ld\n", i, j, loc1.lat, loc1.lon, trackpoint_time(pt1));
+	      trackpoint_destroy(pt1);
+	      trackpoint_destroy(pt2);
+	      track_destroy(compact);
+	      track_destroy(full);
+	      return;
+	    }
+	  trackpoint_destroy(pt1);
+	  trackpoint_destroy(pt2);
+	}
+    }
+
+  // too long after the start of the segment for a 32-bit offset
+  trackpoint *late = trackpoint_create(41.0, -72.0, time + 3000000000L);
+  if (track_add_point(compact, late))
+    {
+      printf("ERROR: added point out of range of the segment\n");
+      trackpoint_destroy(late);
+      track_destroy(compact);
+      track_destroy(full);
+      return;
+    }
+  trackpoint_destroy(late);
+
+  int **map1, **map2;
+  int rows1, cols1, rows2, cols2;
+  track_heatmap(compact, 0.007, 0.003, &map1, &rows1, &cols1);
+  track_heatmap(full, 0.007, 0.003, &map2, &rows2, &cols2);
+  bool same = (map1 != NULL && map2 != NULL && rows1 == rows2 && cols1 == cols2);
+  for (int r = 0; same && r < rows1; r++)
+    {
+      for (int c = 0; c < cols1; c++)
+	{
+	  same = same && map1[r][c] == map2[r][c];
+	}
+    }
+  if (map1 != NULL)
+    {
+      free_heatmap(map1, rows1);
+    }
+  if (map2 != NULL)
+    {
+      free_heatmap(map2, rows2);
+    }
+  if (!same)
+    {
+      printf("ERROR: compact heatmap differs\n");
+      track_destroy(compact);
+      track_destroy(full);
+      return;
+    }
+
+  // lengths are of the rounded points, so off by millimeters per hop
+  double *lengths = track_get_lengths(compact);
+  double *full_lengths = track_get_lengths(full);
+  same = true;
+  for (int i = 0; i < 3; i++)
+    {
+      same = same && fabs(lengths[i] - full_lengths[i]) < 1.0;
+    }
+
+  track_merge_segments(compact, 0, 3);
+  trackpoint *pt = track_get_point(compact, 0, 4499);
+  if (!same || track_count_points(compact, 0) != 4500 || trackpoint_time(pt) != time - 3)
+    {
+      printf("ERROR: compact segment lengths or merge incorrect\n");
+    }
+  else
+    {
+      printf("PASSED\n");
+    }
+  trackpoint_destroy(pt);
+  free(lengths);
+  free(full_lengths);
+  track_destroy(compact);
+  track_destroy(full);
+}
+
+void segment_summaries()
+{
+  // two segments straddling the antimeridian, one far west
+  track *trk = track_create();
+  if (trk == NULL)
+    {
+      printf("ERROR: could not create track\n");
+      return;
+    }
+
+  double lons[][4] = {{179.5, -179.8, 179.9, -179.6}, {-100.0, -99.0, -101.0, -100.5}};
+  double lats[][4] = {{10.0, 12.0, 9.0, 11.0}, {-5.0, -4.0, -6.0, -3.0}};
+  long time = 100;
+  for (int i = 0; i < 2; i++)
+    {
+      track_start_segment(trk);
+      for (int j = 0; j < 4; j++)
+	{
+	  trackpoint *pt = trackpoint_create(lats[i][j], lons[i][j], time);
+	  track_add_point(trk, pt);
+	  trackpoint_destroy(pt);
+	  time += 10;
+	}
+    }
+
+  track_summary summary;
+  double *lengths = track_get_lengths(trk);
+  if (!track_segment_summary(trk, 0, &summary) || summary.count != 4 || summary.first_time != 100
+      || summary.last_time != 130 || summary.south != 9.0 || summary.north != 12.0
+      || summary.min_lon != -179.8 || summary.max_lon != 179.9 || summary.length != lengths[0]
+      || track_segment_summary(trk, 2, &summary))
+    {
+      printf("ERROR: incorrect summary of segment 0\n");
+      free(lengths);
+      track_destroy(trk);
+      return;
+    }
+  free(lengths);
+
+  // whole segments in, whole segments out, and partial overlaps
+  track_window windows[] = {{-90, 90, -180, 180, 0, 1000},
+			    {8, 13, 179, -179, 0, 1000},
+			    {8, 13, 179.7, -179.7, 0, 1000},
+			    {-90, 90, -180, 180, 120, 150},
+			    {-5.5, 0, -100.2, -98, 0, 1000},
+			    {20, 30, -180, 180, 0, 1000}};
+  long expected[] = {8, 4, 2, 4, 2, 0};
+  for (int w = 0; w < 6; w++)
+    {
+      long count = track_count_in_window(trk, &windows[w]);
+      if (count != expected[w])
+	{
+	  printf("ERROR: window %d has %ld points, expected %ld\n", w, count, expected[w]);
+	  track_destroy(trk);
+	  return;
+	}
+    }
+
+  // merged summaries cover both parts
+  track_merge_segments(trk, 0, 2);
+  if (!track_segment_summary(trk, 0, &summary) || summary.count != 8 || summary.first_time != 100
+      || summary.last_time != 170 || summary.south != -6.0 || summary.north != 12.0
+      || summary.min_lon != -179.8 || summary.max_lon != 179.9)
+    {
+      printf("ERROR: incorrect summary of merged segment\n");
+      track_destroy(trk);
+      return;
+    }
+  track_destroy(trk);
+
+  // averaging duplicates moves points, so the bounds shrink
+  track *a = track_create();
+  track *b = track_create();
+  trackpoint *pa = trackpoint_create(0.0, 0.0, 10);
+  trackpoint *pb = trackpoint_create(2.0, 2.0, 10);
+  track_add_point(a, pa);
+  track_add_point(b, pb);
+  trackpoint_destroy(pa);
+  trackpoint_destroy(pb);
+  track *inputs[] = {a, b};
+  track_merge_policy policy = {TRACK_MERGE_AVERAGE, TRACK_MERGE_BREAK_NONE, 0};
+  track *merged = track_merge_tracks_with(inputs, 2, &policy);
+  bool ok = (merged != NULL && track_segment_summary(merged, 0, &summary) && summary.count == 1
+	     && fabs(summary.south - 1.0) < 1e-9 && fabs(summary.north - 1.0) < 1e-9
+	     && fabs(summary.min_lon - 1.0) < 1e-9 && fabs(summary.max_lon - 1.0) < 1e-9);
+  if (merged != NULL)
+    {
+      track_destroy(merged);
+    }
+  track_destroy(a);
+  track_destroy(b);
+  if (!ok)
+    {
+      printf("ERROR: incorrect summary after averaging\n");
+      return;
+    }
+
+  printf("PASSED\n");
+}
+
+int compare_lons(const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Checks a heatmap of n points against one computed directly from the
+ * rule in track.h, sorting the longitudes for the wedge.
+ */
+bool check_wedge_map(const location *pts, int n, double cw, double ch, int **map, int rows, int cols)
+{
+  double *lons = malloc(sizeof(double) * n);
+  double north = -90;
+  double south = 90;
+  for (int i = 0; i < n; i++)
+    {
+      lons[i] = pts[i].lon;
+      north = fmax(north, pts[i].lat);
+      south = fmin(south, pts[i].lat);
+    }
+  qsort(lons, n, sizeof(double), compare_lons);
+  double west = lons[0];
+  double span = lons[n - 1] - lons[0];
+  for (int i = 1; i < n; i++)
+    {
+      if (lons[i - 1] + 360.0 - lons[i] < span)
+	{
+	  span = lons[i - 1] + 360.0 - lons[i];
+	  west = lons[i];
+	}
+    }
+  free(lons);
+
+  int expected_rows = (int) ceil((north - south) / ch);
+  int expected_cols = (int) ceil(span / cw);
+  expected_rows = (expected_rows < 1 ? 1 : expected_rows);
+  expected_cols = (expected_cols < 1 ? 1 : expected_cols);
+  if (map == NULL || rows != expected_rows || cols != expected_cols)
+    {
+      return false;
+    }
+
+  int *counts = calloc((size_t) rows * cols, sizeof(int));
+  for (int i = 0; i < n; i++)
+    {
+      double east = pts[i].lon - west;
+      if (east < 0)
+	{
+	  east += 360.0;
+	}
+      int x = (int) fmin(east / cw, nextafter((double) cols, 0.0));
+      int y = (int) fmin((north - pts[i].lat) / ch, nextafter((double) rows, 0.0));
+      counts[y * cols + x]++;
+    }
+  bool same = true;
+  for (int r = 0; r < rows; r++)
+    {
+      for (int c = 0; c < cols; c++)
+	{
+	  same = same && map[r][c] == counts[r * cols + c];
+	}
+    }
+  free(counts);
+  return same;
+}
+
+void incremental_wedge()
+{
+  // clustered across the antimeridian, two far clusters, nearly all
+  // the way around, and spread so densely that the bins cannot decide
+  double centers[][2] = {{179.8, 0.5}, {-170.0, 0.3}, {0.0, 170.0}, {0.0, 180.0}};
+  int sizes[] = {500, 300, 400, 20000};
+  srand(7);
+  for (int scenario = 0; scenario < 4; scenario++)
+    {
+      track *trk = track_create();
+      location *pts = malloc(sizeof(location) * sizes[scenario] * 2);
+      int n = 0;
+      for (int round = 0; round < 2; round++)
+	{
+	  // heatmaps between additions use the bins kept up to date
+	  for (int i = 0; i < sizes[scenario]; i++)
+	    {
+	      double lon = centers[scenario][0] + (rand() / (double) RAND_MAX * 2.0 - 1.0) * centers[scenario][1];
+	      if (scenario == 1 && i % 2 == 1)
+		{
+		  lon = 120.0 + rand() / (double) RAND_MAX;
+		}
+	      lon = (lon >= 180.0 ? lon - 360.0 : lon);
+	      pts[n].lat = (rand() / (double) RAND_MAX) * 10.0;
+	      pts[n].lon = lon;
+	      trackpoint *pt = trackpoint_create(pts[n].lat, pts[n].lon, n);
+	      track_add_point(trk, pt);
+	      trackpoint_destroy(pt);
+	      n++;
+	    }
+
+	  int **map;
+	  int rows, cols;
+	  track_heatmap(trk, 0.037, 0.41, &map, &rows, &cols);
+	  bool ok = check_wedge_map(pts, n, 0.037, 0.41, map, rows, cols);
+	  if (map != NULL)
+	    {
+	      free_heatmap(map, rows);
+	    }
+	  if (!ok)
+	    {
+	      printf("ERROR: heatmap differs from the exact wedge in scenario %d round %d\n", scenario, round);
+	      free(pts);
+	      track_destroy(trk);
+	      return;
+	    }
+	}
+      free(pts);
+      track_destroy(trk);
+    }
+
+  printf("PASSED\n");
+}
+
+void spatial_index()
+{
+  // a dense local cluster plus points all over the globe
+  track *trk = track_create();
+  int n = 0;
+  srand(11);
+  for (int i = 0; i < 3; i++)
+    {
+      track_start_segment(trk);
+      for (int j = 0; j < 2000; j++)
+	{
+	  double lat, lon;
+	  if (j % 4 == 0)
+	    {
+	      lat = rand() / (double) RAND_MAX * 180.0 - 90.0;
+	      lon = rand() / (double) RAND_MAX * 360.0 - 180.0;
+	    }
+	  else
+	    {
+	      lat = 41.3 + rand() / (double) RAND_MAX * 0.1;
+	      lon = -72.9 + rand() / (double) RAND_MAX * 0.1;
+	    }
+	  trackpoint *pt = trackpoint_create(lat, lon, n++);
+	  track_add_point(trk, pt);
+	  trackpoint_destroy(pt);
+	}
+    }
+
+  track_index *idx = track_index_create(trk);
+  if (idx == NULL || track_index_count(idx) != n)
+    {
+      printf("ERROR: could not create index\n");
+      track_destroy(trk);
+      return;
+    }
+
+  location queries[100];
+  for (int q = 0; q < 100; q++)
+    {
+      queries[q].lat = (q % 2 == 0 ? 41.3 + rand() / (double) RAND_MAX * 0.1 : rand() / (double) RAND_MAX * 180.0 - 90.0);
+      queries[q].lon = (q % 2 == 0 ? -72.9 + rand() / (double) RAND_MAX * 0.1 : rand() / (double) RAND_MAX * 360.0 - 180.0);
+    }
+  track_fix fixes[100];
+  double distances[100];
+  int found = track_index_nearest_batch(idx, queries, 100, fixes, distances);
+
+  bool ok = (found == 100);
+  for (int q = 0; ok && q < 100; q++)
+    {
+      // brute force over every point
+      double best = INFINITY;
+      for (int i = 0; i < 3; i++)
+	{
+	  for (int j = 0; j < 2000; j++)
+	    {
+	      trackpoint *pt = track_get_point(trk, i, j);
+	      location loc = trackpoint_location(pt);
+	      double d = location_distance(&queries[q], &loc);
+	      best = fmin(best, d);
+	      trackpoint_destroy(pt);
+	    }
+	}
+
+      track_fix fix;
+      double d;
+      trackpoint *pt = track_get_point(trk, fixes[q].segment, fixes[q].point);
+      ok = (fabs(distances[q] - best) < 1e-9 && track_index_nearest(idx, queries[q], &fix, &d)
+	    && d == best && trackpoint_time(pt) == fixes[q].time);
+      trackpoint_destroy(pt);
+      if (!ok)
+	{
+	  printf("ERROR: nearest to query %d at %f, expected %f\n", q, distances[q], best);
+	}
+    }
+
+  // the box query finds what the track counts
+  track_window windows[] = {{41.32, 41.35, -72.88, -72.85, 0, 100000},
+			    {-30, 30, 150, -150, 0, 100000},
+			    {41.3, 41.4, -73, -72, 1000, 3000}};
+  for (int w = 0; ok && w < 3; w++)
+    {
+      track_fix *in;
+      long count = track_index_box(idx, &windows[w], &in);
+      ok = (count == track_count_in_window(trk, &windows[w]) && count > 0);
+      for (long k = 0; ok && k < count; k++)
+	{
+	  ok = (in[k].time >= windows[w].start && in[k].time <= windows[w].end
+		&& in[k].loc.lat >= windows[w].south && in[k].loc.lat <= windows[w].north);
+	}
+      free(in);
+      if (!ok)
+	{
+	  printf("ERROR: box query %d got %ld points\n", w, count);
+	}
+    }
+
+  track_index_destroy(idx);
+  track_destroy(trk);
+  if (ok)
+    {
+      printf("PASSED\n");
+    }
+}
+
+void simplify()
+{
+  // a straight line north with a spike east every 100 points, then a
+  // segment too short to simplify
+  track *trk = track_create();
+  for (int j = 0; j <= 1000; j++)
+    {
+      double lon = (j % 100 == 50 ? 0.001 : 0.0);
+      trackpoint *pt = trackpoint_create(j * 1e-5, lon, j);
+      track_add_point(trk, pt);
+      trackpoint_destroy(pt);
+    }
+  track_start_segment(trk);
+  for (int j = 0; j < 2; j++)
+    {
+      trackpoint *pt = trackpoint_create(1.0, j * 1e-6, 2000 + j);
+      track_add_point(trk, pt);
+      trackpoint_destroy(pt);
+    }
+
+  // each spike is about 111 m off the line; the rest are on it
+  track_simplify_stats stats;
+  track_simplify(trk, 5.0, &stats);
+  if (stats.points_before != 1003 || track_count_points(trk, 1) != 2)
+    {
+      printf("ERROR: simplified %ld points to %ld\n", stats.points_before, stats.points_after);
+      track_destroy(trk);
+      return;
+    }
+
+  // both ends of the line, each spike and the points either side of it
+  int n = track_count_points(trk, 0);
+  if (n != 32 || stats.points_after != n + 2)
+    {
+      printf("ERROR: kept %d points in the first segment\n", n);
+      track_destroy(trk);
+      return;
+    }
+
+  long last_time = -1;
+  double length = 0.0;
+  location prev;
+  for (int j = 0; j < n; j++)
+    {
+      trackpoint *pt = track_get_point(trk, 0, j);
+      location loc = trackpoint_location(pt);
+      long time = trackpoint_time(pt);
+      bool endpoint = (j == 0 && time == 0) || (j == n - 1 && time == 1000);
+      bool spike = (time % 100 == 49 || time % 100 == 50 || time % 100 == 51);
+      if (time <= last_time || !(endpoint || spike))
+	{
+	  printf("ERROR: kept point at time %ld\n", time);
+	  trackpoint_destroy(pt);
+	  track_destroy(trk);
+	  return;
+	}
+      if (j > 0)
+	{
+	  length += location_distance(&prev, &loc);
+	}
+      prev = loc;
+      last_time = time;
+      trackpoint_destroy(pt);
+    }
+
+  double *lengths = track_get_lengths(trk);
+  bool ok = fabs(lengths[0] - length) < 1e-9 && fabs(stats.length_after - lengths[0] - lengths[1]) < 1e-9
+    && fabs(stats.length_before - stats.length_after) < 1e-6;
+  free(lengths);
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: incorrect lengths after simplifying\n");
+      return;
+    }
+  printf("PASSED\n");
+}
+
+bool add_at(track *trk, double lat, double lon, long time)
+{
+  trackpoint *pt = trackpoint_create(lat, lon, time);
+  bool added = track_add_point(trk, pt);
+  trackpoint_destroy(pt);
+  return added;
+}
+
+void jitter_collapse()
+{
+  // 100 fixes within about 3 m of the first, then points 111 m and
+  // 55 m on with a short stop at the first of them
+  track_options opts = {.jitter_radius = 10.0};
+  track *trk = track_create_with(&opts);
+  add_at(trk, 0.0, 0.0, 0);
+  for (int t = 1; t <= 100; t++)
+    {
+      add_at(trk, (t % 7 - 3) * 1e-5, (t % 5 - 2) * 1e-5, t);
+    }
+  bool early = add_at(trk, 0.01, 0.0, 50);
+  add_at(trk, 0.001, 0.0, 200);
+  for (int t = 201; t <= 205; t++)
+    {
+      add_at(trk, 0.001, 1e-5, t);
+    }
+  add_at(trk, 0.0015, 0.0, 250);
+
+  if (early || track_count_points(trk, 0) != 3 || track_count_collapsed(trk) != 105
+      || track_get_dwell(trk, 0, 0) != 100 || track_get_dwell(trk, 0, 1) != 5 || track_get_dwell(trk, 0, 2) != 0)
+    {
+      printf("ERROR: kept %d points and collapsed %ld\n", track_count_points(trk, 0), track_count_collapsed(trk));
+      track_destroy(trk);
+      return;
+    }
+
+  // the stop counts in its cell and the rest is spread along the hops
+  double **map;
+  int rows, cols;
+  track_heatmap_dwell(trk, 0.0005, 0.0005, &map, &rows, &cols);
+  double total = 0.0;
+  double most = 0.0;
+  for (int r = 0; r < rows; r++)
+    {
+      for (int c = 0; c < cols; c++)
+	{
+	  total += map[r][c];
+	  most = fmax(most, map[r][c]);
+	}
+      free(map[r]);
+    }
+  free(map);
+  if (fabs(total - 250.0) > 1e-6 || most < 100.0)
+    {
+      printf("ERROR: dwell heatmap totals %f with at most %f in a cell\n", total, most);
+      track_destroy(trk);
+      return;
+    }
+
+  // the dwell times follow their points through a merge and a simplify
+  track_start_segment(trk);
+  add_at(trk, 0.002, 0.0, 300);
+  add_at(trk, 0.002, 1e-5, 310);
+  track_merge_segments(trk, 0, 2);
+  track_simplify(trk, 5.0, NULL);
+  bool ok = track_count_points(trk, 0) == 3 && track_get_dwell(trk, 0, 0) == 100
+    && track_get_dwell(trk, 0, 1) == 5 && track_get_dwell(trk, 0, 2) == 10;
+
+  // resetting starts the count over
+  track_reset(trk);
+  ok = ok && track_count_collapsed(trk) == 0 && track_get_dwell(trk, 0, 0) == 0;
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: dwell times lost in merge, simplify or reset\n");
+      return;
+    }
+  printf("PASSED\n");
+}
+
+void memory_budget()
+{
+  // room for 1000 points; a closed segment then a long one heading north
+  track_options opts = {.memory_budget = 1000 * 24};
+  track *trk = track_create_with(&opts);
+  for (int t = 0; t < 500; t++)
+    {
+      add_at(trk, -1.0, t * 1e-5, t);
+    }
+  track_start_segment(trk);
+  long n = 100001;
+  for (long t = 0; t < n; t++)
+    {
+      add_at(trk, t * 1e-5, 0.0, 1000 + t);
+    }
+
+  long rate = track_sample_rate(trk);
+  int count0 = track_count_points(trk, 0);
+  int count1 = track_count_points(trk, 1);
+  if (track_memory_budget(trk) != 24000 || count0 + count1 > 1000 || rate < 128 || (rate & (rate - 1)) != 0)
+    {
+      printf("ERROR: %d points at rate %ld\n", count0 + count1, rate);
+      track_destroy(trk);
+      return;
+    }
+
+  // both ends of each segment and evenly spaced points between
+  bool ok = true;
+  double length = 0.0;
+  location prev;
+  for (int j = 0; j < count1; j++)
+    {
+      trackpoint *pt = track_get_point(trk, 1, j);
+      location loc = trackpoint_location(pt);
+      long time = trackpoint_time(pt) - 1000;
+      ok = ok && (j == count1 - 1 ? time == n - 1 : time == j * rate);
+      if (j > 0)
+	{
+	  length += location_distance(&prev, &loc);
+	}
+      prev = loc;
+      trackpoint_destroy(pt);
+    }
+  trackpoint *first = track_get_point(trk, 0, 0);
+  trackpoint *last = track_get_point(trk, 0, count0 - 1);
+  ok = ok && trackpoint_time(first) == 0 && trackpoint_time(last) == 499;
+  trackpoint_destroy(first);
+  trackpoint_destroy(last);
+
+  // the summary and lengths match the points kept
+  track_summary summary;
+  double *lengths = track_get_lengths(trk);
+  track_segment_summary(trk, 1, &summary);
+  ok = ok && fabs(lengths[1] - length) < 1e-6 && summary.south == 0.0
+    && fabs(summary.north - (n - 1) * 1e-5) < 1e-12 && summary.last_time == 1000 + n - 1;
+  free(lengths);
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: incorrect points kept under the budget\n");
+      return;
+    }
+  printf("PASSED\n");
+}
+
+void position_at()
+{
+  // east along the equator one fix every 10 s with a stop from 100 to
+  // 160 s, then a segment east along 60 N from 1000 to 1010 s
+  track_options opts = {.jitter_radius = 5.0};
+  track *trk = track_create_with(&opts);
+  for (int t = 0; t <= 300; t += 10)
+    {
+      double lon = (t <= 100 ? t : (t <= 160 ? 100 : t - 60)) * 1e-4;
+      add_at(trk, 0.0, lon, t);
+    }
+  track_start_segment(trk);
+  add_at(trk, 60.0, 0.0, 1000);
+  add_at(trk, 60.0, 10.0, 1010);
+
+  location loc;
+  bool ok = track_position_at(trk, 45, TRACK_INTERPOLATE_LINEAR, &loc) && fabs(loc.lon - 45e-4) < 1e-12;
+  ok = ok && track_position_at(trk, 130, TRACK_INTERPOLATE_LINEAR, &loc) && loc.lon == 100e-4;
+  ok = ok && track_position_at(trk, 165, TRACK_INTERPOLATE_LINEAR, &loc) && fabs(loc.lon - 105e-4) < 1e-12;
+  ok = ok && track_position_at(trk, 300, TRACK_INTERPOLATE_LINEAR, &loc) && fabs(loc.lon - 240e-4) < 1e-12;
+  ok = ok && !track_position_at(trk, -1, TRACK_INTERPOLATE_LINEAR, &loc)
+    && !track_position_at(trk, 500, TRACK_INTERPOLATE_LINEAR, &loc)
+    && !track_position_at(trk, 1011, TRACK_INTERPOLATE_LINEAR, &loc);
+  if (!ok)
+    {
+      printf("ERROR: incorrect position on the first segment\n");
+      track_destroy(trk);
+      return;
+    }
+
+  // the great circle bulges toward the pole
+  location straight, curved;
+  track_position_at(trk, 1005, TRACK_INTERPOLATE_LINEAR, &straight);
+  track_position_at(trk, 1005, TRACK_INTERPOLATE_GEODESIC, &curved);
+  if (straight.lat != 60.0 || fabs(straight.lon - 5.0) > 1e-12 || !(curved.lat > 60.01) || fabs(curved.lon - 5.0) > 1e-9)
+    {
+      printf("ERROR: midpoints %f, %f and %f, %f\n", straight.lat, straight.lon, curved.lat, curved.lon);
+      track_destroy(trk);
+      return;
+    }
+
+  // the batch agrees with single queries, sorted or not
+  int q = 2000;
+  long *times = malloc(sizeof(long) * q);
+  location *locs = malloc(sizeof(location) * q);
+  for (int k = 0; k < q; k++)
+    {
+      times[k] = (k < q / 2 ? k * 1100 / (q / 2) - 50 : rand() % 1100 - 50);
+    }
+  int found = track_positions_at(trk, times, q, TRACK_INTERPOLATE_GEODESIC, locs);
+  int expected = 0;
+  for (int k = 0; k < q && ok; k++)
+    {
+      if (track_position_at(trk, times[k], TRACK_INTERPOLATE_GEODESIC, &loc))
+	{
+	  expected++;
+	  ok = (loc.lat == locs[k].lat && loc.lon == locs[k].lon);
+	}
+      else
+	{
+	  ok = isnan(locs[k].lat) && isnan(locs[k].lon);
+	}
+    }
+  free(times);
+  free(locs);
+  track_destroy(trk);
+  if (!ok || found != expected)
+    {
+      printf("ERROR: batch found %d positions, expected %d\n", found, expected);
+      return;
+    }
+  printf("PASSED\n");
+}
+
+void running_lengths()
+{
+  // the same wandering segments with and without running lengths
+  track_options opts = {.running_lengths = true};
+  track *trks[] = {track_create_with(&opts), track_create()};
+  for (int t = 0; t < 2; t++)
+    {
+      srand(7);
+      double lat = 41.3;
+      double lon = -72.9;
+      for (long i = 0; i < 5000; i++)
+	{
+	  lat += (rand() / (double) RAND_MAX - 0.5) * 0.001;
+	  lon += (rand() / (double) RAND_MAX - 0.5) * 0.001;
+	  add_at(trks[t], lat, lon, i * 10);
+	  if (i % 1500 == 1499)
+	    {
+	      track_start_segment(trks[t]);
+	    }
+	}
+      track_merge_segments(trks[t], 1, 3);
+    }
+
+  bool ok = track_count_segments(trks[0]) == 3 && isnan(track_length_between(trks[0], 0, 5, 4))
+    && isnan(track_length_between(trks[0], 0, 0, 1500));
+  double *lengths = track_get_lengths(trks[0]);
+  for (int i = 0; i < 3 && ok; i++)
+    {
+      int n = track_count_points(trks[0], i);
+      ok = fabs(track_length_between(trks[0], i, 0, n - 1) - lengths[i]) < 1e-9;
+      for (int k = 0; k < 50 && ok; k++)
+	{
+	  int a = rand() % n;
+	  int b = a + rand() % (n - a);
+	  ok = fabs(track_length_between(trks[0], i, a, b) - track_length_between(trks[1], i, a, b)) < 1e-9;
+	}
+    }
+  free(lengths);
+
+  // lengths over times, including part hops, stops and the gap between segments
+  for (int k = 0; k < 50 && ok; k++)
+    {
+      long start = rand() % 52000 - 1000;
+      long end = start + rand() % 20000;
+      double with = track_length_during(trks[0], start, end);
+      ok = with >= 0 && fabs(with - track_length_during(trks[1], start, end)) < 1e-9;
+    }
+  ok = ok && fabs(track_length_during(trks[0], 5, 15) - track_length_between(trks[0], 0, 0, 2) / 2) < 1e-9
+    && track_length_during(trks[0], 14995, 14999) == 0.0 && track_length_during(trks[0], 20, 10) == 0.0;
+
+  // simplifying and thinning keep the lengths up to date
+  track_simplify(trks[0], 20.0, NULL);
+  lengths = track_get_lengths(trks[0]);
+  ok = ok && fabs(track_length_between(trks[0], 1, 0, track_count_points(trks[0], 1) - 1) - lengths[1]) < 1e-9;
+  free(lengths);
+  track_destroy(trks[0]);
+  track_destroy(trks[1]);
+
+  opts.memory_budget = 100 * 32;
+  track *trk = track_create_with(&opts);
+  for (long i = 0; i < 1000; i++)
+    {
+      add_at(trk, i * 1e-4, 0.0, i);
+    }
+  ok = ok && track_count_points(trk, 0) <= 100
+    && fabs(track_length_between(trk, 0, 0, track_count_points(trk, 0) - 1) - track_length_during(trk, 0, 999)) < 1e-9;
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: running lengths disagree with summed hops\n");
+      return;
+    }
+  printf("PASSED\n");
+}
+
+void heatmap_meters()
+{
+  // an empty track gets one empty cell and a bad cell size no map
+  track *trk = track_create();
+  int **map;
+  int rows, cols;
+  track_heatmap_meters(trk, 100.0, 100.0, &map, &rows, &cols);
+  bool ok = map != NULL && rows == 1 && cols == 1 && map[0][0] == 0;
+  if (map != NULL)
+    {
+      free_heatmap(map, rows);
+    }
+  track_heatmap_meters(trk, 0.0, 100.0, &map, &rows, &cols);
+  ok = ok && map == NULL;
+
+  // the same span of longitude is half as wide at 60 N as on the equator,
+  // about 278 m either side of the central meridian there and 556 m here
+  add_at(trk, 60.0, 0.0, 0);
+  add_at(trk, 60.0, 0.01, 1);
+  add_at(trk, 0.0, 0.0, 2);
+  add_at(trk, 0.0, 0.01, 3);
+  track_heatmap_meters(trk, 100.0, 100.0, &map, &rows, &cols);
+  track_destroy(trk);
+  if (!ok || map == NULL)
+    {
+      printf("ERROR: incorrect heatmap of an empty track\n");
+      return;
+    }
+
+  int total = 0;
+  for (int r = 0; r < rows; r++)
+    {
+      for (int c = 0; c < cols; c++)
+	{
+	  total += map[r][c];
+	}
+    }
+  ok = rows == 66717 && cols == 12 && total == 4 && map[0][3] == 1 && map[0][8] == 1
+    && map[rows - 1][0] == 1 && map[rows - 1][cols - 1] == 1;
+  free_heatmap(map, rows);
+  if (!ok)
+    {
+      printf("ERROR: incorrect %d x %d heatmap in meters\n", rows, cols);
+      return;
+    }
+  printf("PASSED\n");
+}
+
+void heatmap_hex()
+{
+  // an empty track gets one empty cell and a bad size no map
+  track *trk = track_create();
+  int **map;
+  track_hex_layout layout;
+  track_heatmap_hex(trk, 0.01, TRACK_HEX_POINTY, false, &map, &layout);
+  bool ok = map != NULL && layout.rows == 1 && layout.cols == 1 && map[0][0] == 0;
+  if (map != NULL)
+    {
+      free_heatmap(map, layout.rows);
+    }
+  track_heatmap_hex(trk, 0.0, TRACK_HEX_POINTY, false, &map, &layout);
+  ok = ok && map == NULL;
+  if (!ok)
+    {
+      printf("ERROR: incorrect hexagonal heatmap of an empty track\n");
+      track_destroy(trk);
+      return;
+    }
+
+  // a walk across the antimeridian, each point counted in the cell
+  // whose center is nearest in degrees
+  srand(5);
+  double lat = 10.0;
+  double lon = 179.95;
+  for (int i = 0; i < 500; i++)
+    {
+      lat += (rand() / (double) RAND_MAX - 0.5) * 0.01;
+      lon += (rand() / (double) RAND_MAX - 0.5) * 0.01;
+      lon -= (lon >= 180.0 ? 360.0 : 0.0);
+      add_at(trk, lat, lon, i);
+    }
+  for (int o = 0; o < 2; o++)
+    {
+      track_hex_orientation orientation = (o == 0 ? TRACK_HEX_POINTY : TRACK_HEX_FLAT);
+      track_heatmap_hex(trk, 0.01, orientation, false, &map, &layout);
+      if (map == NULL)
+	{
+	  printf("ERROR: no hexagonal heatmap\n");
+	  track_destroy(trk);
+	  return;
+	}
+
+      int **expected = malloc(sizeof(int *) * layout.rows);
+      for (int r = 0; r < layout.rows; r++)
+	{
+	  expected[r] = calloc(layout.cols, sizeof(int));
+	}
+      for (int j = 0; j < track_count_points(trk, 0); j++)
+	{
+	  trackpoint *pt = track_get_point(trk, 0, j);
+	  location loc = trackpoint_location(pt);
+	  trackpoint_destroy(pt);
+	  double best = INFINITY;
+	  int best_r = 0, best_c = 0;
+	  for (int r = 0; r < layout.rows; r++)
+	    {
+	      for (int c = 0; c < layout.cols; c++)
+		{
+		  location center = track_hex_center(&layout, r, c);
+		  double dx = fmod(loc.lon - center.lon + 540.0, 360.0) - 180.0;
+		  double dy = loc.lat - center.lat;
+		  if (dx * dx + dy * dy < best)
+		    {
+		      best = dx * dx + dy * dy;
+		      best_r = r;
+		      best_c = c;
+		    }
+		}
+	    }
+	  expected[best_r][best_c]++;
+	}
+
+      // and no empty rows or columns at the edges
+      int first_col = 0, last_col = 0, last_row = 0;
+      for (int r = 0; r < layout.rows; r++)
+	{
+	  for (int c = 0; c < layout.cols; c++)
+	    {
+	      ok = ok && map[r][c] == expected[r][c];
+	      last_row += (r == layout.rows - 1) * map[r][c];
+	      first_col += (c == 0) * map[r][c];
+	      last_col += (c == layout.cols - 1) * map[r][c];
+	    }
+	}
+      ok = ok && last_row > 0 && first_col > 0 && last_col > 0;
+      free_heatmap(expected, layout.rows);
+      free_heatmap(map, layout.rows);
+      if (!ok)
+	{
+	  printf("ERROR: incorrect %d x %d hexagonal heatmap\n", layout.rows, layout.cols);
+	  track_destroy(trk);
+	  return;
+	}
+    }
+  track_destroy(trk);
+
+  // two points 1 km apart at 60 N, about 5.8 hexagons of 100 m apart
+  trk = track_create();
+  add_at(trk, 60.0, 0.0, 0);
+  add_at(trk, 60.0, 0.018, 1);
+  track_heatmap_hex(trk, 100.0, TRACK_HEX_POINTY, true, &map, &layout);
+  track_destroy(trk);
+  if (map == NULL)
+    {
+      printf("ERROR: no hexagonal heatmap in meters\n");
+      return;
+    }
+  location west = {60.0, 0.0};
+  location east = {60.0, 0.018};
+  location first = track_hex_center(&layout, 0, 0);
+  location last = track_hex_center(&layout, 0, layout.cols - 1);
+  ok = layout.rows == 1 && layout.cols == 7 && map[0][0] == 1 && map[0][6] == 1
+    && location_distance(&west, &first) < 0.1 && location_distance(&east, &last) < 0.1;
+  free_heatmap(map, layout.rows);
+  if (!ok)
+    {
+      printf("ERROR: incorrect %d x %d hexagonal heatmap in meters\n", layout.rows, layout.cols);
+      return;
+    }
+  printf("PASSED\n");
+}
+
+void image_output()
+{
+  // a bad size or scale gets no writer
+  FILE *out = tmpfile();
+  bool ok = out != NULL && image_writer_create(out, IMAGE_GRAY, IMAGE_SCALE_LINEAR, 0, 3, 1.0) == NULL
+    && image_writer_create(out, IMAGE_GRAY, IMAGE_SCALE_LINEAR, 2, 3, -1.0) == NULL;
+
+  // linear gray levels, log gray levels, then colors
+  int rows[2][3] = {{0, 5, 10}, {20, -1, 1}};
+  double dwell[3] = {0.0, 9.0, 99.0};
+  image_writer *w = image_writer_create(out, IMAGE_GRAY, IMAGE_SCALE_LINEAR, 2, 3, 10.0);
+  ok = ok && w != NULL && image_write_row(w, rows[0]) && image_write_row(w, rows[1])
+    && !image_write_row(w, rows[0]) && image_writer_finish(w);
+  w = image_writer_create(out, IMAGE_GRAY, IMAGE_SCALE_LOG, 1, 3, 99.0);
+  ok = ok && w != NULL && image_write_row_double(w, dwell) && image_writer_finish(w);
+  w = image_writer_create(out, IMAGE_COLOR, IMAGE_SCALE_LINEAR, 1, 3, 10.0);
+  ok = ok && w != NULL && image_write_row(w, rows[0]) && image_writer_finish(w);
+
+  // and an unfinished image is reported
+  w = image_writer_create(out, IMAGE_GRAY, IMAGE_SCALE_LINEAR, 2, 1, 1.0);
+  ok = ok && w != NULL && !image_writer_finish(w);
+  if (!ok)
+    {
+      printf("ERROR: could not write images\n");
+      return;
+    }
+
+  unsigned char expected[] = "P5\n3 2\n255\n\x00\x7f\xff\xff\x00\x19"
+    "P5\n3 1\n255\n\x00\x7f\xff"
+    "P6\n3 1\n255\n\x00\x00\x00\xe3\x63\x00\xff\xff\xff"
+    "P5\n1 2\n255\n";
+  unsigned char found[sizeof(expected)];
+  rewind(out);
+  size_t size = fread(found, 1, sizeof(found), out);
+  fclose(out);
+  if (size != sizeof(expected) - 1 || memcmp(found, expected, size) != 0)
+    {
+      printf("ERROR: incorrect image of %d bytes\n", (int) size);
+      return;
+    }
+  printf("PASSED\n");
+}
+
+void gpx_input()
+{
+  // timestamps in and out of range, with offsets and fractions
+  const char *good[] = {"2021-05-01T12:00:00Z", " 2000-02-29T00:00:00.999+00:00 ", "1969-12-31T23:59:59",
+			"1600-03-01t00:00:00z", "2021-05-01T08:00:00-0400"};
+  long good_times[] = {1619870400, 951782400, -1, -11670912000, 1619870400};
+  const char *bad[] = {"2021-05-01", "2021-13-01T00:00:00Z", "2100-02-29T00:00:00Z", "2021-05-01T24:00:00Z",
+		       "2021-05-01T12:00:00.Z", "2021-05-01T12:00:00+5", "2021-05-01T12:00:00Zjunk", ""};
+  bool ok = true;
+  for (int k = 0; k < 5; k++)
+    {
+      long time;
+      ok = ok && gpx_parse_time(good[k], strlen(good[k]), &time) && time == good_times[k];
+    }
+  for (int k = 0; k < 8; k++)
+    {
+      long time;
+      ok = ok && !gpx_parse_time(bad[k], strlen(bad[k]), &time);
+    }
+  if (!ok)
+    {
+      printf("ERROR: incorrect ISO 8601 timestamps\n");
+      return;
+    }
+
+  // points in comments and CDATA are not read, nor points without times,
+  // and the last segment is started but its point is cut off
+  const char *doc =
+    "<?xml version=\"1.0\"?>\n"
+    "<!-- <trkpt lat=\"1\" lon=\"1\"><time>2020-01-01T00:00:00Z</time></trkpt> -->\n"
+    "<gpx xmlns=\"http://www.topografix.com/GPX/1/1\">\n"
+    " <metadata><time>2021-05-01T00:00:00Z</time></metadata>\n"
+    " <trk><name><![CDATA[a <trkseg> in a name]]></name>\n"
+    "  <trkseg>\n"
+    "   <trkpt lat=\"41.3078680\" lon=\"-72.9342120\"><ele>10</ele><time>2021-05-01T12:00:00Z</time></trkpt>\n"
+    "   <trkpt lon='-72.9342340' lat='41.3078780'><time>2021-05-01T12:00:01.5Z</time></trkpt>\n"
+    "   <trkpt lat=\"41.30788\" lon=\"-72.93426\"/>\n"
+    "  </trkseg>\n"
+    "  <trkseg>\n"
+    "   <gpx:trkpt lat = \"41.3079\" lon=\"-72.9343\"><gpx:time>2021-05-01T08:00:05-04:00</gpx:time></gpx:trkpt>\n"
+    "   <trkpt lat=\"41.3080\" lon=\"-72.9344\"><time>not a time</time></trkpt>\n"
+    "   <trkpt lat=\"41.3080\" lon=\"200\"><time>2021-05-01T12:00:06Z</time></trkpt>\n"
+    "   <trkpt lat=\"4.13081e1\" lon=\"-72.9345\"><time>2021-05-01 12:00:07</time></trkpt>\n"
+    "  </trkseg>\n"
+    "  <trkseg><trkpt lat=\"41.31\" lon=\"-72.93\"><time>2021-05-01T12:00:08Z</time>";
+  track *trk = track_create();
+  long added = gpx_read_buffer(doc, strlen(doc), trk);
+  location expected[] = {{41.3078680, -72.9342120}, {41.3078780, -72.9342340},
+			 {41.3079, -72.9343}, {41.3081, -72.9345}};
+  long expected_times[] = {1619870400, 1619870401, 1619870405, 1619870407};
+  ok = added == 4 && track_count_segments(trk) == 3
+    && track_count_points(trk, 0) == 2 && track_count_points(trk, 1) == 2;
+  for (int k = 0; k < 4 && ok; k++)
+    {
+      trackpoint *pt = track_get_point(trk, k / 2, k % 2);
+      location loc = trackpoint_location(pt);
+      ok = loc.lat == expected[k].lat && loc.lon == expected[k].lon && trackpoint_time(pt) == expected_times[k];
+      trackpoint_destroy(pt);
+    }
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: incorrect track read from GPX\n");
+      return;
+    }
+
+  // a missing file
+  trk = track_create();
+  ok = gpx_read_file("/nonexistent/track.gpx", trk) == -1;
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: read a missing GPX file\n");
+      return;
+    }
+  printf("PASSED\n");
+}
+
+// a recorded receiver log: a GGA before any date, fixes across midnight
+// with a duplicate second and a bad checksum, a lost fix, noise, a
+// sentence that is not read, a lowercase checksum and an overlong line
+const char *nmea_log =
+  "$GPGGA,235957,4916.450,N,12311.120,W,1,08,0.9,545.4,M,46.9,M,,*5D\r\n"
+  "$GPRMC,235958,A,4916.450,N,12311.120,W,000.5,054.7,100324,020.3,E*6A\r\n"
+  "$GPGGA,235958.00,4916.450,N,12311.120,W,1,08,0.9,545.4,M,46.9,M,,*7C\r\n"
+  "$GNGGA,235959.50,4916.451,N,12311.121,W,1,08,0.9,545.4,M,46.9,M,,*66\r\n"
+  "$GPGGA,000000,4916.452,N,12311.122,W,1,08,0.9,545.4,M,46.9,M,,*00\r\n"
+  "$GPGGA,000001,4916.453,N,12311.123,W,2,08,0.9,545.4,M,46.9,M,,*50\r\n"
+  "$GPRMC,000002,V,,,,,,,110324,,*36\r\n"
+  "$GPGGA,000003,,,,,0,00,,,M,,M,,*65\r\n"
+  "$GPRMC,000010,A,0000.000,S,00000.000,E,000.0,000.0,110324,,*04\r\n"
+  "garbage\r\n"
+  "$GPGSV,3,1,11,03,03,111,00,04,15,270,00,06,01,010,00,13,06,292,00*74\r\n"
+  "$GPRMC,000011,A,0030.000,S,17959.999,E,000.0,000.0,110324,,*0c\r\n"
+  "$GPRMC,000012,A,0030.000,S,17959.999,E,000.0,000.0,110324,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,"
+  ",,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,*0C\r\n";
+
+/**
+ * Returns whether the given track and reader hold what reading nmea_log
+ * should give.
+ */
+bool nmea_check(const track *trk, const nmea_reader *r)
+{
+  location expected[] = {{49.2741666666666667, -123.1853333333333333}, {49.2741833333333333, -123.1853500000000000},
+			 {49.2742166666666667, -123.1853833333333333}, {0.0, 0.0}, {-0.5, 179.9999833333333333}};
+  long times[] = {1710115198, 1710115199, 1710115201, 1710115210, 1710115211};
+  nmea_stats stats;
+  nmea_reader_stats(r, &stats);
+  bool ok = stats.lines == 13 && stats.rejected == 3 && stats.fixes == 6 && stats.points == 5 && stats.losses == 2
+    && track_count_segments(trk) == 2 && track_count_points(trk, 0) == 3 && track_count_points(trk, 1) == 2;
+  for (int k = 0; k < 5 && ok; k++)
+    {
+      trackpoint *pt = track_get_point(trk, k / 3, k % 3);
+      location loc = trackpoint_location(pt);
+      ok = fabs(loc.lat - expected[k].lat) < 1e-12 && fabs(loc.lon - expected[k].lon) < 1e-12
+	&& trackpoint_time(pt) == times[k];
+      trackpoint_destroy(pt);
+    }
+  return ok;
+}
+
+void nmea_input()
+{
+  // the log arriving a few bytes at a time on a nonblocking pipe
+  int fds[2];
+  if (pipe(fds) != 0 || fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0)
+    {
+      printf("ERROR: could not make a pipe\n");
+      return;
+    }
+  track *trk = track_create();
+  nmea_reader *r = nmea_reader_create(trk, 0);
+  bool ok = true;
+  size_t len = strlen(nmea_log);
+  for (size_t k = 0; k < len && ok; k += 7)
+    {
+      ok = write(fds[1], nmea_log + k, (len - k < 7 ? len - k : 7)) > 0 && nmea_read_fd(r, fds[0]) == NMEA_MORE;
+    }
+  close(fds[1]);
+  ok = ok && nmea_read_fd(r, fds[0]) == NMEA_END && nmea_check(trk, r);
+  close(fds[0]);
+  nmea_reader_destroy(r);
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: incorrect track read from an NMEA pipe\n");
+      return;
+    }
+
+  // the same log from a file
+  FILE *recording = tmpfile();
+  fputs(nmea_log, recording);
+  fflush(recording);
+  lseek(fileno(recording), 0, SEEK_SET);
+  trk = track_create();
+  r = nmea_reader_create(trk, 0);
+  ok = nmea_read_fd(r, fileno(recording)) == NMEA_END && nmea_check(trk, r);
+  fclose(recording);
+  nmea_reader_destroy(r);
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: incorrect track read from an NMEA file\n");
+      return;
+    }
+
+  // many times around the buffer, with a gap of more than a minute
+  trk = track_create();
+  r = nmea_reader_create(trk, 60);
+  for (int k = 0; k < 2000; k++)
+    {
+      char line[NMEA_MAX_SENTENCE];
+      int second = k + (k >= 1000 ? 100 : 0);
+      int n = sprintf(line, "$GPRMC,%02d%02d%02d,A,4124.%03d,N,07254.000,W,,,010124,,",
+		      second / 3600, second / 60 % 60, second % 60, k % 1000);
+      unsigned char sum = 0;
+      for (int c = 1; c < n; c++)
+	{
+	  sum ^= line[c];
+	}
+      sprintf(line + n, "*%02X\r\n", sum);
+      nmea_feed(r, line, strlen(line));
+    }
+  nmea_stats stats;
+  nmea_reader_stats(r, &stats);
+  trackpoint *pt = track_get_point(trk, 1, 999);
+  ok = stats.points == 2000 && stats.rejected == 0 && track_count_segments(trk) == 2
+    && track_count_points(trk, 0) == 1000 && trackpoint_time(pt) == 1704067200 + 2099
+    && fabs(trackpoint_location(pt).lat - (41 + 24.999 / 60)) < 1e-12;
+  trackpoint_destroy(pt);
+  nmea_reader_destroy(r);
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: incorrect track fed through the NMEA buffer\n");
+      return;
+    }
+  printf("PASSED\n");
+}
+
+/**
+ * Checks that the given live heatmap, brought up to date with the given
+ * track, counts the given number of new points and matches the map
+ * track_heatmap creates for the track.
+ */
+bool live_matches(track_live_heatmap *live, const track *trk, long added)
+{
+  int **map, **expected;
+  int rows, cols, expected_rows, expected_cols;
+  if (track_live_heatmap_update(live, trk) != added)
+    {
+      return false;
+    }
+  track_live_heatmap_map(live, &map, &rows, &cols);
+  track_heatmap(trk, 0.25, 0.25, &expected, &expected_rows, &expected_cols);
+  bool ok = map != NULL && expected != NULL && rows == expected_rows && cols == expected_cols;
+  for (int r = 0; ok && r < rows; r++)
+    {
+      ok = memcmp(map[r], expected[r], sizeof(int) * cols) == 0;
+    }
+  if (map != NULL)
+    {
+      free_heatmap(map, rows);
+    }
+  if (expected != NULL)
+    {
+      free_heatmap(expected, expected_rows);
+    }
+  return ok;
+}
+
+void live_heatmap()
+{
+  // a bad cell size gets no heatmap and nothing counted gets one empty cell
+  track_live_heatmap *live = track_live_heatmap_create(0.0, 0.25);
+  bool ok = live == NULL;
+  live = track_live_heatmap_create(0.25, 0.25);
+  track *trk = track_create();
+  int **map;
+  int rows, cols;
+  ok = ok && live != NULL && track_live_heatmap_update(live, trk) == 0;
+  track_live_heatmap_map(live, &map, &rows, &cols);
+  ok = ok && map != NULL && rows == 1 && cols == 1 && map[0][0] == 0;
+  if (map != NULL)
+    {
+      free_heatmap(map, rows);
+    }
+  if (!ok)
+    {
+      printf("ERROR: incorrect empty live heatmap\n");
+      track_live_heatmap_destroy(live);
+      track_destroy(trk);
+      return;
+    }
+
+  // starting at the northwest corner the cells are those of track_heatmap,
+  // and each update counts just the points added since the last, across
+  // new segments and on the end of the last one
+  add_at(trk, 10.0, 20.0, 0);
+  long time = 1;
+  for (int batch = 0; batch < 6 && ok; batch++)
+    {
+      for (int i = 0; i < 500; i++, time++)
+	{
+	  add_at(trk, 9.999 - fmod(time * 0.3719, 1.99), 20.001 + fmod(time * 0.6131, 2.49), time);
+	}
+      ok = live_matches(live, trk, batch == 0 ? 501 : 500);
+      if (batch % 2 == 1)
+	{
+	  track_start_segment(trk);
+	}
+    }
+  if (!ok)
+    {
+      printf("ERROR: live heatmap does not match the track's heatmap\n");
+      track_live_heatmap_destroy(live);
+      track_destroy(trk);
+      return;
+    }
+
+  // a point north and west of the first grows the map on those sides
+  // without moving the cells already counted
+  track_live_heatmap_map(live, &map, &rows, &cols);
+  int corner = (map != NULL ? map[0][0] : -1);
+  if (map != NULL)
+    {
+      free_heatmap(map, rows);
+    }
+  int old_rows = rows;
+  int old_cols = cols;
+  add_at(trk, 10.3, 19.8, time);
+  ok = track_live_heatmap_update(live, trk) == 1;
+  track_live_heatmap_map(live, &map, &rows, &cols);
+  ok = ok && map != NULL && rows == old_rows + 2 && cols == old_cols + 1
+    && map[0][0] == 1 && map[2][1] == corner;
+  if (map != NULL)
+    {
+      free_heatmap(map, rows);
+    }
+  track_live_heatmap_destroy(live);
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: incorrect live heatmap after growing northwest\n");
+      return;
+    }
+  printf("PASSED\n");
+}
+
+void *run_service(void *s)
+{
+  service_run(s);
+  return NULL;
+}
+
+void service_requests()
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/track_unit_%ld.sock", (long) getpid());
+  track_options opts = {0};
+  service *s = service_create(path, &opts);
+  pthread_t thread;
+  if (s == NULL || pthread_create(&thread, NULL, run_service, s) != 0)
+    {
+      printf("ERROR: could not start service\n");
+      return;
+    }
+
+  // two segments of points for track 3, kept here too to compare
+  track *trk = track_create();
+  service_point pts[200];
+  for (int i = 0; i < 200; i++)
+    {
+      pts[i].lat = 10.0 - i * 0.0037;
+      pts[i].lon = 20.0 + fmod(i * 0.0131, 0.9);
+      pts[i].time = i;
+      if (i == 100)
+	{
+	  track_start_segment(trk);
+	}
+      add_at(trk, pts[i].lat, pts[i].lon, pts[i].time);
+    }
+
+  // everything sent before any answer is read; the queries must see
+  // the points sent ahead of them
+  double cells[2] = {0.1, 0.1};
+  int fd = service_connect(path);
+  bool ok = fd >= 0
+    && service_send(fd, SERVICE_APPEND, 3, 1, pts, 100 * sizeof(service_point))
+    && service_send(fd, SERVICE_SEGMENT, 3, 2, NULL, 0)
+    && service_send(fd, SERVICE_APPEND, 3, 3, pts + 100, 100 * sizeof(service_point))
+    && service_send(fd, SERVICE_HEATMAP, 3, 4, cells, sizeof(cells))
+    && service_send(fd, SERVICE_LENGTHS, 3, 5, NULL, 0)
+    && service_send(fd, SERVICE_LENGTHS, 7, 6, NULL, 0)
+    && service_send(fd, 99, 3, 7, NULL, 0)
+    && service_send(fd, SERVICE_HEATMAP, 3, 8, cells, 1);
+
+  int **map;
+  int rows, cols;
+  track_heatmap(trk, 0.1, 0.1, &map, &rows, &cols);
+  double *lengths = track_get_lengths(trk);
+  bool seen[9] = {false};
+  for (int k = 0; k < 8 && ok; k++)
+    {
+      service_header header;
+      char *body = service_receive(fd, &header);
+      ok = body != NULL && header.id >= 1 && header.id <= 8 && !seen[header.id];
+      if (ok)
+	{
+	  seen[header.id] = true;
+	  int32_t dims[2];
+	  switch (header.id)
+	    {
+	    case 4:
+	      memcpy(dims, body, sizeof(dims));
+	      ok = header.type == SERVICE_OK && dims[0] == rows && dims[1] == cols
+		&& header.length == (2 + rows * cols) * sizeof(int32_t);
+	      for (int r = 0; ok && r < rows; r++)
+		{
+		  for (int c = 0; c < cols; c++)
+		    {
+		      int32_t count;
+		      memcpy(&count, body + (2 + r * cols + c) * sizeof(int32_t), sizeof(count));
+		      ok = ok && count == map[r][c];
+		    }
+		}
+	      break;
+
+	    case 5:
+	      ok = header.type == SERVICE_OK && header.length == 2 * sizeof(double)
+		&& memcmp(body, lengths, 2 * sizeof(double)) == 0 && lengths[0] > 0 && lengths[1] > 0;
+	      break;
+
+	    case 6:
+	    case 7:
+	    case 8:
+	      ok = header.type == SERVICE_ERROR && header.length == 0;
+	      break;
+
+	    default:
+	      ok = header.type == SERVICE_OK && header.length == 0 && header.track == 3;
+	    }
+	}
+      free(body);
+    }
+
+  if (fd >= 0)
+    {
+      close(fd);
+    }
+  service_stop(s);
+  pthread_join(thread, NULL);
+  service_destroy(s);
+  free_heatmap(map, rows);
+  free(lengths);
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: incorrect responses from the service\n");
+      return;
+    }
+  if (access(path, F_OK) == 0)
+    {
+      printf("ERROR: service left its socket behind\n");
+      return;
+    }
+  printf("PASSED\n");
+}
+
+bool same_tracks(const track *a, const track *b)
+{
+  if (track_count_segments(a) != track_count_segments(b))
+    {
+      return false;
+    }
+  bool ok = true;
+  double *la = track_get_lengths(a);
+  double *lb = track_get_lengths(b);
+  for (int i = 0; i < track_count_segments(a) && ok; i++)
+    {
+      int n = track_count_points(a, i);
+      ok = n == track_count_points(b, i) && la[i] == lb[i];
+      location locs[2][64];
+      long times[2][64];
+      for (int j = 0; j < n && ok; j += 64)
+	{
+	  int got = track_read_points(a, i, j, 64, locs[0], times[0]);
+	  ok = got == track_read_points(b, i, j, 64, locs[1], times[1])
+	    && memcmp(locs[0], locs[1], sizeof(location) * got) == 0
+	    && memcmp(times[0], times[1], sizeof(long) * got) == 0;
+	}
+      for (int j = 0; j < n && ok; j += 97)
+	{
+	  ok = track_get_dwell(a, i, j) == track_get_dwell(b, i, j)
+	    && track_length_between(a, i, 0, j) == track_length_between(b, i, 0, j);
+	}
+    }
+  free(la);
+  free(lb);
+
+  int **maps[2];
+  int rows[2], cols[2];
+  track_heatmap(a, 0.01, 0.01, &maps[0], &rows[0], &cols[0]);
+  track_heatmap(b, 0.01, 0.01, &maps[1], &rows[1], &cols[1]);
+  ok = ok && maps[0] != NULL && maps[1] != NULL && rows[0] == rows[1] && cols[0] == cols[1];
+  for (int r = 0; r < rows[0] && ok; r++)
+    {
+      ok = memcmp(maps[0][r], maps[1][r], sizeof(int) * cols[0]) == 0;
+    }
+  for (int t = 0; t < 2; t++)
+    {
+      if (maps[t] != NULL)
+	{
+	  free_heatmap(maps[t], rows[t]);
+	}
+    }
+  return ok;
+}
+
+void snapshot_restore()
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/track_unit_%ld.snap", (long) getpid());
+
+  // full and compact records, with and without running lengths, short
+  // segments, several blocks, a stop and the cached summaries all
+  // come back, and the restored track goes on growing like the original
+  track_options options[] = {{0}, {.compact = true}, {.running_lengths = true},
+			     {.compact = true, .running_lengths = true, .arena_chunk = 1 << 16}};
+  bool ok = true;
+  for (int o = 0; o < 4 && ok; o++)
+    {
+      track *trk = track_create_with(&options[o]);
+      long time = 0;
+      for (int i = 0; i < 3000; i++, time += 5)
+	{
+	  add_at(trk, 41.3 + fmod(i * 0.0137, 0.2), -72.9 + fmod(i * 0.0291, 0.3), time);
+	  if (i == 1000 || i == 1010 || i == 2900)
+	    {
+	      track_start_segment(trk);
+	    }
+	  if (i == 1200)
+	    {
+	      time += 600;
+	    }
+	}
+      track_refresh(trk);
+      track *restored = NULL;
+      ok = track_snapshot(trk, path) && (restored = track_restore(path)) != NULL
+	&& same_tracks(trk, restored);
+      for (int i = 0; i < 1500 && ok; i++, time += 5)
+	{
+	  ok = add_at(trk, 41.2 - i * 1e-4, -72.8, time) && add_at(restored, 41.2 - i * 1e-4, -72.8, time);
+	  if (i == 700)
+	    {
+	      track_start_segment(trk);
+	      track_start_segment(restored);
+	    }
+	}
+      ok = ok && same_tracks(trk, restored);
+      if (restored != NULL)
+	{
+	  track_reset(restored);
+	  ok = ok && track_count_segments(restored) == 1 && track_count_points(restored, 0) == 0
+	    && add_at(restored, 1.0, 2.0, 3);
+	  track_destroy(restored);
+	}
+      track_destroy(trk);
+    }
+  if (!ok)
+    {
+      printf("ERROR: restored track differs from the snapshot\n");
+      unlink(path);
+      return;
+    }
+
+  // a snapshot written in the background is the track as it was when
+  // the writer started, while points go on being added
+  track *trk = track_create();
+  for (int i = 0; i < 5000; i++)
+    {
+      add_at(trk, i * 1e-4, i * 2e-4, i);
+    }
+  track *before = track_create();
+  for (int i = 0; i < 5000; i++)
+    {
+      add_at(before, i * 1e-4, i * 2e-4, i);
+    }
+  pid_t writer = track_snapshot_background(trk, path);
+  for (int i = 5000; i < 10000; i++)
+    {
+      add_at(trk, i * 1e-4, i * 2e-4, i);
+    }
+  track *restored = NULL;
+  ok = writer > 0 && track_snapshot_wait(writer) && (restored = track_restore(path)) != NULL
+    && same_tracks(before, restored) && track_count_points(trk, 0) == 10000;
+  if (restored != NULL)
+    {
+      track_destroy(restored);
+    }
+  track_destroy(before);
+  track_destroy(trk);
+  if (!ok)
+    {
+      printf("ERROR: incorrect snapshot written in the background\n");
+      unlink(path);
+      return;
+    }
+
+  // missing, truncated and damaged snapshots are refused
+  char temp[80];
+  snprintf(temp, sizeof(temp), "%s.tmp", path);
+  ok = track_restore("/nonexistent/track.snap") == NULL && access(temp, F_OK) != 0;
+  FILE *f = fopen(path, "r+b");
+  ok = ok && f != NULL && fseek(f, 0, SEEK_END) == 0;
+  long size = (f != NULL ? ftell(f) : 0);
+  if (f != NULL)
+    {
+      fseek(f, 0, SEEK_SET);
+      fputc('X', f);
+      fclose(f);
+    }
+  ok = ok && track_restore(path) == NULL && truncate(path, size / 2) == 0 && track_restore(path) == NULL
+    && !track_snapshot(trk = track_create(), "/nonexistent/track.snap");
+  track_destroy(trk);
+  unlink(path);
+  if (!ok)
+    {
+      printf("ERROR: damaged snapshot was restored\n");
+      return;
+    }
+  printf("PASSED\n");
+}
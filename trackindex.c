@@ -0,0 +1,588 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "trackindex.h"
+
+#define PI 3.14159265358979
+#define RADIANS(x) ((x) / 180.0 * PI)
+
+// the WGS 84 ellipsoid in kilometers, as location_distance uses
+#define SEMI_MAJOR 6378.137
+#define FLATTENING (1.0 / 298.257223563)
+#define ECCENTRICITY_SQ (FLATTENING * (2.0 - FLATTENING))
+
+// most points in a leaf of the tree
+#define INDEX_LEAF_SIZE 16
+
+/**
+ * A node of the tree: the points from start up to but not including
+ * end in tree order, with their bounding box in 3-D and their bounds
+ * in latitude, plain longitude and time.  Leaves have no children.
+ */
+typedef struct index_node
+{
+    double lo[3];
+    double hi[3];
+    double south;
+    double north;
+    double min_lon;
+    double max_lon;
+    long first_time;
+    long last_time;
+    long start;
+    long end;
+    int left;
+    int right;
+} index_node;
+
+struct track_index
+{
+    long count;
+    double (*xyz)[3];
+    location *locs;
+    long *times;
+    int *segments;
+    int *points;
+    index_node *nodes;
+    int num_nodes;
+};
+
+/**
+ * Stores the earth-centered cartesian coordinates of the given location
+ * on the ellipsoid in p.
+ */
+static void index_position(location loc, double *p)
+{
+    double lat = RADIANS(loc.lat);
+    double lon = RADIANS(loc.lon);
+    double radius = SEMI_MAJOR / sqrt(1.0 - ECCENTRICITY_SQ * sin(lat) * sin(lat));
+    p[0] = radius * cos(lat) * cos(lon);
+    p[1] = radius * cos(lat) * sin(lon);
+    p[2] = radius * (1.0 - ECCENTRICITY_SQ) * sin(lat);
+}
+
+/**
+ * Rearranges perm[start] through perm[end-1] so that the point at nth
+ * is the one that would be there if they were sorted by the given
+ * coordinate, with none before it greater and none after it less.
+ */
+static void index_select(long *perm, const double (*xyz)[3], long start, long end, long nth, int axis)
+{
+    while (end - start > 1)
+    {
+        double pivot = xyz[perm[start + (end - start) / 2]][axis];
+        long i = start;
+        long j = end - 1;
+        while (i <= j)
+        {
+            while (xyz[perm[i]][axis] < pivot)
+            {
+                i++;
+            }
+            while (xyz[perm[j]][axis] > pivot)
+            {
+                j--;
+            }
+            if (i <= j)
+            {
+                long swap = perm[i];
+                perm[i] = perm[j];
+                perm[j] = swap;
+                i++;
+                j--;
+            }
+        }
+
+        // start..j are at most the pivot and i..end-1 at least it
+        if (nth <= j)
+        {
+            end = j + 1;
+        }
+        else if (nth >= i)
+        {
+            start = i;
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * Builds the subtree over perm[start] through perm[end-1] and returns
+ * the index of its root, splitting at the median of the widest
+ * coordinate.
+ */
+static int index_build(track_index *idx, long *perm, const double (*xyz)[3], const location *locs,
+                       const long *times, long start, long end)
+{
+    int n = idx->num_nodes++;
+    index_node *node = &idx->nodes[n];
+    node->start = start;
+    node->end = end;
+    node->left = -1;
+    node->right = -1;
+
+    for (int a=0; a<3; a++)
+    {
+        node->lo[a] = INFINITY;
+        node->hi[a] = -INFINITY;
+    }
+    node->south = 90;
+    node->north = -90;
+    node->min_lon = INFINITY;
+    node->max_lon = -INFINITY;
+    node->first_time = times[perm[start]];
+    node->last_time = times[perm[start]];
+    for (long k=start; k<end; k++)
+    {
+        const double *p = xyz[perm[k]];
+        for (int a=0; a<3; a++)
+        {
+            node->lo[a] = fmin(node->lo[a], p[a]);
+            node->hi[a] = fmax(node->hi[a], p[a]);
+        }
+        location loc = locs[perm[k]];
+        node->south = fmin(node->south, loc.lat);
+        node->north = fmax(node->north, loc.lat);
+        node->min_lon = fmin(node->min_lon, loc.lon);
+        node->max_lon = fmax(node->max_lon, loc.lon);
+        if (times[perm[k]] < node->first_time)
+        {
+            node->first_time = times[perm[k]];
+        }
+        if (times[perm[k]] > node->last_time)
+        {
+            node->last_time = times[perm[k]];
+        }
+    }
+
+    if (end - start > INDEX_LEAF_SIZE)
+    {
+        int axis = 0;
+        for (int a=1; a<3; a++)
+        {
+            if (node->hi[a] - node->lo[a] > node->hi[axis] - node->lo[axis])
+            {
+                axis = a;
+            }
+        }
+
+        long mid = start + (end - start) / 2;
+        index_select(perm, xyz, start, end, mid, axis);
+
+        // the children are built after this node in the array
+        int left = index_build(idx, perm, xyz, locs, times, start, mid);
+        int right = index_build(idx, perm, xyz, locs, times, mid, end);
+        idx->nodes[n].left = left;
+        idx->nodes[n].right = right;
+    }
+    return n;
+}
+
+track_index *track_index_create(const track *trk)
+{
+    track_index *idx = calloc(1, sizeof(track_index));
+    if (idx == NULL)
+    {
+        return NULL;
+    }
+
+    for (int i=0; i<track_count_segments(trk); i++)
+    {
+        idx->count += track_count_points(trk, i);
+    }
+    long n = idx->count;
+    size_t size = (n > 0 ? n : 1);
+
+    // the points in track order, then permuted into tree order
+    double (*xyz)[3] = malloc(sizeof(double[3]) * size);
+    location *locs = malloc(sizeof(location) * size);
+    long *times = malloc(sizeof(long) * size);
+    int *segments = malloc(sizeof(int) * size);
+    int *points = malloc(sizeof(int) * size);
+    long *perm = malloc(sizeof(long) * size);
+    idx->xyz = malloc(sizeof(double[3]) * size);
+    idx->locs = malloc(sizeof(location) * size);
+    idx->times = malloc(sizeof(long) * size);
+    idx->segments = malloc(sizeof(int) * size);
+    idx->points = malloc(sizeof(int) * size);
+    idx->nodes = malloc(sizeof(index_node) * (4 * size / INDEX_LEAF_SIZE + 4));
+    if (xyz == NULL || locs == NULL || times == NULL || segments == NULL || points == NULL
+        || perm == NULL || idx->xyz == NULL
+        || idx->locs == NULL || idx->times == NULL || idx->segments == NULL || idx->points == NULL
+        || idx->nodes == NULL)
+    {
+        free(xyz);
+        free(locs);
+        free(times);
+        free(segments);
+        free(points);
+        free(perm);
+        track_index_destroy(idx);
+        return NULL;
+    }
+
+    long k = 0;
+    for (int i=0; i<track_count_segments(trk); i++)
+    {
+        int count = track_read_points(trk, i, 0, track_count_points(trk, i), locs + k, times + k);
+        for (int j=0; j<count; j++)
+        {
+            segments[k + j] = i;
+            points[k + j] = j;
+        }
+        k += count;
+    }
+    for (long j=0; j<n; j++)
+    {
+        index_position(locs[j], xyz[j]);
+        perm[j] = j;
+    }
+
+    if (n > 0)
+    {
+        index_build(idx, perm, (const double (*)[3]) xyz, locs, times, 0, n);
+    }
+
+    // store the points contiguously in tree order
+    for (long j=0; j<n; j++)
+    {
+        memcpy(idx->xyz[j], xyz[perm[j]], sizeof(double[3]));
+        idx->locs[j] = locs[perm[j]];
+        idx->times[j] = times[perm[j]];
+        idx->segments[j] = segments[perm[j]];
+        idx->points[j] = points[perm[j]];
+    }
+
+    free(xyz);
+    free(locs);
+    free(times);
+    free(segments);
+    free(points);
+    free(perm);
+    return idx;
+}
+
+void track_index_destroy(track_index *idx)
+{
+    free(idx->xyz);
+    free(idx->locs);
+    free(idx->times);
+    free(idx->segments);
+    free(idx->points);
+    free(idx->nodes);
+    free(idx);
+}
+
+long track_index_count(const track_index *idx)
+{
+    return idx->count;
+}
+
+/**
+ * Returns the square of the straight-line distance from p to the
+ * bounding box of the given node, which is 0 if p is inside it.
+ */
+static double index_box_distance_sq(const index_node *node, const double *p)
+{
+    double d = 0.0;
+    for (int a=0; a<3; a++)
+    {
+        if (p[a] < node->lo[a])
+        {
+            d += (node->lo[a] - p[a]) * (node->lo[a] - p[a]);
+        }
+        else if (p[a] > node->hi[a])
+        {
+            d += (p[a] - node->hi[a]) * (p[a] - node->hi[a]);
+        }
+    }
+    return d;
+}
+
+/**
+ * Returns the distance between the given location and indexed point k.
+ * Nearly antipodal points, where the ellipsoidal formula does not
+ * converge, are measured on the sphere instead.
+ */
+static double index_distance(const track_index *idx, const location *loc, long k)
+{
+    double d = location_distance(loc, &idx->locs[k]);
+    if (isnan(d))
+    {
+        d = location_distance_spherical(loc, &idx->locs[k]);
+    }
+    return d;
+}
+
+/**
+ * Searches the subtree rooted at node n for a point closer to loc,
+ * with cartesian coordinates p, than the best found so far.
+ */
+static void index_search(const track_index *idx, int n, const location *loc, const double *p,
+                         long *best, double *best_distance)
+{
+    const index_node *node = &idx->nodes[n];
+    if (node->left < 0)
+    {
+        for (long k=node->start; k<node->end; k++)
+        {
+            // the straight line is never longer than the path on the surface
+            double dx = idx->xyz[k][0] - p[0];
+            double dy = idx->xyz[k][1] - p[1];
+            double dz = idx->xyz[k][2] - p[2];
+            if (dx * dx + dy * dy + dz * dz >= *best_distance * *best_distance)
+            {
+                continue;
+            }
+
+            double d = index_distance(idx, loc, k);
+            if (d < *best_distance)
+            {
+                *best_distance = d;
+                *best = k;
+            }
+        }
+        return;
+    }
+
+    // the nearer child first, so the other is more likely to be pruned
+    int first = node->left;
+    int second = node->right;
+    double first_bound = index_box_distance_sq(&idx->nodes[first], p);
+    double second_bound = index_box_distance_sq(&idx->nodes[second], p);
+    if (second_bound < first_bound)
+    {
+        int swap = first;
+        first = second;
+        second = swap;
+        double swap_bound = first_bound;
+        first_bound = second_bound;
+        second_bound = swap_bound;
+    }
+
+    if (first_bound < *best_distance * *best_distance)
+    {
+        index_search(idx, first, loc, p, best, best_distance);
+    }
+    if (second_bound < *best_distance * *best_distance)
+    {
+        index_search(idx, second, loc, p, best, best_distance);
+    }
+}
+
+/**
+ * Finds the point nearest loc, starting from the given point and its
+ * distance if start is not negative.  Returns the index of the point
+ * found, or -1 if the location is invalid or the index is empty.
+ */
+static long index_nearest(const track_index *idx, location loc, long start, double *distance)
+{
+    if (idx->count == 0 || !(loc.lat >= -90.0 && loc.lat <= 90.0 && isfinite(loc.lon)))
+    {
+        return -1;
+    }
+
+    double p[3];
+    index_position(loc, p);
+    long best = start;
+    *distance = (start >= 0 ? index_distance(idx, &loc, start) : INFINITY);
+    if (isnan(*distance))
+    {
+        best = -1;
+        *distance = INFINITY;
+    }
+    index_search(idx, 0, &loc, p, &best, distance);
+    return best;
+}
+
+/**
+ * Stores indexed point k in the given fix.
+ */
+static void index_fix(const track_index *idx, long k, track_fix *fix)
+{
+    fix->segment = idx->segments[k];
+    fix->point = idx->points[k];
+    fix->loc = idx->locs[k];
+    fix->time = idx->times[k];
+}
+
+bool track_index_nearest(const track_index *idx, location loc, track_fix *fix, double *distance)
+{
+    double d;
+    long k = index_nearest(idx, loc, -1, &d);
+    if (k < 0)
+    {
+        return false;
+    }
+
+    if (fix != NULL)
+    {
+        index_fix(idx, k, fix);
+    }
+    if (distance != NULL)
+    {
+        *distance = d;
+    }
+    return true;
+}
+
+int track_index_nearest_batch(const track_index *idx, const location *locs, int n,
+                              track_fix *fixes, double *distances)
+{
+    int found = 0;
+    long prev = -1;
+    for (int q=0; q<n; q++)
+    {
+        double d;
+        long k = index_nearest(idx, locs[q], prev, &d);
+        if (k >= 0)
+        {
+            found++;
+            prev = k;
+            if (fixes != NULL)
+            {
+                index_fix(idx, k, &fixes[q]);
+            }
+            if (distances != NULL)
+            {
+                distances[q] = d;
+            }
+        }
+        else
+        {
+            if (fixes != NULL)
+            {
+                fixes[q].segment = -1;
+                fixes[q].point = -1;
+            }
+            if (distances != NULL)
+            {
+                distances[q] = nan("");
+            }
+        }
+    }
+    return found;
+}
+
+/**
+ * Determines whether the given longitude is in the given window.
+ */
+static bool index_window_has_lon(const track_window *window, double lon)
+{
+    if (window->west <= window->east)
+    {
+        return lon >= window->west && lon <= window->east;
+    }
+    else
+    {
+        return lon >= window->west || lon <= window->east;
+    }
+}
+
+/**
+ * A growing array of the fixes found by a box query.
+ */
+typedef struct index_results
+{
+    track_fix *fixes;
+    long count;
+    long capacity;
+    bool failed;
+} index_results;
+
+/**
+ * Adds indexed point k to the given results.
+ */
+static void index_results_add(const track_index *idx, index_results *results, long k)
+{
+    if (results->count == results->capacity)
+    {
+        track_fix *bigger = realloc(results->fixes, sizeof(track_fix) * results->capacity * 2);
+        if (bigger == NULL)
+        {
+            results->failed = true;
+            return;
+        }
+        results->fixes = bigger;
+        results->capacity *= 2;
+    }
+    index_fix(idx, k, &results->fixes[results->count++]);
+}
+
+/**
+ * Adds the points in the subtree rooted at node n that are in the given
+ * window to the given results, skipping subtrees entirely outside it
+ * and taking subtrees entirely inside it without checking each point.
+ */
+static void index_collect(const track_index *idx, int n, const track_window *window, index_results *results)
+{
+    const index_node *node = &idx->nodes[n];
+    if (results->failed || node->last_time < window->start || node->first_time > window->end
+        || node->north < window->south || node->south > window->north)
+    {
+        return;
+    }
+
+    bool lons_outside, lons_inside;
+    if (window->west <= window->east)
+    {
+        lons_outside = (node->max_lon < window->west || node->min_lon > window->east);
+        lons_inside = (node->min_lon >= window->west && node->max_lon <= window->east);
+    }
+    else
+    {
+        lons_outside = (node->max_lon < window->west && node->min_lon > window->east);
+        lons_inside = (node->min_lon >= window->west || node->max_lon <= window->east);
+    }
+    if (lons_outside)
+    {
+        return;
+    }
+
+    bool inside = (lons_inside && node->south >= window->south && node->north <= window->north
+                   && node->first_time >= window->start && node->last_time <= window->end);
+    if (inside || node->left < 0)
+    {
+        for (long k=node->start; k<node->end; k++)
+        {
+            if (inside || (idx->times[k] >= window->start && idx->times[k] <= window->end
+                           && idx->locs[k].lat >= window->south && idx->locs[k].lat <= window->north
+                           && index_window_has_lon(window, idx->locs[k].lon)))
+            {
+                index_results_add(idx, results, k);
+            }
+        }
+        return;
+    }
+
+    index_collect(idx, node->left, window, results);
+    index_collect(idx, node->right, window, results);
+}
+
+long track_index_box(const track_index *idx, const track_window *window, track_fix **fixes)
+{
+    index_results results = {malloc(sizeof(track_fix) * 16), 0, 16, false};
+    if (results.fixes == NULL)
+    {
+        *fixes = NULL;
+        return -1;
+    }
+
+    if (idx->count > 0)
+    {
+        index_collect(idx, 0, window, &results);
+    }
+    if (results.failed)
+    {
+        free(results.fixes);
+        *fixes = NULL;
+        return -1;
+    }
+
+    *fixes = results.fixes;
+    return results.count;
+}
@@ -0,0 +1,102 @@
+#ifndef __TRACKINDEX_H__
+#define __TRACKINDEX_H__
+
+#include <stdbool.h>
+
+#include "track.h"
+#include "location.h"
+
+typedef struct track_index track_index;
+
+/**
+ * A point found in an indexed track: its segment and index within the
+ * segment, its location and its timestamp.
+ */
+typedef struct track_fix
+{
+    int segment;
+    int point;
+    location loc;
+    long time;
+} track_fix;
+
+/**
+ * Creates a spatial index over the points of the given track as they
+ * are now; later changes to the track are not reflected in the index,
+ * which does not refer to the track after it is built.  The index is
+ * a k-d tree bulk-loaded in O(n log n) time over the points' positions
+ * on the WGS 84 ellipsoid, with the points stored contiguously in tree
+ * order.
+ *
+ * @param trk a pointer to a valid track
+ * @return a pointer to the new index, or NULL if there was an allocation error
+ */
+track_index *track_index_create(const track *trk);
+
+/**
+ * Destroys the given index.
+ *
+ * @param idx a pointer to a valid index
+ */
+void track_index_destroy(track_index *idx);
+
+/**
+ * Returns the number of points in the given index.
+ *
+ * @param idx a pointer to a valid index
+ */
+long track_index_count(const track_index *idx);
+
+/**
+ * Finds the indexed point nearest the given location by the distance
+ * location_distance measures, in kilometers.  The straight-line
+ * distance through the ellipsoid is a lower bound on that distance,
+ * so whole subtrees are skipped without measuring any of their points.
+ * Ties go to an arbitrary one of the nearest points.  Returns false,
+ * leaving the outputs unchanged, if the index is empty or the location
+ * is invalid.  To ask whether the track came within a given distance
+ * of a spot, compare the distance found with it.
+ *
+ * @param idx a pointer to a valid index
+ * @param loc a location
+ * @param fix a pointer to where to store the nearest point, or NULL
+ * @param distance a pointer to where to store its distance, or NULL
+ * @return true if and only if a point was found
+ */
+bool track_index_nearest(const track_index *idx, location loc, track_fix *fix, double *distance);
+
+/**
+ * Finds the nearest indexed point to each of the given locations, as
+ * track_index_nearest does for each in turn, and returns the number of
+ * locations a point was found for.  Each search starts from the answer
+ * to the previous query, so batches of nearby queries (such as the
+ * points of another track) prune much of the tree from the start.
+ * Fixes for invalid locations have segment -1 and distance NaN.
+ *
+ * @param idx a pointer to a valid index
+ * @param locs an array of n locations
+ * @param n a nonnegative integer
+ * @param fixes an array of n fixes, or NULL
+ * @param distances an array of n distances, or NULL
+ * @return the number of locations a point was found for
+ */
+int track_index_nearest_batch(const track_index *idx, const location *locs, int n,
+                              track_fix *fixes, double *distances);
+
+/**
+ * Finds all indexed points inside the given window, as
+ * track_count_in_window would count them, and returns them in a new
+ * array in no particular order.  The number of points is returned and
+ * the array is stored in *fixes; it is the caller's responsibility to
+ * free it.  If there is a memory allocation error then the return value
+ * is -1 and *fixes is NULL.
+ *
+ * @param idx a pointer to a valid index
+ * @param window a pointer to a window with south <= north, start <= end,
+ * and longitudes between -180 and 180
+ * @param fixes a pointer to where to store the array of points
+ * @return the number of points in the window, or -1
+ */
+long track_index_box(const track_index *idx, const track_window *window, track_fix **fixes);
+
+#endif